@@ -0,0 +1,437 @@
+// Headless skinning benchmark (no window, no OpenGL context needed).
+//
+// Usage : ./bench [<file.off> [<file.skel> [<frames> [<eigenmodes>]]]]
+// defaults : models/Draco.off models/Draco.skel 2000 64 (0 eigenmodes : no spectral benchmark)
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+
+#include "src/Vec3.h"
+#include "src/Mesh.h"
+#include "src/Skeleton.h"
+#include "src/SkinningKernel.h"
+#include "src/IKSolver.h"
+#include "src/LaplacianEigenbasis.h"
+#include "src/PoseCache.h"
+#include "src/RigFile.h"
+
+using namespace std;
+
+typedef std::chrono::steady_clock benchClock;
+
+static double elapsedMs(benchClock::time_point const &start)
+{
+    return std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+}
+
+// previous per-frame path : allocates the output, loops over the influences with Mat3 copies,
+// normalizes the normal for every bone (kept as a reference, for the timings and the error)
+static void referenceSkinning(Mesh const &mesh, SkeletonTransformation const &transfo, std::vector<Vec3> &new_positions)
+{
+    std::vector<Vec3> positions(mesh.V.size());
+    std::vector<Vec3> normals(mesh.V.size());
+    SkinningWeights const &weights = mesh.skinningWeights;
+    for (unsigned int i = 0; i < mesh.V.size(); i++)
+    {
+        positions[i] = Vec3(0, 0, 0);
+        normals[i] = Vec3(0, 0, 0);
+        BoneInfluence const *influences = weights.vertexInfluences(i);
+        for (unsigned int k = 0; k < weights.maxInfluences() && influences[k].weight != 0.f; k++)
+        {
+            Mat3 R = transfo.bone_transformations[influences[k].bone].world_space_rotation;
+            Vec3 t = transfo.bone_transformations[influences[k].bone].world_space_translation;
+            Vec3 n = R * mesh.V[i].n;
+            n.normalize();
+            positions[i] += influences[k].weight * (R * mesh.V[i].p + t);
+            normals[i] += influences[k].weight * n;
+        }
+    }
+    new_positions.swap(positions);
+}
+
+// convergence of the IK solvers from the rest pose, towards targets reached by random poses
+// (so that they are reachable), with one or two effectors, with or without joint limits
+static void benchInverseKinematics(Skeleton const &skeleton, unsigned int nTargets)
+{
+    CCDIKSolver ccd;
+    FABRIKSolver fabrik;
+    DampedLeastSquaresIKSolver dls;
+    IKSolver *solvers[3] = {&ccd, &fabrik, &dls};
+
+    unsigned int tip = skeleton.bones[skeleton.ordered_bone_indices.back()].joints[1];
+    unsigned int middle = skeleton.bones[skeleton.ordered_bone_indices[skeleton.ordered_bone_indices.size() / 2]].joints[1];
+    IKSolverSettings settings;
+    settings.maxIterations = 200;
+    settings.tolerance = 1e-3;
+
+    for (unsigned int test = 0; test < 3; ++test)
+    {
+        bool twoEffectors = (test == 1), limited = (test == 2);
+        IKJointLimits limits;
+        limits.resize(skeleton.bones.size(), limited ? 0.5f : -1.f);
+        cout << "IK, " << (twoEffectors ? "2 effectors (articulations " : "1 effector (articulation ") << tip;
+        if (twoEffectors)
+            cout << ", " << middle;
+        cout << ")" << (limited ? ", joint limits 0.5 rad" : "") << ", " << nTargets << " targets :" << endl;
+
+        for (unsigned int s = 0; s < 3; ++s)
+        {
+            srand(0);
+            unsigned int converged = 0, iterations = 0;
+            double ms = 0.0, finalError = 0.0, errorAt[3] = {0.0, 0.0, 0.0};
+            unsigned int checkpoints[3] = {1, 5, 20};
+            for (unsigned int t = 0; t < nTargets; ++t)
+            {
+                SkeletonTransformation goal;
+                goal.resize(skeleton.bones.size(), skeleton.articulations.size());
+                for (unsigned int b = 0; b < skeleton.bones.size(); ++b)
+                    if (!skeleton.bones[b].isRoot())
+                        goal.setLocalRotation(b, Mat3::RandRotation(limited ? 0.8f : 1.2f));
+                skeleton.computeGlobalTransformationParameters(goal);
+
+                std::vector<IKEffector> effectors(1, IKEffector(tip, goal.articulations_transformed_position[tip]));
+                if (twoEffectors)
+                    effectors.push_back(IKEffector(middle, goal.articulations_transformed_position[middle]));
+
+                SkeletonTransformation transfo;
+                transfo.resize(skeleton.bones.size(), skeleton.articulations.size());
+                IKSolverReport report = solvers[s]->solve(skeleton, transfo, effectors, settings, limited ? &limits : NULL);
+
+                converged += report.converged;
+                iterations += report.iterations;
+                ms += report.elapsedMs;
+                finalError += report.finalError();
+                for (unsigned int c = 0; c < 3; ++c)
+                    errorAt[c] += report.errorPerIteration[std::min<unsigned int>(checkpoints[c], report.errorPerIteration.size() - 1)];
+            }
+            cout << "  " << solvers[s]->name() << " : " << 100.0 * converged / nTargets << "% converged, "
+                 << (double)iterations / nTargets << " iterations, " << ms / nTargets << " ms, final error " << finalError / nTargets
+                 << " ; error after 1/5/20 iterations " << errorAt[0] / nTargets << " / " << errorAt[1] / nTargets << " / " << errorAt[2] / nTargets << endl;
+        }
+    }
+}
+
+// eigenbasis : computation, cache, and compression of a skinned deformation field with n modes
+static void benchEigenbasis(Mesh const &mesh, SkinningKernel const &skinning, unsigned int k)
+{
+    string cacheFile = "bench.eigen";
+    std::remove(cacheFile.c_str());
+    LaplacianEigenbasis eigenbasis;
+    benchClock::time_point start = benchClock::now();
+    if (!eigenbasis.compute(mesh, k, cacheFile))
+        return;
+    cout << "eigenbasis, " << eigenbasis.size() << " modes : " << elapsedMs(start) << " ms (lambda_1 " << eigenbasis.getEigenvalues()[1]
+         << ", lambda_" << eigenbasis.size() - 1 << " " << eigenbasis.getEigenvalues()[eigenbasis.size() - 1] << ")" << endl;
+    start = benchClock::now();
+    LaplacianEigenbasis cached;
+    cached.compute(mesh, k, cacheFile);
+    cout << "eigenbasis from the cache : " << elapsedMs(start) << " ms" << endl;
+    std::remove(cacheFile.c_str());
+
+    unsigned int nV = mesh.V.size();
+    std::vector<float> const &rest = skinning.getRestPositions();
+    Eigen::MatrixXd deformation(nV, 3);
+    for (unsigned int v = 0; v < nV; ++v)
+        for (unsigned int c = 0; c < 3; ++c)
+            deformation(v, c) = skinning.positions[4 * v + c] - rest[4 * v + c];
+    double norm = std::sqrt((deformation.transpose() * eigenbasis.getMass().asDiagonal() * deformation).trace());
+    for (unsigned int n = 4; n <= eigenbasis.size(); n *= 2)
+    {
+        start = benchClock::now();
+        Eigen::MatrixXd coefficients = eigenbasis.project(deformation, n);
+        Eigen::MatrixXd reconstructed = eigenbasis.reconstruct(coefficients);
+        double ms = elapsedMs(start);
+        Eigen::MatrixXd error = reconstructed - deformation;
+        double relativeError = std::sqrt((error.transpose() * eigenbasis.getMass().asDiagonal() * error).trace()) / std::max(norm, 1e-20);
+        cout << "  deformation field with " << n << " modes : " << nV * 3 / (3.0 * n) << "x smaller, relative L2 error " << relativeError
+             << ", project + reconstruct " << ms << " ms" << endl;
+    }
+}
+
+// pose cache : bake (serial / parallel), size, playback cost and quantization error
+static void benchPoseCache(Mesh const &mesh, Skeleton const &skeleton, unsigned int frames)
+{
+    string cacheFile = "bench.poses";
+    unsigned int nFrames = std::max(1u, std::min(frames, 240u));
+    float fps = 60.f;
+    auto animation = [&skeleton](double t, SkeletonTransformation &transfo)
+    { skeleton.computeProceduralAnim(t, transfo); };
+
+    benchClock::time_point start = benchClock::now();
+    PoseCacheFile::bake(cacheFile, mesh, skeleton, animation, nFrames, fps, SkinningMethod_LBS, 32, false);
+    double serialMs = elapsedMs(start);
+    start = benchClock::now();
+    if (!PoseCacheFile::bake(cacheFile, mesh, skeleton, animation, nFrames, fps, SkinningMethod_LBS, 32, true))
+        return;
+    double parallelMs = elapsedMs(start);
+
+    PoseCacheFile file;
+    if (!file.open(cacheFile))
+        return;
+    unsigned int nV = mesh.V.size();
+    double rawBytes = 32.0 * nV * nFrames;
+    cout << "pose cache, " << nFrames << " frames : bake " << serialMs << " ms serial, " << parallelMs << " ms parallel ; "
+         << file.fileSize() / (1024.0 * 1024.0) << " MB (" << file.fileSize() / ((double)nV * nFrames) << " bytes/vertex/frame, "
+         << rawBytes / file.fileSize() << "x smaller than float positions + normals)" << endl;
+
+    // error against the skinning, on every frame
+    SkinningKernel skinning;
+    skinning.setRestPose(mesh);
+    SkeletonTransformation transfo;
+    transfo.resize(skeleton.bones.size(), skeleton.articulations.size());
+    PoseCachePlayer player(file);
+    std::vector<float> positions(4 * nV), normals(4 * nV);
+    double maxPositionError = 0.0, minNormalDot = 1.0;
+    for (unsigned int f = 0; f < nFrames; ++f)
+    {
+        animation(f / (double)fps, transfo);
+        skinning.skin(transfo);
+        player.decode(f, &positions[0], &normals[0]);
+        for (unsigned int v = 0; v < nV; ++v)
+        {
+            float const *n = &skinning.normals[4 * v];
+            double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            double dot = 0.0;
+            for (unsigned int c = 0; c < 3; ++c)
+            {
+                maxPositionError = std::max<double>(maxPositionError, fabs(positions[4 * v + c] - skinning.positions[4 * v + c]));
+                dot += normals[4 * v + c] * n[c];
+            }
+            if (length > 0.0)
+                minNormalDot = std::min(minNormalDot, dot / length);
+        }
+    }
+    cout << "  max position error " << maxPositionError << ", max normal error " << std::acos(std::min(1.0, minNormalDot)) * 180.0 / M_PI << " degrees" << endl;
+
+    // playback : forward, then random access, then several characters on the same mapping
+    unsigned int loops = std::max(1u, frames / nFrames);
+    start = benchClock::now();
+    for (unsigned int l = 0; l < loops; ++l)
+        for (unsigned int f = 0; f < nFrames; ++f)
+            player.decode(f, &positions[0], &normals[0]);
+    double forwardMs = elapsedMs(start) / (loops * nFrames);
+    srand(0);
+    start = benchClock::now();
+    for (unsigned int f = 0; f < nFrames; ++f)
+        player.decode(rand() % nFrames, &positions[0], &normals[0]);
+    double randomMs = elapsedMs(start) / nFrames;
+    unsigned int nCharacters = 8;
+    std::vector<PoseCachePlayer> players(nCharacters, PoseCachePlayer(file));
+    start = benchClock::now();
+    for (unsigned int f = 0; f < nFrames; ++f)
+        for (unsigned int c = 0; c < nCharacters; ++c)
+            players[c].decode((f + c * nFrames / nCharacters) % nFrames, &positions[0], &normals[0]);
+    double charactersMs = elapsedMs(start) / nFrames;
+    cout << "  playback : " << forwardMs << " ms/frame forward, " << randomMs << " ms/frame random access, "
+         << charactersMs << " ms/frame for " << nCharacters << " characters" << endl;
+    file.close();
+    std::remove(cacheFile.c_str());
+}
+
+// rig file : text import + structure vs mapped rig, and detection of a corrupted file
+static void benchRig(Mesh const &mesh, Skeleton const &skeleton, string const &skelFile)
+{
+    string rigFile = "bench.rig";
+    unsigned int repeats = 100;
+    benchClock::time_point start = benchClock::now();
+    for (unsigned int r = 0; r < repeats; ++r)
+    {
+        Skeleton imported;
+        imported.load(skelFile);
+    }
+    double textMs = elapsedMs(start) / repeats;
+    if (!RigFile::write(rigFile, skeleton, mesh.skinningWeights, mesh.computeHash()))
+        return;
+    start = benchClock::now();
+    Skeleton loaded;
+    SkinningWeights weights;
+    string error;
+    bool ok = true;
+    for (unsigned int r = 0; r < repeats; ++r)
+        ok = ok && RigFile::read(rigFile, loaded, weights, &mesh, 0, &error);
+    double rigMs = elapsedMs(start) / repeats;
+    bool same = ok && loaded.ordered_bone_indices == skeleton.ordered_bone_indices && weights.numberOfVertices() == mesh.skinningWeights.numberOfVertices();
+    for (unsigned int i = 0; same && i < weights.data().size(); ++i)
+        same = weights.data()[i].weight == mesh.skinningWeights.data()[i].weight && weights.data()[i].bone == mesh.skinningWeights.data()[i].bone;
+    cout << "rig : text skeleton import " << textMs << " ms (weights not included), rig file (skeleton + weights) " << rigMs << " ms"
+         << (same ? "" : " -- MISMATCH " + error) << endl;
+
+    // one flipped byte in the weights
+    {
+        std::fstream f(rigFile.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(-3, std::ios::end);
+        f.put((char)0x5a);
+    }
+    ok = RigFile::read(rigFile, loaded, weights, &mesh, 0, &error);
+    cout << "  corrupted rig file : " << (ok ? "NOT DETECTED" : error) << endl;
+    std::remove(rigFile.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    string meshFile = argc > 1 ? argv[1] : "models/Draco.off";
+    string skelFile = argc > 2 ? argv[2] : "models/Draco.skel";
+    unsigned int frames = argc > 3 ? atoi(argv[3]) : 2000;
+    unsigned int eigenmodes = argc > 4 ? atoi(argv[4]) : 64;
+
+    Mesh mesh;
+    Skeleton skeleton;
+    mesh.loadOFF(meshFile);
+    string skelError;
+    if (!skeleton.load(skelFile, &skelError))
+    {
+        cerr << skelError << endl;
+        return EXIT_FAILURE;
+    }
+    cout << meshFile << " : " << mesh.V.size() << " vertices, " << mesh.T.size() << " triangles ; "
+         << skelFile << " : " << skeleton.bones.size() << " bones" << endl;
+
+    benchClock::time_point start = benchClock::now();
+    mesh.compute_skinning_weights(skeleton);
+    cout << "inverse distance weights : " << elapsedMs(start) << " ms" << endl;
+
+    // bone heat weights : computed and written to a cache, then read back
+    string cacheFile = "bench.weights";
+    std::remove(cacheFile.c_str());
+    start = benchClock::now();
+    mesh.compute_heat_skinning_weights(skeleton, 4, 1e-3f, cacheFile);
+    cout << "bone heat weights : " << elapsedMs(start) << " ms" << endl;
+    start = benchClock::now();
+    mesh.compute_heat_skinning_weights(skeleton, 4, 1e-3f, cacheFile);
+    cout << "bone heat weights from the cache : " << elapsedMs(start) << " ms" << endl;
+    std::remove(cacheFile.c_str());
+
+    SkeletonTransformation transfo;
+    transfo.resize(skeleton.bones.size(), skeleton.articulations.size());
+    SkinningKernel skinning;
+    skinning.setRestPose(mesh);
+
+    // reference path, a few frames only
+    unsigned int referenceFrames = std::max(1u, frames / 20);
+    std::vector<Vec3> referencePositions;
+    double referenceMs = 0.0;
+    for (unsigned int f = 0; f < referenceFrames; ++f)
+    {
+        skeleton.computeProceduralAnim(f / 60.0, transfo);
+        start = benchClock::now();
+        referenceSkinning(mesh, transfo, referencePositions);
+        referenceMs += elapsedMs(start);
+    }
+    skinning.skin(transfo);
+    double maxError = 0.0;
+    for (unsigned int v = 0; v < mesh.V.size(); ++v)
+        for (unsigned int c = 0; c < 3; ++c)
+            maxError = std::max<double>(maxError, fabs(referencePositions[v][c] - skinning.positions[4 * v + c]));
+
+    cout << "threads : " << parallelThreadCount() << endl;
+    cout << "reference skinning : " << referenceMs / referenceFrames << " ms/frame (" << referenceFrames << " frames)" << endl;
+    cout << "max position difference between the reference and LBS : " << maxError << endl;
+
+    // kernels, reading the float rest pose + influences, or the compressed vertex stream
+    SkinningMethod methods[2] = {SkinningMethod_LBS, SkinningMethod_DQS};
+    SkinningVertexFormat formats[2] = {SkinningVertexFormat_Float, SkinningVertexFormat_Compressed};
+    std::vector<float> floatPositions[2], floatNormals[2];
+    for (unsigned int fmt = 0; fmt < 2; ++fmt)
+    {
+        skinning.setVertexFormat(formats[fmt]);
+        cout << SkinningKernel::vertexFormatName(formats[fmt]) << " vertices : " << skinning.bytesPerVertex() << " bytes/vertex ("
+             << mesh.V.size() * skinning.bytesPerVertex() / (1024.0 * 1024.0) << " MB)" << endl;
+        for (unsigned int m = 0; m < 2; ++m)
+        {
+            skinning.setMethod(methods[m]);
+            double animMs = 0.0, paletteMs = 0.0, skinMs = 0.0;
+            for (unsigned int f = 0; f < frames; ++f)
+            {
+                start = benchClock::now();
+                skeleton.computeProceduralAnim(f / 60.0, transfo);
+                animMs += elapsedMs(start);
+                start = benchClock::now();
+                skinning.buildPalette(transfo);
+                paletteMs += elapsedMs(start);
+                start = benchClock::now();
+                skinning.skin();
+                skinMs += elapsedMs(start);
+            }
+
+            double msPerFrame = skinMs / frames;
+            cout << "  " << SkinningKernel::methodName(methods[m]) << " : " << msPerFrame << " ms/frame (" << frames << " frames), "
+                 << mesh.V.size() / (msPerFrame * 1e3) << " Mvertices/s, "
+                 << skinning.bytesPerFrame() / (msPerFrame * 1e6) << " GB/s ; palette " << paletteMs / frames
+                 << " ms/frame ; procedural anim + FK " << animMs / frames << " ms/frame" << endl;
+
+            if (formats[fmt] == SkinningVertexFormat_Float)
+            {
+                floatPositions[m] = skinning.positions;
+                floatNormals[m] = skinning.normals;
+                if (methods[m] == SkinningMethod_DQS)
+                {
+                    double maxDifference = 0.0;
+                    for (unsigned int i = 0; i < floatPositions[0].size(); ++i)
+                        maxDifference = std::max<double>(maxDifference, fabs(floatPositions[0][i] - skinning.positions[i]));
+                    cout << "  max position difference between LBS and DQS : " << maxDifference << endl;
+                }
+            }
+            else
+            {
+                double maxPosition = 0.0, maxNormal = 0.0;
+                for (unsigned int i = 0; i < skinning.positions.size(); ++i)
+                {
+                    maxPosition = std::max<double>(maxPosition, fabs(floatPositions[m][i] - skinning.positions[i]));
+                    maxNormal = std::max<double>(maxNormal, fabs(floatNormals[m][i] - skinning.normals[i]));
+                }
+                cout << "  max difference with the float vertices : position " << maxPosition << ", normal " << maxNormal << endl;
+            }
+        }
+    }
+    skinning.setVertexFormat(SkinningVertexFormat_Float);
+
+    // incremental forward kinematics + skinning : only the last bone of the hierarchy moves
+    skinning.setMethod(SkinningMethod_LBS);
+    unsigned int lastBone = skeleton.ordered_bone_indices.back();
+    double fullFkMs = 0.0, incrementalFkMs = 0.0, fullSkinMs = 0.0, incrementalSkinMs = 0.0;
+    unsigned int reskinned = 0;
+    skinning.skinUpdated(transfo);
+    for (unsigned int f = 0; f < frames; ++f)
+    {
+        Mat3 R = Mat3::getRotationMatrixFromAxisAndAngle(Vec3(1, 0, 0), 0.3 * sin(f / 60.0));
+
+        transfo.setLocalRotation(lastBone, R);
+        transfo.markAllDirty();
+        start = benchClock::now();
+        skeleton.computeGlobalTransformationParameters(transfo);
+        fullFkMs += elapsedMs(start);
+        start = benchClock::now();
+        skinning.skin(transfo);
+        fullSkinMs += elapsedMs(start);
+        std::fill(transfo.bone_has_moved.begin(), transfo.bone_has_moved.end(), 0);
+
+        transfo.setLocalRotation(lastBone, R.getTranspose());
+        start = benchClock::now();
+        skeleton.computeGlobalTransformationParameters(transfo);
+        incrementalFkMs += elapsedMs(start);
+        start = benchClock::now();
+        reskinned += skinning.skinUpdated(transfo);
+        incrementalSkinMs += elapsedMs(start);
+    }
+    cout << "leaf bone edit, full FK + skinning : " << fullFkMs / frames << " + " << fullSkinMs / frames << " ms/frame" << endl;
+    cout << "leaf bone edit, incremental FK + skinning : " << incrementalFkMs / frames << " + " << incrementalSkinMs / frames
+         << " ms/frame (" << reskinned / frames << " vertices re-skinned per frame)" << endl;
+
+    benchInverseKinematics(skeleton, std::max(20u, frames / 10));
+
+    benchPoseCache(mesh, skeleton, frames);
+
+    benchRig(mesh, skeleton, skelFile);
+
+    if (eigenmodes > 0)
+    {
+        skeleton.computeProceduralAnim(1.0, transfo);
+        skinning.skin(transfo);
+        benchEigenbasis(mesh, skinning, eigenmodes);
+    }
+    return EXIT_SUCCESS;
+}
@@ -13,6 +13,11 @@
 #include "src/Camera.h"
 #include "src/Mesh.h"
 #include "src/Skeleton.h"
+#include "src/SkinningKernel.h"
+#include "src/IKSolver.h"
+#include "src/LaplacianEigenbasis.h"
+#include "src/PoseCache.h"
+#include "src/RigFile.h"
 
 using namespace std;
 
@@ -33,10 +38,26 @@ static bool fullScreen = false;
 Mesh mesh;
 Skeleton skeleton;
 SkeletonTransformation skeletonTransfo;
+SkinningKernel skinning; // skinned positions / normals, reused from one frame to the next
 
 SkeletonTransformation skeletonTransfoIK;
 int targetArticulation = -1;
 Vec3 targetArticulationPosition;
+CCDIKSolver ccdSolver;
+FABRIKSolver fabrikSolver;
+DampedLeastSquaresIKSolver dlsSolver;
+IKSolver *ikSolvers[3] = {&ccdSolver, &fabrikSolver, &dlsSolver};
+unsigned int currentIKSolver = 1;
+IKSolverSettings ikSettings; // see init() : interactive budget
+
+LaplacianEigenbasis eigenbasis; // computed at the first use, then read from models/Draco.eigen
+bool spectralPreview = false;   // only the low frequencies of the deformation are shown
+unsigned int spectralModes = 16;
+std::vector<float> spectralPositions; // filtered copy of skinning.positions : the skinned buffer stays valid for the incremental update
+
+PoseCacheFile poseCache;     // baked procedural anim (models/Draco.poses), mapped in memory
+PoseCachePlayer posePlayer;  // playback cursor on poseCache
+bool posePlayback = false;   // display mode 1 replays the baked frames instead of skinning
 
 int displayedBone = -1;
 
@@ -54,6 +75,14 @@ void printUsage()
          << " ?: Print help" << endl
          << " w: Toggle Wireframe Mode" << endl
          << " f: Toggle full screen mode" << endl
+         << " m: Switch display mode (rest pose, procedural anim, inverse kinematics)" << endl
+         << " k: Switch skinning method (linear blend, dual quaternion)" << endl
+         << " c: Switch skinned vertex format (float, compressed)" << endl
+         << " i: Switch inverse kinematics solver (CCD, FABRIK, damped least squares)" << endl
+         << " l: Toggle low-frequency preview of the deformation (Laplacian eigenbasis)" << endl
+         << " +/-: More / less eigenmodes in the preview" << endl
+         << " b: Bake one period of the procedural anim (models/Draco.poses)" << endl
+         << " p: Toggle playback of the baked procedural anim" << endl
          << " <drag>+<left button>: rotate model" << endl
          << " <drag>+<right button>: move model" << endl
          << " <drag>+<middle button>: zoom" << endl
@@ -93,6 +122,41 @@ void init()
     glDepthFunc(GL_LESS);
     glEnable(GL_DEPTH_TEST);
     glClearColor(0.2f, 0.2f, 0.3f, 1.0f);
+
+    // inverse kinematics : at most 50 iterations or 5 ms per key press
+    ikSettings.maxIterations = 50;
+    ikSettings.timeBudgetMs = 5.0;
+}
+
+// positions to draw : the skinned ones, or their low-frequency part
+float const *applySpectralPreview()
+{
+    if (!spectralPreview)
+        return NULL;
+    spectralPositions.resize(skinning.positions.size());
+    eigenbasis.filterDeformation(&skinning.positions[0], &skinning.getRestPositions()[0], spectralModes, &spectralPositions[0]);
+    return &spectralPositions[0];
+}
+
+// one period of the procedural anim (cos(t) : 2 pi seconds), so that the clip loops
+bool bakeProceduralAnim()
+{
+    unsigned int nFrames = 192;
+    float framesPerSecond = nFrames / (2.0 * M_PI);
+    Skeleton const &s = skeleton;
+    if (!PoseCacheFile::bake("models/Draco.poses", mesh, skeleton, [&s](double t, SkeletonTransformation &transfo)
+                             { s.computeProceduralAnim(t, transfo); },
+                             nFrames, framesPerSecond, skinning.getMethod()))
+        return false;
+    return poseCache.open("models/Draco.poses");
+}
+
+void openPoseCache()
+{
+    if (poseCache.open("models/Draco.poses") && poseCache.meshHash() != mesh.computeHash())
+        poseCache.close(); // baked for another mesh
+    if (poseCache.isOpen())
+        posePlayer.attach(poseCache);
 }
 
 void draw()
@@ -105,13 +169,23 @@ void draw()
 
     if (displayMode == 1)
     {
-        mesh.drawTransformedMesh(skeletonTransfo);
+        if (posePlayback && poseCache.isOpen())
+        {
+            // decode + upload only
+            unsigned int frame = posePlayer.frameAt(0.001 * glutGet((GLenum)GLUT_ELAPSED_TIME));
+            posePlayer.decode(frame, &skinning.positions[0], &skinning.normals[0]);
+            skinning.invalidate();
+        }
+        else
+            skinning.skinUpdated(skeletonTransfo);
+        mesh.drawSkinnedMesh(skinning, applySpectralPreview());
         skeleton.drawTransformedSkeleton(displayedBone, targetArticulation, skeletonTransfo);
     }
 
     if (displayMode == 2)
     {
-        mesh.drawTransformedMesh(skeletonTransfoIK);
+        skinning.skinUpdated(skeletonTransfoIK); // only the vertices of the bones moved by the IK
+        mesh.drawSkinnedMesh(skinning, applySpectralPreview());
         skeleton.drawTransformedSkeleton(displayedBone, targetArticulation, skeletonTransfoIK);
     }
 }
@@ -131,7 +205,10 @@ void moveTargetArticulationBy(Vec3 translation)
     if (targetArticulation > -1 && targetArticulation < skeleton.articulations.size())
     {
         Vec3 newPos = skeletonTransfoIK.articulations_transformed_position[targetArticulation] + translation;
-        skeleton.updateIKChain(skeletonTransfoIK, targetArticulation, newPos);
+        std::vector<IKEffector> effectors(1, IKEffector(targetArticulation, newPos));
+        IKSolverReport report = ikSolvers[currentIKSolver]->solve(skeleton, skeletonTransfoIK, effectors, ikSettings);
+        cout << ikSolvers[currentIKSolver]->name() << ": " << report.iterations << " iterations, error " << report.finalError()
+             << (report.converged ? "" : " (not converged)") << ", " << report.elapsedMs << " ms" << endl;
     }
 }
 
@@ -193,9 +270,56 @@ void key(unsigned char keyPressed, int x, int y)
         if (displayMode == 2)
         {
             skeletonTransfoIK = skeletonTransfo;
+            skinning.invalidate();
+        }
+        break;
+
+    case 'k':
+        skinning.setMethod(skinning.getMethod() == SkinningMethod_LBS ? SkinningMethod_DQS : SkinningMethod_LBS);
+        cout << "Skinning: " << SkinningKernel::methodName(skinning.getMethod()) << endl;
+        break;
+
+    case 'c':
+        skinning.setVertexFormat(skinning.getVertexFormat() == SkinningVertexFormat_Float ? SkinningVertexFormat_Compressed : SkinningVertexFormat_Float);
+        cout << "Skinned vertices: " << SkinningKernel::vertexFormatName(skinning.getVertexFormat()) << ", " << skinning.bytesPerVertex() << " bytes/vertex" << endl;
+        break;
+
+    case 'i':
+        currentIKSolver = (currentIKSolver + 1) % 3;
+        cout << "Inverse kinematics: " << ikSolvers[currentIKSolver]->name() << endl;
+        break;
+
+    case 'l':
+        spectralPreview = !spectralPreview;
+        if (spectralPreview && eigenbasis.empty() && !eigenbasis.compute(mesh, 64, "models/Draco.eigen"))
+            spectralPreview = false;
+        cout << "Low-frequency preview: " << (spectralPreview ? "on" : "off") << endl;
+        break;
+
+    case '+':
+    case '-':
+        spectralModes = (keyPressed == '+') ? std::min(2 * spectralModes, 64u) : std::max(1u, spectralModes / 2); // 64 modes computed
+        cout << "Low-frequency preview: " << spectralModes << " modes" << endl;
+        break;
+
+    case 'b':
+        if (bakeProceduralAnim())
+        {
+            posePlayer.attach(poseCache);
+            cout << "Pose cache: " << poseCache.numberOfFrames() << " frames, " << poseCache.fileSize() / (1024.0 * 1024.0) << " MB" << endl;
         }
         break;
 
+    case 'p':
+        posePlayback = !posePlayback;
+        if (posePlayback && !poseCache.isOpen() && !bakeProceduralAnim())
+            posePlayback = false;
+        if (posePlayback)
+            posePlayer.attach(poseCache);
+        skinning.invalidate();
+        cout << "Baked playback: " << (posePlayback ? "on" : "off") << endl;
+        break;
+
     case 'w':
         GLint polygonMode[2];
         glGetIntegerv(GL_POLYGON_MODE, polygonMode);
@@ -332,8 +456,15 @@ int main(int argc, char **argv)
     key('?', 0, 0);
 
     mesh.loadOFF("models/Draco.off");
-    skeleton.load("models/Draco.skel");
-    mesh.compute_skinning_weights(skeleton);
+    // skeleton + bone heat weights : imported once, then read from the rig file
+    std::string rigError;
+    if (!RigFile::loadOrImport("models/Draco.rig", "models/Draco.skel", mesh, skeleton, 4, 1e-3f, &rigError))
+    {
+        cerr << "Rig: " << rigError << endl;
+        exit(EXIT_FAILURE);
+    }
+    skinning.setRestPose(mesh);
+    openPoseCache();
     skeletonTransfo.resize(skeleton.bones.size(), skeleton.articulations.size());
     skeletonTransfoIK.resize(skeleton.bones.size(), skeleton.articulations.size());
     updateProceduralAnim();
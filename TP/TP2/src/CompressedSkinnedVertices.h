@@ -0,0 +1,157 @@
+#ifndef COMPRESSEDSKINNEDVERTICES_H
+#define COMPRESSEDSKINNEDVERTICES_H
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "SkinningWeights.h"
+#include "VertexQuantization.h"
+
+// -------------------------------------------
+// Compressed skinned vertex stream : the rest pose and the influences of a vertex in one record,
+// read directly by the skinning kernel.
+//   position : unsigned short x y z, relative to the bounding box of the rest pose    6 bytes
+//   normal   : short u v, octahedral                                                  4 bytes
+//   weights  : k unsigned char, summing exactly to 255 (largest remainders)           k bytes
+//   bones    : k indices, unsigned char (at most 256 bones) or unsigned short        k or 2k bytes
+// The record size is rounded to 2 bytes (18 bytes for k = 4 and 8-bit indices, against 64 bytes for
+// the float rest pose + the float influences). Unused influences have a weight of 0 and are at the end.
+// At most 16 influences per vertex are kept.
+// -------------------------------------------
+
+class CompressedSkinnedVertices
+{
+public:
+    CompressedSkinnedVertices() : nVertices(0), k(0), wideBones(false), recordSize(0), bonesOffset(0) {}
+
+    // positions / normals : 4 floats per vertex
+    void build(float const *restPositions, float const *restNormals, SkinningWeights const &weights)
+    {
+        nVertices = weights.numberOfVertices();
+        k = std::min(weights.maxInfluences(), 16u);
+        wideBones = weights.numberOfBones() > 256;
+        bonesOffset = 10 + k;
+        if (wideBones)
+            bonesOffset += bonesOffset & 1; // 2-byte aligned indices
+        recordSize = bonesOffset + k * (wideBones ? 2 : 1);
+        recordSize += recordSize & 1;
+
+        box.fit(restPositions, nVertices, 4);
+        records.assign((size_t)nVertices * recordSize, 0);
+        std::vector<float> w(k);
+        for (unsigned int v = 0; v < nVertices; ++v)
+        {
+            unsigned char *r = &records[(size_t)v * recordSize];
+            unsigned short p[3];
+            short n[2];
+            for (unsigned int c = 0; c < 3; ++c)
+                p[c] = box.quantize(restPositions[4 * v + c], c);
+            octahedralEncode16(&restNormals[4 * v], n);
+            std::memcpy(r, p, 6);
+            std::memcpy(r + 6, n, 4);
+
+            BoneInfluence const *inf = weights.vertexInfluences(v);
+            for (unsigned int i = 0; i < k; ++i)
+                w[i] = inf[i].weight;
+            quantizeWeights(&w[0], k, r + 10);
+            for (unsigned int i = 0; i < k; ++i)
+            {
+                unsigned short bone = r[10 + i] ? inf[i].bone : 0;
+                if (wideBones)
+                    std::memcpy(r + bonesOffset + 2 * i, &bone, 2);
+                else
+                    r[bonesOffset + i] = (unsigned char)bone;
+            }
+        }
+    }
+
+    void clear()
+    {
+        records.clear();
+        nVertices = k = recordSize = bonesOffset = 0;
+    }
+
+    bool empty() const { return records.empty(); }
+    unsigned int numberOfVertices() const { return nVertices; }
+    unsigned int maxInfluences() const { return k; }
+    unsigned int bytesPerVertex() const { return recordSize; }
+    bool hasWideBoneIndices() const { return wideBones; }
+    QuantizationBox const &getBox() const { return box; }
+
+    // rest position (x y z 1) and normal (x y z 0) of vertex v ; influences, sorted by decreasing weight :
+    // returns their number. The normal is only normalized if unitNormal (LBS normalizes after blending).
+    unsigned int decode(unsigned int v, float p[4], float n[4], unsigned int *bones, float *weights, bool unitNormal = true) const
+    {
+        unsigned char const *r = &records[(size_t)v * recordSize];
+        unsigned short q[3];
+        short o[2];
+        std::memcpy(q, r, 6);
+        std::memcpy(o, r + 6, 4);
+        for (unsigned int c = 0; c < 3; ++c)
+            p[c] = box.dequantize(q[c], c);
+        p[3] = 1.f;
+        if (unitNormal)
+            octahedralDecode16(o[0], o[1], n);
+        else
+            octahedralUnfold(o[0] * (1.f / 32767.f), o[1] * (1.f / 32767.f), n);
+        n[3] = 0.f;
+
+        unsigned int count = 0;
+        while (count < k && r[10 + count] != 0)
+        {
+            weights[count] = r[10 + count] * (1.f / 255.f);
+            if (wideBones)
+            {
+                unsigned short bone;
+                std::memcpy(&bone, r + bonesOffset + 2 * count, 2);
+                bones[count] = bone;
+            }
+            else
+                bones[count] = r[bonesOffset + count];
+            ++count;
+        }
+        return count;
+    }
+
+    // weights w[0..k) (sum 1) -> q[0..k) (sum 255) : floor, then the remaining units go to the largest
+    // remainders, so that a weight rounded to 0 is never given a unit before a larger one
+    static void quantizeWeights(float const *w, unsigned int k, unsigned char *q)
+    {
+        float sum = 0.f;
+        for (unsigned int i = 0; i < k; ++i)
+            sum += std::max(0.f, w[i]);
+        if (sum <= 0.f)
+        {
+            std::fill(q, q + k, 0);
+            if (k > 0)
+                q[0] = 255;
+            return;
+        }
+        int total = 0;
+        float remainders[16];
+        unsigned int order[16];
+        unsigned int n = std::min(k, 16u);
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            float x = std::max(0.f, w[i]) / sum * 255.f;
+            int f = (int)std::floor(x);
+            q[i] = (unsigned char)f;
+            remainders[i] = x - f;
+            order[i] = i;
+            total += f;
+        }
+        std::stable_sort(order, order + n, [&remainders](unsigned int a, unsigned int b)
+                         { return remainders[a] > remainders[b]; });
+        for (unsigned int i = 0; total < 255; i = (i + 1) % n, ++total)
+            ++q[order[i]];
+    }
+
+private:
+    std::vector<unsigned char> records;
+    QuantizationBox box;
+    unsigned int nVertices, k;
+    bool wideBones;
+    unsigned int recordSize, bonesOffset;
+};
+
+#endif // COMPRESSEDSKINNEDVERTICES_H
@@ -0,0 +1,28 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+
+// FNV-1a 64 bits : keys of the on-disk caches (mesh, skeleton, parameters).
+// Chain the calls with the previous hash as seed.
+typedef unsigned long long hash64_t;
+
+inline hash64_t hashBytes(void const *data, std::size_t size, hash64_t seed = 14695981039346656037ULL)
+{
+    unsigned char const *bytes = static_cast<unsigned char const *>(data);
+    hash64_t h = seed;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+template <class T>
+inline hash64_t hashValue(T const &value, hash64_t seed)
+{
+    return hashBytes(&value, sizeof(T), seed);
+}
+
+#endif // HASH_H
@@ -0,0 +1,463 @@
+#ifndef IKSOLVER_H
+#define IKSOLVER_H
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include "Vec3.h"
+#include "Skeleton.h"
+
+// -------------------------------------------
+// Inverse kinematics solvers
+// -------------------------------------------
+// The solvers work on a SkeletonTransformation (local rotations + forward kinematics) and move
+// one or several articulations (the effectors) towards their targets.
+// IKSolver::solve runs iterations until every effector is closer than the tolerance, or the
+// iteration / time budget is exhausted, or an iteration does not decrease the error anymore.
+// The error (max distance effector-target) is recorded before and after each iteration.
+// The root bones are pinned : the root articulation is the anchor of the chains.
+
+struct IKEffector
+{
+    unsigned int articulation;
+    Vec3 target;
+    float weight; // relative importance of the effector (DLS rows, FABRIK centroids)
+
+    IKEffector() : articulation(0), target(0, 0, 0), weight(1.f) {}
+    IKEffector(unsigned int a, Vec3 const &t, float w = 1.f) : articulation(a), target(t), weight(w) {}
+};
+
+// max angle (radians) of the local rotation of each bone, negative : free
+struct IKJointLimits
+{
+    std::vector<float> maxAngle;
+
+    void resize(unsigned int nBones, float angle = -1.f) { maxAngle.assign(nBones, angle); }
+    bool isLimited(unsigned int b) const { return b < maxAngle.size() && maxAngle[b] >= 0.f; }
+};
+
+struct IKSolverSettings
+{
+    unsigned int maxIterations;
+    double timeBudgetMs;    // <= 0 : no time limit
+    double tolerance;       // distance at which an effector has reached its target
+    double stallTolerance;  // stop when an iteration gains less than stallTolerance * error
+    bool pinRootBones;
+
+    IKSolverSettings() : maxIterations(20), timeBudgetMs(0.0), tolerance(1e-4), stallTolerance(1e-4), pinRootBones(true) {}
+};
+
+struct IKSolverReport
+{
+    std::vector<double> errorPerIteration; // [0] : before the first iteration
+    unsigned int iterations;
+    double elapsedMs;
+    bool converged;
+
+    IKSolverReport() : iterations(0), elapsedMs(0.0), converged(false) {}
+    double finalError() const { return errorPerIteration.empty() ? 0.0 : errorPerIteration.back(); }
+};
+
+class IKSolver
+{
+public:
+    virtual ~IKSolver() {}
+    virtual const char *name() const = 0;
+
+    IKSolverReport solve(Skeleton const &skeleton, SkeletonTransformation &transfo, std::vector<IKEffector> const &effectors,
+                         IKSolverSettings const &settings = IKSolverSettings(), IKJointLimits const *limits = NULL)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        IKSolverReport report;
+        skeleton.computeGlobalTransformationParameters(transfo);
+        buildChains(skeleton, effectors, settings.pinRootBones);
+
+        double error = effectorError(transfo, effectors);
+        report.errorPerIteration.push_back(error);
+        while (!activeBones.empty() && error > settings.tolerance && report.iterations < settings.maxIterations)
+        {
+            iterate(skeleton, transfo, effectors, limits);
+            ++report.iterations;
+            double previous = error;
+            error = effectorError(transfo, effectors);
+            report.errorPerIteration.push_back(error);
+            if (previous - error <= settings.stallTolerance * previous)
+                break; // stalled (unreachable target, or joint limits)
+            if (settings.timeBudgetMs > 0.0 && elapsedMs(start) >= settings.timeBudgetMs)
+                break;
+        }
+        report.converged = error <= settings.tolerance;
+        report.elapsedMs = elapsedMs(start);
+        return report;
+    }
+
+    static double effectorError(SkeletonTransformation const &transfo, std::vector<IKEffector> const &effectors)
+    {
+        double error = 0.0;
+        for (unsigned int i = 0; i < effectors.size(); ++i)
+            error = std::max<double>(error, (effectors[i].target - transfo.articulations_transformed_position[effectors[i].articulation]).length());
+        return error;
+    }
+
+    // rotation of smallest angle taking the direction of a to the direction of b
+    static Mat3 rotationAligning(Vec3 const &a, Vec3 const &b)
+    {
+        float la = a.length(), lb = b.length();
+        if (la < 1e-12f || lb < 1e-12f)
+            return Mat3::Identity();
+        Vec3 au = a / la, bu = b / lb;
+        Vec3 axis = Vec3::cross(au, bu);
+        float s = axis.length(), c = Vec3::dot(au, bu);
+        if (s < 1e-7f)
+        {
+            if (c > 0.f)
+                return Mat3::Identity();
+            axis = Vec3::cross(au, Vec3(1, 0, 0));
+            if (axis.length() < 1e-3f)
+                axis = Vec3::cross(au, Vec3(0, 1, 0));
+            axis.normalize();
+            return Mat3::getRotationMatrixFromAxisAndAngle(axis, M_PI);
+        }
+        return Mat3::getRotationMatrixFromAxisAndAngle(axis / s, atan2(s, c));
+    }
+
+    // Gram-Schmidt on the columns
+    static void orthonormalize(Mat3 &R)
+    {
+        Vec3 c0(R(0, 0), R(1, 0), R(2, 0)), c1(R(0, 1), R(1, 1), R(2, 1));
+        c0.normalize();
+        c1 -= Vec3::dot(c0, c1) * c0;
+        c1.normalize();
+        R = Mat3::getFromCols(c0, c1, Vec3::cross(c0, c1));
+    }
+
+    // brings the angle of the rotation R back to maxAngle (same axis)
+    static void clampRotation(Mat3 &R, float maxAngle)
+    {
+        float c = std::min(1.f, std::max(-1.f, 0.5f * (R.trace() - 1.f)));
+        if (acos(c) <= maxAngle)
+            return;
+        Vec3 axis(R(2, 1) - R(1, 2), R(0, 2) - R(2, 0), R(1, 0) - R(0, 1));
+        if (axis.length() < 1e-6f)
+        {
+            // angle close to pi : R = 2 axis axis^T - I
+            unsigned int i = 0;
+            for (unsigned int k = 1; k < 3; ++k)
+                if (R(k, k) > R(i, i))
+                    i = k;
+            axis[i] = sqrt(std::max(0.f, 0.5f * (R(i, i) + 1.f)));
+            for (unsigned int k = 0; k < 3; ++k)
+                if (k != i)
+                    axis[k] = R(i, k) / (2.f * axis[i]);
+        }
+        axis.normalize();
+        R = Mat3::getRotationMatrixFromAxisAndAngle(axis, maxAngle);
+    }
+
+protected:
+    std::vector<unsigned int> activeBones;             // bones moved by the solver, fathers first
+    std::vector<int> activeIndex;                      // bone -> index in activeBones, -1 if not moved
+    std::vector<std::vector<unsigned int>> effectorChains; // for each effector, its moved bones from the effector up
+
+    virtual void iterate(Skeleton const &skeleton, SkeletonTransformation &transfo, std::vector<IKEffector> const &effectors, IKJointLimits const *limits) = 0;
+
+    // world space rotation R applied to bone b around its first articulation, given the world rotation F of its father
+    static void rotateBone(Skeleton const &skeleton, SkeletonTransformation &transfo, unsigned int b, Mat3 const &R, IKJointLimits const *limits)
+    {
+        Mat3 F = fatherWorldRotation(skeleton, transfo, b);
+        Mat3 local = F.getTranspose() * R * F * transfo.bone_transformations[b].localRotation;
+        orthonormalize(local); // F^T is only the inverse of F up to rounding : without this the error grows along the chain
+        if (limits && limits->isLimited(b))
+            clampRotation(local, limits->maxAngle[b]);
+        transfo.setLocalRotation(b, local);
+    }
+
+    static Mat3 fatherWorldRotation(Skeleton const &skeleton, SkeletonTransformation const &transfo, unsigned int b)
+    {
+        int father = skeleton.bones[b].fatherBone;
+        return father < 0 ? Mat3::Identity() : transfo.bone_transformations[father].world_space_rotation;
+    }
+
+private:
+    static double elapsedMs(std::chrono::steady_clock::time_point const &start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void buildChains(Skeleton const &skeleton, std::vector<IKEffector> const &effectors, bool pinRootBones)
+    {
+        activeIndex.assign(skeleton.bones.size(), -1);
+        effectorChains.resize(effectors.size());
+        for (unsigned int i = 0; i < effectors.size(); ++i)
+        {
+            effectorChains[i].clear();
+            int b = skeleton.articulations[effectors[i].articulation].fatherBone;
+            while (b >= 0 && !(pinRootBones && skeleton.bones[b].isRoot()))
+            {
+                effectorChains[i].push_back(b);
+                activeIndex[b] = 0;
+                b = skeleton.bones[b].fatherBone;
+            }
+        }
+        activeBones.clear();
+        for (unsigned int bIt = 0; bIt < skeleton.ordered_bone_indices.size(); ++bIt)
+        {
+            unsigned int b = skeleton.ordered_bone_indices[bIt];
+            if (activeIndex[b] >= 0)
+            {
+                activeIndex[b] = activeBones.size();
+                activeBones.push_back(b);
+            }
+        }
+    }
+};
+
+// -------------------------------------------
+// Cyclic coordinate descent : each bone of each chain, from the effector up, is rotated
+// so that the effector points towards the target. One sweep over all the chains per iteration.
+// -------------------------------------------
+class CCDIKSolver : public IKSolver
+{
+public:
+    const char *name() const { return "CCD"; }
+
+protected:
+    void iterate(Skeleton const &skeleton, SkeletonTransformation &transfo, std::vector<IKEffector> const &effectors, IKJointLimits const *limits)
+    {
+        for (unsigned int i = 0; i < effectors.size(); ++i)
+        {
+            for (unsigned int c = 0; c < effectorChains[i].size(); ++c)
+            {
+                unsigned int b = effectorChains[i][c];
+                Vec3 pivot = transfo.articulations_transformed_position[skeleton.bones[b].joints[0]];
+                Vec3 effector = transfo.articulations_transformed_position[effectors[i].articulation];
+                rotateBone(skeleton, transfo, b, rotationAligning(effector - pivot, effectors[i].target - pivot), limits);
+                skeleton.computeGlobalTransformationParameters(transfo); // only the subtree of b
+            }
+        }
+    }
+};
+
+// -------------------------------------------
+// FABRIK (forward and backward reaching) on the articulation positions :
+// backward pass from the effectors (put on their targets) down to the pinned root, then forward
+// pass from the root, keeping the bone lengths. Where several chains meet, the position is the
+// weighted centroid of the proposals. The positions are then turned back into local rotations
+// (and clamped by the joint limits), so that the skeleton transformation stays rigid.
+// -------------------------------------------
+class FABRIKSolver : public IKSolver
+{
+public:
+    const char *name() const { return "FABRIK"; }
+
+protected:
+    void iterate(Skeleton const &skeleton, SkeletonTransformation &transfo, std::vector<IKEffector> const &effectors, IKJointLimits const *limits)
+    {
+        std::vector<Vec3> const &p = transfo.articulations_transformed_position;
+        unsigned int nA = skeleton.articulations.size();
+        backward.assign(nA, Vec3(0, 0, 0));
+        backwardWeight.assign(nA, 0.f);
+        forward = p;
+        isTarget.assign(nA, 0);
+
+        for (unsigned int i = 0; i < effectors.size(); ++i)
+        {
+            unsigned int a = effectors[i].articulation;
+            if (!isTarget[a])
+            {
+                backward[a] = Vec3(0, 0, 0);
+                backwardWeight[a] = 0.f;
+            }
+            isTarget[a] = 1;
+            backward[a] += effectors[i].weight * effectors[i].target;
+            backwardWeight[a] += effectors[i].weight;
+        }
+
+        // backward : children before fathers
+        for (int k = (int)activeBones.size() - 1; k >= 0; --k)
+        {
+            unsigned int b = activeBones[k];
+            unsigned int a0 = skeleton.bones[b].joints[0], a1 = skeleton.bones[b].joints[1];
+            Vec3 end = backwardPosition(a1, p[a1]);
+            float w = backwardWeight[a1];
+            Vec3 d = p[a0] - end;
+            float l = d.length();
+            Vec3 start = l > 1e-12f ? end + (boneLength(skeleton, b) / l) * d : p[a0];
+            if (!isTarget[a0])
+            {
+                backward[a0] += w * start;
+                backwardWeight[a0] += w;
+            }
+        }
+
+        // forward : fathers before children, from the pinned articulations
+        for (unsigned int k = 0; k < activeBones.size(); ++k)
+        {
+            unsigned int b = activeBones[k];
+            unsigned int a0 = skeleton.bones[b].joints[0], a1 = skeleton.bones[b].joints[1];
+            Vec3 d = backwardPosition(a1, p[a1]) - forward[a0];
+            float l = d.length();
+            if (l > 1e-12f)
+                forward[a1] = forward[a0] + (boneLength(skeleton, b) / l) * d;
+            else
+                forward[a1] = forward[a0] + (p[a1] - p[a0]);
+        }
+
+        // positions -> local rotations
+        for (unsigned int k = 0; k < activeBones.size(); ++k)
+        {
+            unsigned int b = activeBones[k];
+            unsigned int a0 = skeleton.bones[b].joints[0], a1 = skeleton.bones[b].joints[1];
+            Mat3 F = fatherWorldRotation(skeleton, transfo, b);
+            Mat3 W = F * transfo.bone_transformations[b].localRotation;
+            Vec3 current = W * (skeleton.articulations[a1].p - skeleton.articulations[a0].p);
+            rotateBone(skeleton, transfo, b, rotationAligning(current, forward[a1] - forward[a0]), limits);
+            // the children need the new world rotation of b (the positions are recomputed once, below)
+            transfo.bone_transformations[b].world_space_rotation = F * transfo.bone_transformations[b].localRotation;
+        }
+        skeleton.computeGlobalTransformationParameters(transfo);
+    }
+
+private:
+    std::vector<Vec3> backward, forward;
+    std::vector<float> backwardWeight;
+    std::vector<unsigned char> isTarget;
+
+    Vec3 backwardPosition(unsigned int a, Vec3 const &fallback) const
+    {
+        return backwardWeight[a] > 0.f ? backward[a] / backwardWeight[a] : fallback;
+    }
+
+    static float boneLength(Skeleton const &skeleton, unsigned int b)
+    {
+        return (skeleton.articulations[skeleton.bones[b].joints[1]].p - skeleton.articulations[skeleton.bones[b].joints[0]].p).length();
+    }
+};
+
+// -------------------------------------------
+// Jacobian damped least squares : each moved bone has 3 rotational degrees of freedom (world axes,
+// around its first articulation). dtheta = J^T (J J^T + lambda^2 I)^-1 e, with e the (clamped)
+// effector errors. J J^T is only 3 x (number of effectors) wide, solved with a Cholesky factorization.
+// damping and maxStep are relative to the mean length of the moved bones.
+// -------------------------------------------
+class DampedLeastSquaresIKSolver : public IKSolver
+{
+public:
+    DampedLeastSquaresIKSolver(double relativeDamping = 0.25, double relativeMaxStep = 2.0) : damping(relativeDamping), maxStep(relativeMaxStep) {}
+
+    const char *name() const { return "DLS"; }
+
+protected:
+    void iterate(Skeleton const &skeleton, SkeletonTransformation &transfo, std::vector<IKEffector> const &effectors, IKJointLimits const *limits)
+    {
+        std::vector<Vec3> const &p = transfo.articulations_transformed_position;
+        unsigned int rows = 3 * effectors.size(), cols = 3 * activeBones.size();
+
+        double meanLength = 0.0;
+        for (unsigned int k = 0; k < activeBones.size(); ++k)
+            meanLength += (p[skeleton.bones[activeBones[k]].joints[1]] - p[skeleton.bones[activeBones[k]].joints[0]]).length();
+        meanLength /= activeBones.size();
+        double lambda = damping * meanLength, stepLength = maxStep * meanLength;
+
+        J.assign(rows * cols, 0.0);
+        e.assign(rows, 0.0);
+        for (unsigned int i = 0; i < effectors.size(); ++i)
+        {
+            double w = effectors[i].weight;
+            Vec3 pe = p[effectors[i].articulation];
+            Vec3 err = effectors[i].target - pe;
+            double l = err.length();
+            double s = l > stepLength ? stepLength / l : 1.0;
+            for (unsigned int c = 0; c < 3; ++c)
+                e[3 * i + c] = w * s * err[c];
+
+            for (unsigned int k = 0; k < effectorChains[i].size(); ++k)
+            {
+                unsigned int b = effectorChains[i][k];
+                Vec3 r = pe - p[skeleton.bones[b].joints[0]];
+                double *Jx = &J[(3 * i) * cols + 3 * activeIndex[b]];
+                double *Jy = Jx + cols;
+                double *Jz = Jy + cols;
+                // columns : x_axis ^ r , y_axis ^ r , z_axis ^ r
+                Jx[0] = 0.0;
+                Jy[0] = -w * r[2];
+                Jz[0] = w * r[1];
+                Jx[1] = w * r[2];
+                Jy[1] = 0.0;
+                Jz[1] = -w * r[0];
+                Jx[2] = -w * r[1];
+                Jy[2] = w * r[0];
+                Jz[2] = 0.0;
+            }
+        }
+
+        // A = J J^T + lambda^2 I , solve A y = e
+        A.assign(rows * rows, 0.0);
+        for (unsigned int i = 0; i < rows; ++i)
+            for (unsigned int j = 0; j <= i; ++j)
+            {
+                double sum = (i == j) ? lambda * lambda : 0.0;
+                for (unsigned int c = 0; c < cols; ++c)
+                    sum += J[i * cols + c] * J[j * cols + c];
+                A[i * rows + j] = sum;
+            }
+        if (!choleskySolve(rows))
+            return;
+
+        // dtheta = J^T y ; every increment is expressed with the father rotations of the current pose
+        dtheta.assign(cols, 0.0);
+        for (unsigned int i = 0; i < rows; ++i)
+            for (unsigned int c = 0; c < cols; ++c)
+                dtheta[c] += J[i * cols + c] * e[i];
+        for (unsigned int k = 0; k < activeBones.size(); ++k)
+        {
+            Vec3 omega(dtheta[3 * k], dtheta[3 * k + 1], dtheta[3 * k + 2]);
+            float angle = omega.length();
+            if (angle > 1e-12f)
+                rotateBone(skeleton, transfo, activeBones[k], Mat3::getRotationMatrixFromAxisAndAngle(omega / angle, angle), limits);
+        }
+        skeleton.computeGlobalTransformationParameters(transfo);
+    }
+
+private:
+    double damping, maxStep;
+    std::vector<double> J, A, e, dtheta;
+
+    // in place : A (lower part) <- L, e <- A^-1 e
+    bool choleskySolve(unsigned int n)
+    {
+        for (unsigned int j = 0; j < n; ++j)
+        {
+            double d = A[j * n + j];
+            for (unsigned int k = 0; k < j; ++k)
+                d -= A[j * n + k] * A[j * n + k];
+            if (!(d > 0.0))
+                return false;
+            d = sqrt(d);
+            A[j * n + j] = d;
+            for (unsigned int i = j + 1; i < n; ++i)
+            {
+                double s = A[i * n + j];
+                for (unsigned int k = 0; k < j; ++k)
+                    s -= A[i * n + k] * A[j * n + k];
+                A[i * n + j] = s / d;
+            }
+        }
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            for (unsigned int k = 0; k < i; ++k)
+                e[i] -= A[i * n + k] * e[k];
+            e[i] /= A[i * n + i];
+        }
+        for (int i = (int)n - 1; i >= 0; --i)
+        {
+            for (unsigned int k = i + 1; k < n; ++k)
+                e[i] -= A[k * n + i] * e[k];
+            e[i] /= A[i * n + i];
+        }
+        return true;
+    }
+};
+
+#endif // IKSOLVER_H
@@ -0,0 +1,291 @@
+#ifndef LAPLACIANEIGENBASIS_H
+#define LAPLACIANEIGENBASIS_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+#include <Eigen/SparseCholesky>
+
+#include <SymEigsShiftSolver.h>
+#if defined(__has_include)
+#if __has_include(<Util/Version.h>)
+#include <Util/Version.h>
+#endif
+#endif
+
+#include "Mesh.h"
+#include "Hash.h"
+#include "LaplacianWeights.h"
+
+// -------------------------------------------
+// Eigenbasis of the cotangent Laplacian ("manifold harmonics")
+// -------------------------------------------
+// The k smallest eigenpairs of L phi = lambda M phi (L cotangent stiffness matrix, M lumped mass),
+// phi M-orthonormal. With M diagonal the problem is solved in its standard form
+// A = M^-1/2 L M^-1/2 by Spectra's SymEigsShiftSolver, in shift-invert mode : the operator
+// (A - sigma I)^-1 is applied through one sparse factorization of L - sigma M, computed when the
+// shift is set and kept (a second compute on the same mesh does not factorize again).
+// The basis is written to / read from a binary cache keyed by the mesh hash and k.
+//
+// project : coefficients c = Phi^T M f ; reconstruct : f = Phi c (the n first modes).
+// Used for spectral smoothing (low-pass filter), compression of deformation fields (a few
+// coefficients per coordinate instead of one value per vertex) and low-frequency previews.
+// -------------------------------------------
+
+// shift-invert operator, with the interface expected by Spectra (rows, cols, set_shift, perform_op)
+class LaplacianShiftInvertOp
+{
+public:
+    typedef double Scalar;
+
+    LaplacianShiftInvertOp() : shift(0.0), factorized(false) {}
+
+    void setMatrices(Eigen::SparseMatrix<double> const &stiffness, Eigen::VectorXd const &mass)
+    {
+        L = stiffness;
+        sqrtMass = mass.cwiseSqrt();
+        factorized = false;
+    }
+
+    Eigen::Index rows() const { return L.rows(); }
+    Eigen::Index cols() const { return L.cols(); }
+    bool isFactorized() const { return factorized; }
+
+    void set_shift(double sigma)
+    {
+        if (factorized && sigma == shift)
+            return; // cached factorization
+        Eigen::SparseMatrix<double> shifted = L;
+        for (Eigen::Index i = 0; i < L.rows(); ++i)
+            shifted.coeffRef(i, i) -= sigma * sqrtMass[i] * sqrtMass[i];
+        if (!factorized)
+            solver.analyzePattern(shifted);
+        solver.factorize(shifted);
+        shift = sigma;
+        factorized = (solver.info() == Eigen::Success);
+    }
+
+    // y = (A - sigma I)^-1 x = M^1/2 (L - sigma M)^-1 M^1/2 x
+    void perform_op(const double *x_in, double *y_out) const
+    {
+        Eigen::Map<const Eigen::VectorXd> x(x_in, L.rows());
+        Eigen::Map<Eigen::VectorXd> y(y_out, L.rows());
+        scratch = sqrtMass.cwiseProduct(x);
+        scratch = solver.solve(scratch);
+        y = sqrtMass.cwiseProduct(scratch);
+    }
+
+private:
+    Eigen::SparseMatrix<double> L;
+    Eigen::VectorXd sqrtMass;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver;
+    mutable Eigen::VectorXd scratch;
+    double shift;
+    bool factorized;
+};
+
+class LaplacianEigenbasis
+{
+public:
+    LaplacianEigenbasis() : sigma(0.0), meshKey(0) {}
+
+    unsigned int size() const { return eigenvalues.size(); }
+    unsigned int numberOfVertices() const { return eigenvectors.rows(); }
+    bool empty() const { return eigenvalues.size() == 0; }
+
+    Eigen::VectorXd const &getEigenvalues() const { return eigenvalues; }
+    Eigen::MatrixXd const &getEigenvectors() const { return eigenvectors; } // nV x k, column i : phi_i
+    Eigen::VectorXd const &getMass() const { return mass; }
+
+    // k smallest eigenpairs ; false if the solver did not converge
+    bool compute(Mesh const &mesh, unsigned int k, std::string const &cacheFilename = "")
+    {
+        unsigned int nV = mesh.V.size();
+        k = std::min(k, nV > 1 ? nV - 1 : 0);
+        hash64_t key = hashValue(k, hashValue((unsigned int)cacheVersion, mesh.computeHash()));
+        if (!cacheFilename.empty() && read(cacheFilename, key))
+        {
+            std::cout << "Laplacian eigenbasis: " << size() << " modes read from " << cacheFilename << std::endl;
+            return true;
+        }
+        if (k == 0)
+            return false;
+
+        // matrices (kept with the factorization : a new k on the same mesh only reruns the iterations)
+        hash64_t geometryKey = mesh.computeHash();
+        if (!op.isFactorized() || geometryKey != meshKey)
+        {
+            LaplacianWeights laplacian;
+            laplacian.buildCotangentWeightsOfTriangleMesh(mesh);
+            std::vector<Eigen::Triplet<double>> triplets;
+            mass.resize(nV);
+            double traceL = 0.0;
+            for (unsigned int i = 0; i < nV; ++i)
+            {
+                double diagonal = 0.0;
+                for (std::map<unsigned int, double>::const_iterator it = laplacian.get_weight_of_adjacent_edges_it_begin(i); it != laplacian.get_weight_of_adjacent_edges_it_end(i); ++it)
+                {
+                    triplets.push_back(Eigen::Triplet<double>(i, it->first, -it->second));
+                    diagonal += it->second;
+                }
+                triplets.push_back(Eigen::Triplet<double>(i, i, diagonal));
+                traceL += diagonal;
+                mass[i] = std::max(laplacian.get_vertex_weight(i), 1e-20);
+            }
+            Eigen::SparseMatrix<double> L(nV, nV);
+            L.setFromTriplets(triplets.begin(), triplets.end());
+            op.setMatrices(L, mass);
+            // just below 0 (the smallest eigenvalue) : L - sigma M is positive definite
+            sigma = -1e-6 * traceL / mass.sum();
+            meshKey = geometryKey;
+        }
+
+        unsigned int ncv = std::min(nV, std::max(2 * k + 1, k + 20));
+#if defined(SPECTRA_MAJOR_VERSION) && SPECTRA_MAJOR_VERSION >= 1
+        Spectra::SymEigsShiftSolver<LaplacianShiftInvertOp> eigs(op, k, ncv, sigma);
+        eigs.init();
+        eigs.compute(Spectra::SortRule::LargestMagn, 1000, 1e-10);
+        bool converged = (eigs.info() == Spectra::CompInfo::Successful);
+#else
+        Spectra::SymEigsShiftSolver<double, Spectra::LARGEST_MAGN, LaplacianShiftInvertOp> eigs(&op, k, ncv, sigma);
+        eigs.init();
+        eigs.compute(1000, 1e-10);
+        bool converged = (eigs.info() == Spectra::SUCCESSFUL);
+#endif
+        if (!converged || !op.isFactorized())
+        {
+            std::cerr << "Laplacian eigenbasis: the eigen solver did not converge" << std::endl;
+            eigenvalues.resize(0);
+            eigenvectors.resize(0, 0);
+            return false;
+        }
+
+        // increasing eigenvalues, phi = M^-1/2 psi
+        Eigen::VectorXd values = eigs.eigenvalues();
+        Eigen::MatrixXd vectors = eigs.eigenvectors();
+        std::vector<unsigned int> order(values.size());
+        for (unsigned int i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&values](unsigned int a, unsigned int b)
+                  { return values[a] < values[b]; });
+        eigenvalues.resize(order.size());
+        eigenvectors.resize(nV, order.size());
+        Eigen::VectorXd invSqrtMass = mass.cwiseSqrt().cwiseInverse();
+        for (unsigned int i = 0; i < order.size(); ++i)
+        {
+            eigenvalues[i] = values[order[i]];
+            eigenvectors.col(i) = invSqrtMass.cwiseProduct(vectors.col(order[i]));
+        }
+
+        if (!cacheFilename.empty())
+            write(cacheFilename, key);
+        return true;
+    }
+
+    // c = Phi^T M f , f : nV x d (one column per coordinate), the nModes first modes (0 : all)
+    Eigen::MatrixXd project(Eigen::MatrixXd const &f, unsigned int nModes = 0) const
+    {
+        unsigned int n = modes(nModes);
+        return eigenvectors.leftCols(n).transpose() * mass.asDiagonal() * f;
+    }
+
+    // f = Phi c , c : n x d
+    Eigen::MatrixXd reconstruct(Eigen::MatrixXd const &coefficients) const
+    {
+        unsigned int n = modes(coefficients.rows());
+        return eigenvectors.leftCols(n) * coefficients.topRows(n);
+    }
+
+    // heat kernel low-pass filter : c_i *= exp(-t lambda_i)
+    Eigen::MatrixXd smooth(Eigen::MatrixXd const &f, double t, unsigned int nModes = 0) const
+    {
+        Eigen::MatrixXd c = project(f, nModes);
+        for (unsigned int i = 0; i < c.rows(); ++i)
+            c.row(i) *= std::exp(-t * eigenvalues[i]);
+        return reconstruct(c);
+    }
+
+    // positions (or any per vertex 3D field) <-> nV x 3 matrices
+    static Eigen::MatrixXd toMatrix(std::vector<Vec3> const &field)
+    {
+        Eigen::MatrixXd f(field.size(), 3);
+        for (unsigned int v = 0; v < field.size(); ++v)
+            for (unsigned int c = 0; c < 3; ++c)
+                f(v, c) = field[v][c];
+        return f;
+    }
+
+    // low-frequency preview of a deformation, on 4 floats per vertex buffers (SkinningKernel layout) :
+    // filtered = rest + Phi Phi^T M (positions - rest), restricted to the nModes first modes
+    // (filtered may be positions)
+    void filterDeformation(float const *positions, float const *restPositions, unsigned int nModes, float *filtered) const
+    {
+        unsigned int n = modes(nModes), nV = numberOfVertices();
+        if (n == 0)
+        {
+            std::copy(positions, positions + 4 * nV, filtered);
+            return;
+        }
+        Eigen::MatrixXd d(nV, 3);
+        for (unsigned int v = 0; v < nV; ++v)
+            for (unsigned int c = 0; c < 3; ++c)
+                d(v, c) = mass[v] * (positions[4 * v + c] - restPositions[4 * v + c]);
+        Eigen::MatrixXd coefficients = eigenvectors.leftCols(n).transpose() * d;
+        d.noalias() = eigenvectors.leftCols(n) * coefficients;
+        for (unsigned int v = 0; v < nV; ++v)
+            for (unsigned int c = 0; c < 3; ++c)
+                filtered[4 * v + c] = restPositions[4 * v + c] + (float)d(v, c);
+    }
+
+private:
+    static const unsigned int cacheVersion = 1;
+
+    Eigen::VectorXd eigenvalues;
+    Eigen::MatrixXd eigenvectors;
+    Eigen::VectorXd mass;
+    LaplacianShiftInvertOp op;
+    double sigma;
+    hash64_t meshKey; // mesh of the current factorization
+
+    unsigned int modes(unsigned int nModes) const { return nModes == 0 ? size() : std::min(nModes, size()); }
+
+    bool read(std::string const &filename, hash64_t key)
+    {
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        char magic[8];
+        hash64_t storedKey = 0;
+        unsigned int header[2];
+        if (!in || !in.read(magic, 8) || std::string(magic, 8) != "TP2EIGEN" || !in.read((char *)&storedKey, sizeof(storedKey)) || storedKey != key || !in.read((char *)header, sizeof(header)))
+            return false;
+        Eigen::VectorXd values(header[1]), m(header[0]);
+        Eigen::MatrixXd vectors(header[0], header[1]);
+        if (!in.read((char *)values.data(), values.size() * sizeof(double)) || !in.read((char *)m.data(), m.size() * sizeof(double)) || !in.read((char *)vectors.data(), vectors.size() * sizeof(double)))
+            return false;
+        eigenvalues.swap(values);
+        mass.swap(m);
+        eigenvectors.swap(vectors);
+        return true;
+    }
+
+    void write(std::string const &filename, hash64_t key) const
+    {
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        unsigned int header[2] = {numberOfVertices(), size()};
+        out.write("TP2EIGEN", 8);
+        out.write((char const *)&key, sizeof(key));
+        out.write((char const *)header, sizeof(header));
+        out.write((char const *)eigenvalues.data(), eigenvalues.size() * sizeof(double));
+        out.write((char const *)mass.data(), mass.size() * sizeof(double));
+        out.write((char const *)eigenvectors.data(), eigenvectors.size() * sizeof(double));
+        if (!out)
+            std::cerr << "Laplacian eigenbasis: could not write " << filename << std::endl;
+    }
+};
+
+#endif // LAPLACIANEIGENBASIS_H
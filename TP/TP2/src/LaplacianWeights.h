@@ -0,0 +1,126 @@
+#ifndef LAPLACIANWEIGHTS_H
+#define LAPLACIANWEIGHTS_H
+
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+#include "Mesh.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Cotangent weights of a triangle mesh (same interface as in the arap TP) :
+// weight( v1 , v2 ) is half the sum of the cotangents of the opposite corners in the triangles (v1,v2,other)
+//   Careful ! these weights can be negative (obtuse triangles), the matrix
+//   L = sum_ij w_ij (e_i - e_j)(e_i - e_j)^T is still positive semi-definite.
+// The vertex weight is the mixed Voronoi area of the vertex (Meyer et al.), its lumped mass.
+//
+//-------------------------------------------------------------------------------------//
+
+class LaplacianWeights
+{
+private:
+    unsigned int n_vertices;
+    std::vector<std::map<unsigned int, double>> edge_weights;
+    std::vector<double> vertex_weights;
+
+public:
+    LaplacianWeights() : n_vertices(0) {}
+    void clear()
+    {
+        n_vertices = 0;
+        edge_weights.clear();
+        vertex_weights.clear();
+    }
+
+    void resize(unsigned int nVertices)
+    {
+        clear();
+        n_vertices = nVertices;
+        edge_weights.resize(nVertices);
+        vertex_weights.resize(nVertices, 0.0);
+    }
+
+    unsigned int get_n_vertices() const { return n_vertices; }
+    unsigned int get_n_adjacent_edges(unsigned int vertex_index) const { return edge_weights[vertex_index].size(); }
+
+    double get_edge_weight(unsigned int v1, unsigned int v2) const
+    {
+        std::map<unsigned int, double>::const_iterator it = edge_weights[v1].find(v2);
+        if (it == edge_weights[v1].end())
+            return 0.0;
+        return it->second;
+    }
+
+    std::map<unsigned int, double>::const_iterator get_weight_of_adjacent_edges_it_begin(unsigned int v1) const { return edge_weights[v1].begin(); }
+    std::map<unsigned int, double>::const_iterator get_weight_of_adjacent_edges_it_end(unsigned int v1) const { return edge_weights[v1].end(); }
+
+    double get_vertex_weight(unsigned int v) const { return vertex_weights[v]; }
+
+    double sumVertexWeights() const
+    {
+        double s = 0.0;
+        for (unsigned int v = 0; v < n_vertices; ++v)
+            s += vertex_weights[v];
+        return s;
+    }
+
+    // wij = 1/2 * (cot(alpha_ij) + cot(beta_ij)), alpha_ij and beta_ij being the two opposite angles of the edge ij
+    void buildCotangentWeightsOfTriangleMesh(const Mesh &mesh)
+    {
+        resize(mesh.V.size());
+        for (unsigned int t = 0; t < mesh.T.size(); ++t)
+        {
+            unsigned int v[3] = {mesh.T[t].v[0], mesh.T[t].v[1], mesh.T[t].v[2]};
+            double p[3][3];
+            for (unsigned int i = 0; i < 3; ++i)
+                for (unsigned int c = 0; c < 3; ++c)
+                    p[i][c] = mesh.V[v[i]].p[c];
+
+            // corner i, opposite edge (i+1, i+2)
+            double cotangent[3], squaredLength[3], dotProduct[3];
+            double area = 0.0;
+            for (unsigned int i = 0; i < 3; ++i)
+            {
+                unsigned int j = (i + 1) % 3, k = (i + 2) % 3;
+                double e1[3], e2[3];
+                for (unsigned int c = 0; c < 3; ++c)
+                {
+                    e1[c] = p[j][c] - p[i][c];
+                    e2[c] = p[k][c] - p[i][c];
+                }
+                double cross[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+                double doubleArea = sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+                dotProduct[i] = e1[0] * e2[0] + e1[1] * e2[1] + e1[2] * e2[2];
+                cotangent[i] = doubleArea > 1e-20 ? dotProduct[i] / doubleArea : 0.0;
+                squaredLength[i] = (p[k][0] - p[j][0]) * (p[k][0] - p[j][0]) + (p[k][1] - p[j][1]) * (p[k][1] - p[j][1]) + (p[k][2] - p[j][2]) * (p[k][2] - p[j][2]);
+                area = doubleArea / 2.0;
+            }
+
+            for (unsigned int i = 0; i < 3; ++i)
+            {
+                unsigned int j = (i + 1) % 3, k = (i + 2) % 3;
+                edge_weights[v[j]][v[k]] += cotangent[i] / 2.0;
+                edge_weights[v[k]][v[j]] += cotangent[i] / 2.0;
+            }
+
+            // mixed Voronoi areas : Voronoi if the triangle is not obtuse, else area/2 for the obtuse corner and area/4 for the others
+            if (dotProduct[0] >= 0.0 && dotProduct[1] >= 0.0 && dotProduct[2] >= 0.0)
+            {
+                for (unsigned int i = 0; i < 3; ++i)
+                {
+                    unsigned int j = (i + 1) % 3, k = (i + 2) % 3;
+                    vertex_weights[v[j]] += cotangent[i] * squaredLength[i] / 8.0;
+                    vertex_weights[v[k]] += cotangent[i] * squaredLength[i] / 8.0;
+                }
+            }
+            else
+            {
+                for (unsigned int i = 0; i < 3; ++i)
+                    vertex_weights[v[i]] += (dotProduct[i] < 0.0) ? area / 2.0 : area / 4.0;
+            }
+        }
+    }
+};
+
+#endif // LAPLACIANWEIGHTS_H
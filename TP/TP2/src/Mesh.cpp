@@ -1,7 +1,13 @@
 #include "Mesh.h"
+#include "SkinningKernel.h"
+#include "LaplacianWeights.h"
+#include "TriangleBVH.h"
+#include "linearSystem.h"
+#include "ParallelFor.h"
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <chrono>
 
 void Mesh::loadOFF(const std::string &filename)
 {
@@ -23,6 +29,10 @@ void Mesh::loadOFF(const std::string &filename)
             in >> T[i].v[j];
     }
     in.close();
+    triangleIndices.resize(3 * sizeT);
+    for (unsigned int i = 0; i < sizeT; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            triangleIndices[3 * i + j] = T[i].v[j];
     recomputeNormals();
 }
 
@@ -43,18 +53,32 @@ void Mesh::recomputeNormals()
         V[i].n.normalize();
 }
 
-void Mesh::compute_skinning_weights(Skeleton &skeleton)
+hash64_t Mesh::computeHash() const
+{
+    hash64_t h = hashValue((unsigned int)V.size(), 14695981039346656037ULL);
+    h = hashValue((unsigned int)T.size(), h);
+    for (unsigned int i = 0; i < V.size(); i++)
+        for (unsigned int c = 0; c < 3; c++)
+            h = hashValue(V[i].p[c], h);
+    for (unsigned int i = 0; i < T.size(); i++)
+        h = hashBytes(T[i].v, sizeof(T[i].v), h);
+    return h;
+}
+
+void Mesh::compute_skinning_weights(Skeleton const &skeleton, unsigned int maxInfluences, float pruneThreshold)
 {
     // you should compute weights for each vertex w.r.t. the skeleton bones
     // so each vertex will have B weights (B = number of bones)
-    // these weights shoud be stored in vertex.w:
+    // only the maxInfluences largest ones are kept, in skinningWeights
 
     unsigned int B = skeleton.bones.size();
     int n = 10; // parametre pour l'influence de la distance sur le poids
+    skinningWeights.resize(V.size(), B, maxInfluences, pruneThreshold);
+    std::vector<double> w(B, 0.0); // poids denses d'un vertex, réutilisés d'un vertex à l'autre
     for (unsigned int i = 0; i < V.size(); ++i)
     {
         // l'idée s'est de parcourir tout les os, et calculer la distance entre le vertex et l'os,
-        V[i].w.resize(B, 0.0); // poids de l'os initialiser a 0
+        std::fill(w.begin(), w.end(), 0.0); // poids de l'os initialiser a 0
         Vec3 poid = V[i].p;
         double sommePoids = 0.0; // variable qui contient les somme des poids pour la normalisation
         // on parcourt tout les os
@@ -71,13 +95,172 @@ void Mesh::compute_skinning_weights(Skeleton &skeleton)
             Vec3 proj = articulation1 + t * articulation1ToArticulation2; // projection orthogonale du vertex sur le segment
             float distance = (poid - proj).length();
             // calcul du poids
-            V[i].w[j] = pow((1.0 / (distance)), n); // on ajoute un petit epsilon pour eviter la division par 0
-            sommePoids += V[i].w[j];
+            w[j] = pow((1.0 / (distance + 1e-6)), n); // on ajoute un petit epsilon pour eviter la division par 0
+            sommePoids += w[j];
             // poids i, j  = (1/ distanceij)^n
         }
         // Normalisation des poids pour rester entre 0 et 1
         for (unsigned int j = 0; j < B; ++j)
-            V[i].w[j] /= sommePoids;
+            w[j] /= sommePoids;
+        skinningWeights.setVertexWeights(i, w);
+    }
+
+    SkinningPruningReport const &report = skinningWeights.getReport();
+    std::cout << "Skinning weights: " << skinningWeights.maxInfluences() << " influences max per vertex (threshold "
+              << pruneThreshold << "), " << report.meanInfluences << " on average, " << report.saturated
+              << " vertices truncated" << std::endl;
+    std::cout << "Pruning error (L1 on the weights): mean " << report.meanError << ", max " << report.maxError << std::endl;
+}
+
+static const char heatWeightsMagic[8] = {'T', 'P', '2', 'H', 'E', 'A', 'T', 'W'};
+static const unsigned int heatWeightsVersion = 1;
+
+void Mesh::compute_heat_skinning_weights(Skeleton const &skeleton, unsigned int maxInfluences, float pruneThreshold, std::string const &cacheFilename)
+{
+    typedef std::chrono::steady_clock heatClock;
+    unsigned int B = skeleton.bones.size();
+    unsigned int nV = V.size();
+    if (B == 0)
+    {
+        // no bone to attach to : no influence, the vertices stay at rest
+        std::cerr << "Skinning weights (bone heat): the skeleton has no bone" << std::endl;
+        skinningWeights.resize(nV, 0, maxInfluences, pruneThreshold);
+        return;
+    }
+
+    // cache key : mesh, skeleton, parameters
+    hash64_t key = computeHash();
+    for (unsigned int a = 0; a < skeleton.articulations.size(); a++)
+        for (unsigned int c = 0; c < 3; c++)
+            key = hashValue(skeleton.articulations[a].p[c], key);
+    for (unsigned int b = 0; b < B; b++)
+        key = hashBytes(skeleton.bones[b].joints, sizeof(skeleton.bones[b].joints), key);
+    key = hashValue(maxInfluences, key);
+    key = hashValue(pruneThreshold, key);
+    key = hashValue(heatWeightsVersion, key);
+
+    if (!cacheFilename.empty())
+    {
+        std::ifstream in(cacheFilename.c_str(), std::ios::binary);
+        char magic[8];
+        hash64_t storedKey = 0;
+        if (in && in.read(magic, 8) && std::equal(magic, magic + 8, heatWeightsMagic) && in.read((char *)&storedKey, sizeof(storedKey)) && storedKey == key && skinningWeights.read(in) && skinningWeights.numberOfVertices() == nV)
+        {
+            std::cout << "Skinning weights (bone heat): read from " << cacheFilename << std::endl;
+            return;
+        }
+    }
+
+    heatClock::time_point start = heatClock::now();
+
+    // 1. attachment : closest bone such that the segment vertex -> closest point of the bone does not cross the surface.
+    // H_ii = 1 / d^2 , d the distance to that bone (no attachment if no bone is visible)
+    TriangleBVH bvh;
+    bvh.build(V, T);
+    std::vector<int> attachedBone(nV, -1), closestBone(nV, 0);
+    std::vector<double> heat(nV, 0.0);
+    parallelFor(nV, [&](unsigned int begin, unsigned int end)
+                {
+        std::vector<std::pair<float, unsigned int>> candidates(B);
+        std::vector<Vec3> closestPoints(B);
+        for (unsigned int i = begin; i < end; ++i)
+        {
+            Vec3 p = V[i].p;
+            for (unsigned int j = 0; j < B; ++j)
+            {
+                Vec3 a0 = skeleton.articulations[skeleton.bones[j].joints[0]].p;
+                Vec3 a1 = skeleton.articulations[skeleton.bones[j].joints[1]].p;
+                Vec3 bone = a1 - a0;
+                float t = std::max(0.f, std::min(1.f, Vec3::dot(p - a0, bone) / std::max(1e-20f, bone.squareLength())));
+                closestPoints[j] = a0 + t * bone;
+                candidates[j] = std::make_pair((p - closestPoints[j]).length(), j);
+            }
+            std::sort(candidates.begin(), candidates.end());
+            closestBone[i] = candidates[0].second;
+            for (unsigned int k = 0; k < B; ++k)
+            {
+                unsigned int j = candidates[k].second;
+                float d = std::max(candidates[k].first, 1e-6f);
+                if (!bvh.segmentIntersects(p, closestPoints[j], 1e-3f, 1.f))
+                {
+                    attachedBone[i] = j;
+                    heat[i] = 1.0 / ((double)d * d);
+                    break;
+                }
+            }
+        } }, 256);
+    double attachMs = std::chrono::duration<double, std::milli>(heatClock::now() - start).count();
+
+    // 2. ( L + M H ) w_j = M H p_j for all the bones j : one factorization, B right hand sides.
+    // (-Delta + H) w = H p with Delta = -M^-1 L, multiplied by the lumped mass matrix M to be symmetric.
+    LaplacianWeights laplacian;
+    laplacian.buildCotangentWeightsOfTriangleMesh(*this);
+    linearSystem system(nV, nV);
+    Eigen::MatrixXd rhs = Eigen::MatrixXd::Zero(nV, B);
+    unsigned int unattached = 0;
+    for (unsigned int i = 0; i < nV; i++)
+    {
+        double mass = laplacian.get_vertex_weight(i);
+        double diagonal = mass * heat[i] + 1e-10 * mass; // the regularization keeps the components without any attachment solvable
+        for (std::map<unsigned int, double>::const_iterator it = laplacian.get_weight_of_adjacent_edges_it_begin(i); it != laplacian.get_weight_of_adjacent_edges_it_end(i); ++it)
+        {
+            system.A(i, it->first) = -it->second;
+            diagonal += it->second;
+        }
+        system.A(i, i) = diagonal;
+        if (attachedBone[i] >= 0)
+            rhs(i, attachedBone[i]) = mass * heat[i];
+        else
+            ++unattached;
+    }
+    heatClock::time_point factorStart = heatClock::now();
+    Eigen::MatrixXd X;
+    bool factorized = system.preprocessSymmetric();
+    double factorMs = std::chrono::duration<double, std::milli>(heatClock::now() - factorStart).count();
+    heatClock::time_point solveStart = heatClock::now();
+    if (factorized)
+        system.solve(rhs, X);
+    double solveMs = std::chrono::duration<double, std::milli>(heatClock::now() - solveStart).count();
+
+    // 3. top-k influences
+    skinningWeights.resize(nV, B, maxInfluences, pruneThreshold);
+    std::vector<double> w(B, 0.0);
+    for (unsigned int i = 0; i < nV; i++)
+    {
+        double sum = 0.0;
+        for (unsigned int j = 0; j < B; j++)
+        {
+            w[j] = factorized ? std::max(0.0, X(i, j)) : 0.0;
+            sum += w[j];
+        }
+        if (sum > 1e-12)
+            for (unsigned int j = 0; j < B; j++)
+                w[j] /= sum;
+        else
+        {
+            std::fill(w.begin(), w.end(), 0.0);
+            w[closestBone[i]] = 1.0;
+        }
+        skinningWeights.setVertexWeights(i, w);
+    }
+
+    double totalMs = std::chrono::duration<double, std::milli>(heatClock::now() - start).count();
+    if (!factorized)
+        std::cerr << "Skinning weights (bone heat): the factorization failed, each vertex follows its closest bone" << std::endl;
+    std::cout << "Skinning weights (bone heat): " << totalMs << " ms (attachment " << attachMs << " ms, factorization " << factorMs
+              << " ms, " << B << " solves " << solveMs << " ms), " << unattached << " vertices see no bone" << std::endl;
+    SkinningPruningReport const &report = skinningWeights.getReport();
+    std::cout << "Pruning error (L1 on the weights): mean " << report.meanError << ", max " << report.maxError
+              << ", " << report.meanInfluences << " influences on average" << std::endl;
+
+    if (!cacheFilename.empty())
+    {
+        std::ofstream out(cacheFilename.c_str(), std::ios::binary);
+        out.write(heatWeightsMagic, 8);
+        out.write((char const *)&key, sizeof(key));
+        skinningWeights.write(out);
+        if (!out)
+            std::cerr << "Skinning weights (bone heat): could not write " << cacheFilename << std::endl;
     }
 }
 
@@ -91,9 +274,9 @@ void Mesh::draw(int displayedBone) const
         for (unsigned int j = 0; j < 3; j++)
         {
             const MeshVertex &v = V[T[i].v[j]];
-            if (displayedBone >= 0 && displayedBone < v.w.size())
+            if (displayedBone >= 0 && displayedBone < (int)skinningWeights.numberOfBones() && !skinningWeights.empty())
             {
-                Vec3 rgb = HSVtoRGB(v.w[displayedBone], 0.8, 0.8);
+                Vec3 rgb = HSVtoRGB(skinningWeights.weight(T[i].v[j], displayedBone), 0.8, 0.8);
                 glColor3f(rgb[0], rgb[1], rgb[2]);
             }
             else
@@ -105,51 +288,21 @@ void Mesh::draw(int displayedBone) const
     glEnd();
 }
 
-void Mesh::drawTransformedMesh(SkeletonTransformation &transfo) const
+void Mesh::drawSkinnedMesh(SkinningKernel const &skinning, float const *positions) const
 {
-
-    std::vector<Vec3> new_positions(V.size());
-    std::vector<Vec3> new_normals(V.size());
-
-    for (unsigned int i = 0; i < V.size(); i++) // on calcul pour chaque os
-    {
-        new_positions[i] = Vec3(0, 0, 0);
-        new_normals[i] = Vec3(0, 0, 0);
-
-        for (unsigned int j = 0; j < transfo.bone_transformations.size(); j++) // pour chaque os
-        {
-            // pi = somme sur j ( poids(i,j) * ( Rj * pi + tj ) )
-            Vec3 poid = V[i].p;                                               // position du vertex i
-            Vec3 normal = V[i].n;                                             // normale du vertex i
-            Mat3 R = transfo.bone_transformations[j].world_space_rotation;    // matrice de rotation de l'os j
-            Vec3 t = transfo.bone_transformations[j].world_space_translation; // translation de l'os j
-            Vec3 p_transformed = R * poid + t;                                // formule de transformation
-            // pour la normale, on fait l'inverse transpose de la matrice de rotation
-            Vec3 n_transformed = R * normal; // car R est une matrice de rotation, son inverse est son transpose
-            n_transformed.normalize();
-
-            new_positions[i] += V[i].w[j] * p_transformed;
-            new_normals[i] += V[i].w[j] * n_transformed;
-        }
-    }
-
-    //---------------------------------------------------//
-    //---------------------------------------------------//
-    //---------------------------------------------------//
+    // the skinning is done beforehand (SkinningKernel::skin), here we only give the buffers to OpenGL
+    if (skinning.numberOfVertices() != V.size() || triangleIndices.empty())
+        return;
 
     glEnable(GL_LIGHTING);
-    glBegin(GL_TRIANGLES);
-    for (unsigned int i = 0; i < T.size(); i++)
-        for (unsigned int j = 0; j < 3; j++)
-        {
-            const MeshVertex &v = V[T[i].v[j]];
-            Vec3 p = new_positions[T[i].v[j]];
-            Vec3 n = new_normals[T[i].v[j]];
-            glColor3f(0.6, 0.6, 0.6);
-            glNormal3f(n[0], n[1], n[2]);
-            glVertex3f(p[0], p[1], p[2]);
-        }
-    glEnd();
+    glColor3f(0.6, 0.6, 0.6);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 4 * sizeof(float), positions ? positions : &skinning.positions[0]);
+    glNormalPointer(GL_FLOAT, 4 * sizeof(float), &skinning.normals[0]);
+    glDrawElements(GL_TRIANGLES, triangleIndices.size(), GL_UNSIGNED_INT, &triangleIndices[0]);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
 }
 
 /*! \brief Convert HSV to RGB color space
@@ -6,11 +6,14 @@
 #include <string>
 #include "Vec3.h"
 #include "Skeleton.h"
+#include "SkinningWeights.h"
+#include "Hash.h"
 
 #include <cmath>
 
 #include <GL/glut.h>
 
+class SkinningKernel;
 
 // -------------------------------------------
 // Basic Mesh class
@@ -18,24 +21,21 @@
 
 struct MeshVertex {
     inline MeshVertex () {
-        w.clear();
     }
     inline MeshVertex (const Vec3 & _p, const Vec3 & _n) : p (_p), n (_n) {
-        w.clear();
     }
-    inline MeshVertex (const MeshVertex & vertex) : p (vertex.p), n (vertex.n) , w(vertex.w) {
+    inline MeshVertex (const MeshVertex & vertex) : p (vertex.p), n (vertex.n) {
     }
     inline virtual ~MeshVertex () {}
     inline MeshVertex & operator = (const MeshVertex & vertex) {
         p = vertex.p;
         n = vertex.n;
-        w = vertex.w;
         return (*this);
     }
     // membres :
     Vec3 p; // une position
     Vec3 n; // une normale
-    std::vector< double > w; // skinning weights
+    // skinning weights : see Mesh::skinningWeights
 };
 
 struct MeshTriangle {
@@ -64,14 +64,22 @@ class Mesh {
 public:
     std::vector<MeshVertex> V;
     std::vector<MeshTriangle> T;
+    SkinningWeights skinningWeights; // top-k bone influences of each vertex
+    std::vector<unsigned int> triangleIndices; // copy of T for glDrawElements (MeshTriangle has a vtable)
 
     void loadOFF (const std::string & filename);
     void recomputeNormals ();
 
-    void compute_skinning_weights( Skeleton & skeleton );
+    hash64_t computeHash() const ; // positions and triangles, key of the on-disk caches
+
+    void compute_skinning_weights( Skeleton const & skeleton , unsigned int maxInfluences = 4 , float pruneThreshold = 1e-3f );
+    // bone heat (Baran & Popovic) : each vertex is attached to its closest visible bone, and the weights
+    // of each bone diffuse on the surface ; the result is read from / written to cacheFilename if given
+    void compute_heat_skinning_weights( Skeleton const & skeleton , unsigned int maxInfluences = 4 , float pruneThreshold = 1e-3f , std::string const & cacheFilename = "" );
 
     void draw( int displayedBone ) const ;
-    void drawTransformedMesh( SkeletonTransformation & transfo ) const ;
+    // positions : 4 floats per vertex drawn instead of the skinned ones (low-frequency preview), or NULL
+    void drawSkinnedMesh( SkinningKernel const & skinning , float const * positions = NULL ) const ;
 
     Vec3 HSVtoRGB( float fH, float fS, float fV) const;
 };
@@ -0,0 +1,151 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+//-------------------------------------------------------------------------------------//
+//
+// Minimal fork/join helper on top of std::thread (we already link with -lpthread).
+// parallelFor( n , f ) calls f( begin , end ) on contiguous chunks of [0,n),
+// one chunk per hardware thread. Small ranges are run on the calling thread.
+//
+// Unlike the other TPs, the worker threads are created once and reused : skinning
+// calls parallelFor every frame, and must not pay a thread creation (and its
+// allocations) each time. A parallelFor issued from inside a chunk runs serially.
+//
+//-------------------------------------------------------------------------------------//
+
+inline unsigned int parallelThreadCount()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+class ParallelForPool
+{
+public:
+    typedef void (*chunk_function_t)(void const *context, unsigned int begin, unsigned int end);
+
+    static ParallelForPool &instance()
+    {
+        static ParallelForPool pool(parallelThreadCount() - 1);
+        return pool;
+    }
+
+    unsigned int numberOfWorkers() const { return workers.size(); }
+
+    // runs f on the chunks [c*chunkSize, (c+1)*chunkSize) of [0,n), c in [0,nChunks) ; false if the pool is busy
+    bool run(chunk_function_t f, void const *context, unsigned int n, unsigned int nChunks)
+    {
+        std::unique_lock<std::mutex> dispatchLock(dispatchMutex, std::try_to_lock);
+        if (!dispatchLock.owns_lock())
+            return false; // nested call, or another thread is using the pool
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = f;
+            jobContext = context;
+            jobSize = n;
+            jobChunks = nChunks;
+            jobChunkSize = (n + nChunks - 1) / nChunks;
+            nextChunk = 0;
+            pendingChunks = nChunks;
+            ++generation;
+        }
+        wakeUp.notify_all();
+        runChunks();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]()
+                  { return pendingChunks == 0; });
+        return true;
+    }
+
+    ~ParallelForPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wakeUp.notify_all();
+        for (unsigned int w = 0; w < workers.size(); ++w)
+            workers[w].join();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex dispatchMutex, mutex;
+    std::condition_variable wakeUp, done;
+    chunk_function_t job;
+    void const *jobContext;
+    unsigned int jobSize, jobChunks, jobChunkSize, nextChunk, pendingChunks;
+    unsigned long generation;
+    bool quit;
+
+    explicit ParallelForPool(unsigned int nWorkers)
+        : job(0), jobContext(0), jobSize(0), jobChunks(0), jobChunkSize(0), nextChunk(0), pendingChunks(0), generation(0), quit(false)
+    {
+        workers.reserve(nWorkers);
+        for (unsigned int w = 0; w < nWorkers; ++w)
+            workers.push_back(std::thread([this]()
+                                          { workerLoop(); }));
+    }
+
+    void workerLoop()
+    {
+        unsigned long seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [&]()
+                            { return quit || generation != seenGeneration; });
+                if (quit)
+                    return;
+                seenGeneration = generation;
+            }
+            runChunks();
+        }
+    }
+
+    void runChunks()
+    {
+        while (true)
+        {
+            unsigned int c;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (nextChunk >= jobChunks)
+                    return;
+                c = nextChunk++;
+            }
+            unsigned int begin = c * jobChunkSize;
+            unsigned int end = std::min(jobSize, begin + jobChunkSize);
+            if (begin < end)
+                job(jobContext, begin, end);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pendingChunks == 0)
+                done.notify_all();
+        }
+    }
+};
+
+template <class function_t>
+void parallelForChunk(void const *context, unsigned int begin, unsigned int end)
+{
+    (*static_cast<function_t const *>(context))(begin, end);
+}
+
+template <class function_t>
+void parallelFor(unsigned int n, function_t const &f, unsigned int minChunkSize = 1024)
+{
+    if (n == 0)
+        return;
+    unsigned int nChunks = std::min(parallelThreadCount(), (n + minChunkSize - 1) / minChunkSize);
+    if (nChunks <= 1 || !ParallelForPool::instance().run(&parallelForChunk<function_t>, &f, n, nChunks))
+        f(0u, n);
+}
+
+#endif // PARALLELFOR_H
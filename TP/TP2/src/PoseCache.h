@@ -0,0 +1,416 @@
+#ifndef POSECACHE_H
+#define POSECACHE_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Mesh.h"
+#include "Skeleton.h"
+#include "SkinningKernel.h"
+#include "ParallelFor.h"
+#include "Hash.h"
+#include "VertexQuantization.h"
+
+// -------------------------------------------
+// Baked animation : skinned positions and normals of N frames, stored once, replayed without
+// forward kinematics nor skinning.
+//
+// File layout (little endian, as written by the machine) :
+//   PoseCacheHeader
+//   PoseCacheChunkEntry[nChunks]                        (offset and size of each chunk in the file)
+//   chunks, 8-byte aligned, each one holding framesPerChunk frames (the last one may hold less) :
+//     QuantizationBox                                   (positions of the chunk)
+//     unsigned int frameOffsets[frames of the chunk]    (from the start of the chunk)
+//     first frame  : per vertex, unsigned short x y z, short octahedral u v (10 bytes)
+//     other frames : per vertex, the 5 prediction residuals, zigzag + varint
+// The prediction is linear (constant velocity) : frame f is predicted as 2 q(f-1) - q(f-2), q(f-1) for the
+// second frame of a chunk. The animation is smooth, so most residuals fit in one byte.
+// A chunk is decoded from its first frame, so that playback can start anywhere at the cost of at most
+// framesPerChunk - 1 delta frames.
+//
+// PoseCacheFile maps the file (mmap, read-only) and can be shared by any number of PoseCachePlayer :
+// a player only holds its cursor (current frame, quantized state), so many characters can replay
+// the same clip at different times. Entering a chunk asks the kernel to read ahead the next one.
+// -------------------------------------------
+
+struct PoseCacheHeader
+{
+    char magic[8]; // "TP2POSES"
+    unsigned int version;
+    unsigned int nVertices, nFrames, framesPerChunk, nChunks;
+    float framesPerSecond;
+    hash64_t meshHash;
+};
+
+struct PoseCacheChunkEntry
+{
+    unsigned long long offset, size;
+};
+
+class PoseCacheFile
+{
+public:
+    static const unsigned int formatVersion = 1;
+
+    PoseCacheFile() : data(0), dataSize(0) { std::memset(&header, 0, sizeof(header)); }
+    ~PoseCacheFile() { close(); }
+
+    bool isOpen() const { return data != 0; }
+    unsigned int numberOfVertices() const { return header.nVertices; }
+    unsigned int numberOfFrames() const { return header.nFrames; }
+    unsigned int framesPerChunk() const { return header.framesPerChunk; }
+    unsigned int numberOfChunks() const { return header.nChunks; }
+    float framesPerSecond() const { return header.framesPerSecond; }
+    float duration() const { return header.nFrames / header.framesPerSecond; }
+    hash64_t meshHash() const { return header.meshHash; }
+    unsigned long long fileSize() const { return dataSize; }
+
+    // bakes nFrames frames at framesPerSecond : animation(t, transfo) sets the pose at time t (in seconds)
+    // and computes the global transformations. Chunks are baked in parallel, each one with its own kernel.
+    template <class animation_t>
+    static bool bake(std::string const &filename, Mesh const &mesh, Skeleton const &skeleton, animation_t const &animation,
+                     unsigned int nFrames, float framesPerSecond, SkinningMethod method = SkinningMethod_LBS,
+                     unsigned int framesPerChunk = 32, bool parallel = true)
+    {
+        unsigned int nV = mesh.V.size();
+        if (nV == 0 || nFrames == 0 || framesPerChunk == 0 || framesPerSecond <= 0.f)
+            return false;
+
+        PoseCacheHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, "TP2POSES", 8);
+        h.version = formatVersion;
+        h.nVertices = nV;
+        h.nFrames = nFrames;
+        h.framesPerChunk = framesPerChunk;
+        h.nChunks = (nFrames + framesPerChunk - 1) / framesPerChunk;
+        h.framesPerSecond = framesPerSecond;
+        h.meshHash = mesh.computeHash();
+
+        std::vector<std::vector<unsigned char>> chunks(h.nChunks);
+        auto bakeChunks = [&](unsigned int begin, unsigned int end)
+        {
+            SkinningKernel kernel;
+            kernel.setRestPose(mesh);
+            kernel.setMethod(method);
+            SkeletonTransformation transfo;
+            transfo.resize(skeleton.bones.size(), skeleton.articulations.size());
+            for (unsigned int c = begin; c < end; ++c)
+                encodeChunk(c, h, kernel, transfo, animation, chunks[c]);
+        };
+        if (parallel)
+            parallelFor(h.nChunks, bakeChunks, 1);
+        else
+            bakeChunks(0, h.nChunks);
+
+        std::vector<PoseCacheChunkEntry> entries(h.nChunks);
+        unsigned long long offset = align8(sizeof(h) + h.nChunks * sizeof(PoseCacheChunkEntry));
+        for (unsigned int c = 0; c < h.nChunks; ++c)
+        {
+            entries[c].offset = offset;
+            entries[c].size = chunks[c].size();
+            offset = align8(offset + chunks[c].size());
+        }
+
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        out.write((char const *)&h, sizeof(h));
+        out.write((char const *)&entries[0], entries.size() * sizeof(PoseCacheChunkEntry));
+        unsigned long long position = sizeof(h) + entries.size() * sizeof(PoseCacheChunkEntry);
+        char const padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        for (unsigned int c = 0; c < h.nChunks; ++c)
+        {
+            out.write(padding, entries[c].offset - position);
+            out.write((char const *)&chunks[c][0], chunks[c].size());
+            position = entries[c].offset + entries[c].size;
+        }
+        if (!out)
+        {
+            std::cerr << "Pose cache: could not write " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool open(std::string const &filename)
+    {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (unsigned long long)st.st_size < sizeof(PoseCacheHeader))
+        {
+            ::close(fd);
+            return false;
+        }
+        void *mapped = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps the file
+        if (mapped == MAP_FAILED)
+            return false;
+        data = static_cast<unsigned char const *>(mapped);
+        dataSize = st.st_size;
+        madvise(mapped, dataSize, MADV_SEQUENTIAL);
+
+        std::memcpy(&header, data, sizeof(header));
+        bool valid = std::string(header.magic, 8) == "TP2POSES" && header.version == formatVersion && header.nVertices > 0 && header.nFrames > 0 && header.framesPerChunk > 0 && header.nChunks == (header.nFrames + header.framesPerChunk - 1) / header.framesPerChunk && sizeof(header) + header.nChunks * sizeof(PoseCacheChunkEntry) <= dataSize;
+        if (valid)
+        {
+            entries.resize(header.nChunks);
+            std::memcpy(&entries[0], data + sizeof(header), header.nChunks * sizeof(PoseCacheChunkEntry));
+            for (unsigned int c = 0; c < header.nChunks && valid; ++c)
+                valid = entries[c].offset + entries[c].size <= dataSize && entries[c].size >= sizeof(QuantizationBox) + framesInChunk(c) * sizeof(unsigned int) + 10ull * header.nVertices && validFrameOffsets(c);
+        }
+        if (!valid)
+        {
+            std::cerr << "Pose cache: " << filename << " is not a valid pose cache" << std::endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (data)
+            munmap(const_cast<unsigned char *>(data), dataSize);
+        data = 0;
+        dataSize = 0;
+        entries.clear();
+        std::memset(&header, 0, sizeof(header));
+    }
+
+    unsigned int framesInChunk(unsigned int chunk) const
+    {
+        return std::min(header.framesPerChunk, header.nFrames - chunk * header.framesPerChunk);
+    }
+
+    unsigned char const *chunkData(unsigned int chunk) const { return data + entries[chunk].offset; }
+    unsigned long long chunkSize(unsigned int chunk) const { return entries[chunk].size; }
+
+    // end of the residuals of a delta frame (from the start of the chunk) : start of the next frame, or end of the chunk
+    unsigned long long frameEnd(unsigned int chunk, unsigned int local) const
+    {
+        return local + 1 < framesInChunk(chunk) ? frameOffset(chunk, local + 1) : entries[chunk].size;
+    }
+
+    unsigned int frameOffset(unsigned int chunk, unsigned int local) const
+    {
+        unsigned int offset;
+        std::memcpy(&offset, chunkData(chunk) + sizeof(QuantizationBox) + local * sizeof(unsigned int), sizeof(offset));
+        return offset;
+    }
+
+    // read ahead (asynchronous) : the pages of the chunk are loaded before the player reaches it
+    void prefetch(unsigned int chunk) const
+    {
+        if (chunk >= header.nChunks)
+            return;
+        long pageSize = sysconf(_SC_PAGESIZE);
+        unsigned long long begin = entries[chunk].offset / pageSize * pageSize;
+        madvise(const_cast<unsigned char *>(data) + begin, entries[chunk].offset + entries[chunk].size - begin, MADV_WILLNEED);
+    }
+
+private:
+    unsigned char const *data;
+    unsigned long long dataSize;
+    PoseCacheHeader header;
+    std::vector<PoseCacheChunkEntry> entries;
+
+    PoseCacheFile(PoseCacheFile const &);
+    PoseCacheFile &operator=(PoseCacheFile const &);
+
+    static unsigned long long align8(unsigned long long x) { return (x + 7) & ~7ull; }
+
+    // the frames follow the offsets table in order, inside the chunk : 10 bytes per vertex for the
+    // first one, at least one byte per residual for the others
+    bool validFrameOffsets(unsigned int chunk) const
+    {
+        unsigned int nF = framesInChunk(chunk);
+        unsigned long long begin = sizeof(QuantizationBox) + nF * sizeof(unsigned int);
+        for (unsigned int f = 0; f < nF; ++f)
+        {
+            unsigned long long offset = frameOffset(chunk, f);
+            if (offset < begin)
+                return false;
+            begin = offset + (f == 0 ? 10ull : 5ull) * header.nVertices;
+        }
+        return begin <= entries[chunk].size;
+    }
+
+    template <class animation_t>
+    static void encodeChunk(unsigned int chunk, PoseCacheHeader const &h, SkinningKernel &kernel, SkeletonTransformation &transfo,
+                            animation_t const &animation, std::vector<unsigned char> &out)
+    {
+        unsigned int nV = h.nVertices;
+        unsigned int first = chunk * h.framesPerChunk;
+        unsigned int nF = std::min(h.framesPerChunk, h.nFrames - first);
+
+        // skinned frames of the chunk : positions kept until the bounding box is known, normals encoded at once
+        std::vector<float> positions(3 * nV * nF);
+        std::vector<int> quantized(5 * nV * nF);
+        QuantizationBox box;
+        for (unsigned int f = 0; f < nF; ++f)
+        {
+            animation((first + f) / (double)h.framesPerSecond, transfo);
+            kernel.skin(transfo);
+            QuantizationBox frameBox;
+            frameBox.fit(&kernel.positions[0], nV, 4);
+            if (f == 0)
+                box = frameBox;
+            else
+                box.extend(frameBox);
+            for (unsigned int v = 0; v < nV; ++v)
+            {
+                short o[2];
+                octahedralEncode16(&kernel.normals[4 * v], o);
+                for (unsigned int c = 0; c < 3; ++c)
+                    positions[3 * (nV * f + v) + c] = kernel.positions[4 * v + c];
+                quantized[5 * (nV * f + v) + 3] = o[0];
+                quantized[5 * (nV * f + v) + 4] = o[1];
+            }
+        }
+        for (unsigned int i = 0; i < nV * nF; ++i)
+            for (unsigned int c = 0; c < 3; ++c)
+                quantized[5 * i + c] = box.quantize(positions[3 * i + c], c);
+
+        // worst case : 10 bytes per vertex for the first frame, 5 varints of at most 3 bytes for the others
+        unsigned int headerSize = sizeof(QuantizationBox) + nF * sizeof(unsigned int);
+        out.resize(headerSize + 10 * nV + (nF - 1) * 15 * nV);
+        std::memcpy(&out[0], &box, sizeof(box));
+        unsigned int *frameOffsets = (unsigned int *)&out[sizeof(box)];
+        unsigned char *w = &out[headerSize];
+        for (unsigned int f = 0; f < nF; ++f)
+        {
+            int const *current = &quantized[5 * nV * f];
+            frameOffsets[f] = w - &out[0];
+            if (f == 0)
+            {
+                for (unsigned int v = 0; v < nV; ++v)
+                {
+                    unsigned short p[3] = {(unsigned short)current[5 * v], (unsigned short)current[5 * v + 1], (unsigned short)current[5 * v + 2]};
+                    short n[2] = {(short)current[5 * v + 3], (short)current[5 * v + 4]};
+                    std::memcpy(w, p, 6);
+                    std::memcpy(w + 6, n, 4);
+                    w += 10;
+                }
+            }
+            else
+            {
+                int const *previous = current - 5 * nV;
+                int const *beforePrevious = f > 1 ? previous - 5 * nV : previous; // no velocity before the second frame
+                for (unsigned int i = 0; i < 5 * nV; ++i)
+                    w = writeVarint(zigzagEncode(current[i] - 2 * previous[i] + beforePrevious[i]), w);
+            }
+        }
+        out.resize(w - &out[0]);
+    }
+};
+
+// Playback cursor on a PoseCacheFile : decode(frame) writes the positions (x y z 1) and normals (x y z 0)
+// of the frame. Playing forward only decodes one residual frame per call.
+class PoseCachePlayer
+{
+public:
+    PoseCachePlayer() : file(0), currentChunk(~0u), currentFrame(0) {}
+    explicit PoseCachePlayer(PoseCacheFile const &f) : file(0) { attach(f); }
+
+    void attach(PoseCacheFile const &f)
+    {
+        file = &f;
+        state.assign(5 * f.numberOfVertices(), 0);
+        velocity.assign(5 * f.numberOfVertices(), 0);
+        currentChunk = ~0u;
+        currentFrame = 0;
+    }
+
+    PoseCacheFile const *getFile() const { return file; }
+
+    // frame at time t (seconds), the clip being looped
+    unsigned int frameAt(double t) const
+    {
+        if (!file || !file->isOpen())
+            return 0;
+        long long frame = (long long)std::floor(t * file->framesPerSecond());
+        long long n = file->numberOfFrames();
+        return (unsigned int)(((frame % n) + n) % n);
+    }
+
+    bool decode(unsigned int frame, float *positions, float *normals)
+    {
+        if (!file || !file->isOpen() || frame >= file->numberOfFrames())
+            return false;
+        unsigned int nV = file->numberOfVertices();
+        unsigned int chunk = frame / file->framesPerChunk();
+        unsigned int local = frame - chunk * file->framesPerChunk();
+        unsigned char const *c = file->chunkData(chunk);
+
+        if (chunk != currentChunk || frame < currentFrame)
+        {
+            unsigned char const *r = c + file->frameOffset(chunk, 0);
+            for (unsigned int v = 0; v < nV; ++v, r += 10)
+            {
+                unsigned short p[3];
+                short n[2];
+                std::memcpy(p, r, 6);
+                std::memcpy(n, r + 6, 4);
+                for (unsigned int i = 0; i < 3; ++i)
+                    state[5 * v + i] = p[i];
+                state[5 * v + 3] = n[0];
+                state[5 * v + 4] = n[1];
+            }
+            std::fill(velocity.begin(), velocity.end(), 0);
+            if (chunk != currentChunk)
+                file->prefetch(chunk + 1 < file->numberOfChunks() ? chunk + 1 : 0);
+            currentChunk = chunk;
+            currentFrame = chunk * file->framesPerChunk();
+        }
+        for (unsigned int f = currentFrame - chunk * file->framesPerChunk() + 1; f <= local; ++f)
+        {
+            unsigned char const *r = c + file->frameOffset(chunk, f), *end = c + file->frameEnd(chunk, f);
+            int *s = &state[0], *d = &velocity[0];
+            for (unsigned int i = 0; i < 5 * nV; ++i)
+            {
+                unsigned int x;
+                r = readVarint(r, end, x);
+                if (!r) // corrupted frame : the state is partly decoded, the chunk will be decoded again
+                {
+                    currentChunk = ~0u;
+                    return false;
+                }
+                d[i] += zigzagDecode(x);
+                s[i] += d[i];
+            }
+        }
+        currentFrame = frame;
+
+        QuantizationBox box;
+        std::memcpy(&box, c, sizeof(box));
+        int const *s = &state[0];
+        parallelFor(nV, [&](unsigned int begin, unsigned int end)
+                    {
+                        for (unsigned int v = begin; v < end; ++v)
+                        {
+                            for (unsigned int i = 0; i < 3; ++i)
+                                positions[4 * v + i] = box.dequantize(s[5 * v + i], i);
+                            positions[4 * v + 3] = 1.f;
+                            octahedralDecode16(s[5 * v + 3], s[5 * v + 4], &normals[4 * v]);
+                            normals[4 * v + 3] = 0.f;
+                        } });
+        return true;
+    }
+
+private:
+    PoseCacheFile const *file;
+    std::vector<int> state;    // quantized x y z u v of the current frame
+    std::vector<int> velocity; // state(current frame) - state(previous frame)
+    unsigned int currentChunk, currentFrame;
+};
+
+#endif // POSECACHE_H
@@ -0,0 +1,451 @@
+#ifndef RIGFILE_H
+#define RIGFILE_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Mesh.h"
+#include "Skeleton.h"
+#include "SkinningWeights.h"
+#include "Hash.h"
+
+// -------------------------------------------
+// Rig container (.rig) : the skeleton with its structure already built (fathers, children,
+// ordered_bone_indices) and the sparse skinning weights of a mesh, so that loading rebuilds nothing.
+//
+// File layout (little endian, as written by the machine) :
+//   RigFileHeader                  (counts, key of the mesh, key of the source .skel + weight parameters,
+//                                   checksum of the header + section table)
+//   RigFileSection[RigSection_Count] (offset, size and FNV-1a checksum of each section)
+//   sections, 8-byte aligned :
+//     articulations : RigArticulationRecord per articulation
+//     articulation children : nArticulations + 1 offsets, then the bone indices (CSR)
+//     bones : RigBoneRecord per bone
+//     bone children : nBones + 1 offsets, then the bone indices (CSR)
+//     ordered bones : ordered_bone_indices
+//     weights : float, maxInfluences per vertex ; weight bones : unsigned short, idem
+// read maps the file (mmap), checks the checksums, every index, the structure (fathers and child
+// lists agree, fathers first in ordered_bone_indices) and the weights (one row per vertex of the mesh,
+// sorted and normalized) before touching the skeleton ;
+// loadOrImport falls back to the text .skel + bone heat weights when the .rig is missing, invalid or
+// older than the .skel (other content), and writes the .rig for the next run.
+// Errors are reported through a message, nothing exits.
+// -------------------------------------------
+
+enum RigSection
+{
+    RigSection_Articulations,
+    RigSection_ArticulationChildren,
+    RigSection_Bones,
+    RigSection_BoneChildren,
+    RigSection_OrderedBones,
+    RigSection_Weights,
+    RigSection_WeightBones,
+    RigSection_Count
+};
+
+struct RigFileSection
+{
+    unsigned long long offset, size;
+    hash64_t checksum;
+};
+
+struct RigFileHeader
+{
+    char magic[8]; // "TP2RIG\0\0"
+    unsigned int version;
+    unsigned int nArticulations, nBones;
+    unsigned int nVertices, maxInfluences, weightBones; // weights : 0 vertices if the rig has none
+    float pruneThreshold;
+    unsigned int nSections;
+    hash64_t meshHash;
+    hash64_t sourceKey; // content of the .skel imported, maxInfluences and pruneThreshold (0 : unknown)
+    hash64_t checksum;  // header (this field at 0) + section table
+};
+
+struct RigArticulationRecord
+{
+    float p[3];
+    int fatherBone;
+};
+
+struct RigBoneRecord
+{
+    unsigned int joints[2];
+    int fatherBone;
+};
+
+class RigFile
+{
+public:
+    static const unsigned int formatVersion = 2;
+
+    // key of a rig imported from skelFilename with these weight parameters (0 if the file cannot be read)
+    static hash64_t sourceKey(std::string const &skelFilename, unsigned int maxInfluences, float pruneThreshold)
+    {
+        std::ifstream in(skelFilename.c_str(), std::ios::binary);
+        if (!in)
+            return 0;
+        std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        hash64_t key = hashBytes(content.data(), content.size());
+        key = hashValue(maxInfluences, key);
+        return hashValue(pruneThreshold, key);
+    }
+
+    static bool write(std::string const &filename, Skeleton const &skeleton, SkinningWeights const &weights, hash64_t meshHash,
+                      hash64_t sourceKey = 0, std::string *error = NULL)
+    {
+        unsigned int nA = skeleton.articulations.size(), nB = skeleton.bones.size();
+        std::vector<std::vector<unsigned char>> sections(RigSection_Count);
+
+        std::vector<RigArticulationRecord> articulations(nA);
+        std::vector<unsigned int> articulationChildren(1, 0);
+        for (unsigned int a = 0; a < nA; ++a)
+        {
+            for (unsigned int c = 0; c < 3; ++c)
+                articulations[a].p[c] = skeleton.articulations[a].p[c];
+            articulations[a].fatherBone = skeleton.articulations[a].fatherBone;
+            articulationChildren.push_back(0);
+        }
+        for (unsigned int a = 0; a < nA; ++a)
+            articulationChildren[a + 1] = articulationChildren[a] + skeleton.articulations[a].childBones.size();
+        for (unsigned int a = 0; a < nA; ++a)
+            articulationChildren.insert(articulationChildren.end(), skeleton.articulations[a].childBones.begin(), skeleton.articulations[a].childBones.end());
+
+        std::vector<RigBoneRecord> bones(nB);
+        std::vector<unsigned int> boneChildren(nB + 1, 0);
+        for (unsigned int b = 0; b < nB; ++b)
+        {
+            bones[b].joints[0] = skeleton.bones[b].joints[0];
+            bones[b].joints[1] = skeleton.bones[b].joints[1];
+            bones[b].fatherBone = skeleton.bones[b].fatherBone;
+            boneChildren[b + 1] = boneChildren[b] + skeleton.bones[b].childBones.size();
+        }
+        for (unsigned int b = 0; b < nB; ++b)
+            boneChildren.insert(boneChildren.end(), skeleton.bones[b].childBones.begin(), skeleton.bones[b].childBones.end());
+
+        std::vector<BoneInfluence> const &influences = weights.data();
+        std::vector<float> w(influences.size());
+        std::vector<unsigned short> wb(influences.size());
+        for (unsigned int i = 0; i < influences.size(); ++i)
+        {
+            w[i] = influences[i].weight;
+            wb[i] = influences[i].bone;
+        }
+
+        setSection(sections[RigSection_Articulations], articulations);
+        setSection(sections[RigSection_ArticulationChildren], articulationChildren);
+        setSection(sections[RigSection_Bones], bones);
+        setSection(sections[RigSection_BoneChildren], boneChildren);
+        setSection(sections[RigSection_OrderedBones], skeleton.ordered_bone_indices);
+        setSection(sections[RigSection_Weights], w);
+        setSection(sections[RigSection_WeightBones], wb);
+
+        RigFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "TP2RIG\0\0", 8);
+        header.version = formatVersion;
+        header.nArticulations = nA;
+        header.nBones = nB;
+        header.nVertices = weights.empty() ? 0 : weights.numberOfVertices();
+        header.maxInfluences = weights.maxInfluences();
+        header.weightBones = weights.numberOfBones();
+        header.pruneThreshold = weights.getPruneThreshold();
+        header.nSections = RigSection_Count;
+        header.meshHash = meshHash;
+        header.sourceKey = sourceKey;
+
+        RigFileSection table[RigSection_Count];
+        unsigned long long offset = align8(sizeof(header) + sizeof(table));
+        for (unsigned int s = 0; s < RigSection_Count; ++s)
+        {
+            table[s].offset = offset;
+            table[s].size = sections[s].size();
+            table[s].checksum = sections[s].empty() ? hashBytes(NULL, 0) : hashBytes(&sections[s][0], sections[s].size());
+            offset = align8(offset + sections[s].size());
+        }
+        header.checksum = headerChecksum(header, table);
+
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        out.write((char const *)&header, sizeof(header));
+        out.write((char const *)table, sizeof(table));
+        unsigned long long position = sizeof(header) + sizeof(table);
+        char const padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        for (unsigned int s = 0; s < RigSection_Count; ++s)
+        {
+            out.write(padding, table[s].offset - position);
+            if (!sections[s].empty())
+                out.write((char const *)&sections[s][0], sections[s].size());
+            position = table[s].offset + table[s].size;
+        }
+        if (!out)
+            return rigError(error, "could not write " + filename);
+        return true;
+    }
+
+    // mesh : the mesh the weights belong to (NULL : not checked), sourceKey : see sourceKey() (0 : not checked)
+    static bool read(std::string const &filename, Skeleton &skeleton, SkinningWeights &weights, Mesh const *mesh = NULL,
+                     hash64_t sourceKey = 0, std::string *error = NULL)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return rigError(error, "cannot open " + filename);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (unsigned long long)st.st_size < sizeof(RigFileHeader) + RigSection_Count * sizeof(RigFileSection))
+        {
+            ::close(fd);
+            return rigError(error, filename + ": truncated file");
+        }
+        void *mapped = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps the file
+        if (mapped == MAP_FAILED)
+            return rigError(error, filename + ": mmap failed");
+        std::string message;
+        bool ok = parse(static_cast<unsigned char const *>(mapped), st.st_size, skeleton, weights, mesh ? mesh->computeHash() : 0,
+                        mesh ? (unsigned int)mesh->V.size() : 0, sourceKey, message);
+        munmap(mapped, st.st_size);
+        if (!ok)
+            return rigError(error, filename + ": " + message);
+        return true;
+    }
+
+    // rig file if valid for this mesh, else text skeleton + bone heat weights (the rig file is then written)
+    static bool loadOrImport(std::string const &rigFilename, std::string const &skelFilename, Mesh &mesh, Skeleton &skeleton,
+                             unsigned int maxInfluences = 4, float pruneThreshold = 1e-3f, std::string *error = NULL)
+    {
+        std::string message;
+        hash64_t key = sourceKey(skelFilename, maxInfluences, pruneThreshold);
+        if (read(rigFilename, skeleton, mesh.skinningWeights, &mesh, key, &message))
+        {
+            if (mesh.skinningWeights.maxInfluences() == maxInfluences && mesh.skinningWeights.getPruneThreshold() == pruneThreshold)
+            {
+                std::cout << "Rig: read from " << rigFilename << std::endl;
+                return true;
+            }
+            message = rigFilename + ": other weight parameters";
+        }
+        std::cout << "Rig: " << message << ", importing " << skelFilename << std::endl;
+        if (!skeleton.load(skelFilename, &message))
+            return rigError(error, message);
+        mesh.compute_heat_skinning_weights(skeleton, maxInfluences, pruneThreshold);
+        if (!write(rigFilename, skeleton, mesh.skinningWeights, mesh.computeHash(), key, &message))
+            std::cerr << "Rig: " << message << std::endl; // the rig is usable all the same
+        return true;
+    }
+
+private:
+    static unsigned long long align8(unsigned long long x) { return (x + 7) & ~7ull; }
+
+    static bool rigError(std::string *error, std::string const &message)
+    {
+        if (error)
+            *error = message;
+        return false;
+    }
+
+    template <class T>
+    static void setSection(std::vector<unsigned char> &section, std::vector<T> const &values)
+    {
+        section.resize(values.size() * sizeof(T));
+        if (!values.empty())
+            std::memcpy(&section[0], &values[0], section.size());
+    }
+
+    template <class T>
+    static bool getSection(unsigned char const *data, RigFileSection const &section, unsigned long long count, std::vector<T> &values)
+    {
+        if (section.size != count * sizeof(T))
+            return false;
+        values.resize(count);
+        if (count > 0)
+            std::memcpy(&values[0], data + section.offset, section.size);
+        return true;
+    }
+
+    static hash64_t headerChecksum(RigFileHeader header, RigFileSection const *table)
+    {
+        header.checksum = 0;
+        return hashBytes(table, RigSection_Count * sizeof(RigFileSection), hashBytes(&header, sizeof(header)));
+    }
+
+    // CSR lists : n + 1 increasing offsets, then offsets[n] indices < bound
+    static bool checkLists(std::vector<unsigned int> const &lists, unsigned int n, unsigned int bound)
+    {
+        if (lists.size() < n + 1 || lists[0] != 0 || lists[n] != lists.size() - (n + 1))
+            return false;
+        for (unsigned int i = 0; i < n; ++i)
+            if (lists[i + 1] < lists[i])
+                return false;
+        for (unsigned int i = n + 1; i < lists.size(); ++i)
+            if (lists[i] >= bound)
+                return false;
+        return true;
+    }
+
+    // the structure buildStructure gives, that forward kinematics relies on : the father articulation of a bone
+    // lists it once, its end articulation has it as father, its father bone is the one of its father articulation
+    // and lists it once, and comes before it in ordered (a permutation of the bones)
+    static bool checkStructure(std::vector<RigArticulationRecord> const &articulations, std::vector<unsigned int> const &articulationChildren,
+                               std::vector<RigBoneRecord> const &bones, std::vector<unsigned int> const &boneChildren, std::vector<unsigned int> const &ordered)
+    {
+        unsigned int nA = articulations.size(), nB = bones.size();
+        std::vector<unsigned int> rank(nB);
+        for (unsigned int i = 0; i < nB; ++i)
+            rank[ordered[i]] = i;
+        for (unsigned int b = 0; b < nB; ++b)
+        {
+            int father = articulations[bones[b].joints[0]].fatherBone;
+            if (articulations[bones[b].joints[1]].fatherBone != (int)b || bones[b].fatherBone != father || (father >= 0 && rank[father] >= rank[b]))
+                return false;
+        }
+        for (unsigned int a = 0; a < nA; ++a)
+            if (articulations[a].fatherBone >= 0 && bones[articulations[a].fatherBone].joints[1] != a)
+                return false;
+        std::vector<unsigned char> inArticulationList(nB, 0), inBoneList(nB, 0);
+        for (unsigned int a = 0; a < nA; ++a)
+            for (unsigned int i = articulationChildren[a]; i < articulationChildren[a + 1]; ++i)
+            {
+                unsigned int c = articulationChildren[nA + 1 + i];
+                if (bones[c].joints[0] != a || inArticulationList[c])
+                    return false;
+                inArticulationList[c] = 1;
+            }
+        for (unsigned int b = 0; b < nB; ++b)
+            for (unsigned int i = boneChildren[b]; i < boneChildren[b + 1]; ++i)
+            {
+                unsigned int c = boneChildren[nB + 1 + i];
+                if (bones[c].fatherBone != (int)b || inBoneList[c])
+                    return false;
+                inBoneList[c] = 1;
+            }
+        for (unsigned int b = 0; b < nB; ++b)
+            if (!inArticulationList[b] || inBoneList[b] != (bones[b].fatherBone >= 0))
+                return false;
+        return true;
+    }
+
+    // each vertex : influences sorted by decreasing weight, so the first one is > 0 and no weight follows a 0
+    // (the skinning stops at the first 0), normalized
+    static bool checkInfluences(float const *w, unsigned int k)
+    {
+        if (!(w[0] > 0.f))
+            return false;
+        double sum = 0.0;
+        for (unsigned int i = 0; i < k; ++i)
+        {
+            if (i > 0 && w[i - 1] == 0.f && w[i] != 0.f)
+                return false;
+            sum += w[i];
+        }
+        return std::fabs(sum - 1.0) <= 1e-3;
+    }
+
+    // meshVertices : number of vertices of the mesh (0 : not checked)
+    static bool parse(unsigned char const *data, unsigned long long size, Skeleton &skeleton, SkinningWeights &weights, hash64_t meshHash,
+                      unsigned int meshVertices, hash64_t sourceKey, std::string &message)
+    {
+        RigFileHeader header;
+        RigFileSection table[RigSection_Count];
+        std::memcpy(&header, data, sizeof(header));
+        std::memcpy(table, data + sizeof(header), sizeof(table));
+        if (std::memcmp(header.magic, "TP2RIG\0\0", 8) != 0)
+            return rigError(&message, "not a rig file");
+        if (header.version != formatVersion || header.nSections != RigSection_Count)
+            return rigError(&message, "unsupported version");
+        if (header.checksum != headerChecksum(header, table))
+            return rigError(&message, "corrupted header");
+        if (meshHash != 0 && header.meshHash != meshHash)
+            return rigError(&message, "weights computed for another mesh");
+        if (meshVertices != 0 && header.nVertices != meshVertices)
+            return rigError(&message, "weights of " + std::to_string(header.nVertices) + " vertices, the mesh has " + std::to_string(meshVertices));
+        if (sourceKey != 0 && header.sourceKey != sourceKey)
+            return rigError(&message, "imported from another skeleton or with other weight parameters");
+        for (unsigned int s = 0; s < RigSection_Count; ++s)
+        {
+            if (table[s].offset > size || table[s].size > size - table[s].offset)
+                return rigError(&message, "section " + std::to_string(s) + " out of the file");
+            if (hashBytes(data + table[s].offset, table[s].size) != table[s].checksum)
+                return rigError(&message, "corrupted section " + std::to_string(s));
+        }
+
+        unsigned int nA = header.nArticulations, nB = header.nBones;
+        unsigned long long nInfluences = (unsigned long long)header.nVertices * header.maxInfluences;
+        std::vector<RigArticulationRecord> articulations;
+        std::vector<RigBoneRecord> bones;
+        std::vector<unsigned int> articulationChildren, boneChildren, ordered;
+        std::vector<float> w;
+        std::vector<unsigned short> wb;
+        if (!getSection(data, table[RigSection_Articulations], nA, articulations) || !getSection(data, table[RigSection_Bones], nB, bones) ||
+            !getSection(data, table[RigSection_ArticulationChildren], table[RigSection_ArticulationChildren].size / sizeof(unsigned int), articulationChildren) ||
+            !getSection(data, table[RigSection_BoneChildren], table[RigSection_BoneChildren].size / sizeof(unsigned int), boneChildren) ||
+            !getSection(data, table[RigSection_OrderedBones], nB, ordered) ||
+            !getSection(data, table[RigSection_Weights], nInfluences, w) || !getSection(data, table[RigSection_WeightBones], nInfluences, wb))
+            return rigError(&message, "section sizes do not match the counts");
+
+        // every index is checked : the skeleton code does not
+        if (!checkLists(articulationChildren, nA, nB) || !checkLists(boneChildren, nB, nB))
+            return rigError(&message, "invalid child lists");
+        std::vector<unsigned char> seen(nB, 0);
+        for (unsigned int i = 0; i < nB; ++i)
+        {
+            if (ordered[i] >= nB || seen[ordered[i]])
+                return rigError(&message, "ordered_bone_indices is not a permutation of the bones");
+            seen[ordered[i]] = 1;
+            RigBoneRecord const &b = bones[i];
+            if (b.joints[0] >= nA || b.joints[1] >= nA || b.fatherBone >= (int)nB || b.fatherBone < -1)
+                return rigError(&message, "bone " + std::to_string(i) + " has invalid indices");
+        }
+        for (unsigned int a = 0; a < nA; ++a)
+            if (articulations[a].fatherBone >= (int)nB || articulations[a].fatherBone < -1)
+                return rigError(&message, "articulation " + std::to_string(a) + " has an invalid father bone");
+        if (!checkStructure(articulations, articulationChildren, bones, boneChildren, ordered))
+            return rigError(&message, "fathers, child lists and ordered_bone_indices do not match");
+        if (header.nVertices > 0 && (header.maxInfluences == 0 || header.weightBones != nB))
+            return rigError(&message, "invalid weight parameters");
+        for (unsigned long long i = 0; i < nInfluences; ++i)
+            if (wb[i] >= header.weightBones || !(w[i] >= 0.f && w[i] <= 1.f))
+                return rigError(&message, "invalid influence of vertex " + std::to_string(i / header.maxInfluences));
+        for (unsigned int v = 0; v < header.nVertices; ++v)
+            if (!checkInfluences(&w[(size_t)v * header.maxInfluences], header.maxInfluences))
+                return rigError(&message, "weights of vertex " + std::to_string(v) + " are not sorted and normalized");
+
+        // valid : fill the skeleton and the weights, as stored
+        Skeleton loaded;
+        loaded.articulations.resize(nA);
+        for (unsigned int a = 0; a < nA; ++a)
+        {
+            Articulation &art = loaded.articulations[a];
+            art.p = Vec3(articulations[a].p[0], articulations[a].p[1], articulations[a].p[2]);
+            art.fatherBone = articulations[a].fatherBone;
+            art.childBones.assign(articulationChildren.begin() + nA + 1 + articulationChildren[a], articulationChildren.begin() + nA + 1 + articulationChildren[a + 1]);
+        }
+        loaded.bones.resize(nB);
+        for (unsigned int b = 0; b < nB; ++b)
+        {
+            Bone &bone = loaded.bones[b];
+            bone.joints[0] = bones[b].joints[0];
+            bone.joints[1] = bones[b].joints[1];
+            bone.fatherBone = bones[b].fatherBone;
+            bone.childBones.assign(boneChildren.begin() + nB + 1 + boneChildren[b], boneChildren.begin() + nB + 1 + boneChildren[b + 1]);
+        }
+        loaded.ordered_bone_indices.swap(ordered);
+        skeleton.articulations.swap(loaded.articulations);
+        skeleton.bones.swap(loaded.bones);
+        skeleton.ordered_bone_indices.swap(loaded.ordered_bone_indices);
+        if (header.nVertices > 0)
+            weights.assign(header.nVertices, header.weightBones, header.maxInfluences, header.pruneThreshold, &w[0], &wb[0]);
+        else
+            weights.resize(0, header.weightBones);
+        return true;
+    }
+};
+
+#endif // RIGFILE_H
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <queue>
+#include <algorithm>
 #include <map>
 #include <cassert>
 #include <string>
@@ -83,10 +84,36 @@ struct SkeletonTransformation
     std::vector<BoneTransformation> bone_transformations;
     std::vector<Vec3> articulations_transformed_position;
 
+    // incremental forward kinematics :
+    // bone_is_dirty[b] : localRotation of b changed since the last computeGlobalTransformationParameters
+    // bone_has_moved[b] : world transformation of b changed since the skinning last consumed it
+    std::vector<unsigned char> bone_is_dirty;
+    std::vector<unsigned char> bone_has_moved;
+
     void resize(unsigned int n_bones, unsigned int n_articulations)
     {
         bone_transformations.resize(n_bones);
         articulations_transformed_position.resize(n_articulations);
+        markAllDirty();
+    }
+
+    void setLocalRotation(unsigned int b, Mat3 const &R)
+    {
+        bone_transformations[b].localRotation = R;
+        markDirty(b);
+    }
+
+    void markDirty(unsigned int b)
+    {
+        if (bone_is_dirty.size() != bone_transformations.size())
+            markAllDirty();
+        bone_is_dirty[b] = 1;
+    }
+
+    void markAllDirty()
+    {
+        bone_is_dirty.assign(bone_transformations.size(), 1);
+        bone_has_moved.assign(bone_transformations.size(), 1);
     }
 };
 
@@ -97,15 +124,29 @@ struct Skeleton
     std::vector<Bone> bones;
     std::vector<unsigned int> ordered_bone_indices; // process them by order in the hierarchy
 
-    void buildStructure()
+    // fathers, children and ordered_bone_indices from the bones (joints[0] : father articulation, joints[1] : child one).
+    // false (and *error set) if an articulation ends two bones, or if some bones are not reachable from a root (cycle)
+    bool buildStructure(std::string *error = NULL)
     {
         ordered_bone_indices.clear();
         std::vector<unsigned int> rootBones; // why not have several
+        for (unsigned int aIdx = 0; aIdx < articulations.size(); ++aIdx)
+        {
+            articulations[aIdx].fatherBone = -1;
+            articulations[aIdx].childBones.clear();
+        }
+        for (unsigned int b = 0; b < bones.size(); ++b)
+        {
+            bones[b].fatherBone = -1;
+            bones[b].childBones.clear();
+        }
 
         for (unsigned int b = 0; b < bones.size(); ++b)
         {
             Articulation &a0 = articulations[bones[b].joints[0]];
             Articulation &a1 = articulations[bones[b].joints[1]];
+            if (a1.fatherBone >= 0)
+                return structureError(error, "articulation " + std::to_string(bones[b].joints[1]) + " ends bones " + std::to_string(a1.fatherBone) + " and " + std::to_string(b));
             a0.childBones.push_back(b);
             a1.setFatherBone(b);
         }
@@ -154,42 +195,71 @@ struct Skeleton
             }
         }
 
-        assert(ordered_bone_indices.size() == bones.size());
+        if (ordered_bone_indices.size() != bones.size())
+            return structureError(error, std::to_string(bones.size() - ordered_bone_indices.size()) + " bones are not reachable from a root bone (cycle)");
+        return true;
     }
 
-    void load(const std::string &filename)
+    // text import (.skel) : "ARTICULATIONS n" then n positions, "BONES m" then m pairs of articulation indices.
+    // On failure the skeleton is left unchanged and *error describes the problem.
+    bool load(const std::string &filename, std::string *error = NULL)
     {
         std::ifstream in(filename.c_str());
         if (!in)
-            exit(EXIT_FAILURE);
+            return structureError(error, "cannot open " + filename);
+        Skeleton loaded;
         std::string tmpString;
         unsigned int sizeA;
-        in >> tmpString >> sizeA;
-        articulations.resize(sizeA);
+        if (!(in >> tmpString >> sizeA) || tmpString != "ARTICULATIONS")
+            return structureError(error, filename + ": expected ARTICULATIONS <count>");
+        loaded.articulations.resize(sizeA);
         for (unsigned int i = 0; i < sizeA; i++)
-            in >> articulations[i].p[0] >> articulations[i].p[1] >> articulations[i].p[2];
+            if (!(in >> loaded.articulations[i].p[0] >> loaded.articulations[i].p[1] >> loaded.articulations[i].p[2]))
+                return structureError(error, filename + ": could not read the position of articulation " + std::to_string(i));
 
         unsigned int sizeB;
-        in >> tmpString >> sizeB;
-        bones.resize(sizeB);
+        if (!(in >> tmpString >> sizeB) || tmpString != "BONES")
+            return structureError(error, filename + ": expected BONES <count>");
+        loaded.bones.resize(sizeB);
         for (unsigned int i = 0; i < sizeB; i++)
         {
             for (unsigned int j = 0; j < 2; j++)
-                in >> bones[i].joints[j];
+                if (!(in >> loaded.bones[i].joints[j]))
+                    return structureError(error, filename + ": could not read the articulations of bone " + std::to_string(i));
+            if (loaded.bones[i].joints[0] >= sizeA || loaded.bones[i].joints[1] >= sizeA || loaded.bones[i].joints[0] == loaded.bones[i].joints[1])
+                return structureError(error, filename + ": bone " + std::to_string(i) + " has invalid articulations");
         }
         in.close();
 
-        buildStructure();
+        std::string structure;
+        if (!loaded.buildStructure(&structure))
+            return structureError(error, filename + ": " + structure);
+        articulations.swap(loaded.articulations);
+        bones.swap(loaded.bones);
+        ordered_bone_indices.swap(loaded.ordered_bone_indices);
+        return true;
     }
 
-    void computeGlobalTransformationParameters(SkeletonTransformation &transfo)
+    // only the dirty bones (see SkeletonTransformation::setLocalRotation) and their descendants are recomputed
+    void computeGlobalTransformationParameters(SkeletonTransformation &transfo) const
     {
         std::vector<Vec3> &articulations_transformed_position = transfo.articulations_transformed_position;
-        articulations_transformed_position.resize(articulations.size());
+        if (articulations_transformed_position.size() != articulations.size() || transfo.bone_is_dirty.size() != bones.size() || transfo.bone_has_moved.size() != bones.size())
+        {
+            articulations_transformed_position.resize(articulations.size());
+            transfo.markAllDirty();
+        }
+        std::vector<unsigned char> &updated = transfo.bone_is_dirty; // becomes "recomputed in this pass"
         for (unsigned int bIt = 0; bIt < ordered_bone_indices.size(); ++bIt)
         {
             unsigned bIdx = ordered_bone_indices[bIt];
-            Bone &b = bones[bIdx];
+            Bone const &b = bones[bIdx];
+
+            // fathers come first in ordered_bone_indices : their flag is already final
+            if (!updated[bIdx] && (b.isRoot() || !updated[b.fatherBone]))
+                continue;
+            updated[bIdx] = 1;
+            transfo.bone_has_moved[bIdx] = 1;
 
             if (b.isRoot())
             {
@@ -225,25 +295,24 @@ struct Skeleton
                 articulations_transformed_position[b.joints[1]] = a1TargetPos;
             }
         }
+        std::fill(updated.begin(), updated.end(), 0);
     }
 
-    void computeProceduralAnim(double t, SkeletonTransformation &transfo)
+    void computeProceduralAnim(double t, SkeletonTransformation &transfo) const
     {
         transfo.bone_transformations.resize(bones.size());
         for (unsigned int bIt = 0; bIt < ordered_bone_indices.size(); ++bIt)
         {
             unsigned bIdx = ordered_bone_indices[bIt];
-            Bone &b = bones[bIdx];
+            Bone const &b = bones[bIdx];
             if (b.isRoot())
             {
-                BoneTransformation &bone_transformation = transfo.bone_transformations[bIdx];
-                bone_transformation.localRotation = Mat3::Identity();
+                transfo.setLocalRotation(bIdx, Mat3::Identity());
             }
             else
             {
-                BoneTransformation &bone_transformation = transfo.bone_transformations[bIdx];
                 Vec3 axis(cos(2 * M_PI * bIt / (double)(bones.size())), sin(2 * M_PI * bIt / (double)(bones.size())), 0.0);
-                bone_transformation.localRotation = Mat3::getRotationMatrixFromAxisAndAngle(axis, (0.25 * M_PI) * cos(t));
+                transfo.setLocalRotation(bIdx, Mat3::getRotationMatrixFromAxisAndAngle(axis, (0.25 * M_PI) * cos(t)));
             }
         }
 
@@ -251,44 +320,17 @@ struct Skeleton
         computeGlobalTransformationParameters(transfo);
     }
 
-    void updateIKChain(SkeletonTransformation &transfoIK, unsigned int targetArticulation, Vec3 targetPosition, unsigned int maxIterNumber = 20, double epsilonPrecision = 0.000001)
-    {
-
-        if (!(articulations[targetArticulation].isRoot()))
-        {
-
-            // E = targetArticulatation
-
-            Vec3 targetArticPos = transfoIK.articulations_transformed_position[targetArticulation]; // position de E
-            int targetId = bones[articulations[targetArticulation].fatherBone].joints[0];
-
-            for (unsigned int i = 0; i < maxIterNumber; i++)
-            {
-                while ((targetPosition - targetArticPos).length() > epsilonPrecision && targetId > 0)
-                {
-
-                    Vec3 positionR = transfoIK.articulations_transformed_position[targetId];
-
-                    Vec3 differencePosition = targetPosition - positionR; // D - Position R
-                    Vec3 relativePosition = targetArticPos - positionR;   // Position E - Position R
-                    Mat3 rotationMatrix = Mat3::getRotationMatrixAligning(relativePosition, differencePosition);
-
-                    transfoIK.bone_transformations[articulations[targetId].childBones[0]].localRotation = rotationMatrix * transfoIK.bone_transformations[articulations[targetId].childBones[0]].localRotation;
-
-                    computeGlobalTransformationParameters(transfoIK);
-
-                    if (articulations[targetId].fatherBone >= 0)
-                    {
-                        targetArticPos = transfoIK.articulations_transformed_position[targetArticulation];
-                        targetId = bones[articulations[targetId].fatherBone].joints[0];
-                    }
-                }
-            }
-        }
-    }
+    // inverse kinematics : see IKSolver.h (CCD, FABRIK, damped least squares)
 
     //----------------------------------------------//
     //----------------------------------------------//
+    static bool structureError(std::string *error, std::string const &message)
+    {
+        if (error)
+            *error = message;
+        return false;
+    }
+
     //----------------------------------------------//
     // draw functions :
     //----------------------------------------------//
@@ -0,0 +1,548 @@
+#ifndef SKINNINGKERNEL_H
+#define SKINNINGKERNEL_H
+
+#include <vector>
+#include <cmath>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "Skeleton.h"
+#include "SkinningWeights.h"
+#include "ParallelFor.h"
+#include "CompressedSkinnedVertices.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SKINNINGKERNEL_USE_SSE
+#endif
+
+// -------------------------------------------
+// Skinning kernel (linear blend / dual quaternion)
+// -------------------------------------------
+// Skinning is separated from drawing :
+//  - setRestPose copies the rest positions / normals once, as float (x,y,z,1) / (x,y,z,0),
+//  - buildPalette converts the bone transformations once per frame into a palette of 3x4 float
+//    matrices, stored by columns (R.col0 , R.col1 , R.col2 , t), 4 floats each,
+//  - skin blends, for each vertex, the palette matrices of its influences (4 floats at a time with SSE),
+//    then applies the blended matrix to the position and the normal.
+// The output buffers are persistent (4 floats per vertex, usable directly with glVertexPointer),
+// so that a frame allocates nothing.
+//
+// Dual quaternion skinning (no candy-wrapper effect on twisting joints) uses the same influences and
+// the same parallel loop : the palette then holds one unit dual quaternion per bone (8 floats :
+// real part x y z w , dual part x y z w), converted once per frame. The quaternions of a vertex are
+// blended in the hemisphere of its first (largest) influence (antipodality), then normalized.
+//
+// skinUpdated only re-skins the vertices influenced by the bones whose world transformation changed
+// since the last call (SkeletonTransformation::bone_has_moved, set by the incremental forward kinematics),
+// through per-bone lists of influenced vertices.
+//
+// The rest pose and the influences are read either from the float buffers (rest pose as float4,
+// SkinningWeights), or from a CompressedSkinnedVertices stream (quantized positions, octahedral normals,
+// 8-bit weights, 8/16-bit bone indices), decoded in the skinning loop itself.
+
+enum SkinningMethod
+{
+    SkinningMethod_LBS,
+    SkinningMethod_DQS
+};
+
+enum SkinningVertexFormat
+{
+    SkinningVertexFormat_Float,
+    SkinningVertexFormat_Compressed
+};
+
+class SkinningKernel
+{
+public:
+    std::vector<float> positions; // skinned positions, x y z 1 per vertex
+    std::vector<float> normals;   // skinned normals, x y z 0 per vertex
+
+    SkinningKernel() : weights(0), k(0), method(SkinningMethod_LBS), format(SkinningVertexFormat_Float), lastTransfo(0), upToDate(false), stamp(0) {}
+
+    SkinningMethod getMethod() const { return method; }
+    void setMethod(SkinningMethod m)
+    {
+        method = m;
+        invalidate();
+    }
+    // the next skinUpdated will re-skin every vertex
+    void invalidate() { upToDate = false; }
+    static const char *methodName(SkinningMethod m) { return m == SkinningMethod_LBS ? "linear blend" : "dual quaternion"; }
+
+    SkinningVertexFormat getVertexFormat() const { return format; }
+    void setVertexFormat(SkinningVertexFormat f)
+    {
+        format = f;
+        if (format == SkinningVertexFormat_Compressed && compressed.empty() && weights)
+            compressed.build(&restPositions[0], &restNormals[0], *weights);
+        invalidate();
+    }
+    static const char *vertexFormatName(SkinningVertexFormat f) { return f == SkinningVertexFormat_Float ? "float" : "compressed"; }
+    CompressedSkinnedVertices const &getCompressedVertices() const { return compressed; }
+
+    unsigned int numberOfVertices() const { return restPositions.size() / 4; }
+    std::vector<float> const &getRestPositions() const { return restPositions; }
+    unsigned int numberOfBones() const { return palette.size() / (method == SkinningMethod_DQS ? 8 : 16); }
+
+    void setRestPose(Mesh const &mesh)
+    {
+        unsigned int n = mesh.V.size();
+        restPositions.resize(4 * n);
+        restNormals.resize(4 * n);
+        for (unsigned int v = 0; v < n; ++v)
+        {
+            for (unsigned int c = 0; c < 3; ++c)
+            {
+                restPositions[4 * v + c] = mesh.V[v].p[c];
+                restNormals[4 * v + c] = mesh.V[v].n[c];
+            }
+            restPositions[4 * v + 3] = 1.f;
+            restNormals[4 * v + 3] = 0.f;
+        }
+        positions = restPositions;
+        normals = restNormals;
+        weights = &mesh.skinningWeights;
+        k = weights->maxInfluences();
+
+        // bone -> influenced vertices lists (CSR)
+        unsigned int nBones = weights->numberOfBones();
+        boneVertexStart.assign(nBones + 1, 0);
+        for (unsigned int v = 0; v < n; ++v)
+        {
+            BoneInfluence const *inf = weights->vertexInfluences(v);
+            for (unsigned int i = 0; i < k && inf[i].weight != 0.f; ++i)
+                ++boneVertexStart[inf[i].bone + 1];
+        }
+        for (unsigned int b = 0; b < nBones; ++b)
+            boneVertexStart[b + 1] += boneVertexStart[b];
+        boneVertices.resize(boneVertexStart[nBones]);
+        std::vector<unsigned int> fill(boneVertexStart.begin(), boneVertexStart.end() - 1);
+        for (unsigned int v = 0; v < n; ++v)
+        {
+            BoneInfluence const *inf = weights->vertexInfluences(v);
+            for (unsigned int i = 0; i < k && inf[i].weight != 0.f; ++i)
+                boneVertices[fill[inf[i].bone]++] = v;
+        }
+        vertexStamp.assign(n, 0);
+        stamp = 0;
+        dirtyVertices.reserve(n);
+        compressed.clear();
+        if (format == SkinningVertexFormat_Compressed)
+            compressed.build(&restPositions[0], &restNormals[0], *weights);
+        invalidate();
+    }
+
+    void buildPalette(SkeletonTransformation const &transfo)
+    {
+        if (method == SkinningMethod_DQS)
+            buildDualQuaternionPalette(transfo);
+        else
+            buildMatrixPalette(transfo);
+    }
+
+    void skin()
+    {
+        skinVertices(numberOfVertices(), NULL);
+    }
+
+    void skin(SkeletonTransformation const &transfo)
+    {
+        buildPalette(transfo);
+        skin();
+    }
+
+    // re-skins the vertices influenced by the bones that moved since the last call ; returns their number
+    unsigned int skinUpdated(SkeletonTransformation &transfo)
+    {
+        unsigned int n = numberOfVertices();
+        std::vector<unsigned char> &moved = transfo.bone_has_moved;
+        if (!upToDate || lastTransfo != &transfo || moved.size() + 1 != boneVertexStart.size())
+        {
+            skin(transfo);
+            std::fill(moved.begin(), moved.end(), 0);
+            upToDate = true;
+            lastTransfo = &transfo;
+            return n;
+        }
+
+        ++stamp;
+        dirtyVertices.clear();
+        for (unsigned int b = 0; b < moved.size(); ++b)
+        {
+            if (!moved[b])
+                continue;
+            moved[b] = 0;
+            for (unsigned int i = boneVertexStart[b]; i < boneVertexStart[b + 1]; ++i)
+            {
+                unsigned int v = boneVertices[i];
+                if (vertexStamp[v] != stamp)
+                {
+                    vertexStamp[v] = stamp;
+                    dirtyVertices.push_back(v);
+                }
+            }
+        }
+        if (dirtyVertices.empty())
+            return 0;
+        buildPalette(transfo);
+        if (2 * dirtyVertices.size() > n)
+            skin(); // most of the mesh : a linear pass is cheaper than the indirection
+        else
+            skinVertices(dirtyVertices.size(), &dirtyVertices[0]);
+        return dirtyVertices.size();
+    }
+
+    // size of the rest pose + influences of a vertex, as read by the skinning loop
+    unsigned int bytesPerVertex() const
+    {
+        if (format == SkinningVertexFormat_Compressed)
+            return compressed.bytesPerVertex();
+        return 2 * 4 * sizeof(float) + k * sizeof(BoneInfluence);
+    }
+
+    // bytes read and written by one skin() call (for the benchmarks)
+    double bytesPerFrame() const
+    {
+        unsigned int n = numberOfVertices();
+        return (double)n * (2 * 4 * sizeof(float) + bytesPerVertex()) + palette.size() * sizeof(float);
+    }
+
+    // unit quaternion (x y z w) of a rotation matrix
+    static void rotationToQuaternion(Mat3 const &R, float q[4])
+    {
+        float trace = R(0, 0) + R(1, 1) + R(2, 2);
+        if (trace > 0.f)
+        {
+            float s = 2.f * std::sqrt(trace + 1.f);
+            q[3] = 0.25f * s;
+            q[0] = (R(2, 1) - R(1, 2)) / s;
+            q[1] = (R(0, 2) - R(2, 0)) / s;
+            q[2] = (R(1, 0) - R(0, 1)) / s;
+        }
+        else if (R(0, 0) > R(1, 1) && R(0, 0) > R(2, 2))
+        {
+            float s = 2.f * std::sqrt(std::max(0.f, 1.f + R(0, 0) - R(1, 1) - R(2, 2)));
+            q[3] = (R(2, 1) - R(1, 2)) / s;
+            q[0] = 0.25f * s;
+            q[1] = (R(0, 1) + R(1, 0)) / s;
+            q[2] = (R(0, 2) + R(2, 0)) / s;
+        }
+        else if (R(1, 1) > R(2, 2))
+        {
+            float s = 2.f * std::sqrt(std::max(0.f, 1.f + R(1, 1) - R(0, 0) - R(2, 2)));
+            q[3] = (R(0, 2) - R(2, 0)) / s;
+            q[0] = (R(0, 1) + R(1, 0)) / s;
+            q[1] = 0.25f * s;
+            q[2] = (R(1, 2) + R(2, 1)) / s;
+        }
+        else
+        {
+            float s = 2.f * std::sqrt(std::max(0.f, 1.f + R(2, 2) - R(0, 0) - R(1, 1)));
+            q[3] = (R(1, 0) - R(0, 1)) / s;
+            q[0] = (R(0, 2) + R(2, 0)) / s;
+            q[1] = (R(1, 2) + R(2, 1)) / s;
+            q[2] = 0.25f * s;
+        }
+        float L = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for (unsigned int c = 0; c < 4; ++c)
+            q[c] /= L;
+    }
+
+private:
+    std::vector<float> restPositions, restNormals;
+    std::vector<float> palette; // LBS : 16 floats per bone ; DQS : 8 floats per bone
+    SkinningWeights const *weights;
+    unsigned int k;
+    SkinningMethod method;
+    SkinningVertexFormat format;
+    CompressedSkinnedVertices compressed; // built when the compressed format is selected
+
+    // incremental skinning
+    std::vector<unsigned int> boneVertexStart, boneVertices; // vertices influenced by each bone
+    std::vector<unsigned int> vertexStamp;                   // stamp of the last skinUpdated that collected the vertex
+    std::vector<unsigned int> dirtyVertices;
+    SkeletonTransformation const *lastTransfo;
+    bool upToDate;
+    unsigned int stamp;
+
+    // skins the vertices vertexList[0..count), or [0,count) if vertexList is NULL
+    void skinVertices(unsigned int count, unsigned int const *vertexList)
+    {
+        if (format == SkinningVertexFormat_Compressed)
+        {
+            CompressedVertexSource source = {&compressed, method == SkinningMethod_DQS};
+            skinVertices(count, vertexList, source);
+        }
+        else
+        {
+            FloatVertexSource source = {&restPositions[0], &restNormals[0], &weights->data()[0], k};
+            skinVertices(count, vertexList, source);
+        }
+    }
+
+    template <class source_t>
+    void skinVertices(unsigned int count, unsigned int const *vertexList, source_t const &source)
+    {
+        if (method == SkinningMethod_DQS)
+            parallelFor(count, [this, vertexList, &source](unsigned int b, unsigned int e)
+                        { skinRangeDQS(b, e, vertexList, source); }, 2048);
+        else
+            parallelFor(count, [this, vertexList, &source](unsigned int b, unsigned int e)
+                        { skinRange(b, e, vertexList, source); }, 2048);
+    }
+
+    void buildDualQuaternionPalette(SkeletonTransformation const &transfo)
+    {
+        unsigned int nBones = transfo.bone_transformations.size();
+        palette.resize(8 * nBones);
+        for (unsigned int b = 0; b < nBones; ++b)
+        {
+            BoneTransformation const &bt = transfo.bone_transformations[b];
+            float *q = &palette[8 * b];
+            rotationToQuaternion(bt.world_space_rotation, q);
+            // dual part : 0.5 * (t,0) * q
+            Vec3 const &t = bt.world_space_translation;
+            q[4] = 0.5f * (t[0] * q[3] + t[1] * q[2] - t[2] * q[1]);
+            q[5] = 0.5f * (-t[0] * q[2] + t[1] * q[3] + t[2] * q[0]);
+            q[6] = 0.5f * (t[0] * q[1] - t[1] * q[0] + t[2] * q[3]);
+            q[7] = -0.5f * (t[0] * q[0] + t[1] * q[1] + t[2] * q[2]);
+        }
+    }
+
+    void buildMatrixPalette(SkeletonTransformation const &transfo)
+    {
+        unsigned int nBones = transfo.bone_transformations.size();
+        palette.resize(16 * nBones);
+        for (unsigned int b = 0; b < nBones; ++b)
+        {
+            BoneTransformation const &bt = transfo.bone_transformations[b];
+            float *m = &palette[16 * b];
+            for (unsigned int col = 0; col < 3; ++col)
+            {
+                for (unsigned int row = 0; row < 3; ++row)
+                    m[4 * col + row] = bt.world_space_rotation(row, col);
+                m[4 * col + 3] = 0.f;
+            }
+            for (unsigned int row = 0; row < 3; ++row)
+                m[12 + row] = bt.world_space_translation[row];
+            m[15] = 1.f;
+        }
+    }
+
+    // vertex sources of the skinning loops : rest position (x y z 1), normal (x y z 0) and influences
+    // (sorted by decreasing weight) of a vertex ; fetch returns the number of influences
+    struct FloatVertexSource
+    {
+        float const *positions, *normals;
+        BoneInfluence const *influences;
+        unsigned int k;
+
+        inline unsigned int fetch(unsigned int v, float p[4], float n[4], unsigned int *bones, float *w) const
+        {
+            for (unsigned int c = 0; c < 4; ++c)
+            {
+                p[c] = positions[4 * v + c];
+                n[c] = normals[4 * v + c];
+            }
+            BoneInfluence const *inf = influences + v * k;
+            unsigned int count = 0;
+            for (; count < k && count < 16 && inf[count].weight != 0.f; ++count)
+            {
+                bones[count] = inf[count].bone;
+                w[count] = inf[count].weight;
+            }
+            return count;
+        }
+    };
+
+    struct CompressedVertexSource
+    {
+        CompressedSkinnedVertices const *stream;
+        bool unitNormal;
+
+        inline unsigned int fetch(unsigned int v, float p[4], float n[4], unsigned int *bones, float *w) const
+        {
+            return stream->decode(v, p, n, bones, w, unitNormal);
+        }
+    };
+
+    template <class source_t>
+    void skinRange(unsigned int begin, unsigned int end, unsigned int const *vertexList, source_t const &source)
+    {
+        float const *P = &palette[0];
+        float p[4], n[4], w[16];
+        unsigned int bones[16];
+        for (unsigned int it = begin; it < end; ++it)
+        {
+            unsigned int v = vertexList ? vertexList[it] : it;
+            unsigned int count = source.fetch(v, p, n, bones, w);
+            if (count == 0)
+            {
+                copyRest(v, p, n);
+                continue;
+            }
+#ifdef SKINNINGKERNEL_USE_SSE
+            __m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+            for (unsigned int i = 0; i < count; ++i)
+            {
+                float const *m = P + 16 * bones[i];
+                __m128 wi = _mm_set1_ps(w[i]);
+                c0 = _mm_add_ps(c0, _mm_mul_ps(wi, _mm_loadu_ps(m)));
+                c1 = _mm_add_ps(c1, _mm_mul_ps(wi, _mm_loadu_ps(m + 4)));
+                c2 = _mm_add_ps(c2, _mm_mul_ps(wi, _mm_loadu_ps(m + 8)));
+                c3 = _mm_add_ps(c3, _mm_mul_ps(wi, _mm_loadu_ps(m + 12)));
+            }
+            __m128 sp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+                                   _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3));
+            __m128 sn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])), _mm_mul_ps(c1, _mm_set1_ps(n[1]))),
+                                   _mm_mul_ps(c2, _mm_set1_ps(n[2])));
+            // normalize once, after blending (w component of sn is 0)
+            __m128 sq = _mm_mul_ps(sn, sn);
+            sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+            sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 0, 3, 2)));
+            sn = _mm_div_ps(sn, _mm_sqrt_ps(_mm_max_ps(sq, _mm_set1_ps(1e-30f))));
+            _mm_storeu_ps(&positions[4 * v], sp);
+            _mm_storeu_ps(&normals[4 * v], sn);
+#else
+            float c[16] = {0.f};
+            for (unsigned int i = 0; i < count; ++i)
+            {
+                float const *m = P + 16 * bones[i];
+                for (unsigned int j = 0; j < 16; ++j)
+                    c[j] += w[i] * m[j];
+            }
+            float *sp = &positions[4 * v];
+            float *sn = &normals[4 * v];
+            for (unsigned int row = 0; row < 3; ++row)
+            {
+                sp[row] = c[row] * p[0] + c[4 + row] * p[1] + c[8 + row] * p[2] + c[12 + row];
+                sn[row] = c[row] * n[0] + c[4 + row] * n[1] + c[8 + row] * n[2];
+            }
+            sp[3] = 1.f;
+            sn[3] = 0.f;
+            float L = std::sqrt(sn[0] * sn[0] + sn[1] * sn[1] + sn[2] * sn[2]);
+            if (L > 0.f)
+                for (unsigned int row = 0; row < 3; ++row)
+                    sn[row] /= L;
+#endif
+        }
+    }
+
+    template <class source_t>
+    void skinRangeDQS(unsigned int begin, unsigned int end, unsigned int const *vertexList, source_t const &source)
+    {
+        float const *P = &palette[0];
+        float p[4], n[4], w[16];
+        unsigned int bones[16];
+        for (unsigned int it = begin; it < end; ++it)
+        {
+            unsigned int v = vertexList ? vertexList[it] : it;
+            unsigned int count = source.fetch(v, p, n, bones, w);
+            if (count == 0)
+            {
+                copyRest(v, p, n);
+                continue;
+            }
+            float const *q0 = P + 8 * bones[0];
+#ifdef SKINNINGKERNEL_USE_SSE
+            __m128 real0 = _mm_loadu_ps(q0);
+            __m128 real = _mm_setzero_ps(), dual = _mm_setzero_ps();
+            for (unsigned int i = 0; i < count; ++i)
+            {
+                float const *q = P + 8 * bones[i];
+                __m128 r = _mm_loadu_ps(q);
+                __m128 d = _mm_mul_ps(r, real0);
+                d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+                d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+                // antipodality : the sign of the dot product is given to the weight
+                __m128 ww = _mm_xor_ps(_mm_set1_ps(w[i]), _mm_and_ps(d, _mm_set1_ps(-0.f)));
+                real = _mm_add_ps(real, _mm_mul_ps(ww, r));
+                dual = _mm_add_ps(dual, _mm_mul_ps(ww, _mm_loadu_ps(q + 4)));
+            }
+            // normalize by the norm of the real part
+            __m128 sq = _mm_mul_ps(real, real);
+            sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+            sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 0, 3, 2)));
+            __m128 invL = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(_mm_max_ps(sq, _mm_set1_ps(1e-30f))));
+            __m128 r = _mm_mul_ps(real, invL), d = _mm_mul_ps(dual, invL);
+            __m128 rw = _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3)), dw = _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 3, 3));
+            __m128 two = _mm_set1_ps(2.f);
+            // translation : 2 * ( rw * d.xyz - dw * r.xyz + r.xyz x d.xyz ) (w lane : 0)
+            __m128 t = _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rw, d), _mm_mul_ps(dw, r)), cross(r, d)));
+            // rotation : x + 2 r.xyz x ( r.xyz x x + rw x ) (keeps the w lane of x)
+            __m128 x = _mm_loadu_ps(p);
+            __m128 y = _mm_loadu_ps(n);
+            __m128 sp = _mm_add_ps(_mm_add_ps(x, _mm_mul_ps(two, cross(r, _mm_add_ps(cross(r, x), _mm_mul_ps(rw, x))))), t);
+            __m128 sn = _mm_add_ps(y, _mm_mul_ps(two, cross(r, _mm_add_ps(cross(r, y), _mm_mul_ps(rw, y)))));
+            _mm_storeu_ps(&positions[4 * v], sp);
+            _mm_storeu_ps(&normals[4 * v], sn);
+#else
+            float b[8];
+            for (unsigned int c = 0; c < 8; ++c)
+                b[c] = 0.f;
+            for (unsigned int i = 0; i < count; ++i)
+            {
+                float const *q = P + 8 * bones[i];
+                float dot = q[0] * q0[0] + q[1] * q0[1] + q[2] * q0[2] + q[3] * q0[3];
+                float wi = dot < 0.f ? -w[i] : w[i]; // antipodality
+                for (unsigned int c = 0; c < 8; ++c)
+                    b[c] += wi * q[c];
+            }
+            // normalize by the norm of the real part
+            float L = std::sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2] + b[3] * b[3]);
+            float invL = L > 0.f ? 1.f / L : 0.f;
+            float rx = b[0] * invL, ry = b[1] * invL, rz = b[2] * invL, rw = b[3] * invL;
+            float dx = b[4] * invL, dy = b[5] * invL, dz = b[6] * invL, dw = b[7] * invL;
+
+            // translation : 2 * ( rw * d.xyz - dw * r.xyz + r.xyz x d.xyz )
+            float tx = 2.f * (rw * dx - dw * rx + ry * dz - rz * dy);
+            float ty = 2.f * (rw * dy - dw * ry + rz * dx - rx * dz);
+            float tz = 2.f * (rw * dz - dw * rz + rx * dy - ry * dx);
+
+            float *sp = &positions[4 * v];
+            float *sn = &normals[4 * v];
+            // rotation : x + 2 r.xyz x ( r.xyz x x + rw x )
+            float cx = ry * p[2] - rz * p[1] + rw * p[0];
+            float cy = rz * p[0] - rx * p[2] + rw * p[1];
+            float cz = rx * p[1] - ry * p[0] + rw * p[2];
+            sp[0] = p[0] + 2.f * (ry * cz - rz * cy) + tx;
+            sp[1] = p[1] + 2.f * (rz * cx - rx * cz) + ty;
+            sp[2] = p[2] + 2.f * (rx * cy - ry * cx) + tz;
+            sp[3] = 1.f;
+            cx = ry * n[2] - rz * n[1] + rw * n[0];
+            cy = rz * n[0] - rx * n[2] + rw * n[1];
+            cz = rx * n[1] - ry * n[0] + rw * n[2];
+            sn[0] = n[0] + 2.f * (ry * cz - rz * cy);
+            sn[1] = n[1] + 2.f * (rz * cx - rx * cz);
+            sn[2] = n[2] + 2.f * (rx * cy - ry * cx);
+            sn[3] = 0.f;
+#endif
+        }
+    }
+
+    // a vertex without influence (no weight, or a zero first weight) keeps its rest position and normal,
+    // the same with both methods
+    inline void copyRest(unsigned int v, float const p[4], float const n[4])
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            positions[4 * v + c] = p[c];
+            normals[4 * v + c] = n[c];
+        }
+        positions[4 * v + 3] = 1.f;
+        normals[4 * v + 3] = 0.f;
+    }
+
+#ifdef SKINNINGKERNEL_USE_SSE
+    // cross product of the xyz parts, 0 in the w lane
+    static inline __m128 cross(__m128 a, __m128 b)
+    {
+        __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)), aZXY = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+        __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1)), bZXY = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+        return _mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX));
+    }
+#endif
+};
+
+#endif // SKINNINGKERNEL_H
@@ -0,0 +1,186 @@
+#ifndef SKINNINGWEIGHTS_H
+#define SKINNINGWEIGHTS_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// -------------------------------------------
+// Sparse skinning weights
+// -------------------------------------------
+// Each vertex keeps at most maxInfluences (k) bones, the k largest weights, renormalized.
+// All the influences are stored in one contiguous buffer, k slots per vertex
+// (vertex v uses slots [v*k, v*k+k) ; unused slots have a weight of 0).
+
+struct BoneInfluence
+{
+    float weight;
+    unsigned short bone;
+
+    BoneInfluence() : weight(0.f), bone(0) {}
+};
+
+struct SkinningPruningReport
+{
+    double meanError; // mean over the vertices of sum_j | w_j - w'_j | (dense vs pruned weights)
+    double maxError;
+    double meanInfluences;  // mean number of non zero influences per vertex
+    unsigned int saturated; // number of vertices that had more than k significant influences
+
+    SkinningPruningReport() : meanError(0.0), maxError(0.0), meanInfluences(0.0), saturated(0) {}
+};
+
+class SkinningWeights
+{
+public:
+    SkinningWeights() : k(4), nBones(0), pruneThreshold(1e-3f) {}
+
+    void resize(unsigned int nVertices, unsigned int numberOfBones, unsigned int maxInfluences = 4, float threshold = 1e-3f)
+    {
+        k = std::max(1u, maxInfluences);
+        nBones = numberOfBones;
+        pruneThreshold = threshold;
+        influences.assign(nVertices * k, BoneInfluence());
+        report = SkinningPruningReport();
+    }
+
+    unsigned int maxInfluences() const { return k; }
+    unsigned int numberOfBones() const { return nBones; }
+    unsigned int numberOfVertices() const { return k == 0 ? 0 : influences.size() / k; }
+    float getPruneThreshold() const { return pruneThreshold; }
+    bool empty() const { return influences.empty(); }
+
+    BoneInfluence const *vertexInfluences(unsigned int v) const { return &influences[v * k]; }
+    std::vector<BoneInfluence> const &data() const { return influences; }
+
+    float weight(unsigned int v, unsigned int bone) const
+    {
+        BoneInfluence const *inf = vertexInfluences(v);
+        for (unsigned int i = 0; i < k; ++i)
+            if (inf[i].weight > 0.f && inf[i].bone == bone)
+                return inf[i].weight;
+        return 0.f;
+    }
+
+    // dense : nBones normalized weights of vertex v.
+    // Keeps the k largest weights, drops the ones below pruneThreshold, renormalizes.
+    // Returns the error introduced (L1 distance between dense and pruned weights).
+    double setVertexWeights(unsigned int v, std::vector<double> const &dense)
+    {
+        BoneInfluence *inf = &influences[v * k];
+        for (unsigned int i = 0; i < k; ++i)
+            inf[i] = BoneInfluence();
+
+        // insertion into the k best slots (sorted by decreasing weight)
+        unsigned int used = 0, significant = 0;
+        for (unsigned int j = 0; j < dense.size(); ++j)
+        {
+            float w = (float)dense[j];
+            if (!(w >= pruneThreshold))
+                continue;
+            ++significant;
+            if (used == k && w <= inf[k - 1].weight)
+                continue;
+            unsigned int slot = (used < k) ? used++ : k - 1;
+            while (slot > 0 && inf[slot - 1].weight < w)
+            {
+                inf[slot] = inf[slot - 1];
+                --slot;
+            }
+            inf[slot].weight = w;
+            inf[slot].bone = (unsigned short)j;
+        }
+
+        double sum = 0.0;
+        for (unsigned int i = 0; i < used; ++i)
+            sum += inf[i].weight;
+        if (sum <= 0.0)
+        {
+            // nothing above the threshold : keep the largest weight alone
+            unsigned int best = 0;
+            for (unsigned int j = 1; j < dense.size(); ++j)
+                if (dense[j] > dense[best])
+                    best = j;
+            inf[0].weight = 1.f;
+            inf[0].bone = (unsigned short)best;
+            used = 1;
+            sum = 1.0;
+        }
+        else
+        {
+            for (unsigned int i = 0; i < used; ++i)
+                inf[i].weight = (float)(inf[i].weight / sum);
+        }
+
+        double error = 0.0;
+        for (unsigned int j = 0; j < dense.size(); ++j)
+            error += std::fabs(dense[j] - weight(v, j));
+
+        unsigned int n = numberOfVertices();
+        report.meanError += error / n;
+        report.maxError = std::max(report.maxError, error);
+        report.meanInfluences += (double)used / n;
+        if (significant > k)
+            ++report.saturated;
+        return error;
+    }
+
+    SkinningPruningReport const &getReport() const { return report; }
+
+    // binary (de)serialization, for the weights cache (the pruning report is not stored)
+    void write(std::ostream &out) const
+    {
+        unsigned int header[3] = {k, nBones, numberOfVertices()};
+        out.write((char const *)header, sizeof(header));
+        out.write((char const *)&pruneThreshold, sizeof(pruneThreshold));
+        for (unsigned int i = 0; i < influences.size(); ++i)
+        {
+            out.write((char const *)&influences[i].weight, sizeof(float));
+            out.write((char const *)&influences[i].bone, sizeof(unsigned short));
+        }
+    }
+
+    // from separate arrays (rig file) : weights and bone indices, maxInfluences per vertex
+    void assign(unsigned int nVertices, unsigned int numberOfBones, unsigned int maxInfluences, float threshold,
+                float const *weights, unsigned short const *bones)
+    {
+        resize(nVertices, numberOfBones, maxInfluences, threshold);
+        for (unsigned int i = 0; i < influences.size(); ++i)
+        {
+            influences[i].weight = weights[i];
+            influences[i].bone = bones[i];
+            if (weights[i] > 0.f)
+                report.meanInfluences += 1.0 / nVertices;
+        }
+    }
+
+    bool read(std::istream &in)
+    {
+        unsigned int header[3];
+        float threshold;
+        if (!in.read((char *)header, sizeof(header)) || !in.read((char *)&threshold, sizeof(threshold)) || header[0] == 0)
+            return false;
+        resize(header[2], header[1], header[0], threshold);
+        for (unsigned int i = 0; i < influences.size(); ++i)
+        {
+            if (!in.read((char *)&influences[i].weight, sizeof(float)) || !in.read((char *)&influences[i].bone, sizeof(unsigned short)))
+            {
+                influences.clear();
+                return false;
+            }
+            if (influences[i].weight > 0.f)
+                report.meanInfluences += 1.0 / header[2];
+        }
+        return true;
+    }
+
+private:
+    unsigned int k;      // max influences per vertex
+    unsigned int nBones; // bone indices are stored on 16 bits
+    float pruneThreshold;
+    std::vector<BoneInfluence> influences;
+    SkinningPruningReport report;
+};
+
+#endif // SKINNINGWEIGHTS_H
@@ -0,0 +1,206 @@
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cassert>
+#include "Vec3.h"
+
+// -------------------------------------------
+// Bounding volume hierarchy over the triangles of a mesh, for segment / mesh intersection queries
+// (visibility tests). Binary tree, split at the median of the centroids along the longest axis,
+// stored as a flat array of nodes (children of an inner node are contiguous : first, first+1).
+// The median split halves the triangles at each level : the depth is at most log2(nT) + 1, so
+// the fixed traversal stack (one pending sibling per level) cannot overflow.
+// The queries are const and can run from several threads.
+// -------------------------------------------
+
+class TriangleBVH
+{
+public:
+    TriangleBVH() : maxDepth(0) {}
+
+    template <class vertex_t, class triangle_t>
+    void build(std::vector<vertex_t> const &vertices, std::vector<triangle_t> const &triangles, unsigned int maxLeafSize = 4)
+    {
+        unsigned int nT = triangles.size();
+        corners.resize(9 * nT);
+        for (unsigned int t = 0; t < nT; ++t)
+            for (unsigned int i = 0; i < 3; ++i)
+                for (unsigned int c = 0; c < 3; ++c)
+                    corners[9 * t + 3 * i + c] = vertices[triangles[t].v[i]].p[c];
+
+        order.resize(nT);
+        centroids.resize(3 * nT);
+        for (unsigned int t = 0; t < nT; ++t)
+        {
+            order[t] = t;
+            for (unsigned int c = 0; c < 3; ++c)
+                centroids[3 * t + c] = (corners[9 * t + c] + corners[9 * t + 3 + c] + corners[9 * t + 6 + c]) / 3.f;
+        }
+
+        nodes.clear();
+        nodes.reserve(2 * nT / std::max(1u, maxLeafSize) + 1);
+        maxDepth = 0;
+        if (nT == 0)
+            return;
+        nodes.push_back(Node());
+        buildNode(0, 0, nT, maxLeafSize, 0);
+        assert(maxDepth < stackSize);
+
+        // triangles in leaf order, so that a leaf reads contiguous memory
+        std::vector<float> sorted(corners.size());
+        for (unsigned int i = 0; i < nT; ++i)
+            std::copy(&corners[9 * order[i]], &corners[9 * order[i]] + 9, &sorted[9 * i]);
+        corners.swap(sorted);
+        std::vector<float>().swap(centroids);
+    }
+
+    unsigned int numberOfNodes() const { return nodes.size(); }
+
+    // true if the segment a + t (b - a), t in ]tMin, tMax[, intersects a triangle
+    bool segmentIntersects(Vec3 const &a, Vec3 const &b, float tMin = 0.f, float tMax = 1.f) const
+    {
+        if (nodes.empty())
+            return false;
+        float o[3] = {a[0], a[1], a[2]};
+        float d[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        float inv[3];
+        for (unsigned int c = 0; c < 3; ++c)
+            inv[c] = d[c] != 0.f ? 1.f / d[c] : FLT_MAX;
+
+        unsigned int stack[stackSize];
+        unsigned int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            Node const &node = nodes[stack[--top]];
+            if (!boxIntersects(node, o, inv, tMin, tMax))
+                continue;
+            if (node.count > 0)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; ++i)
+                    if (triangleIntersects(&corners[9 * i], o, d, tMin, tMax))
+                        return true;
+            }
+            else
+            {
+                assert(top + 2 <= stackSize); // depth < stackSize (build)
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+        return false;
+    }
+
+private:
+    static const unsigned int stackSize = 64;
+
+    struct Node
+    {
+        float bmin[3], bmax[3];
+        unsigned int first; // inner node : index of the first child ; leaf : index of the first triangle (in order)
+        unsigned int count; // number of triangles, 0 for an inner node
+    };
+
+    std::vector<Node> nodes;
+    std::vector<float> corners;   // 9 floats per triangle (after build : in leaf order)
+    std::vector<float> centroids; // only during the build
+    std::vector<unsigned int> order;
+    unsigned int maxDepth; // of the leaves, the root being at depth 0
+
+    void buildNode(unsigned int nodeIndex, unsigned int begin, unsigned int end, unsigned int maxLeafSize, unsigned int depth)
+    {
+        maxDepth = std::max(maxDepth, depth);
+        Node node;
+        float cmin[3], cmax[3];
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            node.bmin[c] = cmin[c] = FLT_MAX;
+            node.bmax[c] = cmax[c] = -FLT_MAX;
+        }
+        for (unsigned int i = begin; i < end; ++i)
+        {
+            unsigned int t = order[i];
+            for (unsigned int c = 0; c < 3; ++c)
+            {
+                for (unsigned int k = 0; k < 3; ++k)
+                {
+                    node.bmin[c] = std::min(node.bmin[c], corners[9 * t + 3 * k + c]);
+                    node.bmax[c] = std::max(node.bmax[c], corners[9 * t + 3 * k + c]);
+                }
+                cmin[c] = std::min(cmin[c], centroids[3 * t + c]);
+                cmax[c] = std::max(cmax[c], centroids[3 * t + c]);
+            }
+        }
+
+        unsigned int axis = 0;
+        for (unsigned int c = 1; c < 3; ++c)
+            if (cmax[c] - cmin[c] > cmax[axis] - cmin[axis])
+                axis = c;
+
+        if (end - begin <= maxLeafSize || cmax[axis] - cmin[axis] <= 0.f)
+        {
+            node.first = begin;
+            node.count = end - begin;
+            nodes[nodeIndex] = node;
+            return;
+        }
+
+        unsigned int middle = (begin + end) / 2;
+        std::vector<float> const &centers = centroids;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                         [&centers, axis](unsigned int t1, unsigned int t2)
+                         { return centers[3 * t1 + axis] < centers[3 * t2 + axis]; });
+
+        node.first = nodes.size();
+        node.count = 0;
+        nodes[nodeIndex] = node;
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        buildNode(node.first, begin, middle, maxLeafSize, depth + 1);
+        buildNode(node.first + 1, middle, end, maxLeafSize, depth + 1);
+    }
+
+    static bool boxIntersects(Node const &node, float const *o, float const *inv, float tMin, float tMax)
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            float t0 = (node.bmin[c] - o[c]) * inv[c];
+            float t1 = (node.bmax[c] - o[c]) * inv[c];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tMin = std::max(tMin, t0);
+            tMax = std::min(tMax, t1);
+            if (tMin > tMax)
+                return false;
+        }
+        return true;
+    }
+
+    // Moller-Trumbore
+    static bool triangleIntersects(float const *p, float const *o, float const *d, float tMin, float tMax)
+    {
+        float e1[3] = {p[3] - p[0], p[4] - p[1], p[5] - p[2]};
+        float e2[3] = {p[6] - p[0], p[7] - p[1], p[8] - p[2]};
+        float q[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+        float det = e1[0] * q[0] + e1[1] * q[1] + e1[2] * q[2];
+        if (std::fabs(det) < 1e-20f)
+            return false;
+        float invDet = 1.f / det;
+        float s[3] = {o[0] - p[0], o[1] - p[1], o[2] - p[2]};
+        float u = (s[0] * q[0] + s[1] * q[1] + s[2] * q[2]) * invDet;
+        if (u < 0.f || u > 1.f)
+            return false;
+        float r[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+        float v = (d[0] * r[0] + d[1] * r[1] + d[2] * r[2]) * invDet;
+        if (v < 0.f || u + v > 1.f)
+            return false;
+        float t = (e2[0] * r[0] + e2[1] * r[1] + e2[2] * r[2]) * invDet;
+        return t > tMin && t < tMax;
+    }
+};
+
+#endif // TRIANGLEBVH_H
@@ -0,0 +1,163 @@
+#ifndef VERTEXQUANTIZATION_H
+#define VERTEXQUANTIZATION_H
+
+#include <cmath>
+#include <algorithm>
+#include <cfloat>
+
+// -------------------------------------------
+// Quantization helpers shared by the compressed vertex formats (pose cache, compressed skinning) :
+//  - positions : 16 bits per coordinate, relative to a bounding box,
+//  - normals : octahedral encoding, 2 signed values (16 or 8 bits),
+//  - zigzag + varint (LEB128) coding of signed deltas.
+// -------------------------------------------
+
+struct QuantizationBox
+{
+    float origin[3]; // min corner
+    float extent[3]; // max - min (never 0)
+
+    QuantizationBox()
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            origin[c] = 0.f;
+            extent[c] = 1.f;
+        }
+    }
+
+    // box of n points, stride floats apart
+    void fit(float const *points, unsigned int n, unsigned int stride)
+    {
+        float bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (unsigned int i = 0; i < n; ++i)
+            for (unsigned int c = 0; c < 3; ++c)
+            {
+                bmin[c] = std::min(bmin[c], points[stride * i + c]);
+                bmax[c] = std::max(bmax[c], points[stride * i + c]);
+            }
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            origin[c] = n > 0 ? bmin[c] : 0.f;
+            extent[c] = n > 0 ? std::max(bmax[c] - bmin[c], 1e-12f) : 1.f;
+        }
+    }
+
+    void extend(QuantizationBox const &other)
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            float bmin = std::min(origin[c], other.origin[c]);
+            float bmax = std::max(origin[c] + extent[c], other.origin[c] + other.extent[c]);
+            origin[c] = bmin;
+            extent[c] = std::max(bmax - bmin, 1e-12f);
+        }
+    }
+
+    unsigned short quantize(float x, unsigned int c) const
+    {
+        float t = (x - origin[c]) / extent[c];
+        return (unsigned short)(std::min(1.f, std::max(0.f, t)) * 65535.f + 0.5f);
+    }
+
+    float dequantize(unsigned int q, unsigned int c) const { return origin[c] + extent[c] * (q * (1.f / 65535.f)); }
+};
+
+// octahedral encoding of a unit vector, in [-1,1]^2
+inline void octahedralEncode(float const n[3], float &u, float &v)
+{
+    float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+    if (l1 <= 0.f)
+    {
+        u = v = 0.f;
+        return;
+    }
+    float x = n[0] / l1, y = n[1] / l1;
+    if (n[2] < 0.f)
+    {
+        float ox = x;
+        x = (1.f - std::fabs(y)) * (ox >= 0.f ? 1.f : -1.f);
+        y = (1.f - std::fabs(ox)) * (y >= 0.f ? 1.f : -1.f);
+    }
+    u = x;
+    v = y;
+}
+
+// direction of the encoded vector, not normalized
+inline void octahedralUnfold(float u, float v, float n[3])
+{
+    float z = 1.f - std::fabs(u) - std::fabs(v);
+    float t = std::max(-z, 0.f);
+    n[0] = u + ((u >= 0.f) ? -t : t);
+    n[1] = v + ((v >= 0.f) ? -t : t);
+    n[2] = z;
+}
+
+inline void octahedralDecode(float u, float v, float n[3])
+{
+    octahedralUnfold(u, v, n);
+    float x = n[0], y = n[1], z = n[2];
+    float L = std::sqrt(x * x + y * y + z * z);
+    float inv = L > 0.f ? 1.f / L : 0.f;
+    n[0] = x * inv;
+    n[1] = y * inv;
+    n[2] = z * inv;
+}
+
+// 16 bits signed per component
+inline void octahedralEncode16(float const n[3], short q[2])
+{
+    float u, v;
+    octahedralEncode(n, u, v);
+    q[0] = (short)std::floor(std::min(1.f, std::max(-1.f, u)) * 32767.f + 0.5f);
+    q[1] = (short)std::floor(std::min(1.f, std::max(-1.f, v)) * 32767.f + 0.5f);
+}
+
+inline void octahedralDecode16(int qu, int qv, float n[3])
+{
+    octahedralDecode(qu * (1.f / 32767.f), qv * (1.f / 32767.f), n);
+}
+
+// 8 bits signed per component
+inline void octahedralEncode8(float const n[3], signed char q[2])
+{
+    float u, v;
+    octahedralEncode(n, u, v);
+    q[0] = (signed char)std::floor(std::min(1.f, std::max(-1.f, u)) * 127.f + 0.5f);
+    q[1] = (signed char)std::floor(std::min(1.f, std::max(-1.f, v)) * 127.f + 0.5f);
+}
+
+inline void octahedralDecode8(int qu, int qv, float n[3])
+{
+    octahedralDecode(qu * (1.f / 127.f), qv * (1.f / 127.f), n);
+}
+
+// signed delta -> unsigned (small magnitudes -> small values), then 7 bits per byte
+inline unsigned int zigzagEncode(int x) { return ((unsigned int)x << 1) ^ (unsigned int)(x >> 31); }
+inline int zigzagDecode(unsigned int x) { return (int)(x >> 1) ^ -(int)(x & 1); }
+
+inline unsigned char *writeVarint(unsigned int x, unsigned char *out)
+{
+    while (x >= 0x80)
+    {
+        *out++ = (unsigned char)(x | 0x80);
+        x >>= 7;
+    }
+    *out++ = (unsigned char)x;
+    return out;
+}
+
+// reads at most up to end (excluded) : NULL if the varint is truncated or longer than 5 bytes
+inline unsigned char const *readVarint(unsigned char const *in, unsigned char const *end, unsigned int &x)
+{
+    x = 0;
+    for (unsigned int shift = 0; in < end && shift < 35; shift += 7)
+    {
+        x |= (unsigned int)(*in & 0x7f) << shift;
+        if (!(*in++ & 0x80))
+            return in;
+    }
+    return 0;
+}
+
+#endif // VERTEXQUANTIZATION_H
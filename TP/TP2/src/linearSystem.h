@@ -19,6 +19,9 @@ using namespace Spectra;
 
 #include <vector>
 #include <map>
+#include <algorithm>
+
+#include "ParallelFor.h"
 
 
 class linearSystem {
@@ -27,6 +30,10 @@ class linearSystem {
     Eigen::SparseMatrix< double > _A , _At , _AtA;
     Eigen::SimplicialLDLT< Eigen::SparseMatrix< double > > _AtA_choleskyDecomposition;
 
+    // square symmetric positive definite systems (preprocessSymmetric) : A itself is factorized, not AtA
+    Eigen::SimplicialLDLT< Eigen::SparseMatrix< double > > _A_choleskyDecomposition;
+    bool _isSymmetric;
+
     Eigen::VectorXd _b;
 
     unsigned int _rows , _columns;
@@ -34,6 +41,7 @@ class linearSystem {
 public:
     linearSystem() {
         _rows = _columns = 0;
+        _isSymmetric = false;
     }
     linearSystem( int rows , int columns ) {
         setDimensions(rows , columns);
@@ -43,6 +51,7 @@ public:
 
     void setDimensions( int rows , int columns ) {
         _rows = rows; _columns = columns;
+        _isSymmetric = false;
         _ASparse.clear();
         _ASparse.resize(_rows);
         _b.resize(_rows);
@@ -57,6 +66,51 @@ public:
     }
 
     void preprocess() {
+        convertToEigen();
+        _isSymmetric = false;
+        _At = _A.transpose();
+        _AtA = _At * _A;
+        _AtA_choleskyDecomposition.analyzePattern(_AtA);
+        _AtA_choleskyDecomposition.compute(_AtA);
+    }
+
+    // for a square symmetric positive definite A (Laplacian + diagonal for instance) :
+    // A is factorized directly, which is much cheaper (and better conditioned) than the normal equations.
+    // Returns false if the factorization failed (A not positive definite).
+    bool preprocessSymmetric() {
+        convertToEigen();
+        _isSymmetric = true;
+        _A_choleskyDecomposition.analyzePattern(_A);
+        _A_choleskyDecomposition.compute(_A);
+        return _A_choleskyDecomposition.info() == Eigen::Success;
+    }
+
+    void solve( Eigen::VectorXd & X ) {
+        if( _isSymmetric )
+            X = _A_choleskyDecomposition.solve( _b );
+        else
+            X = _AtA_choleskyDecomposition.solve( _At * _b );
+    }
+
+    // several right hand sides (one per column of B), with the factorization computed once :
+    // the columns are solved by blocks of columnsPerBlock, the blocks in parallel
+    void solve( Eigen::MatrixXd const & B , Eigen::MatrixXd & X , unsigned int columnsPerBlock = 4 ) {
+        X.resize( _columns , B.cols() );
+        unsigned int nBlocks = ( B.cols() + columnsPerBlock - 1 ) / columnsPerBlock;
+        parallelFor( nBlocks , [&]( unsigned int begin , unsigned int end ) {
+            for( unsigned int block = begin ; block < end ; ++block ) {
+                unsigned int c0 = block * columnsPerBlock;
+                unsigned int nc = std::min< unsigned int >( columnsPerBlock , B.cols() - c0 );
+                if( _isSymmetric )
+                    X.middleCols( c0 , nc ) = _A_choleskyDecomposition.solve( B.middleCols( c0 , nc ) );
+                else
+                    X.middleCols( c0 , nc ) = _AtA_choleskyDecomposition.solve( _At * B.middleCols( c0 , nc ) );
+            }
+        } , 1 );
+    }
+
+private:
+    void convertToEigen() {
         // convert ad-hoc matrix to Eigen sparse format:
         {
             _A.resize(_rows , _columns);
@@ -70,16 +124,9 @@ public:
             }
             _A.setFromTriplets( triplets.begin() , triplets.end() );
         }
-        _At = _A.transpose();
-        _AtA = _At * _A;
-        _AtA_choleskyDecomposition.analyzePattern(_AtA);
-        _AtA_choleskyDecomposition.compute(_AtA);
-    }
-
-    void solve( Eigen::VectorXd & X ) {
-        X = _AtA_choleskyDecomposition.solve( _At * _b );
     }
 
+public:
 
 
     template< class vector_t >
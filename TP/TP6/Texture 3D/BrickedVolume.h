@@ -0,0 +1,684 @@
+#ifndef BRICKEDVOLUME_H
+#define BRICKEDVOLUME_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Bricked label volume (.bvol) for volumes that do not fit in memory : the volume is cut
+// in bricks of brickSize^3 voxels (32 or 64), each compressed on its own, and a brick is
+// only read from the disk when it is used.
+//
+// File layout (little endian, as written by the machine) :
+//   BrickedVolumeHeader          (sizes, voxel size, number of voxels of each label)
+//   BrickIndexEntry[nBricks]     (offset and size of each brick, x first ; size 0 : uniform brick)
+//   bricks                       (compressed with header.codec)
+// Bricks on the border of the volume are smaller (the extent of brick b is given by brickBox()).
+// A decoded brick is x first, then y, then z.
+// Codec BrickCodec_RLE : for each row of the brick, runs of (label, length) bytes.
+// Codec BrickCodec_Palette (as the compressed segmentation of Neuroglancer) : the number of
+// labels of the brick minus one, its labels, then the index of each voxel in this palette on
+// 1, 2, 4 or 8 bits (the smallest that fits), packed from the low bits of each byte.
+//
+// BrickedVolume keeps a page table (brick -> decoded brick, if resident) and an LRU cache
+// bounded by a memory budget. brick() is thread safe and returns a shared pointer : a brick
+// evicted while a thread still reads it stays alive until the thread releases it.
+// prefetch() / prefetchAlongView() queue bricks for a background thread, which reads them
+// ahead of the slicing or the ray marching (front to back along the view direction) ; an
+// in-order pass over the bricks keeps readAhead() bricks queued, no more, so that the
+// prefetched bricks are still resident when it reaches them.
+// decodeAll() decodes the whole volume in parallel (one brick per task) into a buffer, the
+// data of an ImaVolume or a mapped GPU staging buffer, without going through the cache.
+//
+//-------------------------------------------------------------------------------------//
+
+enum BrickCodec
+{
+    BrickCodec_Raw = 0,
+    BrickCodec_RLE = 1,
+    BrickCodec_Palette = 2
+};
+
+struct BrickedVolumeHeader
+{
+    char magic[8]; // "TP6BVOL\0"
+    uint32_t version;
+    uint32_t nx, ny, nz;
+    float dx, dy, dz;
+    uint32_t brickSize;
+    uint32_t codec;
+    uint32_t nBricks;
+    uint64_t labelCounts[256];
+};
+
+struct BrickIndexEntry
+{
+    uint64_t offset;
+    uint32_t size;  // 0 : every voxel of the brick has the label below
+    uint32_t label;
+};
+
+typedef std::shared_ptr<const std::vector<unsigned char>> BrickData;
+
+struct BrickCacheStatistics
+{
+    size_t hits, misses, evictions, bytesRead, prefetched;
+    BrickCacheStatistics() : hits(0), misses(0), evictions(0), bytesRead(0), prefetched(0) {}
+};
+
+class BrickedVolume
+{
+public:
+    static const uint32_t currentVersion = 1;
+
+    BrickedVolume() : fd(-1), memoryBudget(256u << 20), residentBytes(0), stopPrefetch(false)
+    {
+        std::memset(&header, 0, sizeof(header));
+    }
+    ~BrickedVolume() { close(); }
+
+    //--------------------------------------------------------------------- writing
+
+    static bool write(std::string const &fileName, unsigned char const *voxels, unsigned int nx, unsigned int ny, unsigned int nz,
+                      float dx, float dy, float dz, unsigned int brickSize = 32, BrickCodec codec = BrickCodec_RLE, std::string *error = NULL)
+    {
+        if (brickSize == 0 || brickSize > 256)
+            return fail(error, "brick size must be in [1,256]");
+        BrickedVolumeHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, "TP6BVOL\0", 8);
+        h.version = currentVersion;
+        h.nx = nx;
+        h.ny = ny;
+        h.nz = nz;
+        h.dx = dx;
+        h.dy = dy;
+        h.dz = dz;
+        h.brickSize = brickSize;
+        h.codec = codec;
+        unsigned int nb[3];
+        bricksPerAxis(h, nb);
+        h.nBricks = nb[0] * nb[1] * nb[2];
+
+        // bricks compressed in parallel, written in order
+        std::vector<std::vector<unsigned char>> payloads(h.nBricks);
+        std::vector<BrickIndexEntry> index(h.nBricks);
+        std::mutex merge;
+        parallelFor(h.nBricks, [&](unsigned int begin, unsigned int end)
+                    {
+            std::vector<unsigned char> raw;
+            uint64_t counts[256] = {0};
+            for (unsigned int b = begin; b < end; ++b)
+            {
+                unsigned int origin[3], extent[3];
+                brickBox(h, b, origin, extent);
+                raw.resize((size_t)extent[0] * extent[1] * extent[2]);
+                for (unsigned int z = 0; z < extent[2]; ++z)
+                    for (unsigned int y = 0; y < extent[1]; ++y)
+                        std::memcpy(&raw[((size_t)z * extent[1] + y) * extent[0]],
+                                    voxels + (((size_t)(origin[2] + z) * ny + origin[1] + y) * nx + origin[0]), extent[0]);
+                for (size_t i = 0; i < raw.size(); ++i)
+                    ++counts[raw[i]];
+                index[b].label = raw[0];
+                if (std::count(raw.begin(), raw.end(), raw[0]) == (long)raw.size())
+                    continue; // uniform brick : nothing stored
+                encodeBrick((BrickCodec)h.codec, raw, extent, payloads[b]);
+                index[b].size = (uint32_t)payloads[b].size();
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            for (unsigned int l = 0; l < 256; ++l)
+                h.labelCounts[l] += counts[l]; }, 1);
+
+        uint64_t offset = sizeof(BrickedVolumeHeader) + (uint64_t)h.nBricks * sizeof(BrickIndexEntry);
+        for (unsigned int b = 0; b < h.nBricks; ++b)
+        {
+            index[b].offset = offset;
+            offset += index[b].size;
+        }
+        std::ofstream file(fileName.c_str(), std::ios::binary);
+        if (!file.is_open())
+            return fail(error, fileName + " cannot be written");
+        file.write((char const *)&h, sizeof(h));
+        file.write((char const *)&index[0], (std::streamsize)(index.size() * sizeof(BrickIndexEntry)));
+        for (unsigned int b = 0; b < h.nBricks; ++b)
+            if (!payloads[b].empty())
+                file.write((char const *)&payloads[b][0], (std::streamsize)payloads[b].size());
+        if (!file.good())
+            return fail(error, fileName + " : write error");
+        return true;
+    }
+
+    //--------------------------------------------------------------------- reading
+
+    // reads the header and the brick index only
+    bool open(std::string const &fileName, std::string *error = NULL)
+    {
+        close();
+        int f = ::open(fileName.c_str(), O_RDONLY);
+        if (f < 0)
+            return fail(error, fileName + " cannot be opened");
+        BrickedVolumeHeader h;
+        off_t fileSize = lseek(f, 0, SEEK_END);
+        if (pread(f, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || std::memcmp(h.magic, "TP6BVOL\0", 8) != 0)
+        {
+            ::close(f);
+            return fail(error, fileName + " is not a bricked volume");
+        }
+        unsigned int nb[3];
+        bool valid = h.version == currentVersion && h.nx && h.ny && h.nz && h.brickSize && h.brickSize <= 256 &&
+                     h.codec <= BrickCodec_Palette && h.dx > 0.f && h.dy > 0.f && h.dz > 0.f;
+        if (valid)
+        {
+            bricksPerAxis(h, nb);
+            valid = (uint64_t)nb[0] * nb[1] * nb[2] == h.nBricks;
+        }
+        std::vector<BrickIndexEntry> idx(valid ? h.nBricks : 0);
+        size_t indexBytes = idx.size() * sizeof(BrickIndexEntry);
+        if (valid && pread(f, &idx[0], indexBytes, sizeof(h)) != (ssize_t)indexBytes)
+            valid = false;
+        for (size_t b = 0; valid && b < idx.size(); ++b)
+            valid = idx[b].label < 256 && idx[b].offset + idx[b].size <= (uint64_t)fileSize;
+        if (!valid)
+        {
+            ::close(f);
+            return fail(error, fileName + " : bad header or brick index");
+        }
+
+        fd = f;
+        header = h;
+        index.swap(idx);
+        pageTable.assign(header.nBricks, Page());
+        residentBytes = 0;
+        lru.clear();
+        statistics = BrickCacheStatistics();
+        stopPrefetch = false;
+        prefetchThread = std::thread([this]()
+                                     { prefetchLoop(); });
+        return true;
+    }
+
+    void close()
+    {
+        if (prefetchThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(prefetchMutex);
+                stopPrefetch = true;
+                prefetchQueue.clear();
+            }
+            prefetchWakeUp.notify_all();
+            prefetchThread.join();
+        }
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        pageTable.clear();
+        lru.clear();
+        index.clear();
+        residentBytes = 0;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    unsigned int size(int axis) const { return axis == 0 ? header.nx : axis == 1 ? header.ny : header.nz; }
+    float voxelSize(int axis) const { return axis == 0 ? header.dx : axis == 1 ? header.dy : header.dz; }
+    unsigned int brickSize() const { return header.brickSize; }
+    unsigned int numberOfBricks() const { return header.nBricks; }
+    unsigned int numberOfBricks(int axis) const
+    {
+        unsigned int nb[3];
+        bricksPerAxis(header, nb);
+        return nb[axis];
+    }
+    BrickCodec codec() const { return (BrickCodec)header.codec; }
+    uint64_t labelCount(unsigned char label) const { return header.labelCounts[label]; }
+    std::vector<unsigned char> labels() const
+    {
+        std::vector<unsigned char> l;
+        for (unsigned int i = 0; i < 256; ++i)
+            if (header.labelCounts[i])
+                l.push_back((unsigned char)i);
+        return l;
+    }
+    size_t compressedSize(unsigned int b) const { return index[b].size; }
+
+    unsigned int brickOf(unsigned int x, unsigned int y, unsigned int z) const
+    {
+        unsigned int nb[3];
+        bricksPerAxis(header, nb);
+        unsigned int s = header.brickSize;
+        return ((z / s) * nb[1] + y / s) * nb[0] + x / s;
+    }
+    void brickBox(unsigned int b, unsigned int origin[3], unsigned int extent[3]) const { brickBox(header, b, origin, extent); }
+
+    // true if the brick is made of one label (it is never read)
+    bool isUniform(unsigned int b, unsigned char &label) const
+    {
+        label = (unsigned char)index[b].label;
+        return index[b].size == 0;
+    }
+
+    void setMemoryBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        memoryBudget = bytes;
+        evict();
+    }
+    // both are written by the prefetching thread and setMemoryBudget : read under the lock
+    size_t getMemoryBudget() const
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        return memoryBudget;
+    }
+    size_t getResidentBytes() const
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        return residentBytes;
+    }
+    // bricks an in-order pass can have prefetched ahead of it : half of the budget, the other half
+    // holding the bricks already passed (evicted first), so that none is evicted before it is used
+    unsigned int readAhead() const
+    {
+        size_t brickBytes = (size_t)header.brickSize * header.brickSize * header.brickSize;
+        return (unsigned int)std::max<size_t>(1, std::min<size_t>(header.nBricks, getMemoryBudget() / 2 / brickBytes));
+    }
+    BrickCacheStatistics getStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        return statistics;
+    }
+
+    // decoded brick b (empty pointer for a uniform brick, see isUniform), read from the disk if needed
+    BrickData brick(unsigned int b)
+    {
+        return fetch(b, false);
+    }
+
+    unsigned char voxel(unsigned int x, unsigned int y, unsigned int z)
+    {
+        unsigned int b = brickOf(x, y, z);
+        unsigned char label;
+        if (isUniform(b, label))
+            return label;
+        unsigned int origin[3], extent[3];
+        brickBox(b, origin, extent);
+        BrickData data = brick(b);
+        return (*data)[((size_t)(z - origin[2]) * extent[1] + (y - origin[1])) * extent[0] + (x - origin[0])];
+    }
+
+    // slice orthogonal to axis at position i, rows along the first remaining axis (x, or y for axis 0)
+    void slice(int axis, unsigned int i, std::vector<unsigned char> &out)
+    {
+        int u = axis == 0 ? 1 : 0, v = axis == 2 ? 1 : 2;
+        unsigned int nu = size(u), nv = size(v);
+        out.assign((size_t)nu * nv, 0);
+        unsigned int s = header.brickSize;
+        unsigned int nb[3];
+        bricksPerAxis(header, nb);
+        std::vector<unsigned int> sliceBricks;
+        for (unsigned int bv = 0; bv < nb[v]; ++bv)
+            for (unsigned int bu = 0; bu < nb[u]; ++bu)
+            {
+                unsigned int c[3];
+                c[axis] = i / s;
+                c[u] = bu;
+                c[v] = bv;
+                sliceBricks.push_back((c[2] * nb[1] + c[1]) * nb[0] + c[0]);
+            }
+        prefetch(sliceBricks);
+        for (size_t k = 0; k < sliceBricks.size(); ++k)
+        {
+            unsigned int b = sliceBricks[k], origin[3], extent[3];
+            brickBox(b, origin, extent);
+            unsigned char label;
+            bool uniform = isUniform(b, label);
+            BrickData data = uniform ? BrickData() : brick(b);
+            unsigned int local[3];
+            local[axis] = i - origin[axis];
+            for (unsigned int y = 0; y < extent[v]; ++y)
+                for (unsigned int x = 0; x < extent[u]; ++x)
+                {
+                    local[u] = x;
+                    local[v] = y;
+                    out[(size_t)(origin[v] + y) * nu + origin[u] + x] =
+                        uniform ? label : (*data)[((size_t)local[2] * extent[1] + local[1]) * extent[0] + local[0]];
+                }
+        }
+    }
+
+    // whole volume into out (nx * ny * nz, x first) ; false if a brick cannot be read or decoded
+    bool decodeAll(unsigned char *out, std::string *error = NULL) const
+    {
+        bool ok = true;
+        std::mutex failure;
+        parallelFor(header.nBricks, [&](unsigned int begin, unsigned int end)
+                    {
+            std::vector<unsigned char> compressed, decoded;
+            for (unsigned int b = begin; b < end; ++b)
+            {
+                unsigned int origin[3], extent[3];
+                brickBox(b, origin, extent);
+                unsigned char const *brickData = NULL;
+                if (index[b].size)
+                {
+                    compressed.resize(index[b].size);
+                    if (pread(fd, &compressed[0], compressed.size(), (off_t)index[b].offset) != (ssize_t)compressed.size() ||
+                        !decodeBrick((BrickCodec)header.codec, &compressed[0], compressed.size(), extent, decoded))
+                    {
+                        std::lock_guard<std::mutex> lock(failure);
+                        ok = false;
+                        continue;
+                    }
+                    brickData = &decoded[0];
+                }
+                for (unsigned int z = 0; z < extent[2]; ++z)
+                    for (unsigned int y = 0; y < extent[1]; ++y)
+                    {
+                        unsigned char *row = out + (((size_t)(origin[2] + z) * header.ny + origin[1] + y) * header.nx + origin[0]);
+                        if (brickData)
+                            std::memcpy(row, brickData + ((size_t)z * extent[1] + y) * extent[0], extent[0]);
+                        else
+                            std::memset(row, (int)index[b].label, extent[0]);
+                    }
+            } }, 1);
+        if (!ok)
+            return fail(error, "corrupted brick");
+        return true;
+    }
+
+    // queues bricks for the background thread (the ones already resident or uniform are skipped)
+    void prefetch(std::vector<unsigned int> const &bricks)
+    {
+        {
+            std::lock_guard<std::mutex> lock(prefetchMutex);
+            for (size_t i = 0; i < bricks.size(); ++i)
+                prefetchQueue.push_back(bricks[i]);
+        }
+        prefetchWakeUp.notify_all();
+    }
+
+    void prefetchRange(unsigned int begin, unsigned int end)
+    {
+        {
+            std::lock_guard<std::mutex> lock(prefetchMutex);
+            for (unsigned int b = begin; b < std::min(end, header.nBricks); ++b)
+                prefetchQueue.push_back(b);
+        }
+        prefetchWakeUp.notify_all();
+    }
+
+    // non uniform bricks, front to back from eye along the view direction, as long as they fit in the budget
+    void prefetchAlongView(float const eye[3], float const viewDirection[3])
+    {
+        std::vector<std::pair<float, unsigned int>> order;
+        float d[3] = {header.dx, header.dy, header.dz};
+        for (unsigned int b = 0; b < header.nBricks; ++b)
+        {
+            if (index[b].size == 0)
+                continue;
+            unsigned int origin[3], extent[3];
+            brickBox(b, origin, extent);
+            float depth = 0.f;
+            for (int c = 0; c < 3; ++c)
+                depth += ((origin[c] + 0.5f * extent[c]) * d[c] - eye[c]) * viewDirection[c];
+            if (depth + 0.87f * header.brickSize * std::max(d[0], std::max(d[1], d[2])) >= 0.f)
+                order.push_back(std::make_pair(depth, b));
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<unsigned int> bricks;
+        size_t bytes = 0, brickBytes = (size_t)header.brickSize * header.brickSize * header.brickSize, budget = getMemoryBudget();
+        for (size_t i = 0; i < order.size() && bytes + brickBytes <= budget; ++i, bytes += brickBytes)
+            bricks.push_back(order[i].second);
+        {
+            std::lock_guard<std::mutex> lock(prefetchMutex);
+            prefetchQueue.clear(); // the previous view is obsolete
+        }
+        prefetch(bricks);
+    }
+
+    //--------------------------------------------------------------------- codecs
+
+    static void encodeBrick(BrickCodec codec, std::vector<unsigned char> const &raw, unsigned int const extent[3], std::vector<unsigned char> &out)
+    {
+        out.clear();
+        if (codec == BrickCodec_Raw)
+        {
+            out = raw;
+            return;
+        }
+        if (codec == BrickCodec_Palette)
+        {
+            int indexOf[256];
+            std::fill(indexOf, indexOf + 256, -1);
+            std::vector<unsigned char> palette;
+            for (size_t i = 0; i < raw.size(); ++i)
+                if (indexOf[raw[i]] < 0)
+                {
+                    indexOf[raw[i]] = (int)palette.size();
+                    palette.push_back(raw[i]);
+                }
+            unsigned int bits = paletteBits((unsigned int)palette.size());
+            out.push_back((unsigned char)(palette.size() - 1));
+            out.insert(out.end(), palette.begin(), palette.end());
+            if (bits == 0)
+                return;
+            size_t start = out.size();
+            out.resize(start + (raw.size() * bits + 7) / 8, 0);
+            for (size_t i = 0; i < raw.size(); ++i)
+                out[start + i * bits / 8] |= (unsigned char)(indexOf[raw[i]] << (i * bits % 8));
+            return;
+        }
+        for (size_t row = 0; row < (size_t)extent[1] * extent[2]; ++row)
+        {
+            unsigned char const *r = &raw[row * extent[0]];
+            for (unsigned int x = 0; x < extent[0];)
+            {
+                unsigned int length = 1;
+                while (x + length < extent[0] && r[x + length] == r[x] && length < 255)
+                    ++length;
+                out.push_back(r[x]);
+                out.push_back((unsigned char)length);
+                x += length;
+            }
+        }
+    }
+
+    static bool decodeBrick(BrickCodec codec, unsigned char const *in, size_t size, unsigned int const extent[3], std::vector<unsigned char> &out)
+    {
+        size_t n = (size_t)extent[0] * extent[1] * extent[2];
+        out.resize(n);
+        if (codec == BrickCodec_Raw)
+        {
+            if (size != n)
+                return false;
+            std::memcpy(&out[0], in, n);
+            return true;
+        }
+        if (codec == BrickCodec_Palette)
+        {
+            if (size == 0 || size < 1u + in[0] + 1u)
+                return false;
+            unsigned int nPalette = in[0] + 1u, bits = paletteBits(nPalette);
+            unsigned char const *palette = in + 1, *indices = in + 1 + nPalette;
+            if (size != 1 + nPalette + (n * bits + 7) / 8)
+                return false;
+            if (bits == 0)
+            {
+                std::memset(&out[0], palette[0], n);
+                return true;
+            }
+            // an index past the palette reads as its last label
+            unsigned char lookup[256];
+            for (unsigned int i = 0; i < 256; ++i)
+                lookup[i] = palette[std::min(i, nPalette - 1)];
+            unsigned int perByte = 8 / bits, valueMask = (1u << bits) - 1;
+            for (size_t i = 0; i < n; i += perByte)
+            {
+                unsigned int byte = indices[i / perByte];
+                for (unsigned int k = 0; k < perByte && i + k < n; ++k, byte >>= bits)
+                    out[i + k] = lookup[byte & valueMask];
+            }
+            return true;
+        }
+        size_t o = 0;
+        for (size_t i = 0; i + 1 < size; i += 2)
+        {
+            if (o + in[i + 1] > n)
+                return false;
+            std::memset(&out[o], in[i], in[i + 1]);
+            o += in[i + 1];
+        }
+        return o == n && size % 2 == 0;
+    }
+
+private:
+    struct Page
+    {
+        BrickData data;
+        std::list<unsigned int>::iterator lruPosition;
+    };
+
+    BrickedVolumeHeader header;
+    std::vector<BrickIndexEntry> index;
+    int fd;
+
+    mutable std::mutex cacheMutex;
+    std::vector<Page> pageTable; // data empty : not resident
+    std::list<unsigned int> lru; // most recently used first
+    size_t memoryBudget, residentBytes;
+    BrickCacheStatistics statistics;
+
+    std::thread prefetchThread;
+    std::mutex prefetchMutex;
+    std::condition_variable prefetchWakeUp;
+    std::deque<unsigned int> prefetchQueue;
+    bool stopPrefetch;
+
+    static bool fail(std::string *error, std::string const &message)
+    {
+        if (error)
+            *error = message;
+        return false;
+    }
+
+    static unsigned int paletteBits(unsigned int nPalette)
+    {
+        return nPalette <= 1 ? 0 : nPalette <= 2 ? 1 : nPalette <= 4 ? 2 : nPalette <= 16 ? 4 : 8;
+    }
+
+    static void bricksPerAxis(BrickedVolumeHeader const &h, unsigned int nb[3])
+    {
+        nb[0] = (h.nx + h.brickSize - 1) / h.brickSize;
+        nb[1] = (h.ny + h.brickSize - 1) / h.brickSize;
+        nb[2] = (h.nz + h.brickSize - 1) / h.brickSize;
+    }
+
+    static void brickBox(BrickedVolumeHeader const &h, unsigned int b, unsigned int origin[3], unsigned int extent[3])
+    {
+        unsigned int nb[3], n[3] = {h.nx, h.ny, h.nz};
+        bricksPerAxis(h, nb);
+        unsigned int c[3] = {b % nb[0], (b / nb[0]) % nb[1], b / (nb[0] * nb[1])};
+        for (int a = 0; a < 3; ++a)
+        {
+            origin[a] = c[a] * h.brickSize;
+            extent[a] = std::min(h.brickSize, n[a] - origin[a]);
+        }
+    }
+
+    BrickData fetch(unsigned int b, bool prefetching)
+    {
+        if (index[b].size == 0)
+            return BrickData();
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            Page &page = pageTable[b];
+            if (page.data)
+            {
+                if (!prefetching)
+                {
+                    ++statistics.hits;
+                    lru.splice(lru.begin(), lru, page.lruPosition);
+                }
+                return page.data;
+            }
+        }
+
+        // read and decoded without the lock : other bricks can be served meanwhile
+        std::vector<unsigned char> compressed(index[b].size);
+        std::shared_ptr<std::vector<unsigned char>> decoded = std::make_shared<std::vector<unsigned char>>();
+        unsigned int origin[3], extent[3];
+        brickBox(b, origin, extent);
+        bool ok = pread(fd, &compressed[0], compressed.size(), (off_t)index[b].offset) == (ssize_t)compressed.size() &&
+                  decodeBrick((BrickCodec)header.codec, &compressed[0], compressed.size(), extent, *decoded);
+        if (!ok) // corrupted brick : read as its first label, so that callers never get garbage
+            decoded->assign((size_t)extent[0] * extent[1] * extent[2], (unsigned char)index[b].label);
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        Page &page = pageTable[b];
+        statistics.bytesRead += compressed.size();
+        if (prefetching)
+            ++statistics.prefetched;
+        else
+            ++statistics.misses;
+        if (page.data) // loaded by another thread meanwhile
+            return page.data;
+        page.data = decoded;
+        lru.push_front(b);
+        page.lruPosition = lru.begin();
+        residentBytes += decoded->size();
+        evict();
+        return decoded;
+    }
+
+    // under cacheMutex ; the most recently used brick always stays
+    void evict()
+    {
+        while (residentBytes > memoryBudget && lru.size() > 1)
+        {
+            unsigned int victim = lru.back();
+            lru.pop_back();
+            residentBytes -= pageTable[victim].data->size();
+            pageTable[victim].data.reset();
+            ++statistics.evictions;
+        }
+    }
+
+    void prefetchLoop()
+    {
+        while (true)
+        {
+            unsigned int b;
+            {
+                std::unique_lock<std::mutex> lock(prefetchMutex);
+                prefetchWakeUp.wait(lock, [this]()
+                                    { return stopPrefetch || !prefetchQueue.empty(); });
+                if (stopPrefetch)
+                    return;
+                b = prefetchQueue.front();
+                prefetchQueue.pop_front();
+            }
+            if (b < header.nBricks)
+                fetch(b, true);
+        }
+    }
+};
+
+#endif // BRICKEDVOLUME_H
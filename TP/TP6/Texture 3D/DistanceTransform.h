@@ -0,0 +1,202 @@
+#ifndef DISTANCETRANSFORM_H
+#define DISTANCETRANSFORM_H
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Exact Euclidean distance transform of a label volume (Felzenszwalb & Huttenlocher,
+// Meijster) : distance of each voxel center to the nearest center of a "feature" voxel
+// (a label of the set), in physical units, with the anisotropic voxel size of the .dim.
+//
+// The squared distance is separable : one pass per axis, each line being independent.
+//   x : distance to the nearest feature of the row, two scans (Meijster's first phase)
+//   y, z : lower envelope of the parabolas d(p)^2 + (w (q - p))^2 of the line
+// The lines of each pass are split among the threads. The y and z lines are strided :
+// a block of columns is copied (whole rows of x, contiguous) into a buffer of the thread,
+// transformed, and copied back.
+//
+//-------------------------------------------------------------------------------------//
+
+class DistanceTransform
+{
+public:
+    // distance[nx * ny * nz] : 0 on the feature voxels, infinity if there is none
+    static void compute(unsigned char const *voxels, unsigned int nx, unsigned int ny, unsigned int nz,
+                        float dx, float dy, float dz, bool const feature[256], float *distance)
+    {
+        unsigned int n[3] = {nx, ny, nz};
+        float d[3] = {dx, dy, dz};
+        squaredDistance(voxels, n, d, feature, false, distance);
+        parallelFor(nz, [&](unsigned int begin, unsigned int end)
+                    {
+            for (size_t i = (size_t)begin * nx * ny; i < (size_t)end * nx * ny; ++i)
+                distance[i] = std::sqrt(distance[i]); }, 1);
+    }
+
+    // signed distance to the boundary of the labels of the set : distance to the nearest
+    // voxel of the set outside of it, minus the distance to the nearest voxel out of the
+    // set inside of it
+    static void computeSigned(unsigned char const *voxels, unsigned int nx, unsigned int ny, unsigned int nz,
+                              float dx, float dy, float dz, bool const inside[256], float *distance)
+    {
+        unsigned int n[3] = {nx, ny, nz};
+        float d[3] = {dx, dy, dz};
+        std::vector<float> interior((size_t)nx * ny * nz);
+        squaredDistance(voxels, n, d, inside, false, distance);
+        squaredDistance(voxels, n, d, inside, true, &interior[0]);
+        parallelFor(nz, [&](unsigned int begin, unsigned int end)
+                    {
+            for (size_t i = (size_t)begin * nx * ny; i < (size_t)end * nx * ny; ++i)
+                distance[i] = std::sqrt(distance[i]) - std::sqrt(interior[i]); }, 1);
+    }
+
+    // quantized distance : round(distance / step), 65535 for the larger ones (and infinity)
+    static void quantize(float const *distance, size_t count, float step, uint16_t *quantized)
+    {
+        float scale = 1.f / step;
+        unsigned int nChunks = (unsigned int)((count + chunkSize - 1) / chunkSize);
+        parallelFor(nChunks, [&](unsigned int begin, unsigned int end)
+                    {
+            for (size_t i = (size_t)begin * chunkSize; i < std::min(count, (size_t)end * chunkSize); ++i)
+                quantized[i] = (uint16_t)std::min(65535.f, std::floor(distance[i] * scale + 0.5f)); }, 1);
+    }
+
+private:
+    static const size_t chunkSize = 1 << 18;
+    static const unsigned int columnBlock = 16; // columns of x copied together for the y and z passes
+
+    // squared distances to the voxels whose feature[label] != complement
+    static void squaredDistance(unsigned char const *voxels, unsigned int const n[3], float const d[3],
+                                bool const feature[256], bool complement, float *f)
+    {
+        size_t sliceSize = (size_t)n[0] * n[1];
+
+        // x : rows
+        parallelFor(n[1] * n[2], [&](unsigned int begin, unsigned int end)
+                    {
+            for (unsigned int r = begin; r < end; ++r)
+                rowDistance(voxels + (size_t)r * n[0], n[0], d[0] * d[0], feature, complement, f + (size_t)r * n[0]); }, 64);
+
+        // y : the rows of a z slice ; z : the slices of a row
+        parallelFor(n[2], [&](unsigned int begin, unsigned int end)
+                    {
+            Lines lines(n[1]);
+            for (unsigned int z = begin; z < end; ++z)
+                transformColumns(f + z * sliceSize, n[0], n[1], n[0], d[1] * d[1], lines); }, 1);
+        parallelFor(n[1], [&](unsigned int begin, unsigned int end)
+                    {
+            Lines lines(n[2]);
+            for (unsigned int y = begin; y < end; ++y)
+                transformColumns(f + (size_t)y * n[0], n[0], n[2], sliceSize, d[2] * d[2], lines); }, 1);
+    }
+
+    // distance along the row to the nearest feature voxel : forward and backward scans
+    static void rowDistance(unsigned char const *row, unsigned int n, float w2, bool const feature[256], bool complement, float *f)
+    {
+        float const infinity = std::numeric_limits<float>::infinity();
+        int last = -1;
+        for (unsigned int x = 0; x < n; ++x)
+        {
+            if (feature[row[x]] != complement)
+                last = (int)x;
+            f[x] = last < 0 ? infinity : float(x - last);
+        }
+        last = -1;
+        for (unsigned int x = n; x-- > 0;)
+        {
+            if (feature[row[x]] != complement)
+                last = (int)x;
+            if (last >= 0)
+                f[x] = std::min(f[x], float(last - (int)x));
+        }
+        for (unsigned int x = 0; x < n; ++x)
+            f[x] = f[x] * f[x] * w2;
+    }
+
+    // scratch of a thread for the lines of length n
+    struct Lines
+    {
+        std::vector<float> block; // columnBlock lines of n values
+        std::vector<float> transformed;
+        std::vector<unsigned int> v; // abscissae of the parabolas of the envelope
+        std::vector<double> z;       // their boundaries
+
+        Lines(unsigned int length) : block((size_t)columnBlock * length), transformed(length), v(length), z(length + 1) {}
+    };
+
+    // nColumns lines of n values, value i of column c at data[i * stride + c]
+    static void transformColumns(float *data, unsigned int nColumns, unsigned int n, size_t stride, float w2, Lines &lines)
+    {
+        for (unsigned int c0 = 0; c0 < nColumns; c0 += columnBlock)
+        {
+            unsigned int width = nColumns - c0 < columnBlock ? nColumns - c0 : columnBlock;
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                float const *row = data + i * stride + c0;
+                for (unsigned int c = 0; c < width; ++c)
+                    lines.block[(size_t)c * n + i] = row[c];
+            }
+            for (unsigned int c = 0; c < width; ++c)
+            {
+                float *line = &lines.block[(size_t)c * n];
+                envelope(line, n, w2, lines);
+                std::copy(lines.transformed.begin(), lines.transformed.end(), line);
+            }
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                float *row = data + i * stride + c0;
+                for (unsigned int c = 0; c < width; ++c)
+                    row[c] = lines.block[(size_t)c * n + i];
+            }
+        }
+    }
+
+    // lines.transformed[q] = min over p of f[p] + w2 (q - p)^2 ; the infinite f[p] are not
+    // parabolas of the envelope (their intersections would be undefined)
+    static void envelope(float const *f, unsigned int n, float w2, Lines &lines)
+    {
+        unsigned int *v = &lines.v[0];
+        double *z = &lines.z[0];
+        int k = -1;
+        for (unsigned int q = 0; q < n; ++q)
+        {
+            if (std::isinf(f[q]))
+                continue;
+            double fq = f[q] + double(w2) * q * q, s = 0.;
+            while (k >= 0)
+            {
+                double fv = f[v[k]] + double(w2) * v[k] * v[k];
+                s = (fq - fv) / (2. * w2 * (double(q) - v[k]));
+                if (s > z[k])
+                    break;
+                --k;
+            }
+            ++k;
+            v[k] = q;
+            z[k] = k == 0 ? -std::numeric_limits<double>::infinity() : s;
+        }
+        if (k < 0)
+        {
+            std::fill(lines.transformed.begin(), lines.transformed.end(), std::numeric_limits<float>::infinity());
+            return;
+        }
+        z[k + 1] = std::numeric_limits<double>::infinity();
+        int j = 0;
+        for (unsigned int q = 0; q < n; ++q)
+        {
+            while (z[j + 1] < q)
+                ++j;
+            double offset = double(q) - v[j];
+            lines.transformed[q] = float(w2 * offset * offset + f[v[j]]);
+        }
+    }
+};
+
+#endif // DISTANCETRANSFORM_H
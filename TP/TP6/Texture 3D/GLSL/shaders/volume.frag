@@ -6,6 +6,18 @@
 // --------------------------------------------------
 
 uniform sampler3D mask; // déclaration de la map mask
+uniform sampler1D labelColors; // couleur de chaque label, alpha nul pour un label caché
+uniform int labelMode; // 1 : mask contient les labels (R8), 0 : les couleurs (RGBA)
+
+// lancer de rayons : grille de macrocellules (255 : contient un label visible) pour sauter le vide
+uniform int rayMarching;
+uniform sampler3D occupancy;
+uniform int macrocellSize;
+uniform ivec3 volumeSize;
+uniform vec3 voxelSize;
+
+// niveau de détail : mipmap de mask lu (chaque niveau divise la résolution par 2)
+uniform int lod;
 
 uniform float xCutPosition;
 uniform float yCutPosition;
@@ -19,6 +31,10 @@ uniform float xMax;
 uniform float yMax;
 uniform float zMax;
 
+// boîte des labels visibles (statistiques des labels)
+uniform vec3 visibleMin;
+uniform vec3 visibleMax;
+
 uniform mat4 mv_matrix;
 uniform mat4 proj_matrix;
 
@@ -56,14 +72,100 @@ bool ComputeVisibility(vec3 point){
 	return true;
 }
 
-vec3 rayTrace(vec3 inpos){
+// voxel du niveau lod contenant un voxel de la pleine résolution (tailles des mipmaps arrondies
+// à l'inférieur : le dernier voxel d'un axe impair couvre aussi le reste, cf. LabelPyramid)
+ivec3 levelVoxelOf(ivec3 voxel){
+	return min(voxel >> lod, textureSize(mask, lod) - ivec3(1));
+}
+
+// voxel de la pleine résolution, lu au niveau lod
+vec4 sampleColor(ivec3 voxel){
+	vec4 color = texelFetch(mask, levelVoxelOf(voxel), lod);
+	if(labelMode == 1){
+		color = texelFetch(labelColors, int(color.r * 255. + 0.5), 0);
+	}
+	return color;
+}
+
+ivec3 voxelAt(vec3 p){
+	return clamp(ivec3(p / voxelSize), ivec3(0), volumeSize - ivec3(1));
+}
+
+// Même rendu que VolumeRenderer (CPU) : rayon limité à la boîte visible (les plans de coupe sont
+// alignés sur les axes), échantillons tous les demi voxels composés d'avant en arrière, éclairage
+// par la normale de la dernière face de voxel traversée. Une macrocellule vide est sautée d'un
+// pas de 3D-DDA jusqu'au premier échantillon après sa sortie.
+vec4 rayTrace(vec3 inpos){
 	vec3 camPos = (inverse(mv_matrix) * vec4(0, 0, 0, 1)).xyz;
 	vec3 dir = normalize(inpos - camPos);
 
-	//TODO raytrace
-
+	vec3 boxMin = vec3(xCutDirection > 0 ? max(0., xCutPosition) : 0.,
+	                   yCutDirection > 0 ? max(0., yCutPosition) : 0.,
+	                   zCutDirection > 0 ? max(0., zCutPosition) : 0.);
+	vec3 boxMax = vec3(xCutDirection > 0 ? xMax : min(xMax, xCutPosition),
+	                   yCutDirection > 0 ? yMax : min(yMax, yCutPosition),
+	                   zCutDirection > 0 ? zMax : min(zMax, zCutPosition));
+	boxMin = max(boxMin, visibleMin);
+	boxMax = min(boxMax, visibleMax);
+	// composantes nulles : la sortie de ce côté est à l'infini
+	vec3 safeDir = mix(dir, vec3(1e-6), lessThan(abs(dir), vec3(1e-6)));
+	vec3 invDir = 1. / safeDir;
+	vec3 t0 = (boxMin - camPos) * invDir;
+	vec3 t1 = (boxMax - camPos) * invDir;
+	vec3 tSmall = min(t0, t1);
+	vec3 tBig = max(t0, t1);
+	float tNear = max(max(tSmall.x, tSmall.y), max(tSmall.z, 0.));
+	float tFar = min(min(tBig.x, tBig.y), tBig.z);
+	if(tNear > tFar){
+		return vec4(0);
+	}
 
-	return vec3(0);
+	int axis = tSmall.x == tNear ? 0 : (tSmall.y == tNear ? 1 : 2);
+	float stepSize = 0.5 * min(voxelSize.x, min(voxelSize.y, voxelSize.z)) * float(1 << lod);
+	float tStart = tNear + 0.5 * stepSize;
+	vec4 result = vec4(0);
+	ivec3 previous = ivec3(-1);
+	float i = 0.;
+	for(int iteration = 0; iteration < 8192; ++iteration){
+		float t = tStart + i * stepSize;
+		if(t > tFar){
+			break;
+		}
+		ivec3 voxel = voxelAt(camPos + t * dir);
+		ivec3 cell = voxel / macrocellSize;
+		if(texelFetch(occupancy, cell, 0).r == 0.){
+			vec3 boundary = vec3(cell + ivec3(greaterThan(dir, vec3(0)))) * float(macrocellSize) * voxelSize;
+			vec3 tExit = mix((boundary - camPos) * invDir, vec3(1e30), lessThan(abs(dir), vec3(1e-6)));
+			float next = floor((min(tExit.x, min(tExit.y, tExit.z)) - tStart) / stepSize) + 1.;
+			i = max(i + 1., next);
+			previous = levelVoxelOf(voxelAt(camPos + (tStart + (i - 1.) * stepSize) * dir));
+			continue;
+		}
+
+		// axe de la face traversée (le plus aligné avec le rayon si plusieurs), au niveau lod
+		ivec3 levelVoxel = levelVoxelOf(voxel);
+		float changedDir = -1.;
+		for(int c = 0; c < 3; ++c){
+			if(previous.x >= 0 && levelVoxel[c] != previous[c] && abs(dir[c]) > changedDir){
+				axis = c;
+				changedDir = abs(dir[c]);
+			}
+		}
+		previous = levelVoxel;
+
+		vec4 color = sampleColor(voxel);
+		if(color.a > 0.){
+			float a = color.a >= 1. ? 1. : 1. - pow(1. - color.a, 0.5 * float(1 << lod));
+			float shade = 0.3 + 0.7 * abs(dir[axis]);
+			result.rgb += (1. - result.a) * a * shade * color.rgb;
+			result.a += (1. - result.a) * a;
+			if(result.a >= 0.99){
+				break;
+			}
+		}
+		i += 1.;
+	}
+	return result;
 }
 
 // --------------------------------------------------
@@ -71,10 +173,23 @@ vec3 rayTrace(vec3 inpos){
 // --------------------------------------------------
 void main() {
 
+	if(rayMarching == 1){
+		vec4 color = rayTrace(position);
+		if(color.a == 0.){
+			discard;
+		}
+		gl_FragColor = vec4(color.rgb / color.a, color.a);
+		return;
+	}
+
 	if(!ComputeVisibility(position)){
 		discard;
 	}
 
 	//TODO fetch color in texture
-	gl_FragColor = texture3D(mask, textCoord);
+	vec4 color = sampleColor(voxelAt(position));
+	if(labelMode == 1 && color.a == 0.){
+		discard;
+	}
+	gl_FragColor = color;
 }
@@ -0,0 +1,443 @@
+#ifndef IMAVOLUME_H
+#define IMAVOLUME_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// .dim / .ima label volumes (GIS format).
+//   .dim : "nx ny nz [nt]" followed by options, in any order :
+//          -type U8|S8|S16|U16|FLOAT   -dx -dy -dz   -bo DCBA (little endian) | ABCD (big endian)
+//   .ima : the raw voxels, x first, then y, then z.
+//
+// The .ima is mapped in memory (no temporary buffer) and decoded in parallel chunks ;
+// the labels are found with a histogram (256 bins, 65536 for 16-bit images) merged
+// from one histogram per chunk. An U8 image is not converted at all : voxels() points
+// into the mapping, which is kept while the volume is open.
+// Labels are unsigned char for the viewer : 16-bit labels that do not fit are renumbered
+// in increasing order, 0 staying 0, or from 1 if the file has no 0 (sourceLabel() gives back
+// the value of the file).
+//
+//-------------------------------------------------------------------------------------//
+
+enum ImaVoxelType
+{
+    IMA_U8,
+    IMA_S16,
+    IMA_U16,
+    IMA_FLOAT
+};
+
+struct ImaHeader
+{
+    unsigned int nx, ny, nz;
+    float dx, dy, dz;
+    ImaVoxelType type;
+    bool bigEndian;
+
+    ImaHeader() : nx(0), ny(0), nz(0), dx(1.f), dy(1.f), dz(1.f), type(IMA_U8), bigEndian(false) {}
+
+    size_t numberOfVoxels() const { return (size_t)nx * ny * nz; }
+
+    unsigned int bytesPerVoxel() const
+    {
+        switch (type)
+        {
+        case IMA_S16:
+        case IMA_U16:
+            return 2;
+        case IMA_FLOAT:
+            return 4;
+        default:
+            return 1;
+        }
+    }
+
+    bool read(std::string const &dimFileName, std::string *error = NULL)
+    {
+        std::ifstream dimFile(dimFileName.c_str());
+        if (!dimFile.is_open())
+            return fail(error, dimFileName + " cannot be opened");
+
+        *this = ImaHeader();
+        if (!(dimFile >> nx >> ny >> nz) || nx == 0 || ny == 0 || nz == 0)
+            return fail(error, dimFileName + " : bad dimensions");
+
+        std::string token;
+        while (dimFile >> token)
+        {
+            if (token == "-type")
+            {
+                std::string t;
+                dimFile >> t;
+                if (t == "U8" || t == "S8")
+                    type = IMA_U8;
+                else if (t == "S16")
+                    type = IMA_S16;
+                else if (t == "U16")
+                    type = IMA_U16;
+                else if (t == "FLOAT")
+                    type = IMA_FLOAT;
+                else
+                    return fail(error, dimFileName + " : unsupported voxel type " + t);
+            }
+            else if (token == "-dx")
+                dimFile >> dx;
+            else if (token == "-dy")
+                dimFile >> dy;
+            else if (token == "-dz")
+                dimFile >> dz;
+            else if (token == "-bo")
+            {
+                std::string order;
+                dimFile >> order;
+                if (order == "ABCD" || order == "4321")
+                    bigEndian = true;
+                else if (order == "DCBA" || order == "1234")
+                    bigEndian = false;
+                else
+                    return fail(error, dimFileName + " : unknown byte order " + order);
+            }
+            else if (token == "-om")
+            {
+                std::string mode;
+                dimFile >> mode;
+                if (mode != "binar")
+                    return fail(error, dimFileName + " : only binary .ima files are supported");
+            }
+            // other options (-dt, -dimt ...) and the number of frames are ignored
+        }
+        if (!(dx > 0.f && dy > 0.f && dz > 0.f))
+            return fail(error, dimFileName + " : bad voxel size");
+        return true;
+    }
+
+    static bool fail(std::string *error, std::string const &message)
+    {
+        if (error)
+            *error = message;
+        return false;
+    }
+};
+
+// read-only mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() : address(NULL), length(0) {}
+    ~MappedFile() { close(); }
+
+    bool open(std::string const &fileName)
+    {
+        close();
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void *a = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (a == MAP_FAILED)
+            return false;
+        address = a;
+        length = (size_t)st.st_size;
+        madvise(address, length, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    void close()
+    {
+        if (address)
+            munmap(address, length);
+        address = NULL;
+        length = 0;
+    }
+
+    unsigned char const *data() const { return (unsigned char const *)address; }
+    size_t size() const { return length; }
+
+private:
+    void *address;
+    size_t length;
+
+    MappedFile(MappedFile const &);
+    MappedFile &operator=(MappedFile const &);
+};
+
+class ImaVolume
+{
+public:
+    ImaVolume() : voxelData(NULL) { clear(); }
+
+    bool open(std::string const &dimFileName, std::string *error = NULL)
+    {
+        clear();
+        ImaHeader h;
+        if (!h.read(dimFileName, error))
+            return false;
+
+        std::string imaFileName = imaFileNameOf(dimFileName);
+        if (!file.open(imaFileName))
+            return ImaHeader::fail(error, imaFileName + " cannot be mapped");
+
+        size_t n = h.numberOfVoxels();
+        if (n > 0xFFFFFFFFu || file.size() < n * h.bytesPerVoxel())
+        {
+            std::ostringstream s;
+            if (n > 0xFFFFFFFFu)
+                s << dimFileName << " : too many voxels";
+            else
+                s << imaFileName << " : " << file.size() << " bytes, " << n * h.bytesPerVoxel() << " expected";
+            file.close();
+            return ImaHeader::fail(error, s.str());
+        }
+        header = h;
+
+        if (header.type == IMA_U8)
+            decodeU8();
+        else if (header.type == IMA_FLOAT)
+            decodeFloat();
+        else
+            decode16();
+        return true;
+    }
+
+    void clear()
+    {
+        file.close();
+        std::vector<unsigned char>().swap(decoded);
+        voxelData = NULL;
+        labels.clear();
+        sourceLabels.clear();
+        labelCounts.assign(256, 0);
+        header = ImaHeader();
+    }
+
+    bool empty() const { return voxelData == NULL; }
+    ImaHeader const &getHeader() const { return header; }
+
+    // nx * ny * nz labels, valid until clear() / open()
+    unsigned char const *voxels() const { return voxelData; }
+    unsigned char at(unsigned int x, unsigned int y, unsigned int z) const
+    {
+        return voxelData[((size_t)z * header.ny + y) * header.nx + x];
+    }
+    // true if voxels() reads the file mapping directly
+    bool isZeroCopy() const { return voxelData != NULL && decoded.empty(); }
+
+    // labels present in the volume, in increasing order
+    std::vector<unsigned char> const &getLabels() const { return labels; }
+    // value in the .ima of labels[i]
+    int sourceLabel(unsigned int i) const { return sourceLabels[i]; }
+    // number of voxels of each label value (256 entries)
+    std::vector<size_t> const &getLabelCounts() const { return labelCounts; }
+
+    // writes header.numberOfVoxels() voxels of header.type (distances, ...) as a .dim / .ima
+    // pair, in the byte order of the host
+    static bool write(std::string const &dimFileName, ImaHeader const &header, void const *voxels, std::string *error = NULL)
+    {
+        static char const *typeNames[] = {"U8", "S16", "U16", "FLOAT"};
+        std::string imaFileName = imaFileNameOf(dimFileName);
+        if (imaFileName == dimFileName)
+            return ImaHeader::fail(error, dimFileName + " : .dim file name expected");
+        std::ofstream dimFile(dimFileName.c_str());
+        dimFile << header.nx << " " << header.ny << " " << header.nz << " 1\n"
+                << "-type " << typeNames[header.type] << "\n"
+                << "-dx " << header.dx << "\n-dy " << header.dy << "\n-dz " << header.dz << "\n"
+                << "-bo " << (hostIsBigEndian() ? "ABCD" : "DCBA") << "\n"
+                << "-om binar\n";
+        if (!dimFile)
+            return ImaHeader::fail(error, dimFileName + " cannot be written");
+
+        std::ofstream imaFile(imaFileName.c_str(), std::ios::binary);
+        imaFile.write((char const *)voxels, header.numberOfVoxels() * header.bytesPerVoxel());
+        if (!imaFile)
+            return ImaHeader::fail(error, imaFileName + " cannot be written");
+        return true;
+    }
+
+    static std::string imaFileNameOf(std::string const &dimFileName)
+    {
+        std::string imaFileName = dimFileName;
+        size_t dot = imaFileName.rfind(".dim");
+        if (dot != std::string::npos)
+            imaFileName.replace(dot, 4, ".ima");
+        return imaFileName;
+    }
+
+private:
+    ImaHeader header;
+    MappedFile file;
+    std::vector<unsigned char> decoded;
+    unsigned char const *voxelData;
+    std::vector<unsigned char> labels;
+    std::vector<int> sourceLabels;
+    std::vector<size_t> labelCounts;
+
+    static const unsigned int chunkSize = 1 << 18;
+
+    static bool hostIsBigEndian()
+    {
+        uint16_t one = 1;
+        unsigned char first;
+        std::memcpy(&first, &one, 1);
+        return first == 0;
+    }
+
+    unsigned int numberOfVoxels() const { return (unsigned int)header.numberOfVoxels(); }
+
+    // labels / labelCounts from the 256-bin histogram of the decoded voxels
+    void labelsFromCounts()
+    {
+        for (unsigned int l = 0; l < 256; ++l)
+        {
+            if (labelCounts[l] == 0)
+                continue;
+            labels.push_back((unsigned char)l);
+            sourceLabels.push_back((int)l);
+        }
+    }
+
+    void decodeU8()
+    {
+        voxelData = file.data();
+        std::mutex merge;
+        parallelFor(numberOfVoxels(), [&](unsigned int begin, unsigned int end)
+                    {
+            size_t local[256] = {0};
+            for (unsigned int i = begin; i < end; ++i)
+                ++local[voxelData[i]];
+            std::lock_guard<std::mutex> lock(merge);
+            for (unsigned int l = 0; l < 256; ++l)
+                labelCounts[l] += local[l]; }, chunkSize);
+        labelsFromCounts();
+    }
+
+    void decodeFloat()
+    {
+        decoded.resize(numberOfVoxels());
+        unsigned char const *in = file.data();
+        bool swap = header.bigEndian != hostIsBigEndian();
+        std::mutex merge;
+        parallelFor(numberOfVoxels(), [&](unsigned int begin, unsigned int end)
+                    {
+            size_t local[256] = {0};
+            for (unsigned int i = begin; i < end; ++i)
+            {
+                uint32_t bits;
+                std::memcpy(&bits, in + 4 * (size_t)i, 4);
+                if (swap)
+                    bits = (bits >> 24) | ((bits >> 8) & 0xFF00u) | ((bits << 8) & 0xFF0000u) | (bits << 24);
+                float v;
+                std::memcpy(&v, &bits, 4);
+                // truncated like before ; NaN and negative values are background
+                unsigned char label = v >= 1.f ? (unsigned char)std::min(v, 255.f) : 0;
+                decoded[i] = label;
+                ++local[label];
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            for (unsigned int l = 0; l < 256; ++l)
+                labelCounts[l] += local[l]; }, chunkSize);
+        voxelData = &decoded[0];
+        labelsFromCounts();
+    }
+
+    void decode16()
+    {
+        decoded.resize(numberOfVoxels());
+        unsigned char const *in = file.data();
+        bool swap = header.bigEndian != hostIsBigEndian();
+        std::vector<size_t> histogram(65536, 0);
+        std::mutex merge;
+        auto sample = [in, swap](unsigned int i)
+        {
+            uint16_t v;
+            std::memcpy(&v, in + 2 * (size_t)i, 2);
+            return swap ? (uint16_t)((v >> 8) | (v << 8)) : v;
+        };
+        parallelFor(numberOfVoxels(), [&](unsigned int begin, unsigned int end)
+                    {
+            std::vector<unsigned int> local(65536, 0);
+            for (unsigned int i = begin; i < end; ++i)
+            {
+                uint16_t v = sample(i);
+                decoded[i] = (unsigned char)v;
+                ++local[v];
+            }
+            std::lock_guard<std::mutex> lock(merge);
+            for (unsigned int l = 0; l < 65536; ++l)
+                histogram[l] += local[l]; }, chunkSize);
+        voxelData = &decoded[0];
+
+        // 0 (the background) first, then the values in increasing order (negative S16 values first)
+        std::vector<uint16_t> values;
+        if (histogram[0] != 0)
+            values.push_back(0);
+        for (unsigned int j = 0; j < 65536; ++j)
+        {
+            uint16_t v = header.type == IMA_S16 ? (uint16_t)(j + 32768) : (uint16_t)j;
+            if (v != 0 && histogram[v] != 0)
+                values.push_back(v);
+        }
+        bool fits = true;
+        for (size_t j = 0; j < values.size(); ++j)
+            fits = fits && values[j] < 256;
+        if (fits)
+            std::sort(values.begin(), values.end());
+        // without background, the renumbered labels start at 1 : 0 stays the background of the viewer
+        unsigned int first = histogram[0] != 0 ? 0 : 1;
+
+        if (fits || values.size() + first > 256)
+        {
+            if (!fits)
+                std::cerr << "ImaVolume : " << values.size() << " labels, only the low byte of each value is kept" << std::endl;
+            for (unsigned int v = 0; v < 65536; ++v)
+                labelCounts[v & 0xFF] += histogram[v];
+            for (unsigned int l = 0; l < 256; ++l)
+            {
+                if (labelCounts[l] == 0)
+                    continue;
+                labels.push_back((unsigned char)l);
+                sourceLabels.push_back(fits ? (int)l : -1);
+            }
+            return;
+        }
+
+        // renumber : label first + i is the i-th value of the file, the background stays 0
+        std::vector<unsigned char> renumber(65536, 0);
+        for (size_t j = 0; j < values.size(); ++j)
+        {
+            unsigned int l = first + j;
+            renumber[values[j]] = (unsigned char)l;
+            labels.push_back((unsigned char)l);
+            sourceLabels.push_back(header.type == IMA_S16 ? (int)(int16_t)values[j] : (int)values[j]);
+            labelCounts[l] = histogram[values[j]];
+        }
+        parallelFor(numberOfVoxels(), [&](unsigned int begin, unsigned int end)
+                    {
+            for (unsigned int i = begin; i < end; ++i)
+                decoded[i] = renumber[sample(i)]; }, chunkSize);
+    }
+};
+
+#endif // IMAVOLUME_H
@@ -0,0 +1,141 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <algorithm>
+
+//-------------------------------------------------------------------------------------//
+//
+// RGB 8 bits images (rows from top to bottom) to .ppm (P6) or .png, without Qt or zlib :
+// the png is written with stored (not compressed) deflate blocks.
+//
+//-------------------------------------------------------------------------------------//
+
+inline bool writePPM(std::string const &fileName, std::vector<unsigned char> const &rgb, unsigned int width, unsigned int height)
+{
+    std::ofstream file(fileName.c_str(), std::ios::binary);
+    if (!file.is_open())
+        return false;
+    file << "P6\n"
+         << width << " " << height << "\n255\n";
+    file.write((char const *)&rgb[0], (std::streamsize)width * height * 3);
+    return file.good();
+}
+
+class PNGChunkWriter
+{
+public:
+    explicit PNGChunkWriter(std::ofstream &_file) : file(_file) {}
+
+    void write(char const type[4], std::vector<unsigned char> const &data)
+    {
+        unsigned char header[8];
+        writeBigEndian(header, (uint32_t)data.size());
+        for (int i = 0; i < 4; ++i)
+            header[4 + i] = (unsigned char)type[i];
+        file.write((char const *)header, 8);
+        if (!data.empty())
+            file.write((char const *)&data[0], (std::streamsize)data.size());
+        uint32_t c = crc(0xFFFFFFFFu, header + 4, 4);
+        if (!data.empty())
+            c = crc(c, &data[0], data.size());
+        unsigned char footer[4];
+        writeBigEndian(footer, c ^ 0xFFFFFFFFu);
+        file.write((char const *)footer, 4);
+    }
+
+    static void writeBigEndian(unsigned char *out, uint32_t v)
+    {
+        out[0] = (unsigned char)(v >> 24);
+        out[1] = (unsigned char)(v >> 16);
+        out[2] = (unsigned char)(v >> 8);
+        out[3] = (unsigned char)v;
+    }
+
+private:
+    std::ofstream &file;
+
+    static uint32_t crc(uint32_t c, unsigned char const *data, size_t n)
+    {
+        static uint32_t table[256];
+        static bool tableReady = false;
+        if (!tableReady)
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t t = i;
+                for (int k = 0; k < 8; ++k)
+                    t = (t & 1) ? 0xEDB88320u ^ (t >> 1) : t >> 1;
+                table[i] = t;
+            }
+            tableReady = true;
+        }
+        for (size_t i = 0; i < n; ++i)
+            c = table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+        return c;
+    }
+};
+
+inline bool writePNG(std::string const &fileName, std::vector<unsigned char> const &rgb, unsigned int width, unsigned int height)
+{
+    std::ofstream file(fileName.c_str(), std::ios::binary);
+    if (!file.is_open())
+        return false;
+    static unsigned char const signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    file.write((char const *)signature, 8);
+    PNGChunkWriter chunks(file);
+
+    std::vector<unsigned char> ihdr(13, 0);
+    PNGChunkWriter::writeBigEndian(&ihdr[0], width);
+    PNGChunkWriter::writeBigEndian(&ihdr[4], height);
+    ihdr[8] = 8; // bits per channel
+    ihdr[9] = 2; // RGB
+    chunks.write("IHDR", ihdr);
+
+    // rows prefixed by the filter type 0, in stored deflate blocks of at most 65535 bytes
+    size_t rowSize = (size_t)width * 3 + 1;
+    size_t rawSize = rowSize * height;
+    std::vector<unsigned char> idat;
+    idat.reserve(rawSize + 6 + 5 * (rawSize / 65535 + 1));
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    uint32_t a = 1, b = 0;
+    size_t written = 0;
+    do
+    {
+        size_t blockSize = std::min<size_t>(65535, rawSize - written);
+        idat.push_back(written + blockSize == rawSize ? 1 : 0);
+        idat.push_back((unsigned char)blockSize);
+        idat.push_back((unsigned char)(blockSize >> 8));
+        idat.push_back((unsigned char)~blockSize);
+        idat.push_back((unsigned char)(~blockSize >> 8));
+        for (size_t i = written; i < written + blockSize; ++i)
+        {
+            size_t row = i / rowSize, column = i % rowSize;
+            unsigned char v = column == 0 ? 0 : rgb[row * width * 3 + column - 1];
+            idat.push_back(v);
+            a = (a + v) % 65521;
+            b = (b + a) % 65521;
+        }
+        written += blockSize;
+    } while (written < rawSize);
+    unsigned char adler[4];
+    PNGChunkWriter::writeBigEndian(adler, (b << 16) | a);
+    idat.insert(idat.end(), adler, adler + 4);
+    chunks.write("IDAT", idat);
+    chunks.write("IEND", std::vector<unsigned char>());
+    return file.good();
+}
+
+// .png if the name ends with .png, .ppm otherwise
+inline bool writeImage(std::string const &fileName, std::vector<unsigned char> const &rgb, unsigned int width, unsigned int height)
+{
+    if (fileName.size() > 4 && fileName.compare(fileName.size() - 4, 4, ".png") == 0)
+        return writePNG(fileName, rgb, width, height);
+    return writePPM(fileName, rgb, width, height);
+}
+
+#endif // IMAGEWRITER_H
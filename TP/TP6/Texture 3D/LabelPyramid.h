@@ -0,0 +1,139 @@
+#ifndef LABELPYRAMID_H
+#define LABELPYRAMID_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Multi-resolution pyramid of a label volume : level l + 1 has a voxel per 2x2x2 voxels
+// of level l, whose label is the most frequent of these voxels. The sizes are the ones of
+// the GL mipmaps, max(1, n / 2) rounded down : on an odd size, the last voxel of the axis
+// also covers the last voxel of level l (3 voxels instead of 2). Labels are never averaged ;
+// on a tie the background (0) loses, then the first voxel (x first) wins, so that thin
+// structures do not vanish at the first levels.
+// Level 0 is the volume itself (kept by pointer), the other levels are built in parallel
+// (z slices of the coarse level).
+//
+// As long as 2^level is at most the macrocell size, a coarse voxel is inside one
+// macrocell (but the last ones of an odd axis) : its label is one of the labels of the
+// macrocell, and the empty space skipping of the full resolution stays valid at this level.
+// Voxel v of level 0 is in voxel min(v >> l, size(l) - 1) of level l.
+//
+//-------------------------------------------------------------------------------------//
+
+class LabelPyramid
+{
+public:
+    LabelPyramid() : base(NULL) {}
+
+    // levels 0..maxLevel at most, up to a 1x1x1 level
+    void build(unsigned char const *voxels, unsigned int nx, unsigned int ny, unsigned int nz,
+               float dx, float dy, float dz, unsigned int maxLevel)
+    {
+        base = voxels;
+        levels.assign(1, Level());
+        Level &level0 = levels[0];
+        level0.n[0] = nx;
+        level0.n[1] = ny;
+        level0.n[2] = nz;
+        level0.d[0] = dx;
+        level0.d[1] = dy;
+        level0.d[2] = dz;
+        while (levels.size() <= maxLevel && (levels.back().n[0] > 1 || levels.back().n[1] > 1 || levels.back().n[2] > 1))
+        {
+            levels.push_back(Level());
+            Level const &fine = levels[levels.size() - 2];
+            Level &coarse = levels.back();
+            for (int c = 0; c < 3; ++c)
+            {
+                coarse.n[c] = std::max(1u, fine.n[c] / 2);
+                coarse.d[c] = fine.d[c] * fine.n[c] / coarse.n[c]; // mean size : same extent as level 0
+            }
+            coarse.voxels.resize((size_t)coarse.n[0] * coarse.n[1] * coarse.n[2]);
+            downsample(levels.size() == 2 ? base : &fine.voxels[0], fine.n, coarse);
+        }
+    }
+
+    void clear()
+    {
+        base = NULL;
+        levels.clear();
+    }
+
+    bool empty() const { return levels.empty(); }
+    unsigned int numberOfLevels() const { return (unsigned int)levels.size(); }
+
+    unsigned char const *voxels(unsigned int level) const { return level == 0 ? base : &levels[level].voxels[0]; }
+    unsigned int size(unsigned int level, int axis) const { return levels[level].n[axis]; }
+    float voxelSize(unsigned int level, int axis) const { return levels[level].d[axis]; }
+
+    // level whose voxels are about one pixel wide, given the pixels covered by a voxel of
+    // level 0 ; one level coarser during an interaction
+    static unsigned int levelFor(float pixelsPerVoxel, bool interacting, unsigned int nLevels)
+    {
+        int level = pixelsPerVoxel > 0.f && pixelsPerVoxel < 1.f ? int(std::floor(-std::log2(pixelsPerVoxel))) : 0;
+        if (interacting)
+            ++level;
+        return (unsigned int)std::min<int>(level, int(nLevels) - 1);
+    }
+
+private:
+    struct Level
+    {
+        unsigned int n[3];
+        float d[3];
+        std::vector<unsigned char> voxels; // empty for level 0
+    };
+
+    unsigned char const *base;
+    std::vector<Level> levels;
+
+    static void downsample(unsigned char const *fine, unsigned int const nf[3], Level &coarse)
+    {
+        unsigned int const *nc = coarse.n;
+        parallelFor(nc[2], [&](unsigned int begin, unsigned int end)
+                    {
+            unsigned char block[27];
+            for (unsigned int z = begin; z < end; ++z)
+                for (unsigned int y = 0; y < nc[1]; ++y)
+                    for (unsigned int x = 0; x < nc[0]; ++x)
+                    {
+                        int count = 0;
+                        for (unsigned int fz = 2 * z; fz < last(z, nc[2], nf[2]); ++fz)
+                            for (unsigned int fy = 2 * y; fy < last(y, nc[1], nf[1]); ++fy)
+                                for (unsigned int fx = 2 * x; fx < last(x, nc[0], nf[0]); ++fx)
+                                    block[count++] = fine[((size_t)fz * nf[1] + fy) * nf[0] + fx];
+                        coarse.voxels[((size_t)z * nc[1] + y) * nc[0] + x] = majority(block, count);
+                    } }, 1);
+    }
+
+    // end of the fine voxels of coarse voxel c along an axis : the last one takes the rest
+    static unsigned int last(unsigned int c, unsigned int nc, unsigned int nf)
+    {
+        return c + 1 == nc ? nf : 2 * c + 2;
+    }
+
+    static unsigned char majority(unsigned char const *block, int count)
+    {
+        unsigned char best = block[0];
+        int bestVotes = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            int votes = 0;
+            for (int j = 0; j < count; ++j)
+                votes += block[j] == block[i];
+            if (votes > bestVotes || (votes == bestVotes && best == 0 && block[i] != 0))
+            {
+                best = block[i];
+                bestVotes = votes;
+            }
+        }
+        return best;
+    }
+};
+
+#endif // LABELPYRAMID_H
@@ -0,0 +1,189 @@
+#ifndef LABELSTATISTICS_H
+#define LABELSTATISTICS_H
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <algorithm>
+
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Statistics of each label of a volume, in one parallel pass (z slabs, merged at the
+// end) : number of voxels, physical volume, bounding box (voxel indices, inclusive) and
+// centroid (in the space of Texture, voxel (i, j, k) centered at ((i + 0.5) dx, ...)).
+// As MacrocellGrid, it can also be built block by block (bricks) : reset(), addBlock()
+// or addUniformBlock(), then finish().
+//
+//-------------------------------------------------------------------------------------//
+
+struct LabelStatistic
+{
+    uint64_t count;
+    double volume;
+    unsigned int min[3], max[3]; // empty box (min > max) when count is 0
+    double centroid[3];
+};
+
+class LabelStatistics
+{
+public:
+    LabelStatistics() { reset(0, 0, 0, 1.f, 1.f, 1.f); }
+
+    void compute(unsigned char const *voxels, unsigned int nx, unsigned int ny, unsigned int nz, float dx, float dy, float dz)
+    {
+        reset(nx, ny, nz, dx, dy, dz);
+        std::mutex merge;
+        parallelFor(nz, [&](unsigned int begin, unsigned int end)
+                    {
+            Partial partial;
+            unsigned int origin[3] = {0, 0, begin}, extent[3] = {nx, ny, end - begin};
+            partial.addBlock(voxels + (size_t)begin * nx * ny, origin, extent);
+            std::lock_guard<std::mutex> lock(merge);
+            total.merge(partial); }, 1);
+        finish();
+    }
+
+    void reset(unsigned int nx, unsigned int ny, unsigned int nz, float dx, float dy, float dz)
+    {
+        n[0] = nx;
+        n[1] = ny;
+        n[2] = nz;
+        d[0] = dx;
+        d[1] = dy;
+        d[2] = dz;
+        total = Partial();
+        finish();
+    }
+
+    // block of extent[0] x extent[1] x extent[2] voxels at origin, x first
+    void addBlock(unsigned char const *block, unsigned int const origin[3], unsigned int const extent[3]) { total.addBlock(block, origin, extent); }
+    void addUniformBlock(unsigned char label, unsigned int const origin[3], unsigned int const extent[3]) { total.addUniformBlock(label, origin, extent); }
+
+    void finish()
+    {
+        double voxelVolume = double(d[0]) * d[1] * d[2];
+        for (unsigned int l = 0; l < 256; ++l)
+        {
+            LabelStatistic &s = statistics[l];
+            s.count = total.count[l];
+            s.volume = s.count * voxelVolume;
+            for (int c = 0; c < 3; ++c)
+            {
+                s.min[c] = total.min[l][c];
+                s.max[c] = total.max[l][c];
+                s.centroid[c] = s.count ? (total.sum[l][c] / double(s.count) + 0.5) * d[c] : 0.;
+            }
+        }
+    }
+
+    LabelStatistic const &operator[](unsigned char label) const { return statistics[label]; }
+
+    // union of the boxes of the labels whose visible[label] is true ; false if none has voxels
+    bool visibleBox(bool const visible[256], unsigned int min[3], unsigned int max[3]) const
+    {
+        bool found = false;
+        for (unsigned int l = 0; l < 256; ++l)
+        {
+            if (!visible[l] || statistics[l].count == 0)
+                continue;
+            for (int c = 0; c < 3; ++c)
+            {
+                min[c] = found ? std::min(min[c], statistics[l].min[c]) : statistics[l].min[c];
+                max[c] = found ? std::max(max[c], statistics[l].max[c]) : statistics[l].max[c];
+            }
+            found = true;
+        }
+        return found;
+    }
+
+private:
+    struct Partial
+    {
+        uint64_t count[256];
+        double sum[256][3]; // of the voxel indices
+        unsigned int min[256][3], max[256][3];
+
+        Partial()
+        {
+            for (unsigned int l = 0; l < 256; ++l)
+            {
+                count[l] = 0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    sum[l][c] = 0.;
+                    min[l][c] = ~0u;
+                    max[l][c] = 0;
+                }
+            }
+        }
+
+        // the rows are counted by runs : the sums of x over a run are closed form
+        void addBlock(unsigned char const *block, unsigned int const origin[3], unsigned int const extent[3])
+        {
+            for (unsigned int z = 0; z < extent[2]; ++z)
+                for (unsigned int y = 0; y < extent[1]; ++y)
+                {
+                    unsigned char const *row = block + ((size_t)z * extent[1] + y) * extent[0];
+                    for (unsigned int x = 0; x < extent[0];)
+                    {
+                        unsigned int end = x + 1;
+                        while (end < extent[0] && row[end] == row[x])
+                            ++end;
+                        unsigned int first[3] = {origin[0] + x, origin[1] + y, origin[2] + z};
+                        unsigned int last[3] = {origin[0] + end - 1, first[1], first[2]};
+                        addRun(row[x], first, last);
+                        x = end;
+                    }
+                }
+        }
+
+        void addUniformBlock(unsigned char label, unsigned int const origin[3], unsigned int const extent[3])
+        {
+            uint64_t c = (uint64_t)extent[0] * extent[1] * extent[2];
+            count[label] += c;
+            for (int a = 0; a < 3; ++a)
+            {
+                sum[label][a] += double(c) * (origin[a] + 0.5 * (extent[a] - 1));
+                min[label][a] = std::min(min[label][a], origin[a]);
+                max[label][a] = std::max(max[label][a], origin[a] + extent[a] - 1);
+            }
+        }
+
+        void addRun(unsigned char label, unsigned int const first[3], unsigned int const last[3])
+        {
+            uint64_t length = last[0] - first[0] + 1;
+            count[label] += length;
+            sum[label][0] += 0.5 * double(first[0] + last[0]) * length;
+            sum[label][1] += double(first[1]) * length;
+            sum[label][2] += double(first[2]) * length;
+            for (int a = 0; a < 3; ++a)
+            {
+                min[label][a] = std::min(min[label][a], first[a]);
+                max[label][a] = std::max(max[label][a], last[a]);
+            }
+        }
+
+        void merge(Partial const &other)
+        {
+            for (unsigned int l = 0; l < 256; ++l)
+            {
+                count[l] += other.count[l];
+                for (int a = 0; a < 3; ++a)
+                {
+                    sum[l][a] += other.sum[l][a];
+                    min[l][a] = std::min(min[l][a], other.min[l][a]);
+                    max[l][a] = std::max(max[l][a], other.max[l][a]);
+                }
+            }
+        }
+    };
+
+    unsigned int n[3];
+    float d[3];
+    Partial total;
+    LabelStatistic statistics[256];
+};
+
+#endif // LABELSTATISTICS_H
@@ -0,0 +1,317 @@
+#ifndef LABELSURFACE_H
+#define LABELSURFACE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <fstream>
+#include <cstdint>
+#include <algorithm>
+
+#include "ParallelFor.h"
+#include "MacrocellGrid.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Surfaces of labels (surface nets) : the dual grid has a cell between each 2x2x2 voxel
+// centers, the voxels outside the volume being outside. A cell whose corners are both
+// inside and outside gets one vertex, at the mean of the middles of its crossed edges,
+// and each pair of neighbor voxels inside / outside gives a quad joining the vertices of
+// the 4 cells around it. The mesh is indexed and closed (see LabelMesh::isClosed).
+//
+// Positions are in the space of Texture (voxel (i, j, k) centered at ((i + 0.5) dx, ...)).
+//
+// Extraction in parallel by z slabs of cells, in two passes :
+//   1. the vertices of the slab, with a hash cell -> vertex ;
+//   2. the quads of the edges of the cells of the slab, looking up the vertices of the
+//      previous slab in its hash (read only by then), so that slabs share their vertices.
+// With a MacrocellGrid, the blocks of cells around macrocells without the label are skipped.
+//
+//-------------------------------------------------------------------------------------//
+
+struct LabelMesh
+{
+    std::vector<float> positions;         // x y z
+    std::vector<unsigned int> triangles; // 3 vertex indices
+
+    unsigned int numberOfVertices() const { return (unsigned int)(positions.size() / 3); }
+    unsigned int numberOfTriangles() const { return (unsigned int)(triangles.size() / 3); }
+
+    void clear()
+    {
+        positions.clear();
+        triangles.clear();
+    }
+
+    void append(LabelMesh const &other)
+    {
+        unsigned int offset = numberOfVertices();
+        positions.insert(positions.end(), other.positions.begin(), other.positions.end());
+        for (size_t i = 0; i < other.triangles.size(); ++i)
+            triangles.push_back(other.triangles[i] + offset);
+    }
+
+    // true if every edge is used as many times in each direction (no border, consistent
+    // orientation) ; voxels touching by an edge make edges with 4 triangles
+    bool isClosed() const
+    {
+        std::map<std::pair<unsigned int, unsigned int>, int> edges;
+        for (size_t t = 0; t < triangles.size(); t += 3)
+            for (int e = 0; e < 3; ++e)
+            {
+                unsigned int a = triangles[t + e], b = triangles[t + (e + 1) % 3];
+                edges[std::make_pair(std::min(a, b), std::max(a, b))] += a < b ? 1 : -1;
+            }
+        for (std::map<std::pair<unsigned int, unsigned int>, int>::const_iterator it = edges.begin(); it != edges.end(); ++it)
+            if (it->second != 0)
+                return false;
+        return true;
+    }
+
+    bool writeOFF(std::string const &fileName) const
+    {
+        std::ofstream file(fileName.c_str());
+        if (!file.is_open())
+            return false;
+        file << "OFF\n"
+             << numberOfVertices() << " " << numberOfTriangles() << " 0\n";
+        for (size_t i = 0; i < positions.size(); i += 3)
+            file << positions[i] << " " << positions[i + 1] << " " << positions[i + 2] << "\n";
+        for (size_t t = 0; t < triangles.size(); t += 3)
+            file << "3 " << triangles[t] << " " << triangles[t + 1] << " " << triangles[t + 2] << "\n";
+        return file.good();
+    }
+};
+
+class LabelSurface
+{
+public:
+    // surface of the voxels whose label is inside (inside[label] true)
+    static void extract(unsigned char const *voxels, unsigned int const n[3], float const d[3], bool const inside[256],
+                        LabelMesh &mesh, MacrocellGrid const *grid = NULL)
+    {
+        mesh.clear();
+        Volume volume(voxels, n, inside);
+        std::vector<char> blocks;
+        unsigned int blockShift = 31;
+        if (grid && !grid->empty())
+            blockShift = activeBlocks(*grid, n, inside, blocks);
+
+        // slabs of cells (z in [0, nz]), more than threads so that uneven slabs balance
+        unsigned int nSlabs = std::min(n[2] + 1, 4 * parallelThreadCount());
+        std::vector<Slab> slabs(nSlabs);
+        for (unsigned int s = 0; s < nSlabs; ++s)
+        {
+            slabs[s].begin = (unsigned int)((uint64_t)(n[2] + 1) * s / nSlabs);
+            slabs[s].end = (unsigned int)((uint64_t)(n[2] + 1) * (s + 1) / nSlabs);
+        }
+
+        parallelFor(nSlabs, [&](unsigned int begin, unsigned int end)
+                    {
+            for (unsigned int s = begin; s < end; ++s)
+                buildVertices(volume, d, blocks, blockShift, slabs[s]); }, 1);
+
+        std::vector<unsigned int> offsets(nSlabs + 1, 0);
+        for (unsigned int s = 0; s < nSlabs; ++s)
+            offsets[s + 1] = offsets[s] + (unsigned int)slabs[s].cells.size();
+
+        parallelFor(nSlabs, [&](unsigned int begin, unsigned int end)
+                    {
+            for (unsigned int s = begin; s < end; ++s)
+                buildQuads(volume, slabs, s, offsets); }, 1);
+
+        mesh.positions.resize((size_t)offsets[nSlabs] * 3);
+        size_t nTriangles = 0;
+        for (unsigned int s = 0; s < nSlabs; ++s)
+            nTriangles += slabs[s].triangles.size();
+        mesh.triangles.resize(nTriangles);
+        size_t triangleOffset = 0;
+        for (unsigned int s = 0; s < nSlabs; ++s)
+        {
+            std::copy(slabs[s].positions.begin(), slabs[s].positions.end(), mesh.positions.begin() + (size_t)offsets[s] * 3);
+            std::copy(slabs[s].triangles.begin(), slabs[s].triangles.end(), mesh.triangles.begin() + triangleOffset);
+            triangleOffset += slabs[s].triangles.size();
+        }
+    }
+
+    static void extract(unsigned char const *voxels, unsigned int const n[3], float const d[3], unsigned char label,
+                        LabelMesh &mesh, MacrocellGrid const *grid = NULL)
+    {
+        bool inside[256] = {false};
+        inside[label] = true;
+        extract(voxels, n, d, inside, mesh, grid);
+    }
+
+private:
+    struct Volume
+    {
+        unsigned char const *voxels;
+        unsigned int n[3];
+        bool inside[256];
+
+        Volume(unsigned char const *_voxels, unsigned int const _n[3], bool const _inside[256]) : voxels(_voxels)
+        {
+            std::copy(_n, _n + 3, n);
+            std::copy(_inside, _inside + 256, inside);
+        }
+
+        // voxel (x, y, z), coordinates shifted by one : 0 is the outside layer before the volume
+        bool isInside(unsigned int x, unsigned int y, unsigned int z) const
+        {
+            if (x - 1 >= n[0] || y - 1 >= n[1] || z - 1 >= n[2])
+                return false;
+            return inside[voxels[((size_t)(z - 1) * n[1] + (y - 1)) * n[0] + (x - 1)]];
+        }
+    };
+
+    // cells [begin, end) along z ; cell (x, y, z) has the voxels x-1..x, y-1..y, z-1..z as corners
+    struct Slab
+    {
+        unsigned int begin, end;
+        std::vector<uint64_t> cells;      // of the vertices
+        std::vector<float> positions;
+        std::vector<unsigned char> masks; // corners inside, bit x + 2 y + 4 z
+        std::unordered_map<uint64_t, unsigned int> vertexOf;
+        std::vector<unsigned int> triangles;
+    };
+
+    static uint64_t cellKey(unsigned int const n[3], unsigned int x, unsigned int y, unsigned int z)
+    {
+        return ((uint64_t)z * (n[1] + 1) + y) * (n[0] + 1) + x;
+    }
+
+    // blocks of 2^shift cells that can cross the surface : the voxels of their cells are in
+    // the macrocells b-1 and b on each axis
+    static unsigned int activeBlocks(MacrocellGrid const &grid, unsigned int const n[3], bool const inside[256], std::vector<char> &blocks)
+    {
+        unsigned int shift = grid.getCellShift(), nb[3], nc[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            nb[c] = (n[c] >> shift) + 1;
+            nc[c] = grid.numberOfCells(c);
+        }
+        std::vector<char> hasInside((size_t)nc[0] * nc[1] * nc[2], 0);
+        for (unsigned int z = 0; z < nc[2]; ++z)
+            for (unsigned int y = 0; y < nc[1]; ++y)
+                for (unsigned int x = 0; x < nc[0]; ++x)
+                    for (unsigned int l = 0; l < 256 && !hasInside[((size_t)z * nc[1] + y) * nc[0] + x]; ++l)
+                        hasInside[((size_t)z * nc[1] + y) * nc[0] + x] = inside[l] && grid.containsLabel(x, y, z, (unsigned char)l);
+        blocks.assign((size_t)nb[0] * nb[1] * nb[2], 0);
+        for (unsigned int bz = 0; bz < nb[2]; ++bz)
+            for (unsigned int by = 0; by < nb[1]; ++by)
+                for (unsigned int bx = 0; bx < nb[0]; ++bx)
+                {
+                    char active = 0;
+                    for (unsigned int z = bz ? bz - 1 : 0; z <= std::min(bz, nc[2] - 1); ++z)
+                        for (unsigned int y = by ? by - 1 : 0; y <= std::min(by, nc[1] - 1); ++y)
+                            for (unsigned int x = bx ? bx - 1 : 0; x <= std::min(bx, nc[0] - 1); ++x)
+                                active |= hasInside[((size_t)z * nc[1] + y) * nc[0] + x];
+                    blocks[((size_t)bz * nb[1] + by) * nb[0] + bx] = active;
+                }
+        return shift;
+    }
+
+    static void buildVertices(Volume const &volume, float const d[3], std::vector<char> const &blocks, unsigned int blockShift, Slab &slab)
+    {
+        unsigned int const *n = volume.n;
+        unsigned int nb[2] = {(n[0] >> blockShift) + 1, (n[1] >> blockShift) + 1};
+        for (unsigned int z = slab.begin; z < slab.end; ++z)
+            for (unsigned int y = 0; y <= n[1]; ++y)
+            {
+                unsigned char mask = 0; // the corners x+1 of a cell are the corners x of the next one
+                for (unsigned int x = 0; x <= n[0]; ++x)
+                {
+                    if (!blocks.empty() && !blocks[((size_t)(z >> blockShift) * nb[1] + (y >> blockShift)) * nb[0] + (x >> blockShift)])
+                    {
+                        x |= (1u << blockShift) - 1; // next block
+                        continue;
+                    }
+                    bool restart = (x & ((1u << blockShift) - 1)) == 0; // first cell of a row or of a block
+                    mask = restart ? 0 : (mask >> 1) & 0x55;
+                    if (restart)
+                        for (int k = 0; k < 8; k += 2)
+                            mask |= volume.isInside(x, y + ((k >> 1) & 1), z + (k >> 2)) << k;
+                    for (int k = 1; k < 8; k += 2)
+                        mask |= volume.isInside(x + 1, y + ((k >> 1) & 1), z + (k >> 2)) << k;
+                    if (mask == 0 || mask == 255)
+                        continue;
+
+                    // middles of the crossed edges, in corner units
+                    float p[3] = {0.f, 0.f, 0.f};
+                    int crossed = 0;
+                    for (int k = 0; k < 8; ++k)
+                        for (int a = 0; a < 3; ++a)
+                        {
+                            int other = k | (1 << a);
+                            if (other == k || ((mask >> k) & 1) == ((mask >> other) & 1))
+                                continue;
+                            for (int c = 0; c < 3; ++c)
+                                p[c] += c == a ? 0.5f : float((k >> c) & 1);
+                            ++crossed;
+                        }
+                    unsigned int cell[3] = {x, y, z};
+                    slab.vertexOf[cellKey(n, x, y, z)] = (unsigned int)slab.cells.size();
+                    slab.cells.push_back(cellKey(n, x, y, z));
+                    slab.masks.push_back(mask);
+                    // corner 0 of the cell is the center of voxel cell - 1
+                    for (int c = 0; c < 3; ++c)
+                        slab.positions.push_back((float(cell[c]) - 0.5f + p[c] / crossed) * d[c]);
+                }
+            }
+    }
+
+    static const unsigned int noVertex = ~0u;
+
+    // noVertex if the cell has none (outside of the grid, or skipped with its block)
+    static unsigned int vertexOf(std::vector<Slab> const &slabs, unsigned int s, unsigned int const n[3], unsigned int x, unsigned int y, unsigned int z,
+                                 std::vector<unsigned int> const &offsets)
+    {
+        while (s > 0 && z < slabs[s].begin)
+            --s;
+        std::unordered_map<uint64_t, unsigned int>::const_iterator it = slabs[s].vertexOf.find(cellKey(n, x, y, z));
+        return it == slabs[s].vertexOf.end() ? noVertex : offsets[s] + it->second;
+    }
+
+    // for each vertex of the slab, the edges from corner 0 of its cell along +x, +y and +z ;
+    // only the triangles of slab s are written, the hashes of the others are read
+    static void buildQuads(Volume const &volume, std::vector<Slab> &slabs, unsigned int s, std::vector<unsigned int> const &offsets)
+    {
+        Slab &slab = slabs[s];
+        unsigned int const *n = volume.n;
+        for (size_t v = 0; v < slab.cells.size(); ++v)
+        {
+            uint64_t key = slab.cells[v];
+            unsigned int cell[3] = {(unsigned int)(key % (n[0] + 1)), (unsigned int)((key / (n[0] + 1)) % (n[1] + 1)),
+                                    (unsigned int)(key / ((uint64_t)(n[0] + 1) * (n[1] + 1)))};
+            unsigned char mask = slab.masks[v];
+            for (int a = 0; a < 3; ++a)
+            {
+                bool first = mask & 1, second = (mask >> (1 << a)) & 1;
+                if (first == second)
+                    continue;
+                // the 4 cells around the edge, counter clockwise seen from +a
+                int b = (a + 1) % 3, c = (a + 2) % 3;
+                unsigned int quad[4];
+                int const corners[4][2] = {{1, 1}, {0, 1}, {0, 0}, {1, 0}}; // cells minus (e_b, e_c)
+                bool complete = true;
+                for (int q = 0; q < 4; ++q)
+                {
+                    unsigned int around[3] = {cell[0], cell[1], cell[2]};
+                    around[b] -= corners[q][0];
+                    around[c] -= corners[q][1];
+                    quad[q] = vertexOf(slabs, s, n, around[0], around[1], around[2], offsets);
+                    complete = complete && quad[q] != noVertex;
+                }
+                if (!complete) // cannot happen for a crossed edge, but a hole beats a dangling index
+                    continue;
+                if (!first) // normal towards the outside : -a
+                    std::swap(quad[1], quad[3]);
+                unsigned int const triangles[6] = {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]};
+                slab.triangles.insert(slab.triangles.end(), triangles, triangles + 6);
+            }
+        }
+    }
+};
+
+#endif // LABELSURFACE_H
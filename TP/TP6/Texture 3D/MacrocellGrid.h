@@ -0,0 +1,212 @@
+#ifndef MACROCELLGRID_H
+#define MACROCELLGRID_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Empty space skipping for the ray marchers : the volume is cut in macrocells of
+// cellSize^3 voxels (a power of 2), and each macrocell keeps the set of the labels it
+// contains (256 bits). A macrocell is empty when none of its labels is visible : the
+// ray marchers then jump to its exit with a 3D-DDA step instead of sampling it.
+//
+// The label sets are built in parallel (one z slab of macrocells per task), or block by
+// block for a bricked volume. The cells of each label are also listed, so that showing or
+// hiding a label only updates the count of visible labels of the cells that contain it,
+// not the whole grid.
+// occupancy() has one byte per macrocell (255 : something visible), x first, for the
+// 3D texture of volume.frag.
+//
+//-------------------------------------------------------------------------------------//
+
+class MacrocellGrid
+{
+public:
+    MacrocellGrid() : shift(3), dirty(false)
+    {
+        for (int c = 0; c < 3; ++c)
+            n[c] = cells[c] = 0;
+        std::fill(visible, visible + 256, false);
+    }
+
+    // all the labels are visible after a build
+    void build(unsigned char const *voxels, unsigned int nx, unsigned int ny, unsigned int nz, unsigned int cellSize = 8)
+    {
+        reset(nx, ny, nz, cellSize);
+        unsigned int size = 1u << shift;
+        parallelFor(cells[2], [&](unsigned int begin, unsigned int end)
+                    {
+            unsigned int origin[3] = {0, 0, begin * size};
+            unsigned int extent[3] = {n[0], n[1], std::min(n[2], end * size) - begin * size};
+            addBlock(voxels + (size_t)origin[2] * n[0] * n[1], origin, extent); }, 1);
+        finish();
+    }
+
+    // Incremental build, for volumes read by blocks (bricks) : reset(), addBlock() or
+    // addUniformBlock() for each block, then finish(). Blocks sharing macrocells must not
+    // be added concurrently.
+    void reset(unsigned int nx, unsigned int ny, unsigned int nz, unsigned int cellSize = 8)
+    {
+        shift = 0;
+        while ((1u << (shift + 1)) <= std::max(1u, cellSize))
+            ++shift;
+        n[0] = nx;
+        n[1] = ny;
+        n[2] = nz;
+        for (int c = 0; c < 3; ++c)
+            cells[c] = (n[c] + (1u << shift) - 1) >> shift;
+        labelSets.assign((size_t)cells[0] * cells[1] * cells[2], LabelSet());
+    }
+
+    // block of extent[0] x extent[1] x extent[2] voxels at origin, x first
+    void addBlock(unsigned char const *block, unsigned int const origin[3], unsigned int const extent[3])
+    {
+        unsigned int size = 1u << shift;
+        for (unsigned int z = 0; z < extent[2]; ++z)
+            for (unsigned int y = 0; y < extent[1]; ++y)
+            {
+                LabelSet *row = &labelSets[((size_t)((origin[2] + z) >> shift) * cells[1] + ((origin[1] + y) >> shift)) * cells[0]];
+                unsigned char const *v = block + ((size_t)z * extent[1] + y) * extent[0];
+                int previous = -1;
+                for (unsigned int i = 0, x = origin[0]; i < extent[0]; ++i, ++x)
+                {
+                    if (v[i] == previous && (x & (size - 1)) != 0)
+                        continue; // runs of the same label
+                    previous = v[i];
+                    row[x >> shift].bits[v[i] >> 6] |= uint64_t(1) << (v[i] & 63);
+                }
+            }
+    }
+
+    void addUniformBlock(unsigned char label, unsigned int const origin[3], unsigned int const extent[3])
+    {
+        for (unsigned int cz = origin[2] >> shift; cz <= (origin[2] + extent[2] - 1) >> shift; ++cz)
+            for (unsigned int cy = origin[1] >> shift; cy <= (origin[1] + extent[1] - 1) >> shift; ++cy)
+                for (unsigned int cx = origin[0] >> shift; cx <= (origin[0] + extent[0] - 1) >> shift; ++cx)
+                    labelSets[((size_t)cz * cells[1] + cy) * cells[0] + cx].bits[label >> 6] |= uint64_t(1) << (label & 63);
+    }
+
+    void finish()
+    {
+        size_t nCells = labelSets.size();
+
+        // cells of each label
+        labelCellsBegin.assign(257, 0);
+        for (size_t i = 0; i < nCells; ++i)
+            labelSets[i].forEach([&](unsigned int l)
+                                 { ++labelCellsBegin[l + 1]; });
+        for (unsigned int l = 0; l < 256; ++l)
+            labelCellsBegin[l + 1] += labelCellsBegin[l];
+        labelCells.resize(labelCellsBegin[256]);
+        std::vector<unsigned int> fill(labelCellsBegin.begin(), labelCellsBegin.end() - 1);
+        for (size_t i = 0; i < nCells; ++i)
+            labelSets[i].forEach([&](unsigned int l)
+                                 { labelCells[fill[l]++] = (unsigned int)i; });
+
+        visibleCount.assign(nCells, 0);
+        std::fill(visible, visible + 256, false);
+        occupancyBytes.assign(nCells, 0);
+        for (unsigned int l = 0; l < 256; ++l)
+            setLabelVisible((unsigned char)l, true);
+        dirty = true;
+    }
+
+    void clear()
+    {
+        labelSets.clear();
+        labelCells.clear();
+        labelCellsBegin.clear();
+        visibleCount.clear();
+        occupancyBytes.clear();
+        for (int c = 0; c < 3; ++c)
+            n[c] = cells[c] = 0;
+    }
+
+    bool empty() const { return labelSets.empty(); }
+
+    // returns the number of macrocells whose occupancy changed
+    unsigned int setLabelVisible(unsigned char label, bool v)
+    {
+        if (visible[label] == v || labelCellsBegin.empty())
+            return 0;
+        visible[label] = v;
+        unsigned int changed = 0;
+        for (unsigned int i = labelCellsBegin[label]; i < labelCellsBegin[label + 1]; ++i)
+        {
+            unsigned int cell = labelCells[i];
+            unsigned short count = visibleCount[cell] = v ? visibleCount[cell] + 1 : visibleCount[cell] - 1;
+            if ((count == 0) != (occupancyBytes[cell] == 0))
+            {
+                occupancyBytes[cell] = count ? 255 : 0;
+                ++changed;
+            }
+        }
+        dirty = dirty || changed > 0;
+        return changed;
+    }
+
+    // visibility from RGBA label colors (alpha 0 : hidden), only the labels that changed are updated
+    unsigned int setVisibleLabels(unsigned char const labelColors[256 * 4])
+    {
+        unsigned int changed = 0;
+        for (unsigned int l = 0; l < 256; ++l)
+            changed += setLabelVisible((unsigned char)l, labelColors[4 * l + 3] != 0);
+        return changed;
+    }
+
+    bool isLabelVisible(unsigned char label) const { return visible[label]; }
+
+    unsigned int getCellShift() const { return shift; }
+    unsigned int getCellSize() const { return 1u << shift; }
+    unsigned int numberOfCells(int axis) const { return cells[axis]; }
+
+    // cell of voxel (x, y, z)
+    bool isEmpty(unsigned int x, unsigned int y, unsigned int z) const
+    {
+        return occupancyBytes[((size_t)(z >> shift) * cells[1] + (y >> shift)) * cells[0] + (x >> shift)] == 0;
+    }
+    bool containsLabel(unsigned int cx, unsigned int cy, unsigned int cz, unsigned char label) const
+    {
+        return labelSets[((size_t)cz * cells[1] + cy) * cells[0] + cx].contains(label);
+    }
+
+    unsigned char const *occupancy() const { return occupancyBytes.empty() ? NULL : &occupancyBytes[0]; }
+
+    // true once after each change of occupancy (to re-upload the texture)
+    bool takeDirty()
+    {
+        bool d = dirty;
+        dirty = false;
+        return d;
+    }
+
+private:
+    struct LabelSet
+    {
+        uint64_t bits[4];
+        LabelSet() { bits[0] = bits[1] = bits[2] = bits[3] = 0; }
+        bool contains(unsigned int l) const { return (bits[l >> 6] >> (l & 63)) & 1; }
+        template <class function_t>
+        void forEach(function_t const &f) const
+        {
+            for (unsigned int w = 0; w < 4; ++w)
+                for (uint64_t b = bits[w]; b != 0; b &= b - 1)
+                    f(64 * w + __builtin_ctzll(b));
+        }
+    };
+
+    unsigned int n[3], cells[3];
+    unsigned int shift;
+    std::vector<LabelSet> labelSets;
+    std::vector<unsigned int> labelCellsBegin, labelCells; // cells of each label
+    std::vector<unsigned short> visibleCount;                // visible labels of each cell
+    std::vector<unsigned char> occupancyBytes;
+    bool visible[256];
+    bool dirty;
+};
+
+#endif // MACROCELLGRID_H
@@ -258,6 +258,12 @@ void Texture::initTexture()
 void Texture::deleteTexture()
 {
     glDeleteTextures(1, &textureId);
+    if (labelColorsId != 0)
+        glDeleteTextures(1, &labelColorsId);
+    labelColorsId = 0;
+    if (occupancyId != 0)
+        glDeleteTextures(1, &occupancyId);
+    occupancyId = 0;
 }
 
 void Texture::draw(const qglviewer::Camera *camera)
@@ -303,6 +309,33 @@ void Texture::draw(const qglviewer::Camera *camera)
     glBindTexture(GL_TEXTURE_3D, textureId);
     glFunctions->glUniform1i(glFunctions->glGetUniformLocation(programID, "mask"), 0);
 
+    // Table des couleurs des labels sur l'unité 1
+    glFunctions->glUniform1i(glFunctions->glGetUniformLocation(programID, "labelMode"), labelMode ? 1 : 0);
+    if (labelMode)
+    {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_1D, labelColorsId);
+        glFunctions->glUniform1i(glFunctions->glGetUniformLocation(programID, "labelColors"), 1);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Niveau de détail (mipmaps de la pyramide des labels)
+    glFunctions->glUniform1i(glFunctions->glGetUniformLocation(programID, "lod"), lod);
+    glFunctions->glUniform3i(glFunctions->glGetUniformLocation(programID, "volumeSize"), n[0], n[1], n[2]);
+    glFunctions->glUniform3f(glFunctions->glGetUniformLocation(programID, "voxelSize"), d[0], d[1], d[2]);
+
+    // Lancer de rayons : macrocellules sur l'unité 2
+    glFunctions->glUniform1i(glFunctions->glGetUniformLocation(programID, "rayMarching"), rayMarching ? 1 : 0);
+    if (rayMarching)
+    {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_3D, occupancyId);
+        glFunctions->glUniform1i(glFunctions->glGetUniformLocation(programID, "occupancy"), 2);
+        glActiveTexture(GL_TEXTURE0);
+        glFunctions->glUniform1i(glFunctions->glGetUniformLocation(programID, "macrocellSize"), macrocellSize);
+        glEnable(GL_BLEND);
+    }
+
     // Envoyer les Uniforms permettant de définir les plans de coupes alignés sur les axes
     glFunctions->glUniform1f(glFunctions->glGetUniformLocation(programID, "xCutPosition"), xCutPosition);
     glFunctions->glUniform1f(glFunctions->glGetUniformLocation(programID, "yCutPosition"), yCutPosition);
@@ -313,45 +346,67 @@ void Texture::draw(const qglviewer::Camera *camera)
 
     /***********************************************************************/
 
-    drawBoundingBox(false);
+    // Boîte des labels visibles : les rayons n'en sortent pas, et ses faces pleines les lancent
+    float visibleMin[3], visibleMax[3];
+    for (int c = 0; c < 3; c++)
+    {
+        visibleMin[c] = Vmin[c] * d[c];
+        visibleMax[c] = (Vmax[c] + 1) * d[c];
+    }
+    glFunctions->glUniform3f(glFunctions->glGetUniformLocation(programID, "visibleMin"), visibleMin[0], visibleMin[1], visibleMin[2]);
+    glFunctions->glUniform3f(glFunctions->glGetUniformLocation(programID, "visibleMax"), visibleMax[0], visibleMax[1], visibleMax[2]);
+    if (rayMarching)
+    {
+        if (Vmin[0] <= Vmax[0] && Vmin[1] <= Vmax[1] && Vmin[2] <= Vmax[2])
+            drawCube(visibleMin, visibleMax);
+    }
+    else
+        drawBoundingBox();
     drawCutPlanes();
+    glDisable(GL_BLEND);
 }
 
 void Texture::drawCube()
+{
+    const float min[3] = {0.f, 0.f, 0.f}, max[3] = {float(xMax), float(yMax), float(zMax)};
+    drawCube(min, max);
+}
+
+void Texture::drawCube(const float min[3], const float max[3])
 {
     glBegin(GL_QUADS);
 
-    glVertex3f(0.0f, 0.0f, 0.0f); // Bottom Right Of The Texture and Quad
-    glVertex3f(0.0f, yMax, 0.0f); // Top Right Of The Texture and Quad
-    glVertex3f(xMax, yMax, 0.0f); // Top Left Of The Texture and Quad
-    glVertex3f(xMax, 0.0f, 0.0f); // Bottom Left Of The Texture and Quad
+    glVertex3f(min[0], min[1], min[2]); // Bottom Right Of The Texture and Quad
+    glVertex3f(min[0], max[1], min[2]); // Top Right Of The Texture and Quad
+    glVertex3f(max[0], max[1], min[2]); // Top Left Of The Texture and Quad
+    glVertex3f(max[0], min[1], min[2]); // Bottom Left Of The Texture and Quad
     // Bottom Face
-    glVertex3f(0.0f, 0.0f, 0.0f); // Top Right Of The Texture and Quad
-    glVertex3f(xMax, 0.0f, 0.0f); // Top Left Of The Texture and Quad
-    glVertex3f(xMax, 0.0f, zMax); // Bottom Left Of The Texture and Quad
-    glVertex3f(0.0f, 0.0f, zMax); // Bottom Right Of The Texture and Quad
+    glVertex3f(min[0], min[1], min[2]); // Top Right Of The Texture and Quad
+    glVertex3f(max[0], min[1], min[2]); // Top Left Of The Texture and Quad
+    glVertex3f(max[0], min[1], max[2]); // Bottom Left Of The Texture and Quad
+    glVertex3f(min[0], min[1], max[2]); // Bottom Right Of The Texture and Quad
     // Left Face
-    glVertex3f(0.0f, 0.0f, 0.0f); // Bottom Left Of The Texture and Quad
-    glVertex3f(0.0f, 0.0f, zMax); // Bottom Right Of The Texture and Quad
-    glVertex3f(0.0f, yMax, zMax); // Top Right Of The Texture and Quad
-    glVertex3f(0.0f, yMax, 0.0f); // Top Left Of The Texture and Quad
+    glVertex3f(min[0], min[1], min[2]); // Bottom Left Of The Texture and Quad
+    glVertex3f(min[0], min[1], max[2]); // Bottom Right Of The Texture and Quad
+    glVertex3f(min[0], max[1], max[2]); // Top Right Of The Texture and Quad
+    glVertex3f(min[0], max[1], min[2]); // Top Left Of The Texture and Quad
     // Right face
-    glVertex3f(xMax, 0.0f, 0.0f); // Bottom Right Of The Texture and Quad
-    glVertex3f(xMax, yMax, 0.0f); // Top Right Of The Texture and Quad
-    glVertex3f(xMax, yMax, zMax); // Top Left Of The Texture and Quad
-    glVertex3f(xMax, 0.0f, zMax); // Bottom Left Of The Texture and Quad
+    glVertex3f(max[0], min[1], min[2]); // Bottom Right Of The Texture and Quad
+    glVertex3f(max[0], max[1], min[2]); // Top Right Of The Texture and Quad
+    glVertex3f(max[0], max[1], max[2]); // Top Left Of The Texture and Quad
+    glVertex3f(max[0], min[1], max[2]); // Bottom Left Of The Texture and Quad
 
     // Front Face
-    glVertex3f(0.0f, 0.0f, zMax); // Bottom Left Of The Texture and Quad
-    glVertex3f(xMax, 0.0f, zMax); // Bottom Right Of The Texture and Quad
-    glVertex3f(xMax, yMax, zMax); // Top Right Of The Texture and Quad
-    glVertex3f(0.0f, yMax, zMax); // Top Left Of The Texture and Quad
+    glVertex3f(min[0], min[1], max[2]); // Bottom Left Of The Texture and Quad
+    glVertex3f(max[0], min[1], max[2]); // Bottom Right Of The Texture and Quad
+    glVertex3f(max[0], max[1], max[2]); // Top Right Of The Texture and Quad
+    glVertex3f(min[0], max[1], max[2]); // Top Left Of The Texture and Quad
 
     // Top Face
-    glVertex3f(0.0f, yMax, 0.0f); // Top Left Of The Texture and Quad
-    glVertex3f(0.0f, yMax, zMax); // Bottom Left Of The Texture and Quad
-    glVertex3f(xMax, yMax, zMax); // Bottom Right Of The Texture and Quad
-    glVertex3f(xMax, yMax, 0.0f); // Top Right Of The Texture and Quad
+    glVertex3f(min[0], max[1], min[2]); // Top Left Of The Texture and Quad
+    glVertex3f(min[0], max[1], max[2]); // Bottom Left Of The Texture and Quad
+    glVertex3f(max[0], max[1], max[2]); // Bottom Right Of The Texture and Quad
+    glVertex3f(max[0], max[1], min[2]); // Top Right Of The Texture and Quad
     glEnd();
 }
 
@@ -403,7 +458,7 @@ void Texture::drawBoundingBox(bool fill)
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
-void Texture::build(const std::vector<unsigned char> &data, const std::vector<unsigned char> &labels,
+void Texture::build(const unsigned char *data, const std::vector<unsigned char> &labels,
                     unsigned int &nx, unsigned int &ny, unsigned int &nz,
                     float &dx, float &dy, float &dz,
                     std::map<unsigned char, QColor> &labelsToColor)
@@ -445,36 +500,124 @@ void Texture::build(const std::vector<unsigned char> &data, const std::vector<un
         max_id = std::max((unsigned int)labels[i], max_id);
     }
 
-    Vmin[0] = 3000;
-    Vmin[1] = 3000;
-    Vmin[2] = 3000;
-    Vmax[0] = 0;
-    Vmax[1] = 0;
-    Vmax[2] = 0;
+    // boîte (en voxels, bornes incluses) des labels visibles : tout le volume tant que les
+    // statistiques des labels ne l'ont pas réduite
+    Vmin[0] = 0;
+    Vmin[1] = 0;
+    Vmin[2] = 0;
+    Vmax[0] = int(n[0]) - 1;
+    Vmax[1] = int(n[1]) - 1;
+    Vmax[2] = int(n[2]) - 1;
 
     // TODO fill texels with data
 
     // Dans la fonction build de la classe Texture remplir les valeurs RGBA des Texels
     // avec les couleurs définies dans labelsToColor
 
-    rgbTexture = new unsigned char[n[0] * n[1] * n[2] * 4];
+    initTexture();
+    glBindTexture(GL_TEXTURE_3D, textureId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    for (unsigned int i = 0; i < gridSize; i++)
+    if (labelMode)
     {
-        int greyValue = data[i];
-        QColor color = labelsToColor[greyValue];
-
-        rgbTexture[i * 4 + 0] = color.red();
-        rgbTexture[i * 4 + 1] = color.green();
-        rgbTexture[i * 4 + 2] = color.blue();
-        rgbTexture[i * 4 + 3] = color.alpha(); // Alpha channel
+        // Les labels ne s'interpolent pas : un octet par voxel, lu au plus proche
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, n[0], n[1], n[2], 0, GL_RED, GL_UNSIGNED_BYTE, data);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+        nLevels = 1;
+        lod = 0;
+
+        setLabelColors(labelsToColor, std::map<unsigned char, bool>());
+        return;
     }
 
-    initTexture();
+    std::vector<unsigned char> rgbTexture((size_t)gridSize * 4);
+    unsigned char colors[256 * 4];
+    for (unsigned int l = 0; l < 256; l++)
+    {
+        QColor color = labelsToColor.count(l) ? labelsToColor[l] : QColor(0, 0, 0);
+        colors[l * 4 + 0] = color.red();
+        colors[l * 4 + 1] = color.green();
+        colors[l * 4 + 2] = color.blue();
+        colors[l * 4 + 3] = color.alpha(); // Alpha channel
+    }
+    for (unsigned int i = 0; i < gridSize; i++)
+        std::copy(colors + data[i] * 4, colors + data[i] * 4 + 4, &rgbTexture[(size_t)i * 4]);
 
     // Charger les données de la texture vers le GPU DONE
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, n[0], n[1], n[2], 0, GL_RGBA, GL_UNSIGNED_BYTE, &rgbTexture[0]);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+    nLevels = 1;
+    lod = 0;
+}
+
+void Texture::uploadBlock(const unsigned char *block, const unsigned int origin[3], const unsigned int extent[3])
+{
+    glBindTexture(GL_TEXTURE_3D, textureId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, origin[0], origin[1], origin[2], extent[0], extent[1], extent[2],
+                    GL_RED, GL_UNSIGNED_BYTE, block);
+}
+
+void Texture::setLabelColors(const std::map<unsigned char, QColor> &colorMap, const std::map<unsigned char, bool> &displayMap)
+{
+    for (unsigned int l = 0; l < 256; l++)
+    {
+        std::map<unsigned char, QColor>::const_iterator color = colorMap.find(l);
+        std::map<unsigned char, bool>::const_iterator visible = displayMap.find(l);
+        QColor c = color != colorMap.end() ? color->second : QColor(0, 0, 0);
+        labelColors[l * 4 + 0] = c.red();
+        labelColors[l * 4 + 1] = c.green();
+        labelColors[l * 4 + 2] = c.blue();
+        labelColors[l * 4 + 3] = (visible == displayMap.end() || visible->second) ? c.alpha() : 0;
+    }
+
+    if (labelColorsId == 0)
+    {
+        glGenTextures(1, &labelColorsId);
+        glBindTexture(GL_TEXTURE_1D, labelColorsId);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, labelColors);
+        return;
+    }
+    glBindTexture(GL_TEXTURE_1D, labelColorsId);
+    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, 256, GL_RGBA, GL_UNSIGNED_BYTE, labelColors);
+}
+
+void Texture::setPyramid(const LabelPyramid &pyramid)
+{
+    if (!labelMode || pyramid.empty())
+        return;
     glBindTexture(GL_TEXTURE_3D, textureId);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, n[0], n[1], n[2], 0, GL_RGBA, GL_UNSIGNED_BYTE, rgbTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (unsigned int l = 1; l < pyramid.numberOfLevels(); l++)
+        glTexImage3D(GL_TEXTURE_3D, l, GL_R8, pyramid.size(l, 0), pyramid.size(l, 1), pyramid.size(l, 2), 0,
+                     GL_RED, GL_UNSIGNED_BYTE, pyramid.voxels(l));
+    nLevels = pyramid.numberOfLevels();
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, nLevels - 1);
+    setLevelOfDetail(lod);
+}
+
+void Texture::setMacrocells(const MacrocellGrid &grid)
+{
+    if (grid.empty())
+        return;
+    macrocellSize = grid.getCellSize();
+    if (occupancyId == 0)
+    {
+        glGenTextures(1, &occupancyId);
+        glBindTexture(GL_TEXTURE_3D, occupancyId);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_3D, occupancyId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, grid.numberOfCells(0), grid.numberOfCells(1), grid.numberOfCells(2), 0,
+                 GL_RED, GL_UNSIGNED_BYTE, grid.occupancy());
 }
 
 void Texture::setXCut(int _xCut)
@@ -499,7 +642,7 @@ void Texture::clear()
 {
 
     if (textureCreated)
-        glDeleteTextures(1, &textureId);
+        deleteTexture();
 
     init();
 }
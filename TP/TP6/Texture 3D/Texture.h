@@ -2,6 +2,12 @@
 #define TEXTURE_H
 
 #include "Vec3D.h"
+#include "MacrocellGrid.h"
+#include "LabelPyramid.h"
+
+#include <map>
+#include <vector>
+#include <algorithm>
 
 #include <QString>
 #include <QColor>
@@ -22,7 +28,21 @@ private :
 
     GLuint textureId = 0;
 
-    unsigned char * rgbTexture;
+    // label mode : the labels are uploaded as a GL_R8 3D texture and colored in volume.frag
+    // through a 256 texels 1D texture (alpha 0 for hidden labels) ; otherwise RGBA texels
+    bool labelMode = true;
+    GLuint labelColorsId = 0;
+    unsigned char labelColors[256 * 4];
+
+    // ray marching in volume.frag, skipping the macrocells without visible label
+    bool rayMarching = false;
+    GLuint occupancyId = 0;
+    int macrocellSize = 8;
+
+    // level of detail : the coarse levels of a LabelPyramid are the mipmaps of the label
+    // texture, read by volume.frag at the level lod
+    int nLevels = 1;
+    int lod = 0;
 
     unsigned int n[3];
     float d[3];
@@ -54,6 +74,8 @@ private :
 
 public:
 
+    // box of the visible labels, in voxels (inclusive), empty if Vmin > Vmax ; the ray
+    // marching stays inside
     Vec3Di Vmin;
     Vec3Di Vmax;
 
@@ -67,6 +89,7 @@ public:
 
     void draw( const qglviewer::Camera * camera );
     void drawCube();
+    void drawCube(const float min[3], const float max[3]);
     void drawBoundingBox(bool fill = false);
     void drawCutPlanes();
 
@@ -96,18 +119,43 @@ public:
     void setYCutDisplay(bool _yCutDisplay){yCutDisplay = _yCutDisplay;}
     void setZCutDisplay(bool _zCutDisplay){zCutDisplay = _zCutDisplay;}
 
+    void getCutPlanes(float position[3], int direction[3]) const
+    {
+        position[0] = xCutPosition; position[1] = yCutPosition; position[2] = zCutPosition;
+        direction[0] = xCutDirection; direction[1] = yCutDirection; direction[2] = zCutDirection;
+    }
+
     float getXMax(){return xMax;}
     float getYMax(){return yMax;}
     float getZMax(){return zMax;}
 
     GLuint getTextureId(){return textureId;}
 
+    bool isLabelMode() const {return labelMode;}
+    void setLabelMode(bool _labelMode){labelMode = _labelMode;}
+    // updates the 1D color texture only (label mode)
+    void setLabelColors(const std::map<unsigned char, QColor> & colorMap, const std::map<unsigned char, bool> & displayMap);
+
+    bool isRayMarching() const {return rayMarching;}
+    void setRayMarching(bool _rayMarching){rayMarching = _rayMarching;}
+    // uploads the occupancy of the macrocells (one byte each)
+    void setMacrocells(const MacrocellGrid & grid);
+
+    // label mode only : levels 1.. of the pyramid as mipmaps of the label texture
+    void setPyramid(const LabelPyramid & pyramid);
+    int getNumberOfLevels() const {return nLevels;}
+    int getLevelOfDetail() const {return lod;}
+    void setLevelOfDetail(int level){lod = std::max(0, std::min(level, nLevels - 1));}
+
     float getGridStep(){return minD;}
 
-    void build(const std::vector<unsigned char> & data, const std::vector<unsigned char> & labesl,
+    void build(const unsigned char * data, const std::vector<unsigned char> & labesl,
                unsigned int & nx , unsigned int & ny , unsigned int & nz,
                float & dx , float & dy , float & dz,
                std::map<unsigned char, QColor> & colorMap );
+    // label mode only : data NULL in build() allocates the texture, filled block by block
+    // (bricks of a BrickedVolume) with uploadBlock()
+    void uploadBlock(const unsigned char * block, const unsigned int origin[3], const unsigned int extent[3]);
 
     bool printShaderErrors(GLuint shader);
     bool printProgramErrors(int program);
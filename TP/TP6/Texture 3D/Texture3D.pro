@@ -18,7 +18,17 @@ HEADERS += Window.h \
     TextureViewer.h \
     Texture.h \
     TextureDockWidget.h \
-    Vec3D.h
+    Vec3D.h \
+    ImaVolume.h \
+    ParallelFor.h \
+    VolumeRenderer.h \
+    ImageWriter.h \
+    MacrocellGrid.h \
+    BrickedVolume.h \
+    LabelSurface.h \
+    LabelPyramid.h \
+    LabelStatistics.h \
+    DistanceTransform.h
 INCLUDEPATH = ./GLSL
 LIBS = -lQGLViewer-qt5 \
     -lglut \
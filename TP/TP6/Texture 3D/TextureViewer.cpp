@@ -1,4 +1,8 @@
 #include "TextureViewer.h"
+#include "VolumeRenderer.h"
+#include "ImageWriter.h"
+#include "LabelSurface.h"
+#include <chrono>
 #include <cfloat>
 #include <QFileDialog>
 #include <QGLViewer/manipulatedCameraFrame.h>
@@ -22,6 +26,7 @@ void TextureViewer::draw()
 
     camera()->setSceneRadius(1000);
 
+    updateLevelOfDetail();
     texture->draw(camera());
 
     drawMesh();
@@ -114,6 +119,12 @@ void TextureViewer::init()
 
     cut = Vec3Df(0., 0., 0.),
     cutDirection = Vec3Df(1., 1., 1.);
+
+    // keys of keyPressEvent, in the Keyboard tab of the help (none of them is a default shortcut of QGLViewer)
+    setKeyDescription(Qt::Key_V, "Toggles the ray marching of the volume");
+    setKeyDescription(Qt::Key_P, "Ray casts the current view on the CPU into cpu_render.png");
+    setKeyDescription(Qt::Key_M, "Shows (or hides) the surfaces of the visible labels");
+    setKeyDescription(Qt::Key_L, "Switches between the label texture and the RGBA texture");
 }
 
 void TextureViewer::clear()
@@ -135,14 +146,16 @@ void TextureViewer::open3DImage(const QString &fileName)
     // Texture objet
     texture->clear();
     subdomain_indices.clear();
-    std::vector<unsigned char> data;
     unsigned int nx, ny, nz;
     float dx, dy, dz;
 
     // Load the data from the 3D image
-    if (fileName.endsWith(".dim"))
-        openIMA(fileName, data, subdomain_indices, nx, ny, nz, dx, dy, dz);
-    else
+    if (fileName.endsWith(".bvol"))
+    {
+        if (!openBricked(fileName, subdomain_indices, nx, ny, nz, dx, dy, dz))
+            return;
+    }
+    else if (!fileName.endsWith(".dim") || !openIMA(fileName, subdomain_indices, nx, ny, nz, dx, dy, dz))
         return;
 
     for (unsigned int i = 0; i < subdomain_indices.size(); i++)
@@ -158,10 +171,30 @@ void TextureViewer::open3DImage(const QString &fileName)
                 iColorMap[currentLabel].setHsvF(0.98 * double(i) / subdomain_indices.size(), 0.8, 0.8);
         }
 
-        iDisplayMap[currentLabel] = true;
+        // the background is hidden, as with -hide 0 in VolumeRender : the rays go through it (its
+        // macrocells are skipped) instead of stopping on an opaque black box at the border
+        iDisplayMap[currentLabel] = currentLabel != 0;
+    }
+    if (bricks.isOpen())
+    {
+        texture->setLabelMode(true);
+        texture->build(NULL, subdomain_indices, nx, ny, nz, dx, dy, dz, iColorMap);
+        streamBricks();
+        pyramid.clear();
     }
-    // iColorMap[0].setAlpha(0);
-    texture->build(data, subdomain_indices, nx, ny, nz, dx, dy, dz, iColorMap);
+    else
+    {
+        texture->build(volume.voxels(), subdomain_indices, nx, ny, nz, dx, dy, dz, iColorMap);
+        macrocells.build(volume.voxels(), nx, ny, nz);
+        statistics.compute(volume.voxels(), nx, ny, nz, dx, dy, dz);
+        // no coarser level than the macrocells, so that they still skip the empty space
+        pyramid.build(volume.voxels(), nx, ny, nz, dx, dy, dz, macrocells.getCellShift());
+        texture->setPyramid(pyramid);
+    }
+    if (texture->isLabelMode())
+        texture->setLabelColors(iColorMap, iDisplayMap);
+    syncMacrocells(true);
+    updateVisibleBox();
 
     imageLoaded = true;
 
@@ -327,13 +360,6 @@ void TextureViewer::openOffMesh(const QString &fileName)
             std::cout << "Rescaled mesh bounds: min(" << newMeshMin.x << ", " << newMeshMin.y << ", " << newMeshMin.z << ")" << std::endl;
             std::cout << "                      max(" << newMeshMax.x << ", " << newMeshMax.y << ", " << newMeshMax.z << ")" << std::endl;
 
-            // Mettre à jour Vmin et Vmax dans la classe Texture pour la normalisation
-            // Utiliser les coordonnées de l'espace texture pour la normalisation
-            texture->Vmin = Vec3Di(0, 0, 0);                                              // Minimum de l'espace texture
-            texture->Vmax = Vec3Di(int(textureXMax), int(textureYMax), int(textureZMax)); // Maximum de l'espace texture
-
-            std::cout << "Updated texture space: Vmin(0,0,0) -> Vmax(" << int(textureXMax) << "," << int(textureYMax) << "," << int(textureZMax) << ")" << std::endl;
-
             // Ajuster la caméra pour voir le maillage redimensionné
             Vec finalCenter = (newMeshMin + newMeshMax) * 0.5f;
             float finalRadius = (newMeshMax - newMeshMin).norm() * 0.6f;
@@ -372,120 +398,280 @@ void TextureViewer::selectIAll()
 {
     for (std::map<unsigned char, bool>::iterator it = iDisplayMap.begin(); it != iDisplayMap.end(); ++it)
         iDisplayMap[it->first] = true;
-    update();
+    updateLabelColors();
 }
 
 void TextureViewer::discardIAll()
 {
     for (std::map<unsigned char, bool>::iterator it = iDisplayMap.begin(); it != iDisplayMap.end(); ++it)
         iDisplayMap[it->first] = false;
-    update();
+    updateLabelColors();
 }
 
 void TextureViewer::setIVisibility(unsigned int i, bool visibility)
 {
     if (iDisplayMap.find(i) != iDisplayMap.end())
         iDisplayMap[i] = visibility;
-    update();
+    updateLabelColors();
 }
 
-void TextureViewer::openIMA(const QString &fileName, std::vector<unsigned char> &data, std::vector<unsigned char> &labels,
-                            unsigned int &nx, unsigned int &ny, unsigned int &nz, float &dx, float &dy, float &dz)
+// Only the 256 texels of the color table are sent (the RGBA mode ignores the visibility)
+void TextureViewer::updateLabelColors()
 {
-    QString imaName = QString(fileName);
+    if (imageLoaded && texture->isLabelMode())
+    {
+        makeCurrent();
+        texture->setLabelColors(iColorMap, iDisplayMap);
+        syncMacrocells();
+        updateVisibleBox();
+    }
+    update();
+}
 
-    imaName.replace(".dim", ".ima");
-    std::ifstream imaFile(imaName.toUtf8());
-    if (!imaFile.is_open())
-        return;
+// Only the macrocells of the labels whose visibility changed are updated, then the (small)
+// occupancy texture is sent again. The RGBA mode cannot hide labels : everything is visible.
+void TextureViewer::syncMacrocells(bool upload)
+{
+    for (std::map<unsigned char, bool>::const_iterator it = iDisplayMap.begin(); it != iDisplayMap.end(); ++it)
+        macrocells.setLabelVisible(it->first, it->second || !texture->isLabelMode());
+    if (macrocells.takeDirty() || upload)
+        texture->setMacrocells(macrocells);
+}
 
-    std::ifstream dimFile(fileName.toUtf8());
-    if (!dimFile.is_open())
+// The finest level whose voxels are at least a pixel wide at the center of the scene, one
+// level coarser while the camera is moved ; the full resolution is back once the mouse is released.
+void TextureViewer::updateLevelOfDetail()
+{
+    if (texture->getNumberOfLevels() <= 1)
         return;
+    float pixelsPerVoxel = texture->getGridStep() / camera()->pixelGLRatio(camera()->sceneCenter());
+    bool interacting = camera()->frame()->isManipulated() || camera()->frame()->isSpinning();
+    texture->setLevelOfDetail(LabelPyramid::levelFor(pixelsPerVoxel, interacting, texture->getNumberOfLevels()));
+}
 
-    dimFile >> nx;
-    dimFile >> ny;
-    dimFile >> nz;
-
-    string dummy, type;
+void TextureViewer::mouseReleaseEvent(QMouseEvent *e)
+{
+    QGLViewer::mouseReleaseEvent(e);
+    update(); // refined to the level of the settled view
+}
 
-    dimFile >> dummy;
-    while (dummy.find("-type") == string::npos)
-        dimFile >> dummy;
+// Box of the visible labels from the statistics computed at load time (no pass over the volume) :
+// the rays are cast from it only. The RGBA mode shows every label.
+void TextureViewer::updateVisibleBox()
+{
+    bool visible[256] = {false};
+    for (std::map<unsigned char, bool>::const_iterator it = iDisplayMap.begin(); it != iDisplayMap.end(); ++it)
+        visible[it->first] = it->second || !texture->isLabelMode();
+    unsigned int min[3], max[3];
+    if (statistics.visibleBox(visible, min, max))
+    {
+        texture->Vmin = Vec3Di(min[0], min[1], min[2]);
+        texture->Vmax = Vec3Di(max[0], max[1], max[2]);
+    }
+    else
+    {
+        texture->Vmin = Vec3Di(0, 0, 0);
+        texture->Vmax = Vec3Di(-1, -1, -1);
+    }
+}
 
-    dimFile >> type;
+void TextureViewer::rebuildTexture()
+{
+    if (bricks.isOpen())
+    {
+        // the RGBA texture would need the whole volume in memory
+        unsigned int nx = bricks.size(0), ny = bricks.size(1), nz = bricks.size(2);
+        float dx = bricks.voxelSize(0), dy = bricks.voxelSize(1), dz = bricks.voxelSize(2);
+        texture->setLabelMode(true);
+        texture->build(NULL, subdomain_indices, nx, ny, nz, dx, dy, dz, iColorMap);
+        streamBricks();
+    }
+    else
+    {
+        const ImaHeader &header = volume.getHeader();
+        unsigned int nx = header.nx, ny = header.ny, nz = header.nz;
+        float dx = header.dx, dy = header.dy, dz = header.dz;
+        texture->build(volume.voxels(), subdomain_indices, nx, ny, nz, dx, dy, dz, iColorMap);
+        texture->setPyramid(pyramid);
+    }
+    if (texture->isLabelMode())
+        texture->setLabelColors(iColorMap, iDisplayMap);
+    syncMacrocells(true);
+    updateVisibleBox();
+}
 
-    while (dummy.find("-dx") == string::npos)
-        dimFile >> dummy;
+// Same view, cut planes and label colors as the OpenGL rendering, ray cast on the CPU
+void TextureViewer::renderOnCPU(const std::string &fileName)
+{
+    VolumeRenderer renderer;
+    if (bricks.isOpen())
+        renderer.setBrickedVolume(&bricks);
+    else
+    {
+        const ImaHeader &header = volume.getHeader();
+        renderer.setVolume(volume.voxels(), header.nx, header.ny, header.nz, header.dx, header.dy, header.dz);
+    }
 
-    dimFile >> dx;
+    VolumeRenderParameters parameters;
+    texture->getCutPlanes(parameters.cutPosition, parameters.cutDirection);
+    float voxelSize[3] = {texture->dx(), texture->dy(), texture->dz()};
+    for (int c = 0; c < 3; ++c)
+    {
+        parameters.visibleMin[c] = texture->Vmin[c] * voxelSize[c];
+        parameters.visibleMax[c] = (texture->Vmax[c] + 1) * voxelSize[c];
+    }
+    for (std::map<unsigned char, QColor>::const_iterator it = iColorMap.begin(); it != iColorMap.end(); ++it)
+    {
+        unsigned char *c = &parameters.labelColors[4 * it->first];
+        c[0] = it->second.red();
+        c[1] = it->second.green();
+        c[2] = it->second.blue();
+        c[3] = iDisplayMap[it->first] ? it->second.alpha() : 0;
+    }
+    QColor background = backgroundColor();
+    parameters.background[0] = background.redF();
+    parameters.background[1] = background.greenF();
+    parameters.background[2] = background.blueF();
+
+    RenderCamera renderCamera;
+    Vec position = camera()->position(), direction = camera()->viewDirection(), up = camera()->upVector();
+    float eye[3] = {float(position.x), float(position.y), float(position.z)};
+    float target[3] = {float(position.x + direction.x), float(position.y + direction.y), float(position.z + direction.z)};
+    float upVector[3] = {float(up.x), float(up.y), float(up.z)};
+    renderCamera.lookAt(eye, target, upVector);
+    renderCamera.fieldOfView = camera()->fieldOfView();
+    renderCamera.width = width();
+    renderCamera.height = height();
+    if (bricks.isOpen())
+        bricks.prefetchAlongView(renderCamera.eye, renderCamera.forward);
+
+    macrocells.setVisibleLabels(parameters.labelColors);
+    renderer.setMacrocells(&macrocells);
+
+    std::vector<unsigned char> rgb;
+    VolumeRenderStats stats = renderer.render(renderCamera, parameters, rgb);
+    makeCurrent();
+    syncMacrocells();
+    std::cout << "CPU rendering : " << stats.seconds * 1e3 << " ms, " << stats.megaRaysPerSecond() << " Mrays/s" << std::endl;
+    if (writeImage(fileName, rgb, renderCamera.width, renderCamera.height))
+        std::cout << "written to " << fileName << std::endl;
+}
 
-    dimFile >> dummy;
-    while (dummy.find("-dy") == string::npos)
-        dimFile >> dummy;
+// One closed surface per visible label (except the background), in the space of the texture
+void TextureViewer::extractSurfaces()
+{
+    if (bricks.isOpen())
+    {
+        std::cout << "Surfaces of a bricked volume : not supported, open the .dim" << std::endl;
+        return;
+    }
+    const ImaHeader &header = volume.getHeader();
+    unsigned int n[3] = {header.nx, header.ny, header.nz};
+    float d[3] = {header.dx, header.dy, header.dz};
 
-    dimFile >> dy;
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    LabelMesh mesh, labelMesh;
+    for (std::map<unsigned char, bool>::const_iterator it = iDisplayMap.begin(); it != iDisplayMap.end(); ++it)
+    {
+        if (it->first == 0 || !it->second)
+            continue;
+        LabelSurface::extract(volume.voxels(), n, d, it->first, labelMesh, &macrocells);
+        mesh.append(labelMesh);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    vertices.resize(mesh.numberOfVertices());
+    for (unsigned int v = 0; v < mesh.numberOfVertices(); ++v)
+        vertices[v] = Vec(mesh.positions[3 * v], mesh.positions[3 * v + 1], mesh.positions[3 * v + 2]);
+    triangles.resize(mesh.numberOfTriangles());
+    for (unsigned int t = 0; t < mesh.numberOfTriangles(); ++t)
+        triangles[t] = {mesh.triangles[3 * t], mesh.triangles[3 * t + 1], mesh.triangles[3 * t + 2]};
+    std::cout << "Surfaces : " << vertices.size() << " vertices, " << triangles.size() << " triangles in " << seconds * 1e3 << " ms" << std::endl;
+}
 
-    dimFile >> dummy;
-    while (dummy.find("-dz") == string::npos)
-        dimFile >> dummy;
+bool TextureViewer::openIMA(const QString &fileName, std::vector<unsigned char> &labels,
+                            unsigned int &nx, unsigned int &ny, unsigned int &nz, float &dx, float &dy, float &dz)
+{
+    std::string error;
+    bricks.close();
+    if (!volume.open(fileName.toStdString(), &error))
+    {
+        cout << error << endl;
+        return false;
+    }
 
-    dimFile >> dz;
+    const ImaHeader &header = volume.getHeader();
+    nx = header.nx;
+    ny = header.ny;
+    nz = header.nz;
+    dx = header.dx;
+    dy = header.dy;
+    dz = header.dz;
 
     cout << "(nx,dx) = ( " << nx << " ; " << dx << " ) " << endl;
     cout << "(ny,dy) = ( " << ny << " ; " << dy << " ) " << endl;
     cout << "(nz,dz) = ( " << nz << " ; " << dz << " ) " << endl;
 
-    unsigned int size = nx * ny * nz;
-    unsigned int sizeIn = size;
-
-    if (type.find("S16") != string::npos)
-        sizeIn = size * 2;
-    if (type.find("FLOAT") != string::npos)
-        sizeIn = size * 4;
-
-    unsigned char *tempData = new unsigned char[sizeIn];
-
-    imaFile.read((char *)tempData, sizeIn);
-
-    data.clear();
-    data.resize(size);
+    labels = volume.getLabels();
+    return true;
+}
 
-    if (type.find("S16") != string::npos)
+bool TextureViewer::openBricked(const QString &fileName, std::vector<unsigned char> &labels,
+                                unsigned int &nx, unsigned int &ny, unsigned int &nz, float &dx, float &dy, float &dz)
+{
+    std::string error;
+    volume.clear();
+    if (!bricks.open(fileName.toStdString(), &error))
     {
-        for (unsigned int i = 0, j = 0; i < size; i++, j += 2)
-        {
-            unsigned char value = (unsigned char)tempData[j];
-            data[i] = value;
-            if (std::find(labels.begin(), labels.end(), value) == labels.end())
-                labels.push_back(value);
-        }
+        cout << error << endl;
+        return false;
     }
-    else if (type.find("FLOAT") != string::npos)
-    {
-        float *floatArray = (float *)tempData;
+    nx = bricks.size(0);
+    ny = bricks.size(1);
+    nz = bricks.size(2);
+    dx = bricks.voxelSize(0);
+    dy = bricks.voxelSize(1);
+    dz = bricks.voxelSize(2);
+    cout << fileName.toStdString() << " : " << bricks.numberOfBricks() << " bricks of " << bricks.brickSize() << "^3 voxels" << endl;
+
+    labels = bricks.labels();
+    return true;
+}
 
-        for (unsigned int i = 0; i < size; i++)
+// Bricks read in order (ahead by the prefetching thread), sent with glTexSubImage3D and added to
+// the macrocells : only the brick cache is in memory, not the volume.
+void TextureViewer::streamBricks()
+{
+    unsigned int nBricks = bricks.numberOfBricks(), ahead = bricks.readAhead();
+    bricks.prefetchRange(0, ahead);
+    macrocells.reset(bricks.size(0), bricks.size(1), bricks.size(2));
+    statistics.reset(bricks.size(0), bricks.size(1), bricks.size(2), bricks.voxelSize(0), bricks.voxelSize(1), bricks.voxelSize(2));
+    std::vector<unsigned char> uniform;
+    for (unsigned int b = 0; b < nBricks; ++b)
+    {
+        bricks.prefetchRange(b + ahead, b + ahead + 1);
+        unsigned int origin[3], extent[3];
+        unsigned char label;
+        bricks.brickBox(b, origin, extent);
+        if (bricks.isUniform(b, label))
         {
-            unsigned char value = (unsigned char)floatArray[i];
-            data[i] = value;
-            if (std::find(labels.begin(), labels.end(), value) == labels.end())
-                labels.push_back(value);
+            uniform.assign((size_t)extent[0] * extent[1] * extent[2], label);
+            texture->uploadBlock(&uniform[0], origin, extent);
+            macrocells.addUniformBlock(label, origin, extent);
+            statistics.addUniformBlock(label, origin, extent);
         }
-        delete[] floatArray;
-    }
-    else
-    {
-        for (unsigned int i = 0; i < size; i++)
+        else
         {
-            unsigned char value = (unsigned char)tempData[i];
-            data[i] = value;
-            if (std::find(labels.begin(), labels.end(), value) == labels.end())
-                labels.push_back(value);
+            BrickData data = bricks.brick(b);
+            texture->uploadBlock(&(*data)[0], origin, extent);
+            macrocells.addBlock(&(*data)[0], origin, extent);
+            statistics.addBlock(&(*data)[0], origin, extent);
         }
     }
-
-    delete[] tempData;
+    macrocells.finish();
+    statistics.finish();
+    BrickCacheStatistics cacheStatistics = bricks.getStatistics();
+    cout << cacheStatistics.bytesRead << " bytes read, " << bricks.getResidentBytes() << " bytes in the brick cache" << endl;
 }
 
 void TextureViewer::setXCut(float _x)
@@ -561,6 +747,37 @@ void TextureViewer::keyPressEvent(QKeyEvent *e)
     case Qt::Key_R:
         update();
         break;
+    case Qt::Key_L:
+        if (imageLoaded)
+        {
+            makeCurrent();
+            texture->setLabelMode(!texture->isLabelMode());
+            rebuildTexture();
+            std::cout << (texture->isLabelMode() ? "Label texture (R8) + color table" : "RGBA texture") << std::endl;
+            update();
+        }
+        break;
+    case Qt::Key_V:
+        texture->setRayMarching(!texture->isRayMarching());
+        update();
+        break;
+    case Qt::Key_P:
+        if (imageLoaded)
+            renderOnCPU("cpu_render.png");
+        break;
+    case Qt::Key_M:
+        if (imageLoaded)
+        {
+            if (triangles.empty())
+                extractSurfaces();
+            else
+            {
+                vertices.clear();
+                triangles.clear();
+            }
+            update();
+        }
+        break;
     default:
         QGLViewer::keyPressEvent(e);
     }
@@ -582,6 +799,12 @@ QString TextureViewer::helpString() const
     text += "A middle button double click fits the zoom of the camera and the right button re-centers the scene.<br><br>";
     text += "A left button double click while holding right button pressed defines the camera <i>Revolve Around Point</i>. ";
     text += "See the <b>Mouse</b> tab and the documentation web pages for details.<br><br>";
+    text += "Press <b>V</b> to ray march the volume (empty macrocells are skipped) instead of coloring the cut planes.<br><br>";
+    text += "Press <b>P</b> to ray cast the current view on the CPU into cpu_render.png.<br><br>";
+    text += "The labels are drawn with a coarser level (majority vote of 2x2x2 voxels) when the voxels are smaller than a pixel, ";
+    text += "and one level coarser while the camera moves.<br><br>";
+    text += "Press <b>M</b> to show (or hide) the surfaces of the visible labels as a mesh.<br><br>";
+    text += "Press <b>L</b> to switch between the label texture colored through a table and the RGBA texture.<br><br>";
     text += "Press <b>Escape</b> to exit the TextureViewer.";
     return text;
 }
@@ -10,6 +10,9 @@
 #include <math.h>
 #include <algorithm>
 #include "Texture.h"
+#include "ImaVolume.h"
+#include "BrickedVolume.h"
+#include "LabelStatistics.h"
 
 class TextureViewer : public QGLViewer
 {
@@ -41,16 +44,41 @@ protected :
 
     virtual QString helpString() const;
     virtual void keyPressEvent(QKeyEvent *e);
+    virtual void mouseReleaseEvent(QMouseEvent *e);
 
     void drawClippingPlane();
     void drawMesh();
 
     void clear();
     void updateCamera(const qglviewer::Vec & center, float radius);
-
-
-    void openIMA(  const QString & filename,std::vector<unsigned char> & data, std::vector<unsigned char> & labels,
+    void updateLabelColors();
+    void rebuildTexture();
+    void syncMacrocells(bool upload = false);
+    // level of the pyramid for the current view (coarser while the camera moves)
+    void updateLevelOfDetail();
+    void updateVisibleBox();
+    void renderOnCPU(const std::string & fileName);
+    // mesh (vertices, triangles) of the surfaces of the visible labels
+    void extractSurfaces();
+
+
+    bool openIMA(  const QString & filename, std::vector<unsigned char> & labels,
                    unsigned int & nx , unsigned int & ny , unsigned int & nz, float & dx , float & dy , float & dz );
+    bool openBricked(  const QString & filename, std::vector<unsigned char> & labels,
+                       unsigned int & nx , unsigned int & ny , unsigned int & nz, float & dx , float & dy , float & dz );
+    // label texture and macrocells from the bricks, one brick at a time
+    void streamBricks();
+
+    // labels of the loaded 3D image (mapped from the .ima when it is U8)
+    ImaVolume volume;
+    // or of the loaded .bvol, read by bricks through a bounded cache
+    BrickedVolume bricks;
+    // empty space skipping of the ray marchers, built at load time
+    MacrocellGrid macrocells;
+    // coarse levels of the labels (majority vote), mipmaps of the label texture
+    LabelPyramid pyramid;
+    // voxel count, volume, box and centroid of each label, computed at load time
+    LabelStatistics statistics;
 
     Vec3Df cut;
     Vec3Df cutDirection;
@@ -0,0 +1,449 @@
+// Offline rendering of a .dim/.ima or bricked (.bvol) label volume on the CPU (no Qt, no
+// OpenGL context).
+//   VolumeRender image.(dim|bvol) output.png [options]
+// see usage() for the options.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#include "ImaVolume.h"
+#include "BrickedVolume.h"
+#include "VolumeRenderer.h"
+#include "MacrocellGrid.h"
+#include "LabelPyramid.h"
+#include "LabelStatistics.h"
+#include "DistanceTransform.h"
+#include "ImageWriter.h"
+
+using namespace std;
+
+static void usage()
+{
+    cout << "VolumeRender image.(dim|bvol) output.(png|ppm) [options]" << endl;
+    cout << "  -size w h            image size (512 512)" << endl;
+    cout << "  -view az el          camera azimuth and elevation in degrees (30 20)" << endl;
+    cout << "  -fov deg             vertical field of view (45)" << endl;
+    cout << "  -cut x y z           cut plane positions, fraction of the volume size (0 0 0)" << endl;
+    cout << "  -invert axes         inverts the cut directions of the given axes, e.g. -invert xz" << endl;
+    cout << "  -hide label          hides a label (repeatable)" << endl;
+    cout << "  -background          shows the label 0 (hidden by default)" << endl;
+    cout << "  -opacity a           opacity of the labels, per voxel (1)" << endl;
+    cout << "  -step s              sampling step, fraction of the smallest voxel size (0.5)" << endl;
+    cout << "  -threads n           number of threads (one per core)" << endl;
+    cout << "  -macrocell s         size of the macrocells skipping the empty space, 0 : none (8)" << endl;
+    cout << "  -bench n             renders n times and reports the timings" << endl;
+    cout << "  -stats               prints the voxel count, volume, bounding box and centroid of each label" << endl;
+    cout << "  -lod l               renders (and saves with -save-bricks) the level l of the pyramid of a .dim volume (0)" << endl;
+    cout << "  -save-bricks f.bvol  converts the .dim volume to a bricked volume before rendering" << endl;
+    cout << "  -bricksize s         size of the bricks of -save-bricks (32)" << endl;
+    cout << "  -codec c             compression of the bricks of -save-bricks : raw, rle or palette (rle)" << endl;
+    cout << "  -distance f.dim      writes the distance of each voxel to the visible labels (FLOAT)" << endl;
+    cout << "  -distance-step s     quantizes the distances of -distance on U16, in units of s (0 : FLOAT)" << endl;
+    cout << "  -budget MB           memory of the brick cache of a .bvol volume (256)" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+    string dimName = argv[1], outputName = argv[2];
+
+    RenderCamera camera;
+    VolumeRenderParameters parameters;
+    float azimuth = 30.f, elevation = 20.f, fov = 45.f, cut[3] = {0.f, 0.f, 0.f}, opacity = 1.f;
+    bool showBackground = false;
+    vector<int> hidden;
+    unsigned int nRuns = 1;
+    int macrocellSize = 8;
+    string bricksName;
+    unsigned int brickSize = 32;
+    BrickCodec codec = BrickCodec_RLE;
+    size_t budget = 256;
+    unsigned int lod = 0;
+    bool printStatistics = false;
+    string distanceName;
+    float distanceStep = 0.f;
+    for (int i = 3; i < argc; ++i)
+    {
+        string option = argv[i];
+        int remaining = argc - i - 1;
+        if (option == "-size" && remaining >= 2)
+        {
+            camera.width = atoi(argv[++i]);
+            camera.height = atoi(argv[++i]);
+        }
+        else if (option == "-view" && remaining >= 2)
+        {
+            azimuth = atof(argv[++i]);
+            elevation = atof(argv[++i]);
+        }
+        else if (option == "-fov" && remaining >= 1)
+            fov = atof(argv[++i]);
+        else if (option == "-cut" && remaining >= 3)
+            for (int c = 0; c < 3; ++c)
+                cut[c] = atof(argv[++i]);
+        else if (option == "-invert" && remaining >= 1)
+        {
+            string axes = argv[++i];
+            for (size_t a = 0; a < axes.size(); ++a)
+                if (axes[a] >= 'x' && axes[a] <= 'z')
+                    parameters.cutDirection[axes[a] - 'x'] = -1;
+        }
+        else if (option == "-hide" && remaining >= 1)
+            hidden.push_back(atoi(argv[++i]));
+        else if (option == "-background")
+            showBackground = true;
+        else if (option == "-opacity" && remaining >= 1)
+            opacity = atof(argv[++i]);
+        else if (option == "-step" && remaining >= 1)
+            parameters.stepScale = atof(argv[++i]);
+        else if (option == "-threads" && remaining >= 1)
+            parameters.nThreads = atoi(argv[++i]);
+        else if (option == "-macrocell" && remaining >= 1)
+            macrocellSize = atoi(argv[++i]);
+        else if (option == "-bench" && remaining >= 1)
+            nRuns = max(1, atoi(argv[++i]));
+        else if (option == "-stats")
+            printStatistics = true;
+        else if (option == "-lod" && remaining >= 1)
+            lod = max(0, atoi(argv[++i]));
+        else if (option == "-save-bricks" && remaining >= 1)
+            bricksName = argv[++i];
+        else if (option == "-bricksize" && remaining >= 1)
+            brickSize = max(1, atoi(argv[++i]));
+        else if (option == "-codec" && remaining >= 1)
+        {
+            string name = argv[++i];
+            if (name != "raw" && name != "rle" && name != "palette")
+            {
+                usage();
+                return 1;
+            }
+            codec = name == "raw" ? BrickCodec_Raw : name == "rle" ? BrickCodec_RLE : BrickCodec_Palette;
+        }
+        else if (option == "-distance" && remaining >= 1)
+            distanceName = argv[++i];
+        else if (option == "-distance-step" && remaining >= 1)
+            distanceStep = max(0., atof(argv[++i]));
+        else if (option == "-budget" && remaining >= 1)
+            budget = max(0, atoi(argv[++i]));
+        else
+        {
+            cout << "unknown option " << option << endl;
+            usage();
+            return 1;
+        }
+    }
+    if (camera.width == 0 || camera.height == 0 || !(parameters.stepScale > 0.f))
+    {
+        usage();
+        return 1;
+    }
+
+    ImaVolume volume;
+    BrickedVolume bricks;
+    string error;
+    bool bricked = dimName.size() > 5 && dimName.compare(dimName.size() - 5, 5, ".bvol") == 0;
+    unsigned int n[3];
+    float d[3];
+    vector<unsigned char> labels;
+    unsigned char const *voxels = NULL; // of the .dim volume, at the level lod
+    LabelPyramid pyramid;
+    if (bricked)
+    {
+        if (lod > 0)
+        {
+            cout << "-lod needs a .dim volume" << endl;
+            return 1;
+        }
+        if (!bricks.open(dimName, &error))
+        {
+            cout << error << endl;
+            return 1;
+        }
+        bricks.setMemoryBudget(budget << 20);
+        for (int c = 0; c < 3; ++c)
+        {
+            n[c] = bricks.size(c);
+            d[c] = bricks.voxelSize(c);
+        }
+        labels = bricks.labels();
+    }
+    else
+    {
+        if (!volume.open(dimName, &error))
+        {
+            cout << error << endl;
+            return 1;
+        }
+        ImaHeader const &h = volume.getHeader();
+        n[0] = h.nx;
+        n[1] = h.ny;
+        n[2] = h.nz;
+        d[0] = h.dx;
+        d[1] = h.dy;
+        d[2] = h.dz;
+        labels = volume.getLabels();
+        voxels = volume.voxels();
+        if (lod > 0)
+        {
+            chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+            pyramid.build(voxels, n[0], n[1], n[2], d[0], d[1], d[2], lod);
+            double pyramidTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+            lod = pyramid.numberOfLevels() - 1;
+            for (int c = 0; c < 3; ++c)
+            {
+                n[c] = pyramid.size(lod, c);
+                d[c] = pyramid.voxelSize(lod, c);
+            }
+            voxels = pyramid.voxels(lod);
+            cout << "pyramid of " << pyramid.numberOfLevels() << " levels built in " << pyramidTime * 1e3 << " ms, level " << lod << " : "
+                 << n[0] << " x " << n[1] << " x " << n[2] << endl;
+        }
+    }
+    cout << dimName << " : " << n[0] << " x " << n[1] << " x " << n[2] << ", " << labels.size() << " labels" << endl;
+
+    if (!bricksName.empty() && !bricked)
+    {
+        chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+        if (!BrickedVolume::write(bricksName, voxels, n[0], n[1], n[2], d[0], d[1], d[2], brickSize, codec, &error))
+        {
+            cout << error << endl;
+            return 1;
+        }
+        double writeTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        BrickedVolume check;
+        if (!check.open(bricksName, &error))
+        {
+            cout << error << endl;
+            return 1;
+        }
+        size_t compressed = 0, uniform = 0, nVoxels = (size_t)n[0] * n[1] * n[2];
+        for (unsigned int b = 0; b < check.numberOfBricks(); ++b)
+        {
+            unsigned char label;
+            compressed += check.compressedSize(b);
+            uniform += check.isUniform(b, label);
+        }
+        cout << "written to " << bricksName << " in " << writeTime * 1e3 << " ms : " << check.numberOfBricks() << " bricks of "
+             << brickSize << "^3 voxels (" << uniform << " uniform), " << compressed << " bytes for " << nVoxels
+             << " voxels (ratio " << double(nVoxels) / max<size_t>(1, compressed) << ")" << endl;
+
+        // decoding of the whole volume, checked against the original
+        vector<unsigned char> decoded(nVoxels);
+        double best = 1e30;
+        for (unsigned int run = 0; run < max(3u, nRuns); ++run)
+        {
+            start = chrono::high_resolution_clock::now();
+            if (!check.decodeAll(&decoded[0], &error))
+            {
+                cout << error << endl;
+                return 1;
+            }
+            best = min(best, chrono::duration<double>(chrono::high_resolution_clock::now() - start).count());
+        }
+        bool same = equal(decoded.begin(), decoded.end(), voxels);
+        cout << "decoded in " << best * 1e3 << " ms (" << nVoxels / best * 1e-6 << " Mvoxels/s), "
+             << (same ? "identical to the original" : "DIFFERENT FROM THE ORIGINAL") << endl;
+        if (!same)
+            return 1;
+    }
+
+    VolumeRenderer renderer;
+    if (bricked)
+        renderer.setBrickedVolume(&bricks);
+    else
+        renderer.setVolume(voxels, n[0], n[1], n[2], d[0], d[1], d[2]);
+
+    float size[3] = {n[0] * d[0], n[1] * d[1], n[2] * d[2]};
+    parameters.setDefaultColors(labels);
+    unsigned char alpha = (unsigned char)(min(1.f, max(0.f, opacity)) * 255.f + 0.5f);
+    for (unsigned int l = 0; l < 256; ++l)
+        if (parameters.labelColors[4 * l + 3])
+            parameters.setLabelVisibility(l, true, alpha);
+    if (!showBackground)
+        parameters.setLabelVisibility(0, false);
+    for (size_t i = 0; i < hidden.size(); ++i)
+        if (hidden[i] >= 0 && hidden[i] < 256)
+            parameters.setLabelVisibility(hidden[i], false);
+    for (int c = 0; c < 3; ++c)
+        parameters.cutPosition[c] = cut[c] * size[c];
+
+    // label statistics and macrocells : one pass over the volume, or over the bricks read in
+    // order by the prefetching thread
+    MacrocellGrid macrocells;
+    LabelStatistics statistics;
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    if (bricked)
+    {
+        unsigned int nBricks = bricks.numberOfBricks(), ahead = bricks.readAhead();
+        bricks.prefetchRange(0, ahead);
+        statistics.reset(n[0], n[1], n[2], d[0], d[1], d[2]);
+        if (macrocellSize > 0)
+            macrocells.reset(n[0], n[1], n[2], macrocellSize);
+        for (unsigned int b = 0; b < nBricks; ++b)
+        {
+            bricks.prefetchRange(b + ahead, b + ahead + 1);
+            unsigned int origin[3], extent[3];
+            unsigned char label;
+            bricks.brickBox(b, origin, extent);
+            if (bricks.isUniform(b, label))
+            {
+                statistics.addUniformBlock(label, origin, extent);
+                if (macrocellSize > 0)
+                    macrocells.addUniformBlock(label, origin, extent);
+                continue;
+            }
+            BrickData data = bricks.brick(b);
+            statistics.addBlock(&(*data)[0], origin, extent);
+            if (macrocellSize > 0)
+                macrocells.addBlock(&(*data)[0], origin, extent);
+        }
+        statistics.finish();
+        if (macrocellSize > 0)
+            macrocells.finish();
+        double buildTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        cout << "label statistics" << (macrocellSize > 0 ? " and macrocells" : "") << " built in " << buildTime * 1e3 << " ms" << endl;
+    }
+    else
+    {
+        statistics.compute(voxels, n[0], n[1], n[2], d[0], d[1], d[2]);
+        double statisticsTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        cout << "label statistics computed in " << statisticsTime * 1e3 << " ms" << endl;
+        if (macrocellSize > 0)
+        {
+            start = chrono::high_resolution_clock::now();
+            macrocells.build(voxels, n[0], n[1], n[2], macrocellSize);
+            double buildTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+            cout << "macrocells built in " << buildTime * 1e3 << " ms" << endl;
+        }
+    }
+
+    if (printStatistics)
+        for (unsigned int l = 0; l < 256; ++l)
+        {
+            LabelStatistic const &st = statistics[l];
+            if (st.count == 0)
+                continue;
+            cout << "label " << l << " : " << st.count << " voxels, volume " << st.volume << ", box (" << st.min[0] << ", " << st.min[1]
+                 << ", " << st.min[2] << ") - (" << st.max[0] << ", " << st.max[1] << ", " << st.max[2] << "), centroid ("
+                 << st.centroid[0] << ", " << st.centroid[1] << ", " << st.centroid[2] << ")" << endl;
+        }
+
+    // the rays are clipped to the box of the visible labels
+    bool visible[256];
+    for (unsigned int l = 0; l < 256; ++l)
+        visible[l] = parameters.labelColors[4 * l + 3] != 0;
+    unsigned int boxMin[3], boxMax[3];
+    bool anyVisible = statistics.visibleBox(visible, boxMin, boxMax);
+    for (int c = 0; c < 3; ++c)
+    {
+        parameters.visibleMin[c] = anyVisible ? boxMin[c] * d[c] : 1.f;
+        parameters.visibleMax[c] = anyVisible ? (boxMax[c] + 1.f) * d[c] : 0.f; // empty box : no ray
+    }
+
+    if (!distanceName.empty())
+    {
+        // the whole volume is needed : a .bvol is decoded
+        vector<unsigned char> decoded;
+        unsigned char const *labelVoxels = voxels;
+        if (bricked)
+        {
+            decoded.resize((size_t)n[0] * n[1] * n[2]);
+            if (!bricks.decodeAll(&decoded[0], &error))
+            {
+                cout << error << endl;
+                return 1;
+            }
+            labelVoxels = &decoded[0];
+        }
+        vector<float> distances((size_t)n[0] * n[1] * n[2]);
+        start = chrono::high_resolution_clock::now();
+        DistanceTransform::compute(labelVoxels, n[0], n[1], n[2], d[0], d[1], d[2], visible, &distances[0]);
+        double distanceTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        cout << "distance transform computed in " << distanceTime * 1e3 << " ms (" << distances.size() / distanceTime * 1e-6
+             << " Mvoxels/s)" << endl;
+
+        ImaHeader header;
+        header.nx = n[0];
+        header.ny = n[1];
+        header.nz = n[2];
+        header.dx = d[0];
+        header.dy = d[1];
+        header.dz = d[2];
+        header.type = distanceStep > 0.f ? IMA_U16 : IMA_FLOAT;
+        bool written;
+        if (distanceStep > 0.f)
+        {
+            vector<uint16_t> quantized(distances.size());
+            DistanceTransform::quantize(&distances[0], distances.size(), distanceStep, &quantized[0]);
+            written = ImaVolume::write(distanceName, header, &quantized[0], &error);
+        }
+        else
+            written = ImaVolume::write(distanceName, header, &distances[0], &error);
+        if (!written)
+        {
+            cout << error << endl;
+            return 1;
+        }
+        cout << "distances written to " << distanceName << endl;
+    }
+
+    if (macrocellSize > 0)
+    {
+        start = chrono::high_resolution_clock::now();
+        macrocells.setVisibleLabels(parameters.labelColors);
+        double visibilityTime = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        cout << macrocells.numberOfCells(0) << " x " << macrocells.numberOfCells(1) << " x " << macrocells.numberOfCells(2)
+             << " macrocells of " << macrocells.getCellSize() << "^3 voxels, visibility updated in " << visibilityTime * 1e3 << " ms" << endl;
+        renderer.setMacrocells(&macrocells);
+    }
+
+    // the whole volume in view, orbiting around its center (y up)
+    float center[3] = {size[0] * 0.5f, size[1] * 0.5f, size[2] * 0.5f};
+    float radius = 0.5f * sqrt(size[0] * size[0] + size[1] * size[1] + size[2] * size[2]);
+    float az = azimuth * float(M_PI) / 180.f, el = elevation * float(M_PI) / 180.f;
+    camera.fieldOfView = fov * float(M_PI) / 180.f;
+    float distance = radius / sin(0.5f * min(camera.fieldOfView, camera.fieldOfView * camera.width / camera.height)) * 1.05f;
+    float eye[3] = {center[0] + distance * cos(el) * sin(az), center[1] + distance * sin(el), center[2] + distance * cos(el) * cos(az)};
+    float up[3] = {0.f, 1.f, 0.f};
+    camera.lookAt(eye, center, up);
+    if (bricked)
+        bricks.prefetchAlongView(camera.eye, camera.forward);
+
+    vector<unsigned char> rgb;
+    double best = 1e30, total = 0.;
+    VolumeRenderStats stats;
+    for (unsigned int run = 0; run < nRuns; ++run)
+    {
+        stats = renderer.render(camera, parameters, rgb);
+        best = min(best, stats.seconds);
+        total += stats.seconds;
+    }
+    cout << camera.width << " x " << camera.height << " rays, " << double(stats.samples) / stats.rays << " samples per ray" << endl;
+    cout << "best " << best * 1e3 << " ms (" << stats.rays / best * 1e-6 << " Mrays/s), mean " << total / nRuns * 1e3
+         << " ms over " << nRuns << " run(s), " << (parameters.nThreads ? parameters.nThreads : parallelThreadCount()) << " thread(s)" << endl;
+
+    if (bricked)
+    {
+        BrickCacheStatistics cache = bricks.getStatistics();
+        cout << "brick cache : " << cache.hits << " hits, " << cache.misses << " misses, " << cache.prefetched << " prefetched, "
+             << cache.evictions << " evictions, " << cache.bytesRead << " bytes read, " << bricks.getResidentBytes() << " bytes resident" << endl;
+    }
+
+    if (!writeImage(outputName, rgb, camera.width, camera.height))
+    {
+        cout << outputName << " cannot be written" << endl;
+        return 1;
+    }
+    cout << "written to " << outputName << endl;
+    return 0;
+}
@@ -0,0 +1,21 @@
+# -------------------------------------------------
+# Offline CPU rendering of .dim/.ima volumes (no Qt, no OpenGL)
+# -------------------------------------------------
+QT -= core gui
+CONFIG += console c++11
+CONFIG -= app_bundle
+TARGET = volumeRender
+TEMPLATE = app
+MAKEFILE = Makefile.volumeRender
+OBJECTS_DIR = ./obj
+SOURCES += VolumeRender.cpp
+HEADERS += ImaVolume.h \
+    ParallelFor.h \
+    VolumeRenderer.h \
+    ImageWriter.h \
+    MacrocellGrid.h \
+    BrickedVolume.h \
+    LabelPyramid.h \
+    LabelStatistics.h \
+    DistanceTransform.h
+LIBS += -lpthread
@@ -0,0 +1,572 @@
+#ifndef VOLUMERENDERER_H
+#define VOLUMERENDERER_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "ParallelFor.h"
+#include "MacrocellGrid.h"
+#include "BrickedVolume.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VOLUMERENDERER_USE_SSE
+#endif
+
+//-------------------------------------------------------------------------------------//
+//
+// CPU ray casting of a label volume, without OpenGL (offline renders, batch nodes).
+// Same conventions as Texture / volume.frag : the volume fills [0,xMax]x[0,yMax]x[0,zMax]
+// (xMax = nx * dx ...), a point is visible if ( p[a] - cutPosition[a] ) * cutDirection[a] >= 0
+// on the three axes, and each label has an RGBA color (alpha 0 : hidden label).
+//
+// The cut planes being axis aligned, the visible part of the volume is a box : rays are
+// clipped against it once, then marched front to back with a fixed step, compositing the
+// label colors (the opacity is corrected for the step, an opaque label stops the ray) until
+// the accumulated opacity reaches opacityThreshold. A sample is lit by a headlight, with
+// the normal of the voxel face the ray crossed last.
+// With a MacrocellGrid, a sample falling in a macrocell without visible label makes the
+// ray jump to the first sample after the exit of the macrocell (the samples are the same
+// as without the grid, only the empty ones are not taken).
+// The volume can also be a BrickedVolume : each lane then keeps the brick it is in, and
+// only asks the brick cache for another one when it leaves it.
+//
+// Rays are traced by packets of 2x2 pixels (positions, voxel indices and termination four
+// lanes at a time with SSE2). The image is cut in tiles ; each thread starts with its own
+// contiguous range of tiles and steals half of the remaining range of another thread when
+// it is done, so that tiles crossing the volume do not leave the other cores idle.
+//
+//-------------------------------------------------------------------------------------//
+
+struct RenderCamera
+{
+    float eye[3];
+    float forward[3], right[3], up[3]; // orthonormal
+    float fieldOfView;                  // vertical, in radians
+    unsigned int width, height;
+
+    RenderCamera() : fieldOfView(0.785398f), width(512), height(512)
+    {
+        eye[0] = eye[1] = eye[2] = 0.f;
+        forward[0] = forward[1] = 0.f;
+        forward[2] = -1.f;
+        right[0] = 1.f;
+        right[1] = right[2] = 0.f;
+        up[1] = 1.f;
+        up[0] = up[2] = 0.f;
+    }
+
+    void lookAt(float const _eye[3], float const target[3], float const upVector[3])
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            eye[c] = _eye[c];
+            forward[c] = target[c] - _eye[c];
+        }
+        normalize(forward);
+        cross(forward, upVector, right);
+        normalize(right);
+        cross(right, forward, up);
+    }
+
+    static void cross(float const a[3], float const b[3], float r[3])
+    {
+        r[0] = a[1] * b[2] - a[2] * b[1];
+        r[1] = a[2] * b[0] - a[0] * b[2];
+        r[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    static void normalize(float v[3])
+    {
+        float l = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (l > 0.f)
+            for (int c = 0; c < 3; ++c)
+                v[c] /= l;
+    }
+};
+
+struct VolumeRenderParameters
+{
+    float cutPosition[3];
+    int cutDirection[3];
+    float visibleMin[3], visibleMax[3]; // box of the visible labels (LabelStatistics), the rays stay inside
+    unsigned char labelColors[256 * 4];
+    float background[3];
+    float stepScale;        // step, in fraction of the smallest voxel size
+    float opacityThreshold; // early ray termination
+    float ambient;
+    unsigned int tileSize;
+    unsigned int nThreads; // 0 : one per core
+
+    VolumeRenderParameters() : stepScale(0.5f), opacityThreshold(0.99f), ambient(0.3f), tileSize(32), nThreads(0)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            cutPosition[c] = 0.f;
+            cutDirection[c] = 1;
+            visibleMin[c] = 0.f;
+            visibleMax[c] = 1e30f;
+            background[c] = 1.f;
+        }
+        std::memset(labelColors, 0, sizeof(labelColors));
+    }
+
+    // the colors of TextureViewer::open3DImage : black for 0, hues for the other labels
+    void setDefaultColors(std::vector<unsigned char> const &labels)
+    {
+        std::memset(labelColors, 0, sizeof(labelColors));
+        for (unsigned int i = 0; i < labels.size(); ++i)
+        {
+            unsigned char *c = &labelColors[4 * labels[i]];
+            if (labels[i] != 0)
+                hsvToRgb(0.98f * float(i) / labels.size(), 0.8f, 0.8f, c);
+            c[3] = 255;
+        }
+    }
+
+    void setLabelVisibility(unsigned char label, bool visible, unsigned char alpha = 255)
+    {
+        labelColors[4 * label + 3] = visible ? alpha : 0;
+    }
+
+    static void hsvToRgb(float h, float s, float v, unsigned char rgb[3])
+    {
+        float h6 = h * 6.f;
+        int sector = (int)std::floor(h6) % 6;
+        float f = h6 - std::floor(h6);
+        float p = v * (1.f - s), q = v * (1.f - s * f), t = v * (1.f - s * (1.f - f));
+        float r, g, b;
+        switch (sector)
+        {
+        case 0: r = v, g = t, b = p; break;
+        case 1: r = q, g = v, b = p; break;
+        case 2: r = p, g = v, b = t; break;
+        case 3: r = p, g = q, b = v; break;
+        case 4: r = t, g = p, b = v; break;
+        default: r = v, g = p, b = q; break;
+        }
+        rgb[0] = (unsigned char)(r * 255.f + 0.5f);
+        rgb[1] = (unsigned char)(g * 255.f + 0.5f);
+        rgb[2] = (unsigned char)(b * 255.f + 0.5f);
+    }
+};
+
+struct VolumeRenderStats
+{
+    double seconds;
+    size_t rays, samples;
+
+    VolumeRenderStats() : seconds(0.), rays(0), samples(0) {}
+    double megaRaysPerSecond() const { return seconds > 0. ? rays / seconds * 1e-6 : 0.; }
+};
+
+// ranges of tiles, one per thread ; an idle thread steals the second half of the largest range
+class TileScheduler
+{
+public:
+    TileScheduler(unsigned int nTiles, unsigned int nThreads) : ranges(nThreads)
+    {
+        for (unsigned int w = 0; w < nThreads; ++w)
+        {
+            ranges[w].begin = (unsigned int)((size_t)nTiles * w / nThreads);
+            ranges[w].end = (unsigned int)((size_t)nTiles * (w + 1) / nThreads);
+        }
+    }
+
+    bool next(unsigned int worker, unsigned int &tile)
+    {
+        {
+            std::lock_guard<std::mutex> lock(ranges[worker].mutex);
+            if (ranges[worker].begin < ranges[worker].end)
+            {
+                tile = ranges[worker].begin++;
+                return true;
+            }
+        }
+        while (true)
+        {
+            unsigned int victim = 0, largest = 0;
+            for (unsigned int w = 0; w < ranges.size(); ++w)
+            {
+                std::lock_guard<std::mutex> lock(ranges[w].mutex);
+                if (ranges[w].end - ranges[w].begin > largest)
+                {
+                    largest = ranges[w].end - ranges[w].begin;
+                    victim = w;
+                }
+            }
+            if (largest == 0)
+                return false;
+            unsigned int begin, end;
+            {
+                std::lock_guard<std::mutex> lock(ranges[victim].mutex);
+                if (ranges[victim].begin >= ranges[victim].end)
+                    continue; // emptied meanwhile
+                end = ranges[victim].end;
+                begin = ranges[victim].begin + (end - ranges[victim].begin) / 2;
+                ranges[victim].end = begin; // a single tile left : it is taken
+            }
+            std::lock_guard<std::mutex> lock(ranges[worker].mutex);
+            tile = begin;
+            ranges[worker].begin = begin + 1;
+            ranges[worker].end = end;
+            return true;
+        }
+    }
+
+private:
+    struct Range
+    {
+        std::mutex mutex;
+        unsigned int begin, end;
+    };
+    std::vector<Range> ranges;
+};
+
+class VolumeRenderer
+{
+public:
+    VolumeRenderer() : voxels(NULL), bricks(NULL), macrocells(NULL) { n[0] = n[1] = n[2] = 0; }
+
+    // labels : nx * ny * nz, x first ; kept by pointer
+    void setVolume(unsigned char const *labels, unsigned int nx, unsigned int ny, unsigned int nz, float dx, float dy, float dz)
+    {
+        voxels = labels;
+        bricks = NULL;
+        n[0] = nx;
+        n[1] = ny;
+        n[2] = nz;
+        d[0] = dx;
+        d[1] = dy;
+        d[2] = dz;
+    }
+
+    // out of core volume, kept by pointer ; its bricks are read while rendering
+    void setBrickedVolume(BrickedVolume *volume)
+    {
+        voxels = NULL;
+        bricks = volume;
+        for (int c = 0; c < 3; ++c)
+        {
+            n[c] = volume->size(c);
+            d[c] = volume->voxelSize(c);
+        }
+    }
+
+    // empty space skipping (NULL : none) ; its visible labels must be the ones of the label colors
+    void setMacrocells(MacrocellGrid const *grid) { macrocells = grid; }
+
+    // rgb : width * height * 3, rows from top to bottom
+    VolumeRenderStats render(RenderCamera const &camera, VolumeRenderParameters const &parameters, std::vector<unsigned char> &rgb) const
+    {
+        VolumeRenderStats stats;
+        rgb.assign((size_t)camera.width * camera.height * 3, 0);
+        if ((!voxels && !bricks) || camera.width == 0 || camera.height == 0)
+            return stats;
+
+        Frame frame;
+        setupFrame(parameters, frame);
+        unsigned int tile = std::max(2u, parameters.tileSize & ~1u);
+        unsigned int tilesX = (camera.width + tile - 1) / tile, tilesY = (camera.height + tile - 1) / tile;
+        unsigned int nThreads = parameters.nThreads ? parameters.nThreads : parallelThreadCount();
+        nThreads = std::max(1u, std::min(nThreads, tilesX * tilesY));
+        TileScheduler scheduler(tilesX * tilesY, nThreads);
+        std::vector<size_t> samples(nThreads, 0);
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        auto worker = [&](unsigned int w)
+        {
+            unsigned int t;
+            while (scheduler.next(w, t))
+            {
+                unsigned int x0 = (t % tilesX) * tile, y0 = (t / tilesX) * tile;
+                unsigned int x1 = std::min(camera.width, x0 + tile), y1 = std::min(camera.height, y0 + tile);
+                for (unsigned int y = y0; y < y1; y += 2)
+                    for (unsigned int x = x0; x < x1; x += 2)
+                        samples[w] += tracePacket(camera, parameters, frame, x, y, rgb);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned int w = 1; w < nThreads; ++w)
+            threads.push_back(std::thread(worker, w));
+        worker(0);
+        for (unsigned int w = 0; w < threads.size(); ++w)
+            threads[w].join();
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        stats.rays = (size_t)camera.width * camera.height;
+        for (unsigned int w = 0; w < nThreads; ++w)
+            stats.samples += samples[w];
+        return stats;
+    }
+
+private:
+    unsigned char const *voxels;
+    BrickedVolume *bricks;
+    MacrocellGrid const *macrocells;
+    unsigned int n[3];
+    float d[3];
+
+    // per render constants
+    struct Frame
+    {
+        float boxMin[3], boxMax[3]; // visible box
+        float step;
+        float alpha[256];           // opacity of one step
+        float color[256][3];
+    };
+
+    void setupFrame(VolumeRenderParameters const &parameters, Frame &frame) const
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            float size = n[c] * d[c];
+            if (parameters.cutDirection[c] >= 0)
+            {
+                frame.boxMin[c] = std::max(0.f, parameters.cutPosition[c]);
+                frame.boxMax[c] = size;
+            }
+            else
+            {
+                frame.boxMin[c] = 0.f;
+                frame.boxMax[c] = std::min(size, parameters.cutPosition[c]);
+            }
+            frame.boxMin[c] = std::max(frame.boxMin[c], parameters.visibleMin[c]);
+            frame.boxMax[c] = std::min(frame.boxMax[c], parameters.visibleMax[c]);
+        }
+        float minD = std::min(d[0], std::min(d[1], d[2]));
+        frame.step = parameters.stepScale * minD;
+        for (unsigned int l = 0; l < 256; ++l)
+        {
+            float a = parameters.labelColors[4 * l + 3] / 255.f;
+            // opacity defined for a thickness of one voxel
+            frame.alpha[l] = a >= 1.f ? 1.f : 1.f - std::pow(1.f - a, parameters.stepScale);
+            for (int c = 0; c < 3; ++c)
+                frame.color[l][c] = parameters.labelColors[4 * l + c] / 255.f;
+        }
+    }
+
+    // brick of the last sample of a lane
+    struct BrickCursor
+    {
+        unsigned int origin[3], extent[3];
+        BrickData data; // empty : uniform brick
+        unsigned char uniform;
+        BrickCursor() : uniform(0) { origin[0] = origin[1] = origin[2] = extent[0] = extent[1] = extent[2] = 0; }
+    };
+
+    unsigned char brickedLabel(BrickCursor &cursor, unsigned int x, unsigned int y, unsigned int z) const
+    {
+        if (x - cursor.origin[0] >= cursor.extent[0] || y - cursor.origin[1] >= cursor.extent[1] || z - cursor.origin[2] >= cursor.extent[2])
+        {
+            unsigned int b = bricks->brickOf(x, y, z);
+            bricks->brickBox(b, cursor.origin, cursor.extent);
+            cursor.data = bricks->isUniform(b, cursor.uniform) ? BrickData() : bricks->brick(b);
+        }
+        if (!cursor.data)
+            return cursor.uniform;
+        return (*cursor.data)[((size_t)(z - cursor.origin[2]) * cursor.extent[1] + (y - cursor.origin[1])) * cursor.extent[0] + (x - cursor.origin[0])];
+    }
+
+    // rays of the pixels (x, y) .. (x+1, y+1) ; returns the number of samples
+    size_t tracePacket(RenderCamera const &camera, VolumeRenderParameters const &parameters, Frame const &frame,
+                       unsigned int x, unsigned int y, std::vector<unsigned char> &rgb) const
+    {
+        float dir[3][4], t[4], tEnd[4];
+        int axis[4];
+        int pixel[4];
+        float tanHalf = std::tan(camera.fieldOfView * 0.5f);
+        float aspect = float(camera.width) / float(camera.height);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            unsigned int px = x + (lane & 1), py = y + (lane >> 1);
+            pixel[lane] = (px < camera.width && py < camera.height) ? int(py * camera.width + px) : -1;
+            float u = (2.f * (px + 0.5f) / camera.width - 1.f) * tanHalf * aspect;
+            float v = (1.f - 2.f * (py + 0.5f) / camera.height) * tanHalf;
+            float r[3];
+            for (int c = 0; c < 3; ++c)
+                r[c] = camera.forward[c] + u * camera.right[c] + v * camera.up[c];
+            RenderCamera::normalize(r);
+            for (int c = 0; c < 3; ++c)
+                dir[c][lane] = r[c];
+            clip(camera.eye, r, frame, t[lane], tEnd[lane], axis[lane]);
+            if (pixel[lane] < 0)
+                tEnd[lane] = -1.f;
+        }
+
+        float color[4][3] = {{0.f}}, opacity[4] = {0.f, 0.f, 0.f, 0.f};
+        int previous[3][4];
+        int active = 0;
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            if (t[lane] <= tEnd[lane])
+                active |= 1 << lane;
+            previous[0][lane] = previous[1][lane] = previous[2][lane] = -1;
+        }
+
+        // sample i of a lane is at t = tStart + i * step, also after a jump over empty macrocells
+        float tStart[4], sample[4] = {0.f, 0.f, 0.f, 0.f};
+        std::copy(t, t + 4, tStart);
+        int index[3][4];
+        BrickCursor cursors[4];
+        size_t nSamples = 0;
+        float invD[3] = {1.f / d[0], 1.f / d[1], 1.f / d[2]};
+#ifdef VOLUMERENDERER_USE_SSE
+        __m128 tStartV = _mm_loadu_ps(tStart), tEndV = _mm_loadu_ps(tEnd), stepV = _mm_set1_ps(frame.step);
+        __m128 originV[3], dirV[3], maxIndexV[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            originV[c] = _mm_set1_ps(camera.eye[c] * invD[c]);
+            dirV[c] = _mm_mul_ps(_mm_loadu_ps(dir[c]), _mm_set1_ps(invD[c]));
+            maxIndexV[c] = _mm_set1_ps(float(n[c] - 1));
+        }
+#endif
+        while (active)
+        {
+#ifdef VOLUMERENDERER_USE_SSE
+            __m128 tv = _mm_add_ps(tStartV, _mm_mul_ps(_mm_loadu_ps(sample), stepV));
+            for (int c = 0; c < 3; ++c)
+            {
+                __m128 p = _mm_add_ps(originV[c], _mm_mul_ps(tv, dirV[c]));
+                p = _mm_min_ps(_mm_max_ps(p, _mm_setzero_ps()), maxIndexV[c]);
+                _mm_storeu_si128((__m128i *)index[c], _mm_cvttps_epi32(p));
+            }
+#else
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                t[lane] = tStart[lane] + sample[lane] * frame.step;
+                voxelOf(camera.eye, dir, lane, t[lane], invD, index);
+            }
+#endif
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                if (!(active & (1 << lane)))
+                    continue;
+                if (macrocells && macrocells->isEmpty(index[0][lane], index[1][lane], index[2][lane]))
+                {
+                    // 3D-DDA step : first sample after the exit of the macrocell, the previous voxel
+                    // being the one of the sample before it (as if the cell had been marched)
+                    float next = nextSampleAfterMacrocell(camera.eye, dir, lane, index, tStart[lane], frame.step);
+                    sample[lane] = std::max(sample[lane], next - 1.f);
+                    voxelOf(camera.eye, dir, lane, tStart[lane] + sample[lane] * frame.step, invD, previous);
+                    continue;
+                }
+                ++nSamples;
+                int changed = -1;
+                float changedDir = -1.f;
+                for (int c = 0; c < 3; ++c)
+                {
+                    if (index[c][lane] != previous[c][lane] && std::fabs(dir[c][lane]) > changedDir && previous[c][lane] >= 0)
+                    {
+                        changed = c;
+                        changedDir = std::fabs(dir[c][lane]);
+                    }
+                    previous[c][lane] = index[c][lane];
+                }
+                if (changed >= 0)
+                    axis[lane] = changed;
+
+                unsigned char label = bricks ? brickedLabel(cursors[lane], index[0][lane], index[1][lane], index[2][lane])
+                                             : voxels[((size_t)index[2][lane] * n[1] + index[1][lane]) * n[0] + index[0][lane]];
+                float a = frame.alpha[label];
+                if (a <= 0.f)
+                    continue;
+                float shade = parameters.ambient + (1.f - parameters.ambient) * std::fabs(dir[axis[lane]][lane]);
+                float w = (1.f - opacity[lane]) * a * shade;
+                for (int c = 0; c < 3; ++c)
+                    color[lane][c] += w * frame.color[label][c];
+                opacity[lane] += (1.f - opacity[lane]) * a;
+                if (opacity[lane] >= parameters.opacityThreshold)
+                    active &= ~(1 << lane);
+            }
+            for (int lane = 0; lane < 4; ++lane)
+                sample[lane] += 1.f;
+#ifdef VOLUMERENDERER_USE_SSE
+            tv = _mm_add_ps(tStartV, _mm_mul_ps(_mm_loadu_ps(sample), stepV));
+            active &= _mm_movemask_ps(_mm_cmple_ps(tv, tEndV));
+#else
+            for (int lane = 0; lane < 4; ++lane)
+                if (tStart[lane] + sample[lane] * frame.step > tEnd[lane])
+                    active &= ~(1 << lane);
+#endif
+        }
+
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            if (pixel[lane] < 0)
+                continue;
+            unsigned char *out = &rgb[(size_t)pixel[lane] * 3];
+            for (int c = 0; c < 3; ++c)
+            {
+                float v = color[lane][c] + (1.f - opacity[lane]) * parameters.background[c];
+                out[c] = (unsigned char)std::min(255.f, std::max(0.f, v * 255.f + 0.5f));
+            }
+        }
+        return nSamples;
+    }
+
+    void voxelOf(float const eye[3], float const dir[3][4], int lane, float t, float const invD[3], int index[3][4]) const
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            float p = (eye[c] + t * dir[c][lane]) * invD[c];
+            index[c][lane] = (int)std::min(std::max(p, 0.f), float(n[c] - 1));
+        }
+    }
+
+    // index of the first sample after the exit of the macrocell of voxel index[.][lane]
+    float nextSampleAfterMacrocell(float const eye[3], float const dir[3][4], int lane, int const index[3][4], float tStart, float step) const
+    {
+        unsigned int shift = macrocells->getCellShift();
+        float tExit = 1e30f;
+        for (int c = 0; c < 3; ++c)
+        {
+            float dc = dir[c][lane];
+            if (std::fabs(dc) < 1e-12f)
+                continue;
+            unsigned int cell = (unsigned int)index[c][lane] >> shift;
+            float boundary = float(dc > 0.f ? (cell + 1) << shift : cell << shift) * d[c];
+            tExit = std::min(tExit, (boundary - eye[c]) / dc);
+        }
+        return std::floor((tExit - tStart) / step) + 1.f;
+    }
+
+    // [t, tEnd] : the first sample and the end of the ray in the visible box (t > tEnd if it misses it),
+    // axis : the axis of the face it enters by
+    static void clip(float const eye[3], float const dir[3], Frame const &frame, float &t, float &tEnd, int &axis)
+    {
+        float tNear = 0.f, tFar = 1e30f;
+        axis = 0;
+        for (int c = 0; c < 3; ++c)
+        {
+            if (std::fabs(dir[c]) < 1e-12f)
+            {
+                if (eye[c] < frame.boxMin[c] || eye[c] > frame.boxMax[c])
+                    tNear = 1e30f, tFar = -1.f;
+                continue;
+            }
+            float inv = 1.f / dir[c];
+            float t0 = (frame.boxMin[c] - eye[c]) * inv, t1 = (frame.boxMax[c] - eye[c]) * inv;
+            if (t0 > t1)
+                std::swap(t0, t1);
+            if (t0 > tNear)
+            {
+                tNear = t0;
+                axis = c;
+            }
+            tFar = std::min(tFar, t1);
+        }
+        // first sample in the middle of the first step
+        t = tNear + 0.5f * frame.step;
+        tEnd = tFar;
+        if (tNear > tFar)
+            tEnd = t - 1.f;
+    }
+};
+
+#endif // VOLUMERENDERER_H
@@ -103,7 +103,7 @@ void Window::open3DImage()
 {
 
     QString selectedFilter, openFileNameLabel;
-    QString fileFilter = "Known Filetypes (*.dim *.nii);;IMA (*.dim);;NIFTI (*.nii)";
+    QString fileFilter = "Known Filetypes (*.dim *.bvol *.nii);;IMA (*.dim);;Bricked volume (*.bvol);;NIFTI (*.nii)";
 
     QString fileName = QFileDialog::getOpenFileName(this,
                                                     tr("Select an input 3D image"),
@@ -118,7 +118,7 @@ void Window::open3DImage()
     }
 
     statusBar()->showMessage("Opening 3D image...");
-    if (fileName.endsWith(".dim") || fileName.endsWith(".nii"))
+    if (fileName.endsWith(".dim") || fileName.endsWith(".bvol") || fileName.endsWith(".nii"))
     {
         viewer->open3DImage(fileName);
         statusBar()->showMessage("3D image opened");
@@ -62,7 +62,9 @@ ViewerState viewerState;
 enum SelectionToolState
 {
     SelectionTool_Rectangle,
-    SelectionTool_Sphere
+    SelectionTool_Sphere,
+    SelectionTool_Lasso,
+    SelectionTool_Brush
 };
 SelectionToolState selectionToolState;
 
@@ -73,6 +75,22 @@ RectangleSelectionTool rectangleSelectionTool;
 SphereSelectionTool sphereSelectionTool;
 float selectionRadius = 0.05f;
 
+#include "src/SelectionKernel.h"
+ScreenSpaceSelectionKernel selectionKernel; // projected vertices, reused between selections
+
+#include "src/SoftwareDepthBuffer.h"
+SoftwareDepthBuffer occlusionBuffer;  // CPU depth buffer for the visible-only selection
+bool selectVisibleVerticesOnly = false; // if true, the vertices hidden behind the surface are not selected
+
+#include "src/ScreenSpaceGrid.h"
+ScreenSpaceGrid selectionGrid; // projected vertices bucketed by screen cell, for the lasso and the brush
+
+#include "src/LassoSelectionTool.h"
+LassoSelectionTool lassoSelectionTool;
+
+#include "src/BrushSelectionTool.h"
+BrushSelectionTool brushSelectionTool;
+
 // -------------------------------------------
 // ARAP variables
 // -------------------------------------------
@@ -391,20 +409,71 @@ void get3DPosFromMouseInput(int x, int y, float &posX, float &posY, float &posZ)
     posZ += rightVec[2] * mouseX * 0.5f + upVec[2] * mouseY * 0.5f;
 }
 
+void rejectHiddenVerticesFromSelection()
+{
+    // rasterize the mesh at half the viewport resolution, from the already projected vertices
+    int w = (int)selectionKernel.view.viewport[2] / 2, h = (int)selectionKernel.view.viewport[3] / 2;
+    if (occlusionBuffer.getWidth() != w || occlusionBuffer.getHeight() != h)
+        occlusionBuffer.resize(w, h);
+    occlusionBuffer.rasterize(mesh, selectionKernel);
+    occlusionBuffer.rejectOccludedVertices(selectionKernel);
+}
+
 void setTagForVerticesInSphere(bool tagToSet)
 {
-    // check if vertices are inside the sphere
-    for (unsigned int i = 0; i < mesh.V.size(); i++)
+    // check if vertices are inside the sphere (projected on the screen)
+    selectionKernel.project(mesh);
+    float cx, cy, r;
+    sphereSelectionTool.getScreenCircle(selectionKernel.view, cx, cy, r);
+    selectionKernel.selectCircle(cx, cy, r);
+    if (selectVisibleVerticesOnly)
+        rejectHiddenVerticesFromSelection();
+    selectionKernel.applyTag(verticesAreMarkedForCurrentHandle, tagToSet);
+}
+
+void prepareSelectionGrid()
+{
+    // projects the vertices and buckets them in the screen-space grid (only the visible ones if needed)
+    selectionKernel.project(mesh);
+    std::vector<unsigned char> const *mask = NULL;
+    if (selectVisibleVerticesOnly)
     {
-        if (sphereSelectionTool.contains(mesh.V[i]))
-        {
-            verticesAreMarkedForCurrentHandle[i] = tagToSet;
-        }
+        selectionKernel.selectAll();
+        rejectHiddenVerticesFromSelection();
+        mask = &selectionKernel.inside;
     }
+    selectionGrid.build(selectionKernel, mask);
+}
+
+void setTagForVerticesInLasso(bool tagToSet)
+{
+    prepareSelectionGrid();
+    lassoSelectionTool.select(selectionKernel, selectionGrid, verticesAreMarkedForCurrentHandle, tagToSet);
+}
+
+void beginBrushStroke(int x, int y, bool isAdding)
+{
+    brushSelectionTool.isAdding = isAdding;
+    brushSelectionTool.isActive = true;
+    brushSelectionTool.lastX = x;
+    brushSelectionTool.lastY = y;
+    if (activeHandle < 0 || activeHandle >= numberOfHandles)
+        return;
+    // the view does not change during a stroke : the grid is built once, then each dab only visits its cells
+    prepareSelectionGrid();
+    brushSelectionTool.beginStroke(x, y, selectionKernel, selectionGrid, verticesAreMarkedForCurrentHandle, isAdding);
 }
 
 void updateSphereRadiusWithScroll(int button)
 {
+    if (selectionToolState == SelectionTool_Brush)
+    {
+        if (button == 3) // scroll up - increase radius
+            brushSelectionTool.updateRadius(4.f);
+        else if (button == 4) // scroll down - decrease radius
+            brushSelectionTool.updateRadius(-4.f);
+    }
+
     if (selectionToolState == SelectionTool_Sphere && sphereSelectionTool.isActive)
     {
         if (button == 3) // scroll up - increase radius
@@ -467,36 +536,13 @@ Vec3 getViewVector()
 
 void setTagForVerticesInRectangle(bool tagToSet)
 {
-    float modelview[16];
-    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
-    float projection[16];
-    glGetFloatv(GL_PROJECTION_MATRIX, projection);
-
-    for (unsigned int v = 0; v < mesh.V.size(); ++v)
-    {
-        Vec3 const &p = mesh.V[v].p;
-
-        float x = modelview[0] * p[0] + modelview[4] * p[1] + modelview[8] * p[2] + modelview[12];
-        float y = modelview[1] * p[0] + modelview[5] * p[1] + modelview[9] * p[2] + modelview[13];
-        float z = modelview[2] * p[0] + modelview[6] * p[1] + modelview[10] * p[2] + modelview[14];
-        float w = modelview[3] * p[0] + modelview[7] * p[1] + modelview[11] * p[2] + modelview[15];
-        x /= w;
-        y /= w;
-        z /= w;
-        w = 1.f;
-
-        float xx = projection[0] * x + projection[4] * y + projection[8] * z + projection[12] * w;
-        float yy = projection[1] * x + projection[5] * y + projection[9] * z + projection[13] * w;
-        float ww = projection[3] * x + projection[7] * y + projection[11] * z + projection[15] * w;
-        xx /= ww;
-        yy /= ww;
-
-        xx = (xx + 1.f) / 2.f;
-        yy = (yy + 1.f) / 2.f;
-
-        if (rectangleSelectionTool.contains(xx, yy))
-            verticesAreMarkedForCurrentHandle[v] = tagToSet;
-    }
+    selectionKernel.project(mesh);
+    float left, right, bottom, top;
+    rectangleSelectionTool.getNormalizedBounds(left, right, bottom, top);
+    selectionKernel.selectRectangle(left, right, bottom, top);
+    if (selectVisibleVerticesOnly)
+        rejectHiddenVerticesFromSelection();
+    selectionKernel.applyTag(verticesAreMarkedForCurrentHandle, tagToSet);
 }
 
 void addVerticesToCurrentHandle()
@@ -509,6 +555,8 @@ void addVerticesToCurrentHandle()
         setTagForVerticesInRectangle(rectangleSelectionTool.isAdding);
     else if (selectionToolState == SelectionTool_Sphere)
         setTagForVerticesInSphere(sphereSelectionTool.isAdding);
+    else if (selectionToolState == SelectionTool_Lasso)
+        setTagForVerticesInLasso(lassoSelectionTool.isAdding);
 }
 
 void finalizeEditingOfCurrentHandle()
@@ -535,6 +583,9 @@ void printUsage()
          << " ?: Print help" << endl
          << " w: Toggle Wireframe Mode" << endl
          << " f: Toggle full screen mode" << endl
+         << " v: Toggle selection of the visible vertices only" << endl
+         << " s: Cycle selection tool (rectangle, sphere, lasso, brush)" << endl
+         << " <scroll>: brush radius (brush tool)" << endl
          << " <drag>+<left button>: rotate model" << endl
          << " <drag>+<right button>: move model" << endl
          << " <drag>+<middle button>: zoom" << endl
@@ -777,6 +828,8 @@ void draw()
     drawHandles();
     rectangleSelectionTool.draw();
     sphereSelectionTool.draw();
+    lassoSelectionTool.draw();
+    brushSelectionTool.draw();
 }
 
 void display()
@@ -930,6 +983,8 @@ void key(unsigned char keyPressed, int x, int y)
             // Désactiver la sphère de sélection
             sphereSelectionTool.isActive = false;
             rectangleSelectionTool.isActive = false;
+            lassoSelectionTool.isActive = false;
+            brushSelectionTool.isActive = false;
         }
         break;
 
@@ -975,11 +1030,24 @@ void key(unsigned char keyPressed, int x, int y)
             selectionToolState = SelectionTool_Sphere;
         }
         else if (selectionToolState == SelectionTool_Sphere)
+        {
+            selectionToolState = SelectionTool_Lasso;
+        }
+        else if (selectionToolState == SelectionTool_Lasso)
+        {
+            selectionToolState = SelectionTool_Brush;
+        }
+        else if (selectionToolState == SelectionTool_Brush)
         {
             selectionToolState = SelectionTool_Rectangle;
         }
         break;
 
+    case 'v':
+        selectVisibleVerticesOnly = !selectVisibleVerticesOnly;
+        std::cout << "Visible vertices only: " << (selectVisibleVerticesOnly ? "ON" : "OFF") << std::endl;
+        break;
+
     default:
         printUsage();
         break;
@@ -989,7 +1057,8 @@ void key(unsigned char keyPressed, int x, int y)
 
 void mouse(int button, int state, int x, int y)
 {
-    if (glutGetModifiers() & GLUT_ACTIVE_CTRL || rectangleSelectionTool.isActive || sphereSelectionTool.isActive)
+    if (glutGetModifiers() & GLUT_ACTIVE_CTRL || rectangleSelectionTool.isActive || sphereSelectionTool.isActive ||
+        lassoSelectionTool.isActive || brushSelectionTool.isActive)
     { // we can activate the selection only with ctrl pressed
         if (viewerState == ViewerState_EDITINGHANDLE)
         {
@@ -1008,6 +1077,16 @@ void mouse(int button, int state, int x, int y)
                     addVerticesToCurrentHandle();
                     // La sphère reste active jusqu'à ce qu'on appuie sur Entrée
                 }
+                else if (selectionToolState == SelectionTool_Lasso)
+                {
+                    lassoSelectionTool.isActive = false;
+                    addVerticesToCurrentHandle();
+                }
+                else if (selectionToolState == SelectionTool_Brush)
+                {
+                    // the brush has already tagged the vertices while painting
+                    brushSelectionTool.isActive = false;
+                }
             }
             else
             {
@@ -1028,6 +1107,16 @@ void mouse(int button, int state, int x, int y)
                         sphereSelectionTool.isAdding = true;
                         sphereSelectionTool.isActive = true;
                     }
+                    else if (selectionToolState == SelectionTool_Lasso)
+                    {
+                        lassoSelectionTool.initLasso(x, y);
+                        lassoSelectionTool.isAdding = true;
+                        lassoSelectionTool.isActive = true;
+                    }
+                    else if (selectionToolState == SelectionTool_Brush)
+                    {
+                        beginBrushStroke(x, y, true);
+                    }
                 }
                 else if (button == GLUT_RIGHT_BUTTON)
                 {
@@ -1046,6 +1135,16 @@ void mouse(int button, int state, int x, int y)
                         sphereSelectionTool.isAdding = false;
                         sphereSelectionTool.isActive = true;
                     }
+                    else if (selectionToolState == SelectionTool_Lasso)
+                    {
+                        lassoSelectionTool.initLasso(x, y);
+                        lassoSelectionTool.isAdding = false;
+                        lassoSelectionTool.isActive = true;
+                    }
+                    else if (selectionToolState == SelectionTool_Brush)
+                    {
+                        beginBrushStroke(x, y, false);
+                    }
                 }
             }
         }
@@ -1106,6 +1205,20 @@ void motion(int x, int y)
         Vec3 newPos(posX, posY, posZ);
         sphereSelectionTool.updateSphere(newPos);
     }
+    else if (viewerState == ViewerState_EDITINGHANDLE && lassoSelectionTool.isActive)
+    {
+        lassoSelectionTool.addPoint(x, y);
+    }
+    else if (viewerState == ViewerState_EDITINGHANDLE && brushSelectionTool.isActive)
+    {
+        if (activeHandleIsValid())
+            brushSelectionTool.strokeTo(x, y, selectionKernel, selectionGrid, verticesAreMarkedForCurrentHandle, brushSelectionTool.isAdding);
+        else
+        {
+            brushSelectionTool.lastX = x;
+            brushSelectionTool.lastY = y;
+        }
+    }
     else
     {
         // moving the camera:
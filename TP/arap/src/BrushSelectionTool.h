@@ -0,0 +1,119 @@
+#ifndef BrushSelectionTool_H
+#define BrushSelectionTool_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <GL/glut.h>
+#include "SelectionKernel.h"
+#include "ScreenSpaceGrid.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Paint brush : a stroke is a sequence of circular dabs (radius in pixels) along the mouse path.
+// Each dab is applied as soon as the mouse moves, and only visits the grid cells under the dab.
+struct BrushSelectionTool {
+    float radius; // in pixels
+    int lastX , lastY; // last dab, window pixels (y pointing down as in GLUT)
+    bool isAdding; // or it is removing
+    bool isActive;
+    BrushSelectionTool() : radius(20.f) , lastX(0) , lastY(0) , isAdding(false) , isActive(false) {}
+
+    void updateRadius(float deltaRadius) {
+        radius = std::min(200.f , std::max(2.f , radius + deltaRadius));
+    }
+
+    // first dab of the stroke
+    unsigned int beginStroke(int x , int y , ScreenSpaceSelectionKernel const & kernel , ScreenSpaceGrid const & grid ,
+                             std::vector<bool> & tags , bool tagToSet) {
+        lastX = x;
+        lastY = y;
+        return dab((float)x , (float)y , kernel , grid , tags , tagToSet);
+    }
+
+    // dabs from the last position to (x,y), spaced by half a radius so that the stroke has no holes
+    unsigned int strokeTo(int x , int y , ScreenSpaceSelectionKernel const & kernel , ScreenSpaceGrid const & grid ,
+                          std::vector<bool> & tags , bool tagToSet) {
+        float dx = (float)(x - lastX) , dy = (float)(y - lastY);
+        float length = std::sqrt(dx * dx + dy * dy);
+        if( length < 0.25f * radius ) return 0; // wait for the mouse to move a bit more
+        unsigned int nDabs = (unsigned int)std::ceil(length / (0.5f * radius));
+        unsigned int count = 0;
+        for( unsigned int d = 1 ; d <= nDabs ; ++d ) {
+            float t = (float)d / nDabs;
+            count += dab(lastX + t * dx , lastY + t * dy , kernel , grid , tags , tagToSet);
+        }
+        lastX = x;
+        lastY = y;
+        return count;
+    }
+
+    unsigned int dab(float mouseX , float mouseY , ScreenSpaceSelectionKernel const & kernel , ScreenSpaceGrid const & grid ,
+                     std::vector<bool> & tags , bool tagToSet) const {
+        float w = grid.getViewportWidth() , h = grid.getViewportHeight();
+        float cx = mouseX , cy = h - mouseY; // pixels, y pointing up
+        int gx0 , gx1 , gy0 , gy1;
+        if( !grid.cellRange((cx - radius) / w , (cx + radius) / w , (cy - radius) / h , (cy + radius) / h , gx0 , gx1 , gy0 , gy1) )
+            return 0;
+        float r2 = radius * radius;
+        unsigned int count = 0;
+        for( int gy = gy0 ; gy <= gy1 ; ++gy )
+            for( int gx = gx0 ; gx <= gx1 ; ++gx )
+                for( unsigned int i = grid.cellBegin(gx , gy) ; i < grid.cellEnd(gx , gy) ; ++i ) {
+                    unsigned int v = grid.vertex(i);
+                    float ddx = kernel.screenX[v] * w - cx , ddy = kernel.screenY[v] * h - cy;
+                    if( ddx * ddx + ddy * ddy <= r2 && tags[v] != tagToSet ) {
+                        tags[v] = tagToSet;
+                        ++count;
+                    }
+                }
+        return count;
+    }
+
+    void draw() {
+        if( !isActive ) return;
+
+        float viewport[4]; glGetFloatv( GL_VIEWPORT , viewport );
+        float w = viewport[2] , h = viewport[3];
+        float centerX = (float)lastX / w , centerY = 1.f - (float)lastY / h;
+
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_LIGHTING);
+        glEnable(GL_BLEND);
+
+        glMatrixMode( GL_PROJECTION );
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho( 0.f , w , 0.f , h , -1.f , 1.f ); // pixels, so that the brush stays round
+        glMatrixMode( GL_MODELVIEW );
+        glPushMatrix();
+        glLoadIdentity();
+
+        glLineWidth(2.0);
+        if(isAdding)
+            glColor4f(0.1, 0.1, 1.f , 0.5f); // adding -> blue
+        else
+            glColor4f(1.0, 0.1, 0.1 , 0.5f); // removing -> red
+
+        int segments = 32;
+        glBegin(GL_LINE_LOOP);
+        for( int i = 0 ; i < segments ; ++i ) {
+            float angle = 2.0f * M_PI * i / segments;
+            glVertex2f( centerX * w + radius * cos(angle) , centerY * h + radius * sin(angle) );
+        }
+        glEnd();
+
+        glPopMatrix();
+        glMatrixMode( GL_PROJECTION );
+        glPopMatrix();
+        glMatrixMode( GL_MODELVIEW );
+
+        glDisable(GL_BLEND);
+        glEnable(GL_LIGHTING);
+        glEnable(GL_DEPTH_TEST);
+    }
+};
+
+#endif // BrushSelectionTool_H
@@ -0,0 +1,127 @@
+#ifndef LassoSelectionTool_H
+#define LassoSelectionTool_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <GL/glut.h>
+#include "SelectionKernel.h"
+#include "ScreenSpaceGrid.h"
+
+// Free-form lasso : the polygon is given by the successive mouse positions (window pixels).
+// On release, the polygon is scanline-filled into a pixel mask over its bounding box,
+// and only the vertices of the grid cells covered by that box are tested against the mask.
+struct LassoSelectionTool {
+    std::vector<int> xs , ys; // mouse positions, y pointing down as in GLUT
+    bool isAdding; // or it is removing
+    bool isActive;
+    LassoSelectionTool() : isAdding(false) , isActive(false) {}
+
+    void initLasso(int x , int y) {
+        xs.assign(1 , x);
+        ys.assign(1 , y);
+    }
+    void addPoint(int x , int y) {
+        if( !xs.empty() && xs.back() == x && ys.back() == y ) return;
+        xs.push_back(x);
+        ys.push_back(y);
+    }
+
+    // tags the vertices inside the lasso, returns the number of vertices that were tagged
+    unsigned int select(ScreenSpaceSelectionKernel const & kernel , ScreenSpaceGrid const & grid ,
+                        std::vector<bool> & tags , bool tagToSet) const {
+        unsigned int nPts = xs.size();
+        if( nPts < 3 ) return 0;
+        float w = grid.getViewportWidth() , h = grid.getViewportHeight();
+
+        // polygon in pixel coordinates, y pointing up (same as the screen coordinates of the kernel)
+        std::vector<float> px(nPts) , py(nPts);
+        float minX = w , maxX = 0.f , minY = h , maxY = 0.f;
+        for( unsigned int i = 0 ; i < nPts ; ++i ) {
+            px[i] = (float)xs[i];
+            py[i] = h - (float)ys[i];
+            minX = std::min(minX , px[i]); maxX = std::max(maxX , px[i]);
+            minY = std::min(minY , py[i]); maxY = std::max(maxY , py[i]);
+        }
+        int bx0 = std::max(0 , (int)std::floor(minX)) , bx1 = std::min((int)w - 1 , (int)std::floor(maxX));
+        int by0 = std::max(0 , (int)std::floor(minY)) , by1 = std::min((int)h - 1 , (int)std::floor(maxY));
+        if( bx0 > bx1 || by0 > by1 ) return 0;
+        int bw = bx1 - bx0 + 1 , bh = by1 - by0 + 1;
+
+        // scanline fill (even-odd rule), sampling at the pixel centers
+        std::vector<unsigned char> mask(bw * bh , 0);
+        std::vector<float> crossings;
+        for( int row = 0 ; row < bh ; ++row ) {
+            float yc = by0 + row + 0.5f;
+            crossings.clear();
+            for( unsigned int i = 0 , j = nPts - 1 ; i < nPts ; j = i++ ) {
+                if( (py[i] > yc) != (py[j] > yc) )
+                    crossings.push_back( px[i] + (yc - py[i]) * (px[j] - px[i]) / (py[j] - py[i]) );
+            }
+            std::sort(crossings.begin() , crossings.end());
+            for( unsigned int k = 0 ; k + 1 < crossings.size() ; k += 2 ) {
+                int xa = std::max(bx0 , (int)std::ceil(crossings[k] - 0.5f));
+                int xb = std::min(bx1 , (int)std::floor(crossings[k+1] - 0.5f));
+                for( int x = xa ; x <= xb ; ++x )
+                    mask[row * bw + (x - bx0)] = 1;
+            }
+        }
+
+        unsigned int count = 0;
+        int cx0 , cx1 , cy0 , cy1;
+        if( !grid.cellRange((float)bx0 / w , (float)bx1 / w , (float)by0 / h , (float)by1 / h , cx0 , cx1 , cy0 , cy1) )
+            return 0;
+        for( int cy = cy0 ; cy <= cy1 ; ++cy )
+            for( int cx = cx0 ; cx <= cx1 ; ++cx )
+                for( unsigned int i = grid.cellBegin(cx , cy) ; i < grid.cellEnd(cx , cy) ; ++i ) {
+                    unsigned int v = grid.vertex(i);
+                    int x = (int)std::floor(kernel.screenX[v] * w) - bx0;
+                    int y = (int)std::floor(kernel.screenY[v] * h) - by0;
+                    if( x < 0 || y < 0 || x >= bw || y >= bh || !mask[y * bw + x] ) continue;
+                    tags[v] = tagToSet;
+                    ++count;
+                }
+        return count;
+    }
+
+    void draw() {
+        if( !isActive || xs.size() < 2 ) return;
+
+        float viewport[4]; glGetFloatv( GL_VIEWPORT , viewport );
+        float w = viewport[2] , h = viewport[3];
+
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_LIGHTING);
+        glEnable(GL_BLEND);
+
+        glMatrixMode( GL_PROJECTION );
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho( 0.f , 1.f , 0.f , 1.f , -1.f , 1.f );
+        glMatrixMode( GL_MODELVIEW );
+        glPushMatrix();
+        glLoadIdentity();
+
+        glLineWidth(2.0);
+        if(isAdding)
+            glColor4f(0.1, 0.1, 1.f , 0.5f); // adding -> blue
+        else
+            glColor4f(1.0, 0.1, 0.1 , 0.5f); // removing -> red
+
+        glBegin(GL_LINE_LOOP);
+        for( unsigned int i = 0 ; i < xs.size() ; ++i )
+            glVertex2f( (float)xs[i] / w , 1.f - (float)ys[i] / h );
+        glEnd();
+
+        glPopMatrix();
+        glMatrixMode( GL_PROJECTION );
+        glPopMatrix();
+        glMatrixMode( GL_MODELVIEW );
+
+        glDisable(GL_BLEND);
+        glEnable(GL_LIGHTING);
+        glEnable(GL_DEPTH_TEST);
+    }
+};
+
+#endif // LassoSelectionTool_H
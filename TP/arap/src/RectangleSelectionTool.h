@@ -17,6 +17,16 @@ struct RectangleSelectionTool {
         yEnd = y;
     }
 
+    // bounds of the rectangle in [0,1] screen coordinates (reads the viewport once)
+    void getNormalizedBounds(float & left , float & right , float & bottom , float & top) const {
+        float viewport[4]; glGetFloatv( GL_VIEWPORT , viewport );
+        float w = viewport[2] , h = viewport[3];
+        left = (float)(min<int>(xStart,xEnd)) / w;
+        right = (float)(max<int>(xStart,xEnd)) / w;
+        top = 1.f - (float)(min<int>(yStart,yEnd)) / h;
+        bottom = 1.f - (float)(max<int>(yStart,yEnd)) / h;
+    }
+
     bool contains(float xx , float yy) const {
         float viewport[4]; glGetFloatv( GL_VIEWPORT , viewport );
         float w = viewport[2] , h = viewport[3];
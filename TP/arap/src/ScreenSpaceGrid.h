@@ -0,0 +1,92 @@
+#ifndef SCREENSPACEGRID_H
+#define SCREENSPACEGRID_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "SelectionKernel.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Uniform grid over the viewport, bucketing the vertices projected by a
+// ScreenSpaceSelectionKernel (counting sort : one array of offsets per cell, one array
+// of vertex indices). A brush dab or a lasso then only visits the cells it touches.
+//
+// Coordinates are [0,1] screen coordinates, as in the selection kernel ; cells are
+// square in pixels (cellSize pixels wide).
+//
+//-------------------------------------------------------------------------------------//
+
+class ScreenSpaceGrid
+{
+public:
+    ScreenSpaceGrid() : gridW(0), gridH(0), pixelW(1.f), pixelH(1.f), cellSize(16) {}
+
+    int getWidth() const { return gridW; }
+    int getHeight() const { return gridH; }
+    float getViewportWidth() const { return pixelW; }
+    float getViewportHeight() const { return pixelH; }
+
+    // buckets the projected vertices ; if mask is given, only the vertices with mask[v] != 0 are kept
+    void build(ScreenSpaceSelectionKernel const &kernel, std::vector<unsigned char> const *mask = NULL, int pCellSize = 16)
+    {
+        cellSize = std::max(1, pCellSize);
+        pixelW = std::max(1.f, kernel.view.viewport[2]);
+        pixelH = std::max(1.f, kernel.view.viewport[3]);
+        gridW = (int)std::ceil(pixelW / cellSize);
+        gridH = (int)std::ceil(pixelH / cellSize);
+
+        unsigned int n = kernel.size();
+        std::vector<int> cellOfVertex(n, -1);
+        cellStart.assign(gridW * gridH + 1, 0);
+        for (unsigned int v = 0; v < n; ++v)
+        {
+            if (mask != NULL && !(*mask)[v])
+                continue;
+            int c = cellIndex(kernel.screenX[v], kernel.screenY[v]);
+            if (c < 0)
+                continue;
+            cellOfVertex[v] = c;
+            cellStart[c + 1]++;
+        }
+        for (int c = 0; c < gridW * gridH; ++c)
+            cellStart[c + 1] += cellStart[c];
+        vertices.resize(cellStart[gridW * gridH]);
+        std::vector<unsigned int> fill(cellStart.begin(), cellStart.end() - 1);
+        for (unsigned int v = 0; v < n; ++v)
+            if (cellOfVertex[v] >= 0)
+                vertices[fill[cellOfVertex[v]]++] = v;
+    }
+
+    // cell index of a point, -1 if it is outside of the viewport
+    int cellIndex(float sx, float sy) const
+    {
+        float px = sx * pixelW, py = sy * pixelH;
+        if (!(px >= 0.f && py >= 0.f && px < pixelW && py < pixelH))
+            return -1;
+        return ((int)py / cellSize) * gridW + (int)px / cellSize;
+    }
+
+    // range of cells covering the screen rectangle [left,right]x[bottom,top], false if it is empty
+    bool cellRange(float left, float right, float bottom, float top, int &cx0, int &cx1, int &cy0, int &cy1) const
+    {
+        cx0 = std::max(0, (int)std::floor(left * pixelW / cellSize));
+        cx1 = std::min(gridW - 1, (int)std::floor(right * pixelW / cellSize));
+        cy0 = std::max(0, (int)std::floor(bottom * pixelH / cellSize));
+        cy1 = std::min(gridH - 1, (int)std::floor(top * pixelH / cellSize));
+        return cx0 <= cx1 && cy0 <= cy1;
+    }
+
+    unsigned int cellBegin(int cx, int cy) const { return cellStart[cy * gridW + cx]; }
+    unsigned int cellEnd(int cx, int cy) const { return cellStart[cy * gridW + cx + 1]; }
+    unsigned int vertex(unsigned int i) const { return vertices[i]; }
+
+private:
+    int gridW, gridH;
+    float pixelW, pixelH;
+    int cellSize;
+    std::vector<unsigned int> cellStart; // offsets in vertices, gridW * gridH + 1 entries
+    std::vector<unsigned int> vertices;  // vertex indices sorted by cell
+};
+
+#endif // SCREENSPACEGRID_H
@@ -0,0 +1,227 @@
+#ifndef SELECTIONKERNEL_H
+#define SELECTIONKERNEL_H
+
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+#include <GL/glut.h>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "ParallelFor.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SELECTIONKERNEL_USE_SSE
+#endif
+
+//-------------------------------------------------------------------------------------//
+//-------------------------------------------------------------------------------------//
+//
+// Screen-space selection kernel.
+//
+// The modelview and projection matrices are read once per selection (ViewSnapshot),
+// then all the vertices are projected in one pass (4 vertices at a time with SSE,
+// chunks of vertices in parallel) into a reusable screen-space buffer.
+// The rectangle / circle / lasso predicates are then evaluated over that buffer.
+//
+// Screen coordinates follow the convention of setTagForVerticesInRectangle :
+// x and y in [0,1], (0,0) being the bottom-left corner of the viewport.
+//
+//-------------------------------------------------------------------------------------//
+//-------------------------------------------------------------------------------------//
+
+struct ViewSnapshot
+{
+    float modelview[16];
+    float projection[16];
+    float mvp[16]; // projection * modelview (column-major, as OpenGL)
+    float viewport[4];
+
+    void capture()
+    {
+        glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+        glGetFloatv(GL_PROJECTION_MATRIX, projection);
+        glGetFloatv(GL_VIEWPORT, viewport);
+        for (unsigned int c = 0; c < 4; ++c)
+            for (unsigned int r = 0; r < 4; ++r)
+            {
+                float s = 0.f;
+                for (unsigned int k = 0; k < 4; ++k)
+                    s += projection[4 * k + r] * modelview[4 * c + k];
+                mvp[4 * c + r] = s;
+            }
+    }
+
+    // returns false if the point is behind the camera
+    bool project(Vec3 const &p, float &sx, float &sy, float &depth) const
+    {
+        float x = mvp[0] * p[0] + mvp[4] * p[1] + mvp[8] * p[2] + mvp[12];
+        float y = mvp[1] * p[0] + mvp[5] * p[1] + mvp[9] * p[2] + mvp[13];
+        float z = mvp[2] * p[0] + mvp[6] * p[1] + mvp[10] * p[2] + mvp[14];
+        float w = mvp[3] * p[0] + mvp[7] * p[1] + mvp[11] * p[2] + mvp[15];
+        if (w <= 0.f)
+            return false;
+        sx = (x / w + 1.f) / 2.f;
+        sy = (y / w + 1.f) / 2.f;
+        depth = (z / w + 1.f) / 2.f;
+        return true;
+    }
+};
+
+class ScreenSpaceSelectionKernel
+{
+public:
+    ViewSnapshot view;
+    std::vector<float> screenX, screenY, depth; // per vertex ; screenX = -FLT_MAX for vertices behind the camera
+    std::vector<unsigned char> inside;         // result of the last predicate
+
+    unsigned int size() const { return screenX.size(); }
+    bool isBehindCamera(unsigned int v) const { return screenX[v] == -FLT_MAX; }
+
+    // reads the GL matrices once, then projects every vertex
+    void project(Mesh const &mesh)
+    {
+        view.capture();
+        project(mesh, view);
+    }
+
+    void project(Mesh const &mesh, ViewSnapshot const &snapshot)
+    {
+        view = snapshot;
+        unsigned int n = mesh.V.size();
+        screenX.resize(n);
+        screenY.resize(n);
+        depth.resize(n);
+        inside.resize(n);
+        parallelFor(n, [&](unsigned int b, unsigned int e)
+                    { projectRange(mesh, b, e); }, 4096);
+    }
+
+    // every vertex in front of the camera
+    void selectAll()
+    {
+        for (unsigned int v = 0; v < size(); ++v)
+            inside[v] = !isBehindCamera(v);
+    }
+
+    void selectRectangle(float left, float right, float bottom, float top)
+    {
+        parallelFor(size(), [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int v = b; v < e; ++v)
+            {
+                float x = screenX[v], y = screenY[v];
+                inside[v] = (left <= x) & (x <= right) & (bottom <= y) & (y <= top);
+            } }, 8192);
+    }
+
+    void selectCircle(float cx, float cy, float radius)
+    {
+        float r2 = radius * radius;
+        parallelFor(size(), [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int v = b; v < e; ++v)
+            {
+                float dx = screenX[v] - cx, dy = screenY[v] - cy;
+                inside[v] = dx * dx + dy * dy <= r2; // overflows to +inf behind the camera
+            } }, 8192);
+    }
+
+    // polygon given as x0 y0 x1 y1 ... in screen coordinates, even-odd rule
+    void selectLasso(std::vector<float> const &polygon)
+    {
+        unsigned int nPts = polygon.size() / 2;
+        if (nPts < 3)
+        {
+            std::fill(inside.begin(), inside.end(), 0);
+            return;
+        }
+        float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+        for (unsigned int i = 0; i < nPts; ++i)
+        {
+            minX = std::min(minX, polygon[2 * i]);
+            maxX = std::max(maxX, polygon[2 * i]);
+            minY = std::min(minY, polygon[2 * i + 1]);
+            maxY = std::max(maxY, polygon[2 * i + 1]);
+        }
+        parallelFor(size(), [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int v = b; v < e; ++v)
+            {
+                float x = screenX[v], y = screenY[v];
+                if (x < minX || x > maxX || y < minY || y > maxY)
+                {
+                    inside[v] = 0;
+                    continue;
+                }
+                bool in = false;
+                for (unsigned int i = 0, j = nPts - 1; i < nPts; j = i++)
+                {
+                    float xi = polygon[2 * i], yi = polygon[2 * i + 1];
+                    float xj = polygon[2 * j], yj = polygon[2 * j + 1];
+                    if (((yi > y) != (yj > y)) && (x < (xj - xi) * (y - yi) / (yj - yi) + xi))
+                        in = !in;
+                }
+                inside[v] = in;
+            } }, 2048);
+    }
+
+    // writes the result of the last predicate into the tags (std::vector<bool> is not thread safe, so this is sequential)
+    void applyTag(std::vector<bool> &tags, bool tagToSet) const
+    {
+        for (unsigned int v = 0; v < inside.size(); ++v)
+            if (inside[v])
+                tags[v] = tagToSet;
+    }
+
+private:
+    void projectRange(Mesh const &mesh, unsigned int begin, unsigned int end)
+    {
+        float const *m = view.mvp;
+        unsigned int v = begin;
+#ifdef SELECTIONKERNEL_USE_SSE
+        __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]), m3 = _mm_set1_ps(m[3]);
+        __m128 m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]), m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]);
+        __m128 m8 = _mm_set1_ps(m[8]), m9 = _mm_set1_ps(m[9]), m10 = _mm_set1_ps(m[10]), m11 = _mm_set1_ps(m[11]);
+        __m128 m12 = _mm_set1_ps(m[12]), m13 = _mm_set1_ps(m[13]), m14 = _mm_set1_ps(m[14]), m15 = _mm_set1_ps(m[15]);
+        __m128 half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), behind = _mm_set1_ps(-FLT_MAX);
+        for (; v + 4 <= end; v += 4)
+        {
+            Vec3 const &p0 = mesh.V[v].p, &p1 = mesh.V[v + 1].p, &p2 = mesh.V[v + 2].p, &p3 = mesh.V[v + 3].p;
+            __m128 px = _mm_setr_ps(p0[0], p1[0], p2[0], p3[0]);
+            __m128 py = _mm_setr_ps(p0[1], p1[1], p2[1], p3[1]);
+            __m128 pz = _mm_setr_ps(p0[2], p1[2], p2[2], p3[2]);
+
+            __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, px), _mm_mul_ps(m4, py)), _mm_add_ps(_mm_mul_ps(m8, pz), m12));
+            __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m1, px), _mm_mul_ps(m5, py)), _mm_add_ps(_mm_mul_ps(m9, pz), m13));
+            __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m2, px), _mm_mul_ps(m6, py)), _mm_add_ps(_mm_mul_ps(m10, pz), m14));
+            __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m3, px), _mm_mul_ps(m7, py)), _mm_add_ps(_mm_mul_ps(m11, pz), m15));
+
+            __m128 halfInvW = _mm_div_ps(half, w);
+            __m128 front = _mm_cmpgt_ps(w, zero);
+            __m128 sx = _mm_add_ps(_mm_mul_ps(x, halfInvW), half);
+            __m128 sy = _mm_add_ps(_mm_mul_ps(y, halfInvW), half);
+            __m128 sz = _mm_add_ps(_mm_mul_ps(z, halfInvW), half);
+            // vertices behind the camera are sent far outside of every region, as in the scalar loop
+            sx = _mm_or_ps(_mm_and_ps(front, sx), _mm_andnot_ps(front, behind));
+            sy = _mm_and_ps(front, sy);
+            sz = _mm_or_ps(_mm_and_ps(front, sz), _mm_andnot_ps(front, one));
+
+            _mm_storeu_ps(&screenX[v], sx);
+            _mm_storeu_ps(&screenY[v], sy);
+            _mm_storeu_ps(&depth[v], sz);
+        }
+#endif
+        for (; v < end; ++v)
+        {
+            if (!view.project(mesh.V[v].p, screenX[v], screenY[v], depth[v]))
+            {
+                screenX[v] = -FLT_MAX;
+                screenY[v] = 0.f;
+                depth[v] = 1.f;
+            }
+        }
+    }
+};
+
+#endif // SELECTIONKERNEL_H
@@ -0,0 +1,232 @@
+#ifndef SOFTWAREDEPTHBUFFER_H
+#define SOFTWAREDEPTHBUFFER_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "Mesh.h"
+#include "SelectionKernel.h"
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//-------------------------------------------------------------------------------------//
+//
+// Small CPU depth buffer, used to keep only the visible vertices in a selection.
+//
+// The mesh is rasterized from the screen-space buffer of a ScreenSpaceSelectionKernel
+// (so nothing is read back from the GPU, and this also works without a GL context if
+// the kernel was filled from a ViewSnapshot) :
+//   - triangles are binned into 32x32 pixel tiles,
+//   - the tiles are rasterized in parallel, 4 pixels at a time with SSE,
+//   - the buffer is then max-filtered over 3x3 pixels, so that a vertex lying on the
+//     surface is never hidden by its own triangles : a single comparison per vertex.
+//
+// Depth values are window depths in [0,1], as in the selection kernel.
+// Triangles with a vertex behind the camera are skipped (no near plane clipping).
+//
+//-------------------------------------------------------------------------------------//
+//-------------------------------------------------------------------------------------//
+
+class SoftwareDepthBuffer
+{
+public:
+    static const int TILE_SIZE = 32;
+
+    float depthBias; // tolerance added to the buffer depth when testing a vertex
+
+    SoftwareDepthBuffer() : depthBias(1e-5f), width(0), height(0), paddedWidth(0), paddedHeight(0) {}
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    void resize(int w, int h)
+    {
+        width = std::max(1, w);
+        height = std::max(1, h);
+        paddedWidth = (width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+        paddedHeight = (height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+        depth.assign(paddedWidth * paddedHeight, 1.f);
+        conservativeDepth.assign(paddedWidth * paddedHeight, 1.f);
+    }
+
+    // rasterizes the mesh triangles, using the projection stored in the kernel
+    void rasterize(Mesh const &mesh, ScreenSpaceSelectionKernel const &kernel)
+    {
+        std::fill(depth.begin(), depth.end(), 1.f);
+
+        int tilesX = paddedWidth / TILE_SIZE, tilesY = paddedHeight / TILE_SIZE;
+        unsigned int nTiles = tilesX * tilesY;
+        unsigned int nT = mesh.T.size();
+
+        // 1. binning : each chunk of triangles fills its own bins, no synchronization needed
+        unsigned int nChunks = std::max(1u, std::min(parallelThreadCount(), nT / 4096));
+        std::vector<std::vector<std::vector<unsigned int>>> bins(nChunks, std::vector<std::vector<unsigned int>>(nTiles));
+        parallelFor(nChunks, [&](unsigned int cb, unsigned int ce)
+                    {
+            for (unsigned int c = cb; c < ce; ++c)
+            {
+                unsigned int tBegin = (unsigned long long)nT * c / nChunks, tEnd = (unsigned long long)nT * (c + 1) / nChunks;
+                for (unsigned int t = tBegin; t < tEnd; ++t)
+                {
+                    int x0, y0, x1, y1;
+                    if (!triangleBounds(mesh.T[t], kernel, x0, y0, x1, y1))
+                        continue;
+                    for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ++ty)
+                        for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; ++tx)
+                            bins[c][ty * tilesX + tx].push_back(t);
+                }
+            } }, 1);
+
+        // 2. tiles are independent
+        parallelFor(nTiles, [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int tile = b; tile < e; ++tile)
+            {
+                int tileX = (tile % tilesX) * TILE_SIZE, tileY = (tile / tilesX) * TILE_SIZE;
+                for (unsigned int c = 0; c < nChunks; ++c)
+                    for (unsigned int i = 0; i < bins[c][tile].size(); ++i)
+                        rasterizeTriangleInTile(mesh.T[bins[c][tile][i]], kernel, tileX, tileY);
+            } }, 1);
+
+        // 3. 3x3 max filter
+        parallelFor(height, [&](unsigned int yb, unsigned int ye)
+                    {
+            for (int y = yb; y < (int)ye; ++y)
+                for (int x = 0; x < width; ++x)
+                {
+                    float m = 0.f;
+                    for (int dy = std::max(0, y - 1); dy <= std::min(height - 1, y + 1); ++dy)
+                        for (int dx = std::max(0, x - 1); dx <= std::min(width - 1, x + 1); ++dx)
+                            m = std::max(m, depth[dy * paddedWidth + dx]);
+                    conservativeDepth[y * paddedWidth + x] = m;
+                }
+            }, 16);
+    }
+
+    // visibility of a point given in [0,1] screen coordinates
+    bool isVisible(float sx, float sy, float pointDepth) const
+    {
+        int x = (int)std::floor(sx * width), y = (int)std::floor(sy * height);
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return true; // outside of the buffer : we know nothing
+        return pointDepth <= conservativeDepth[y * paddedWidth + x] + depthBias;
+    }
+
+    // clears kernel.inside for the vertices hidden behind the surface
+    void rejectOccludedVertices(ScreenSpaceSelectionKernel &kernel) const
+    {
+        parallelFor(kernel.size(), [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int v = b; v < e; ++v)
+                if (kernel.inside[v] && !isVisible(kernel.screenX[v], kernel.screenY[v], kernel.depth[v]))
+                    kernel.inside[v] = 0; }, 8192);
+    }
+
+private:
+    int width, height;
+    int paddedWidth, paddedHeight;
+    std::vector<float> depth;
+    std::vector<float> conservativeDepth;
+
+    bool triangleBounds(MeshTriangle const &tri, ScreenSpaceSelectionKernel const &kernel, int &x0, int &y0, int &x1, int &y1) const
+    {
+        float minX = 1e30f, maxX = -1e30f, minY = 1e30f, maxY = -1e30f;
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            if (kernel.isBehindCamera(tri[j]))
+                return false;
+            float sx = kernel.screenX[tri[j]], sy = kernel.screenY[tri[j]];
+            minX = std::min(minX, sx * width);
+            maxX = std::max(maxX, sx * width);
+            minY = std::min(minY, sy * height);
+            maxY = std::max(maxY, sy * height);
+        }
+        x0 = std::max(0, (int)std::floor(minX));
+        y0 = std::max(0, (int)std::floor(minY));
+        x1 = std::min(width - 1, (int)std::floor(maxX));
+        y1 = std::min(height - 1, (int)std::floor(maxY));
+        return x0 <= x1 && y0 <= y1;
+    }
+
+    void rasterizeTriangleInTile(MeshTriangle const &tri, ScreenSpaceSelectionKernel const &kernel, int tileX, int tileY)
+    {
+        float px[3], py[3], pz[3];
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            px[j] = kernel.screenX[tri[j]] * width;
+            py[j] = kernel.screenY[tri[j]] * height;
+            pz[j] = kernel.depth[tri[j]];
+        }
+        float area = (px[1] - px[0]) * (py[2] - py[0]) - (px[2] - px[0]) * (py[1] - py[0]);
+        if (std::fabs(area) < 1e-12f)
+            return;
+        if (area < 0.f)
+        {
+            // both orientations are rasterized : reorder to a positive area
+            std::swap(px[1], px[2]);
+            std::swap(py[1], py[2]);
+            std::swap(pz[1], pz[2]);
+            area = -area;
+        }
+
+        // edge functions e_i(x,y) = A_i x + B_i y + C_i, positive inside
+        float A[3], B[3], C[3];
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            unsigned int j = (i + 1) % 3;
+            A[i] = py[i] - py[j];
+            B[i] = px[j] - px[i];
+            C[i] = px[i] * py[j] - px[j] * py[i];
+        }
+        // depth plane z(x,y) = zA x + zB y + zC, from the barycentric coordinates (e_1 -> p0, e_2 -> p1, e_0 -> p2)
+        float invArea = 1.f / area;
+        float zA = (A[1] * pz[0] + A[2] * pz[1] + A[0] * pz[2]) * invArea;
+        float zB = (B[1] * pz[0] + B[2] * pz[1] + B[0] * pz[2]) * invArea;
+        float zC = (C[1] * pz[0] + C[2] * pz[1] + C[0] * pz[2]) * invArea;
+
+        int x0 = std::max(tileX, (int)std::floor(std::min(px[0], std::min(px[1], px[2]))));
+        int x1 = std::min(tileX + TILE_SIZE - 1, (int)std::floor(std::max(px[0], std::max(px[1], px[2]))));
+        int y0 = std::max(tileY, (int)std::floor(std::min(py[0], std::min(py[1], py[2]))));
+        int y1 = std::min(tileY + TILE_SIZE - 1, (int)std::floor(std::max(py[0], std::max(py[1], py[2]))));
+        x0 &= ~3; // 4-pixel aligned, the buffer is padded to whole tiles
+
+#ifdef SELECTIONKERNEL_USE_SSE
+        __m128 stepX = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        __m128 zero = _mm_setzero_ps();
+        for (int y = y0; y <= y1; ++y)
+        {
+            float fy = y + 0.5f;
+            float *row = &depth[y * paddedWidth];
+            for (int x = x0; x <= x1; x += 4)
+            {
+                __m128 fx = _mm_add_ps(_mm_set1_ps((float)x), stepX);
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[0]), fx), _mm_set1_ps(B[0] * fy + C[0]));
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[1]), fx), _mm_set1_ps(B[1] * fy + C[1]));
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[2]), fx), _mm_set1_ps(B[2] * fy + C[2]));
+                __m128 mask = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                if (_mm_movemask_ps(mask) == 0)
+                    continue;
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), fx), _mm_set1_ps(zB * fy + zC));
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 closer = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, closer), _mm_andnot_ps(mask, old)));
+            }
+        }
+#else
+        for (int y = y0; y <= y1; ++y)
+        {
+            float fy = y + 0.5f;
+            float *row = &depth[y * paddedWidth];
+            for (int x = x0; x <= x1; ++x)
+            {
+                float fx = x + 0.5f;
+                if (A[0] * fx + B[0] * fy + C[0] < 0.f || A[1] * fx + B[1] * fy + C[1] < 0.f || A[2] * fx + B[2] * fy + C[2] < 0.f)
+                    continue;
+                row[x] = std::min(row[x], zA * fx + zB * fy + zC);
+            }
+        }
+#endif
+    }
+};
+
+#endif // SOFTWAREDEPTHBUFFER_H
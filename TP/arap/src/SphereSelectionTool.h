@@ -1,6 +1,7 @@
 #ifndef SphereSelectionTool_H
 #define SphereSelectionTool_H
 #include "Vec3.h"
+#include "SelectionKernel.h"
 #include <GL/glut.h>
 #include <cmath>
 
@@ -39,57 +40,33 @@ struct SphereSelectionTool
 	bool contains(const Vec3 &p)
 	{
 		// Project both the point and center to screen coordinates, then check 2D distance
-		// Get transformation matrices
-		float modelview[16];
-		glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
-		float projection[16];
-		glGetFloatv(GL_PROJECTION_MATRIX, projection);
+		ViewSnapshot view;
+		view.capture();
+		return contains(p, view);
+	}
 
-		// Project the vertex p to screen coordinates
-		float px = modelview[0] * p[0] + modelview[4] * p[1] + modelview[8] * p[2] + modelview[12];
-		float py = modelview[1] * p[0] + modelview[5] * p[1] + modelview[9] * p[2] + modelview[13];
-		float pz = modelview[2] * p[0] + modelview[6] * p[1] + modelview[10] * p[2] + modelview[14];
-		float pw = modelview[3] * p[0] + modelview[7] * p[1] + modelview[11] * p[2] + modelview[15];
-		px /= pw;
-		py /= pw;
-		pz /= pw;
-		pw = 1.f;
-
-		float pxx = projection[0] * px + projection[4] * py + projection[8] * pz + projection[12] * pw;
-		float pyy = projection[1] * px + projection[5] * py + projection[9] * pz + projection[13] * pw;
-		float pww = projection[3] * px + projection[7] * py + projection[11] * pz + projection[15] * pw;
-		pxx /= pww;
-		pyy /= pww;
-
-		pxx = (pxx + 1.f) / 2.f;
-		pyy = (pyy + 1.f) / 2.f;
-
-		// Project the center to screen coordinates
-		float cx = modelview[0] * center[0] + modelview[4] * center[1] + modelview[8] * center[2] + modelview[12];
-		float cy = modelview[1] * center[0] + modelview[5] * center[1] + modelview[9] * center[2] + modelview[13];
-		float cz = modelview[2] * center[0] + modelview[6] * center[1] + modelview[10] * center[2] + modelview[14];
-		float cw = modelview[3] * center[0] + modelview[7] * center[1] + modelview[11] * center[2] + modelview[15];
-		cx /= cw;
-		cy /= cw;
-		cz /= cw;
-		cw = 1.f;
-
-		float cxx = projection[0] * cx + projection[4] * cy + projection[8] * cz + projection[12] * cw;
-		float cyy = projection[1] * cx + projection[5] * cy + projection[9] * cz + projection[13] * cw;
-		float cww = projection[3] * cx + projection[7] * cy + projection[11] * cz + projection[15] * cw;
-		cxx /= cww;
-		cyy /= cww;
-
-		cxx = (cxx + 1.f) / 2.f;
-		cyy = (cyy + 1.f) / 2.f;
+	// same test, with matrices that were read once by the caller
+	bool contains(const Vec3 &p, const ViewSnapshot &view) const
+	{
+		float cx, cy, r;
+		getScreenCircle(view, cx, cy, r);
+		float px, py, pz;
+		if (!view.project(p, px, py, pz))
+			return false;
 
 		// Calculate 2D distance in screen space
-		float dx = pxx - cxx;
-		float dy = pyy - cyy;
-		float screenDistance = sqrt(dx * dx + dy * dy);
-		float screenRadius = radius * 2.0f; // Same scaling as in draw()
+		float dx = px - cx;
+		float dy = py - cy;
+		return dx * dx + dy * dy <= r * r;
+	}
 
-		return screenDistance <= screenRadius;
+	// center and radius of the selection disk, in [0,1] screen coordinates
+	void getScreenCircle(const ViewSnapshot &view, float &cx, float &cy, float &screenRadius) const
+	{
+		float cz;
+		if (!view.project(center, cx, cy, cz))
+			cx = cy = -1.f;
+		screenRadius = radius * 2.0f; // Same scaling as in draw()
 	}
 
 	void draw()
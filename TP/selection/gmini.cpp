@@ -28,6 +28,7 @@
 #include "src/Mesh.h"
 #include "src/linearSystem.h"
 #include "src/LaplacianWeights.h"
+#include "src/SpatialIndex.h"
 #include "extern/eigen3/Eigen/SVD"
 #include "extern/eigen3/Eigen/Geometry"
 
@@ -77,6 +78,8 @@ float geodesicSelectionRadius = 0.1f;                    // Rayon de sélection
 bool showGeodesicDistances = true;                       // Variable pour afficher les distances géodésiques
 std::unordered_map<int, float> currentGeodesicDistances; // Stocker les distances pour la visualisation
 float maxGeodesicDistance = 0.0f;                        // Distance géodésique maximale pour la normalisation
+#include "src/GeodesicColorBuffer.h"
+GeodesicColorBuffer geodesicColorBuffer; // couleurs par sommet, recalculées seulement quand les distances changent
 Vec3 clickedVertexNormal;                                // Normale N du vertex V le plus proche du point cliqué P
 bool useNormalBasedSelection = true;                     // Utiliser la sélection basée sur la variation de normale
 float normalThreshold = 0.3f;                            // Seuil de différence de normale (0 = identique, 1 = perpendiculaire)
@@ -86,6 +89,7 @@ float normalThreshold = 0.3f;                            // Seuil de différence
 // -------------------------------------------
 
 Mesh mesh;
+MeshSpatialIndex meshSpatialIndex; // k-d tree des sommets + BVH des triangles, refit après chaque déformation
 LaplacianWeights edgeAndVertexWeights;
 linearSystem arapLinearSystem;
 std::vector<Eigen::MatrixXd> vertexRotationMatrices;
@@ -311,6 +315,9 @@ void updateMeshVertexPositionsFromARAPSolver()
             vertexRotationMatrices[v] = getClosestRotation(tensorMatrix);
         }
     }
+
+    // the vertices moved : keep the topology of the spatial index, only update its boxes
+    meshSpatialIndex.refit(mesh);
 }
 //-----------------------------------------------------------------------------------//
 //-----------------------------------------------------------------------------------//
@@ -370,6 +377,21 @@ void rotateActiveHandle(Vec3 const &rotationAxis, double angle)
 
 void get3DPosFromMouseInput(int x, int y, float &posX, float &posY, float &posZ)
 {
+    // Hit-test the surface first (ray cast in the BVH)
+    {
+        Vec3 origin, direction;
+        sphereSelectionTool.screenRay(x, y, origin, direction);
+        RayHit hit;
+        if (meshSpatialIndex.pick(mesh, origin, direction, hit))
+        {
+            posX = hit.position[0];
+            posY = hit.position[1];
+            posZ = hit.position[2];
+            return;
+        }
+    }
+
+    // Missed the mesh : place the point in front of the camera
     // Convert mouse coordinates to normalized device coordinates
     float mouseX = (2.0f * x) / SCREENWIDTH - 1.0f;
     float mouseY = 1.0f - (2.0f * y) / SCREENHEIGHT;
@@ -443,6 +465,9 @@ void computeAllGeodesicDistances()
             maxGeodesicDistance = pair.second;
     }
 
+    // Couleurs par sommet (une seule fois par calcul de distances, pas à chaque image)
+    geodesicColorBuffer.setDistances(currentGeodesicDistances, mesh);
+
     // Debug: afficher le nombre de distances calculées
     std::cout << "Distances calculées: " << currentGeodesicDistances.size() << " vertices, max distance: " << maxGeodesicDistance << std::endl;
 }
@@ -612,6 +637,8 @@ void printUsage()
          << " ?: Print help" << endl
          << " w: Toggle Wireframe Mode" << endl
          << " f: Toggle full screen mode" << endl
+         << " d: Toggle geodesic distances display" << endl
+         << " c: Cycle geodesic colormap" << endl
          << " <drag>+<left button>: rotate model" << endl
          << " <drag>+<right button>: move model" << endl
          << " <drag>+<middle button>: zoom" << endl
@@ -845,75 +872,24 @@ void drawHandles()
 
 void drawGeodesicDistances()
 {
-    if (clickedVertexIndex == -1 || !showGeodesicDistances || currentGeodesicDistances.empty())
+    if (clickedVertexIndex == -1 || !showGeodesicDistances || geodesicColorBuffer.empty())
         return;
 
-    glDisable(GL_LIGHTING);
-    glPointSize(5.0f);
-    glBegin(GL_POINTS);
-
-    for (const auto &pair : currentGeodesicDistances)
-    {
-        int vertexIndex = pair.first;
-        float distance = pair.second;
-
-        // Couleur basée sur la distance (vert = proche, rouge = loin)
-        float ratio = distance / sphereSelectionTool.radius;
-        glColor3f(ratio, 1.0f - ratio, 0.0f);
-
-        Vec3 pos = mesh.V[vertexIndex].p;
-        glVertex3f(pos[0], pos[1], pos[2]);
-    }
-
-    glEnd();
-    glEnable(GL_LIGHTING);
+    geodesicColorBuffer.drawPoints(mesh);
 }
 
 void drawMeshWithGeodesicColors()
 {
-    if (clickedVertexIndex == -1 || !showGeodesicDistances || currentGeodesicDistances.empty())
+    if (clickedVertexIndex == -1 || !showGeodesicDistances || geodesicColorBuffer.empty())
     {
         // Si pas de distances géodésiques, dessiner normalement
         mesh.draw();
         return;
     }
 
-    // Dessiner le mesh avec les couleurs géodésiques
+    // Dessiner le mesh avec les couleurs géodésiques (tableau de couleurs précalculé)
     glEnable(GL_LIGHTING);
-    glBegin(GL_TRIANGLES);
-
-    for (const auto &triangle : mesh.T)
-    {
-        for (int i = 0; i < 3; i++)
-        {
-            int vertexIndex = triangle.v[i];
-            Vec3 pos = mesh.V[vertexIndex].p;
-            Vec3 normal = mesh.V[vertexIndex].n;
-
-            // Calculer la couleur basée sur la distance géodésique
-            float distance = 0.0f;
-            if (currentGeodesicDistances.find(vertexIndex) != currentGeodesicDistances.end())
-            {
-                distance = currentGeodesicDistances[vertexIndex];
-            }
-            else
-            {
-                distance = maxGeodesicDistance; // Si pas de distance, utiliser la max
-            }
-
-            // Normaliser la distance et calculer la couleur
-            float normalizedDistance = (maxGeodesicDistance > 0) ? (distance / maxGeodesicDistance) : 0.0f;
-
-            float r, g, b;
-            calc_RGB(normalizedDistance, 0.0f, 1.0f, r, g, b);
-
-            glColor3f(r, g, b);
-            glNormal3f(normal[0], normal[1], normal[2]);
-            glVertex3f(pos[0], pos[1], pos[2]);
-        }
-    }
-
-    glEnd();
+    geodesicColorBuffer.draw(mesh);
 }
 
 void draw()
@@ -1136,6 +1112,12 @@ void key(unsigned char keyPressed, int x, int y)
         showGeodesicDistances = !showGeodesicDistances;
         break;
 
+    case 'c':
+        // Changer de colormap : seules les couleurs sont recalculées, pas les distances
+        geodesicColorBuffer.nextColormap();
+        std::cout << "Colormap: " << GeodesicColorBuffer::colormapName(geodesicColorBuffer.getColormap()) << std::endl;
+        break;
+
     case 'h':
         // Basculer entre sélection normale et sélection basée sur la variation de normale
         useNormalBasedSelection = !useNormalBasedSelection;
@@ -1293,7 +1275,7 @@ void mouse(int button, int state, int x, int y)
                     // Sphere: add vertices but keep sphere active until Enter is pressed
                     // addVerticesToCurrentHandle();
                     // La sphère reste active jusqu'à ce qu'on appuie sur Entrée
-                    Vec3 pos = sphereSelectionTool.screenTo3D(x, y);
+                    Vec3 pos = sphereSelectionTool.pickSurface(mesh, x, y);
                     // Trouver V le sommet le plus proche de P et N sa normale associée
                     auto vertexAndNormal = sphereSelectionTool.findClosestVertexWithNormal(mesh, pos);
                     clickedVertexIndex = vertexAndNormal.first;
@@ -1315,8 +1297,8 @@ void mouse(int button, int state, int x, int y)
                     }
                     else if (selectionToolState == SelectionTool_Sphere)
                     {
-                        // Utiliser screenTo3D au lieu de get3DPosFromMouseInput
-                        Vec3 pos = sphereSelectionTool.screenTo3D(x, y);
+                        // Point de la surface sous la souris (BVH), au lieu de get3DPosFromMouseInput
+                        Vec3 pos = sphereSelectionTool.pickSurface(mesh, x, y);
                         sphereSelectionTool.initSphere(pos, selectionRadius);
                         sphereSelectionTool.isAdding = true;
                         sphereSelectionTool.isActive = true;
@@ -1340,8 +1322,8 @@ void mouse(int button, int state, int x, int y)
                     }
                     else if (selectionToolState == SelectionTool_Sphere)
                     {
-                        // Utiliser screenTo3D au lieu de get3DPosFromMouseInput
-                        Vec3 pos = sphereSelectionTool.screenTo3D(x, y);
+                        // Point de la surface sous la souris (BVH), au lieu de get3DPosFromMouseInput
+                        Vec3 pos = sphereSelectionTool.pickSurface(mesh, x, y);
                         sphereSelectionTool.initSphere(pos, selectionRadius);
                         sphereSelectionTool.isAdding = false;
                         sphereSelectionTool.isActive = true;
@@ -1413,7 +1395,7 @@ void motion(int x, int y)
     else if (viewerState == ViewerState_EDITINGHANDLE && sphereSelectionTool.isActive)
     {
         // Update sphere position based on mouse movement
-        Vec3 newPos = sphereSelectionTool.screenTo3D(x, y);
+        Vec3 newPos = sphereSelectionTool.pickSurface(mesh, x, y);
         sphereSelectionTool.updateSphere(newPos);
 
         // Update clicked vertex V index et sa normale N pour le nouveau point
@@ -1479,6 +1461,8 @@ int main(int argc, char **argv)
     mesh.loadOFF(argc == 2 ? argv[1] : "models/couplingdown.off");
     verticesAreMarkedForCurrentHandle.resize(mesh.V.size(), false);
     verticesHandles.resize(mesh.V.size(), -1);
+    meshSpatialIndex.build(mesh);
+    sphereSelectionTool.setSpatialIndex(&meshSpatialIndex);
     edgeAndVertexWeights.buildCotangentWeightsOfTriangleMesh(mesh);
     Eigen::MatrixXd idMatrix(3, 3);
     idMatrix(0, 0) = 1.0;
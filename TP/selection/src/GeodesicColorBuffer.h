@@ -0,0 +1,194 @@
+#ifndef GEODESICCOLORBUFFER_H
+#define GEODESICCOLORBUFFER_H
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "Mesh.h"
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//
+// Couleurs par sommet pour la visualisation des distances géodésiques.
+//
+// Quand les distances changent, elles sont normalisées une fois dans un tableau dense
+// (un float par sommet). Les couleurs (RGB 8 bits par sommet) sont ensuite obtenues par
+// une table de 256 entrées (LUT) précalculée pour la colormap courante.
+// Changer de colormap ne fait que relire la LUT, en parallèle, sans recalculer les distances.
+// Le dessin se contente de donner le tableau de couleurs à Mesh::drawWithColorBuffer.
+//
+//-------------------------------------------------------------------------------------//
+
+enum GeodesicColormap
+{
+    GeodesicColormap_Rainbow,  // bleu -> cyan -> vert -> jaune -> rouge (comme calc_RGB)
+    GeodesicColormap_GreenRed, // vert = proche, rouge = loin
+    GeodesicColormap_Viridis,
+    GeodesicColormap_Grayscale,
+    GeodesicColormap_Count
+};
+
+class GeodesicColorBuffer
+{
+public:
+    static const unsigned int LUT_SIZE = 256;
+
+    GeodesicColorBuffer() : colormap(GeodesicColormap_Rainbow), maxDistance(0.f) { buildLUT(); }
+
+    bool empty() const { return normalizedDistances.empty(); }
+    float getMaxDistance() const { return maxDistance; }
+    GeodesicColormap getColormap() const { return colormap; }
+    std::vector<unsigned char> const &getColors() const { return colors; }
+
+    void clear()
+    {
+        normalizedDistances.clear();
+        colors.clear();
+        maxDistance = 0.f;
+    }
+
+    // distances : sommet -> distance ; les sommets absents prennent la distance max
+    void setDistances(std::unordered_map<int, float> const &distances, Mesh const &mesh)
+    {
+        unsigned int nVertices = mesh.V.size();
+        if (triangleIndices.size() != 3 * mesh.T.size())
+        {
+            triangleIndices.resize(3 * mesh.T.size());
+            for (unsigned int t = 0; t < mesh.T.size(); ++t)
+                for (unsigned int i = 0; i < 3; ++i)
+                    triangleIndices[3 * t + i] = mesh.T[t].v[i];
+        }
+
+        maxDistance = 0.f;
+        for (const auto &pair : distances)
+            maxDistance = std::max(maxDistance, pair.second);
+
+        normalizedDistances.assign(nVertices, 1.f);
+        float invMax = maxDistance > 0.f ? 1.f / maxDistance : 0.f;
+        for (const auto &pair : distances)
+            if (pair.first >= 0 && (unsigned int)pair.first < nVertices)
+                normalizedDistances[pair.first] = pair.second * invMax;
+        recolor();
+    }
+
+    void setColormap(GeodesicColormap c)
+    {
+        if (c == colormap)
+            return;
+        colormap = c;
+        buildLUT();
+        recolor();
+    }
+
+    void nextColormap() { setColormap((GeodesicColormap)((colormap + 1) % GeodesicColormap_Count)); }
+
+    static const char *colormapName(GeodesicColormap c)
+    {
+        switch (c)
+        {
+        case GeodesicColormap_Rainbow:
+            return "rainbow";
+        case GeodesicColormap_GreenRed:
+            return "green-red";
+        case GeodesicColormap_Viridis:
+            return "viridis";
+        case GeodesicColormap_Grayscale:
+            return "grayscale";
+        default:
+            return "?";
+        }
+    }
+
+    void draw(Mesh const &mesh) const
+    {
+        if (colors.size() != 3 * mesh.V.size() || triangleIndices.size() != 3 * mesh.T.size())
+        {
+            mesh.draw();
+            return;
+        }
+        mesh.drawWithColorBuffer(colors, triangleIndices);
+    }
+
+    // les sommets seuls, en points (pour le debug)
+    void drawPoints(Mesh const &mesh, float pointSize = 5.f) const
+    {
+        if (colors.size() != 3 * mesh.V.size() || mesh.V.empty())
+            return;
+        glDisable(GL_LIGHTING);
+        glPointSize(pointSize);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_DOUBLE, sizeof(MeshVertex), (const double *)&mesh.V[0].p);
+        glColorPointer(3, GL_UNSIGNED_BYTE, 0, &colors[0]);
+        glDrawArrays(GL_POINTS, 0, mesh.V.size());
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glEnable(GL_LIGHTING);
+    }
+
+private:
+    GeodesicColormap colormap;
+    float maxDistance;
+    unsigned char lut[3 * LUT_SIZE];
+    std::vector<float> normalizedDistances; // dans [0,1], un par sommet
+    std::vector<unsigned char> colors;      // RGB, un triplet par sommet
+    std::vector<unsigned int> triangleIndices; // la topologie ne change pas : construit une seule fois
+
+    void recolor()
+    {
+        unsigned int n = normalizedDistances.size();
+        colors.resize(3 * n);
+        parallelFor(n, [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int v = b; v < e; ++v)
+            {
+                float t = std::min(1.f, std::max(0.f, normalizedDistances[v]));
+                unsigned int i = (unsigned int)(t * (LUT_SIZE - 1) + 0.5f);
+                colors[3 * v] = lut[3 * i];
+                colors[3 * v + 1] = lut[3 * i + 1];
+                colors[3 * v + 2] = lut[3 * i + 2];
+            } }, 16384);
+    }
+
+    void buildLUT()
+    {
+        for (unsigned int i = 0; i < LUT_SIZE; ++i)
+        {
+            float t = (float)i / (LUT_SIZE - 1);
+            float r, g, b;
+            evaluate(colormap, t, r, g, b);
+            lut[3 * i] = (unsigned char)(255.f * r + 0.5f);
+            lut[3 * i + 1] = (unsigned char)(255.f * g + 0.5f);
+            lut[3 * i + 2] = (unsigned char)(255.f * b + 0.5f);
+        }
+    }
+
+    static void evaluate(GeodesicColormap c, float t, float &r, float &g, float &b)
+    {
+        if (c == GeodesicColormap_GreenRed)
+        {
+            r = t;
+            g = 1.f - t;
+            b = 0.f;
+        }
+        else if (c == GeodesicColormap_Grayscale)
+        {
+            r = g = b = t;
+        }
+        else
+        {
+            // interpolation linéaire entre 5 couleurs clés
+            static const float rainbow[5][3] = {{0.f, 0.f, 1.f}, {0.f, 1.f, 1.f}, {0.f, 1.f, 0.f}, {1.f, 1.f, 0.f}, {1.f, 0.f, 0.f}};
+            static const float viridis[5][3] = {{0.267f, 0.005f, 0.329f}, {0.230f, 0.322f, 0.546f}, {0.128f, 0.567f, 0.551f}, {0.369f, 0.789f, 0.383f}, {0.993f, 0.906f, 0.144f}};
+            const float(*keys)[3] = (c == GeodesicColormap_Viridis) ? viridis : rainbow;
+            float x = t * 4.f;
+            unsigned int k = std::min(3u, (unsigned int)x);
+            float a = x - k;
+            r = (1.f - a) * keys[k][0] + a * keys[k + 1][0];
+            g = (1.f - a) * keys[k][1] + a * keys[k + 1][1];
+            b = (1.f - a) * keys[k][2] + a * keys[k + 1][2];
+        }
+    }
+};
+
+#endif // GEODESICCOLORBUFFER_H
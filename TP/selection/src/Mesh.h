@@ -122,6 +122,24 @@ public:
         glEnd();
     }
 
+    // rgb : un triplet RGB 8 bits par sommet, indices : 3 indices par triangle (MeshTriangle a une vtable,
+    // T ne peut pas être donné tel quel à OpenGL) ; dessin par tableaux de sommets, sans glBegin/glEnd
+    void drawWithColorBuffer(const std::vector<unsigned char> &rgb, const std::vector<unsigned int> &indices) const
+    {
+        if (indices.empty() || rgb.size() < 3 * V.size())
+            return;
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_DOUBLE, sizeof(MeshVertex), (const double *)&V[0].p); // Vec3 = double[3]
+        glNormalPointer(GL_DOUBLE, sizeof(MeshVertex), (const double *)&V[0].n);
+        glColorPointer(3, GL_UNSIGNED_BYTE, 0, &rgb[0]);
+        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, &indices[0]);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
     std::vector<unsigned int> getAdjacentVertices(unsigned int vertexIndex) const
     {
         std::vector<unsigned int> adjacentVertices;
@@ -0,0 +1,51 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+//-------------------------------------------------------------------------------------//
+//
+// Minimal fork/join helper on top of std::thread (we already link with -lpthread).
+// parallelFor( n , f ) calls f( begin , end ) on contiguous chunks of [0,n),
+// one chunk per hardware thread. Small ranges are run on the calling thread.
+//
+//-------------------------------------------------------------------------------------//
+
+inline unsigned int parallelThreadCount()
+{
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+template <class function_t>
+void parallelFor(unsigned int n, function_t const &f, unsigned int minChunkSize = 1024)
+{
+    if (n == 0)
+        return;
+    unsigned int nChunks = std::min(parallelThreadCount(), (n + minChunkSize - 1) / minChunkSize);
+    if (nChunks <= 1)
+    {
+        f(0u, n);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(nChunks - 1);
+    unsigned int chunkSize = (n + nChunks - 1) / nChunks;
+    for (unsigned int c = 1; c < nChunks; ++c)
+    {
+        unsigned int begin = c * chunkSize;
+        unsigned int end = std::min(n, begin + chunkSize);
+        if (begin >= end)
+            break;
+        workers.push_back(std::thread([&f, begin, end]()
+                                      { f(begin, end); }));
+    }
+    f(0u, std::min(n, chunkSize)); // the calling thread takes the first chunk
+    for (unsigned int w = 0; w < workers.size(); ++w)
+        workers[w].join();
+}
+
+#endif // PARALLELFOR_H
@@ -0,0 +1,711 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "ParallelFor.h"
+
+//-------------------------------------------------------------------------------------//
+//-------------------------------------------------------------------------------------//
+//
+// Spatial index over a triangle mesh:
+//   - VertexKdTree : balanced k-d tree over the vertices (nearest, k-nearest, radius queries)
+//   - TriangleBvh  : SAH bounding volume hierarchy over the triangles (ray picking)
+//
+// Both structures keep their topology when the vertices move : refit() only recomputes
+// the bounding boxes, bottom-up, which is what we want after an ARAP deformation.
+// The k-d tree queries prune with the node boxes (not with the split planes), so they
+// stay exact after a refit.
+//
+//-------------------------------------------------------------------------------------//
+//-------------------------------------------------------------------------------------//
+
+struct Aabb
+{
+    float bmin[3];
+    float bmax[3];
+
+    Aabb() { reset(); }
+
+    void reset()
+    {
+        bmin[0] = bmin[1] = bmin[2] = FLT_MAX;
+        bmax[0] = bmax[1] = bmax[2] = -FLT_MAX;
+    }
+    bool isEmpty() const { return bmin[0] > bmax[0]; }
+
+    void extend(float x, float y, float z)
+    {
+        bmin[0] = std::min(bmin[0], x);
+        bmin[1] = std::min(bmin[1], y);
+        bmin[2] = std::min(bmin[2], z);
+        bmax[0] = std::max(bmax[0], x);
+        bmax[1] = std::max(bmax[1], y);
+        bmax[2] = std::max(bmax[2], z);
+    }
+    void extend(Vec3 const &p) { extend(p[0], p[1], p[2]); }
+    void extend(Aabb const &b)
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            bmin[c] = std::min(bmin[c], b.bmin[c]);
+            bmax[c] = std::max(bmax[c], b.bmax[c]);
+        }
+    }
+
+    unsigned int longestAxis() const
+    {
+        float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+        if (dx >= dy && dx >= dz)
+            return 0;
+        return dy >= dz ? 1 : 2;
+    }
+
+    float halfArea() const
+    {
+        if (isEmpty())
+            return 0.f;
+        float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    float squareDistanceTo(float const p[3]) const
+    {
+        if (isEmpty())
+            return FLT_MAX;
+        float d2 = 0.f;
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            float d = std::max(std::max(bmin[c] - p[c], 0.f), p[c] - bmax[c]);
+            d2 += d * d;
+        }
+        return d2;
+    }
+
+    // slab test, returns the entry distance in tEntry
+    bool intersectRay(float const origin[3], float const invDirection[3], float tMax, float &tEntry) const
+    {
+        float t0 = 0.f, t1 = tMax;
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            float tNear = (bmin[c] - origin[c]) * invDirection[c];
+            float tFar = (bmax[c] - origin[c]) * invDirection[c];
+            if (tNear > tFar)
+                std::swap(tNear, tFar);
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+            if (t0 > t1)
+                return false;
+        }
+        tEntry = t0;
+        return true;
+    }
+};
+
+//-------------------------------------------------------------------------------------//
+// k-d tree over the vertices
+//-------------------------------------------------------------------------------------//
+
+class VertexKdTree
+{
+    struct Node
+    {
+        Aabb box;
+        unsigned int begin, end; // range in perm / points
+    };
+
+    static const unsigned int LEAF_SIZE = 8;
+
+    std::vector<Node> nodes;          // implicit complete binary tree : children of i are 2i+1 and 2i+2
+    std::vector<unsigned int> perm;   // vertex indices, in tree order
+    std::vector<float> points;        // copy of the positions in tree order (3 floats per vertex)
+    unsigned int depth;
+
+    unsigned int firstLeaf() const { return (1u << depth) - 1; }
+
+    void scanLeaf(Node const &node, float const q[3], float &bestD2, int &best) const
+    {
+        for (unsigned int i = node.begin; i < node.end; ++i)
+        {
+            float dx = points[3 * i] - q[0], dy = points[3 * i + 1] - q[1], dz = points[3 * i + 2] - q[2];
+            float d2 = dx * dx + dy * dy + dz * dz;
+            if (d2 < bestD2)
+            {
+                bestD2 = d2;
+                best = (int)perm[i];
+            }
+        }
+    }
+
+public:
+    VertexKdTree() : depth(0) {}
+
+    bool empty() const { return perm.empty(); }
+
+    void build(Mesh const &mesh)
+    {
+        unsigned int n = mesh.V.size();
+        perm.resize(n);
+        for (unsigned int i = 0; i < n; ++i)
+            perm[i] = i;
+
+        depth = 0;
+        while (((n + (1u << depth) - 1) >> depth) > LEAF_SIZE)
+            ++depth;
+        nodes.assign((2u << depth) - 1, Node());
+        nodes[0].begin = 0;
+        nodes[0].end = n;
+
+        // top-down median splits, one level at a time : all the nodes of a level are independent
+        for (unsigned int level = 0; level < depth; ++level)
+        {
+            unsigned int levelBegin = (1u << level) - 1;
+            unsigned int levelSize = 1u << level;
+            parallelFor(levelSize, [&](unsigned int b, unsigned int e)
+                        {
+                for (unsigned int k = b; k < e; ++k)
+                {
+                    unsigned int nodeIdx = levelBegin + k;
+                    Node const &node = nodes[nodeIdx];
+                    Aabb box;
+                    for (unsigned int i = node.begin; i < node.end; ++i)
+                        box.extend(mesh.V[perm[i]].p);
+                    unsigned int axis = box.longestAxis();
+                    unsigned int mid = (node.begin + node.end) / 2;
+                    std::nth_element(perm.begin() + node.begin, perm.begin() + mid, perm.begin() + node.end,
+                                     [&](unsigned int a, unsigned int c)
+                                     { return mesh.V[a].p[axis] < mesh.V[c].p[axis]; });
+                    nodes[2 * nodeIdx + 1].begin = node.begin;
+                    nodes[2 * nodeIdx + 1].end = mid;
+                    nodes[2 * nodeIdx + 2].begin = mid;
+                    nodes[2 * nodeIdx + 2].end = node.end;
+                } }, 1);
+        }
+
+        points.resize(3 * n);
+        refit(mesh);
+    }
+
+    // keeps the tree structure, updates the packed positions and the node boxes
+    void refit(Mesh const &mesh)
+    {
+        unsigned int n = perm.size();
+        parallelFor(n, [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int i = b; i < e; ++i)
+            {
+                Vec3 const &p = mesh.V[perm[i]].p;
+                points[3 * i] = p[0];
+                points[3 * i + 1] = p[1];
+                points[3 * i + 2] = p[2];
+            } });
+
+        unsigned int leafBegin = firstLeaf();
+        parallelFor(1u << depth, [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int k = b; k < e; ++k)
+            {
+                Node &leaf = nodes[leafBegin + k];
+                leaf.box.reset();
+                for (unsigned int i = leaf.begin; i < leaf.end; ++i)
+                    leaf.box.extend(points[3 * i], points[3 * i + 1], points[3 * i + 2]);
+            } }, 64);
+
+        for (int level = (int)depth - 1; level >= 0; --level)
+        {
+            unsigned int levelBegin = (1u << level) - 1;
+            parallelFor(1u << level, [&](unsigned int b, unsigned int e)
+                        {
+                for (unsigned int k = b; k < e; ++k)
+                {
+                    unsigned int nodeIdx = levelBegin + k;
+                    nodes[nodeIdx].box = nodes[2 * nodeIdx + 1].box;
+                    nodes[nodeIdx].box.extend(nodes[2 * nodeIdx + 2].box);
+                } }, 256);
+        }
+    }
+
+    // index of the closest vertex, -1 if the tree is empty
+    int nearest(Vec3 const &p, float *squareDistance = NULL) const
+    {
+        int best = -1;
+        float bestD2 = FLT_MAX;
+        if (empty())
+            return best;
+
+        float q[3] = {(float)p[0], (float)p[1], (float)p[2]};
+        unsigned int leafBegin = firstLeaf();
+        std::vector<std::pair<unsigned int, float>> stack;
+        stack.reserve(2 * depth + 2);
+        stack.push_back(std::make_pair(0u, nodes[0].box.squareDistanceTo(q)));
+        while (!stack.empty())
+        {
+            std::pair<unsigned int, float> top = stack.back();
+            stack.pop_back();
+            if (top.second >= bestD2)
+                continue;
+            if (top.first >= leafBegin)
+            {
+                scanLeaf(nodes[top.first], q, bestD2, best);
+                continue;
+            }
+            unsigned int l = 2 * top.first + 1, r = 2 * top.first + 2;
+            float dl = nodes[l].box.squareDistanceTo(q), dr = nodes[r].box.squareDistanceTo(q);
+            // push the farthest child first, so that the closest one is visited first
+            if (dl < dr)
+            {
+                stack.push_back(std::make_pair(r, dr));
+                stack.push_back(std::make_pair(l, dl));
+            }
+            else
+            {
+                stack.push_back(std::make_pair(l, dl));
+                stack.push_back(std::make_pair(r, dr));
+            }
+        }
+        if (squareDistance)
+            *squareDistance = bestD2;
+        return best;
+    }
+
+    // the k closest vertices, sorted by increasing distance
+    void kNearest(Vec3 const &p, unsigned int k, std::vector<unsigned int> &result) const
+    {
+        result.clear();
+        if (empty() || k == 0)
+            return;
+
+        float q[3] = {(float)p[0], (float)p[1], (float)p[2]};
+        unsigned int leafBegin = firstLeaf();
+        std::priority_queue<std::pair<float, unsigned int>> heap; // max-heap on the distance
+        std::vector<unsigned int> stack(1, 0u);
+        while (!stack.empty())
+        {
+            unsigned int nodeIdx = stack.back();
+            stack.pop_back();
+            float bound = heap.size() < k ? FLT_MAX : heap.top().first;
+            if (nodes[nodeIdx].box.squareDistanceTo(q) >= bound)
+                continue;
+            if (nodeIdx >= leafBegin)
+            {
+                Node const &node = nodes[nodeIdx];
+                for (unsigned int i = node.begin; i < node.end; ++i)
+                {
+                    float dx = points[3 * i] - q[0], dy = points[3 * i + 1] - q[1], dz = points[3 * i + 2] - q[2];
+                    float d2 = dx * dx + dy * dy + dz * dz;
+                    if (heap.size() < k)
+                        heap.push(std::make_pair(d2, perm[i]));
+                    else if (d2 < heap.top().first)
+                    {
+                        heap.pop();
+                        heap.push(std::make_pair(d2, perm[i]));
+                    }
+                }
+                continue;
+            }
+            unsigned int l = 2 * nodeIdx + 1, r = 2 * nodeIdx + 2;
+            if (nodes[l].box.squareDistanceTo(q) < nodes[r].box.squareDistanceTo(q))
+                std::swap(l, r);
+            stack.push_back(l);
+            stack.push_back(r);
+        }
+
+        result.resize(heap.size());
+        for (int i = (int)heap.size() - 1; i >= 0; --i)
+        {
+            result[i] = heap.top().second;
+            heap.pop();
+        }
+    }
+
+    // all the vertices closer than radius (unordered)
+    void radiusQuery(Vec3 const &p, float radius, std::vector<unsigned int> &result) const
+    {
+        result.clear();
+        if (empty())
+            return;
+
+        float q[3] = {(float)p[0], (float)p[1], (float)p[2]};
+        float r2 = radius * radius;
+        unsigned int leafBegin = firstLeaf();
+        std::vector<unsigned int> stack(1, 0u);
+        while (!stack.empty())
+        {
+            unsigned int nodeIdx = stack.back();
+            stack.pop_back();
+            if (nodes[nodeIdx].box.squareDistanceTo(q) > r2)
+                continue;
+            if (nodeIdx >= leafBegin)
+            {
+                Node const &node = nodes[nodeIdx];
+                for (unsigned int i = node.begin; i < node.end; ++i)
+                {
+                    float dx = points[3 * i] - q[0], dy = points[3 * i + 1] - q[1], dz = points[3 * i + 2] - q[2];
+                    if (dx * dx + dy * dy + dz * dz <= r2)
+                        result.push_back(perm[i]);
+                }
+                continue;
+            }
+            stack.push_back(2 * nodeIdx + 1);
+            stack.push_back(2 * nodeIdx + 2);
+        }
+    }
+};
+
+//-------------------------------------------------------------------------------------//
+// SAH BVH over the triangles
+//-------------------------------------------------------------------------------------//
+
+struct RayHit
+{
+    float t;
+    int triangle; // -1 if nothing was hit
+    float u, v;   // barycentric coordinates of the hit in the triangle
+    Vec3 position;
+
+    RayHit() : t(FLT_MAX), triangle(-1), u(0.f), v(0.f), position(0.0, 0.0, 0.0) {}
+};
+
+class TriangleBvh
+{
+    struct Node
+    {
+        Aabb box;
+        unsigned int first; // leaf : first index in triIndices ; inner node : index of the right child (left child is the next node)
+        unsigned int count; // number of triangles, 0 for inner nodes
+    };
+
+    static const unsigned int N_BINS = 16;
+    static const unsigned int MAX_LEAF_SIZE = 8;
+
+    std::vector<Node> nodes;
+    std::vector<unsigned int> triIndices;
+    std::vector<Aabb> triBoxes;
+    std::vector<float> centroids;
+
+    void computeTriangleBoxes(Mesh const &mesh)
+    {
+        unsigned int nT = mesh.T.size();
+        triBoxes.resize(nT);
+        centroids.resize(3 * nT);
+        parallelFor(nT, [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int t = b; t < e; ++t)
+            {
+                Aabb &box = triBoxes[t];
+                box.reset();
+                for (unsigned int j = 0; j < 3; ++j)
+                    box.extend(mesh.V[mesh.T[t][j]].p);
+                for (unsigned int c = 0; c < 3; ++c)
+                    centroids[3 * t + c] = 0.5f * (box.bmin[c] + box.bmax[c]);
+            } });
+    }
+
+    struct Bin
+    {
+        Aabb box;
+        unsigned int count;
+        Bin() : count(0) {}
+    };
+
+    unsigned int buildNode(unsigned int first, unsigned int count)
+    {
+        unsigned int nodeIdx = nodes.size();
+        nodes.push_back(Node());
+
+        // bounds of the triangles and of their centroids ; large ranges are reduced in parallel
+        Aabb box, centroidBox;
+        std::mutex mergeMutex;
+        parallelFor(count, [&](unsigned int b, unsigned int e)
+                    {
+            Aabb localBox, localCentroids;
+            for (unsigned int i = first + b; i < first + e; ++i)
+            {
+                unsigned int t = triIndices[i];
+                localBox.extend(triBoxes[t]);
+                localCentroids.extend(centroids[3 * t], centroids[3 * t + 1], centroids[3 * t + 2]);
+            }
+            std::lock_guard<std::mutex> lock(mergeMutex);
+            box.extend(localBox);
+            centroidBox.extend(localCentroids); }, 16384);
+        nodes[nodeIdx].box = box;
+
+        unsigned int axis = centroidBox.longestAxis();
+        float extent = centroidBox.bmax[axis] - centroidBox.bmin[axis];
+        if (count <= 2 || (extent <= 0.f && count <= MAX_LEAF_SIZE))
+        {
+            nodes[nodeIdx].first = first;
+            nodes[nodeIdx].count = count;
+            return nodeIdx;
+        }
+
+        unsigned int splitIndex = first + count / 2; // median fallback (also used when all the centroids coincide)
+        if (extent > 0.f)
+        {
+            // binned SAH along the longest centroid axis
+            float binScale = N_BINS / extent;
+            float axisMin = centroidBox.bmin[axis];
+            Bin bins[N_BINS];
+            parallelFor(count, [&](unsigned int b, unsigned int e)
+                        {
+                Bin localBins[N_BINS];
+                for (unsigned int i = first + b; i < first + e; ++i)
+                {
+                    unsigned int t = triIndices[i];
+                    unsigned int binIdx = std::min(N_BINS - 1, (unsigned int)((centroids[3 * t + axis] - axisMin) * binScale));
+                    localBins[binIdx].box.extend(triBoxes[t]);
+                    localBins[binIdx].count++;
+                }
+                std::lock_guard<std::mutex> lock(mergeMutex);
+                for (unsigned int k = 0; k < N_BINS; ++k)
+                {
+                    bins[k].box.extend(localBins[k].box);
+                    bins[k].count += localBins[k].count;
+                } }, 16384);
+
+            float rightArea[N_BINS];
+            unsigned int rightCount[N_BINS];
+            Aabb acc;
+            unsigned int accCount = 0;
+            for (int k = N_BINS - 1; k > 0; --k)
+            {
+                acc.extend(bins[k].box);
+                accCount += bins[k].count;
+                rightArea[k] = acc.halfArea();
+                rightCount[k] = accCount;
+            }
+
+            float bestCost = FLT_MAX;
+            unsigned int bestBin = 0;
+            acc.reset();
+            accCount = 0;
+            for (unsigned int k = 1; k < N_BINS; ++k)
+            {
+                acc.extend(bins[k - 1].box);
+                accCount += bins[k - 1].count;
+                if (accCount == 0 || rightCount[k] == 0)
+                    continue;
+                float cost = acc.halfArea() * accCount + rightArea[k] * rightCount[k];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestBin = k;
+                }
+            }
+
+            float leafCost = box.halfArea() * count;
+            if (bestBin == 0 || (bestCost >= leafCost && count <= MAX_LEAF_SIZE))
+            {
+                if (count <= MAX_LEAF_SIZE)
+                {
+                    nodes[nodeIdx].first = first;
+                    nodes[nodeIdx].count = count;
+                    return nodeIdx;
+                }
+                std::nth_element(triIndices.begin() + first, triIndices.begin() + splitIndex, triIndices.begin() + first + count,
+                                 [&](unsigned int a, unsigned int c)
+                                 { return centroids[3 * a + axis] < centroids[3 * c + axis]; });
+            }
+            else
+            {
+                splitIndex = std::partition(triIndices.begin() + first, triIndices.begin() + first + count,
+                                            [&](unsigned int t)
+                                            { return std::min(N_BINS - 1, (unsigned int)((centroids[3 * t + axis] - axisMin) * binScale)) < bestBin; }) -
+                             triIndices.begin();
+            }
+        }
+
+        nodes[nodeIdx].count = 0;
+        buildNode(first, splitIndex - first);
+        nodes[nodeIdx].first = buildNode(splitIndex, first + count - splitIndex);
+        return nodeIdx;
+    }
+
+    static bool intersectTriangle(Vec3 const &origin, Vec3 const &direction,
+                                  Vec3 const &p0, Vec3 const &p1, Vec3 const &p2,
+                                  float &t, float &u, float &v)
+    {
+        // Moller-Trumbore
+        Vec3 e1 = p1 - p0, e2 = p2 - p0;
+        Vec3 pvec = Vec3::cross(direction, e2);
+        double det = Vec3::dot(e1, pvec);
+        if (fabs(det) < 1e-12)
+            return false;
+        double invDet = 1.0 / det;
+        Vec3 tvec = origin - p0;
+        double uu = Vec3::dot(tvec, pvec) * invDet;
+        if (uu < 0.0 || uu > 1.0)
+            return false;
+        Vec3 qvec = Vec3::cross(tvec, e1);
+        double vv = Vec3::dot(direction, qvec) * invDet;
+        if (vv < 0.0 || uu + vv > 1.0)
+            return false;
+        double tt = Vec3::dot(e2, qvec) * invDet;
+        if (tt <= 0.0)
+            return false;
+        t = tt;
+        u = uu;
+        v = vv;
+        return true;
+    }
+
+public:
+    bool empty() const { return nodes.empty(); }
+
+    void build(Mesh const &mesh)
+    {
+        nodes.clear();
+        unsigned int nT = mesh.T.size();
+        if (nT == 0)
+            return;
+        computeTriangleBoxes(mesh);
+        triIndices.resize(nT);
+        for (unsigned int t = 0; t < nT; ++t)
+            triIndices[t] = t;
+        nodes.reserve(2 * nT);
+        buildNode(0, nT);
+    }
+
+    // keeps the hierarchy, recomputes the boxes bottom-up (children are always stored after their parent)
+    void refit(Mesh const &mesh)
+    {
+        if (empty())
+            return;
+        computeTriangleBoxes(mesh);
+        parallelFor(nodes.size(), [&](unsigned int b, unsigned int e)
+                    {
+            for (unsigned int n = b; n < e; ++n)
+            {
+                Node &node = nodes[n];
+                if (node.count == 0)
+                    continue;
+                node.box.reset();
+                for (unsigned int i = node.first; i < node.first + node.count; ++i)
+                    node.box.extend(triBoxes[triIndices[i]]);
+            } });
+        for (int n = (int)nodes.size() - 1; n >= 0; --n)
+        {
+            Node &node = nodes[n];
+            if (node.count > 0)
+                continue;
+            node.box = nodes[n + 1].box;
+            node.box.extend(nodes[node.first].box);
+        }
+    }
+
+    // closest intersection of the ray origin + t * direction (t > 0) with the mesh
+    bool intersect(Mesh const &mesh, Vec3 const &origin, Vec3 const &direction, RayHit &hit) const
+    {
+        hit = RayHit();
+        if (empty())
+            return false;
+
+        float o[3] = {(float)origin[0], (float)origin[1], (float)origin[2]};
+        float invD[3];
+        for (unsigned int c = 0; c < 3; ++c)
+            invD[c] = direction[c] != 0.0 ? (float)(1.0 / direction[c]) : FLT_MAX;
+
+        std::vector<std::pair<unsigned int, float>> stack;
+        stack.reserve(64);
+        float tEntry;
+        if (!nodes[0].box.intersectRay(o, invD, FLT_MAX, tEntry))
+            return false;
+        stack.push_back(std::make_pair(0u, tEntry));
+        while (!stack.empty())
+        {
+            std::pair<unsigned int, float> top = stack.back();
+            stack.pop_back();
+            if (top.second > hit.t)
+                continue;
+            Node const &node = nodes[top.first];
+            if (node.count > 0)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; ++i)
+                {
+                    unsigned int tIdx = triIndices[i];
+                    MeshTriangle const &tri = mesh.T[tIdx];
+                    float t, u, v;
+                    if (intersectTriangle(origin, direction, mesh.V[tri[0]].p, mesh.V[tri[1]].p, mesh.V[tri[2]].p, t, u, v) && t < hit.t)
+                    {
+                        hit.t = t;
+                        hit.triangle = tIdx;
+                        hit.u = u;
+                        hit.v = v;
+                    }
+                }
+                continue;
+            }
+            unsigned int l = top.first + 1, r = node.first;
+            float tl, tr;
+            bool hitL = nodes[l].box.intersectRay(o, invD, hit.t, tl);
+            bool hitR = nodes[r].box.intersectRay(o, invD, hit.t, tr);
+            if (hitL && hitR)
+            {
+                if (tl < tr)
+                {
+                    stack.push_back(std::make_pair(r, tr));
+                    stack.push_back(std::make_pair(l, tl));
+                }
+                else
+                {
+                    stack.push_back(std::make_pair(l, tl));
+                    stack.push_back(std::make_pair(r, tr));
+                }
+            }
+            else if (hitL)
+                stack.push_back(std::make_pair(l, tl));
+            else if (hitR)
+                stack.push_back(std::make_pair(r, tr));
+        }
+
+        if (hit.triangle < 0)
+            return false;
+        hit.position = origin + hit.t * direction;
+        return true;
+    }
+};
+
+//-------------------------------------------------------------------------------------//
+// Both indices together : built at load time, refitted after each deformation
+//-------------------------------------------------------------------------------------//
+
+struct MeshSpatialIndex
+{
+    VertexKdTree vertices;
+    TriangleBvh triangles;
+
+    void build(Mesh const &mesh)
+    {
+        // the two builds are independent
+        std::thread bvhThread([&]()
+                              { triangles.build(mesh); });
+        vertices.build(mesh);
+        bvhThread.join();
+    }
+
+    void refit(Mesh const &mesh)
+    {
+        vertices.refit(mesh);
+        triangles.refit(mesh);
+    }
+
+    int closestVertex(Vec3 const &p) const { return vertices.nearest(p); }
+
+    void closestVertices(Vec3 const &p, unsigned int k, std::vector<unsigned int> &result) const { vertices.kNearest(p, k, result); }
+
+    void verticesInBall(Vec3 const &p, float radius, std::vector<unsigned int> &result) const { vertices.radiusQuery(p, radius, result); }
+
+    bool pick(Mesh const &mesh, Vec3 const &origin, Vec3 const &direction, RayHit &hit) const
+    {
+        return triangles.intersect(mesh, origin, direction, hit);
+    }
+};
+
+#endif // SPATIALINDEX_H
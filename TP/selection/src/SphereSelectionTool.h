@@ -1,6 +1,7 @@
 #ifndef SphereSelectionTool_H
 #define SphereSelectionTool_H
 #include "Vec3.h"
+#include "SpatialIndex.h"
 #include <GL/glut.h>
 #include <cmath>
 #include <unordered_map>
@@ -37,8 +38,14 @@ struct SphereSelectionTool
 	Vec3 center;
 	bool isActive;
 	bool isAdding;
+	MeshSpatialIndex const *spatialIndex; // k-d tree / BVH du mesh, optionnel (sinon recherche linéaire)
 
-	SphereSelectionTool() : radius(0.6f), center(0.0, 0.0, 0.0), isActive(false), isAdding(false) {}
+	SphereSelectionTool() : radius(0.6f), center(0.0, 0.0, 0.0), isActive(false), isAdding(false), spatialIndex(NULL) {}
+
+	void setSpatialIndex(MeshSpatialIndex const *pSpatialIndex)
+	{
+		spatialIndex = pSpatialIndex;
+	}
 
 	void initSphere(const Vec3 &pCenter, const float &pRadius)
 	{
@@ -206,6 +213,9 @@ struct SphereSelectionTool
 	// Trouver le vertex le plus proche d'un point
 	int findClosestVertex(const Mesh &mesh, const Vec3 &point)
 	{
+		if (spatialIndex != NULL && !spatialIndex->vertices.empty())
+			return spatialIndex->closestVertex(point);
+
 		int closestIndex = 0;
 		float minDistance = (mesh.V[0].p - point).length();
 
@@ -225,18 +235,7 @@ struct SphereSelectionTool
 	// Trouver le vertex V le plus proche de P et retourner sa normale N
 	std::pair<int, Vec3> findClosestVertexWithNormal(const Mesh &mesh, const Vec3 &point)
 	{
-		int closestIndex = 0;
-		float minDistance = (mesh.V[0].p - point).length();
-
-		for (int i = 1; i < mesh.V.size(); i++)
-		{
-			float distance = (mesh.V[i].p - point).length();
-			if (distance < minDistance)
-			{
-				minDistance = distance;
-				closestIndex = i;
-			}
-		}
+		int closestIndex = findClosestVertex(mesh, point);
 
 		// Retourner l'index du vertex V et sa normale N
 		return std::make_pair(closestIndex, mesh.V[closestIndex].n);
@@ -264,6 +263,43 @@ struct SphereSelectionTool
 		return Vec3(posX, posY, posZ);
 	}
 
+	// Rayon (origine, direction) passant par le pixel de la souris, via gluUnProject sur les plans near et far
+	void screenRay(int mouseX, int mouseY, Vec3 &origin, Vec3 &direction)
+	{
+		GLint viewport[4];
+		GLdouble modelview[16];
+		GLdouble projection[16];
+		GLdouble nearX, nearY, nearZ, farX, farY, farZ;
+
+		glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+		glGetDoublev(GL_PROJECTION_MATRIX, projection);
+		glGetIntegerv(GL_VIEWPORT, viewport);
+
+		GLdouble winX = (double)mouseX;
+		GLdouble winY = (double)viewport[3] - (double)mouseY; // Flip Y coordinate
+		gluUnProject(winX, winY, 0.0, modelview, projection, viewport, &nearX, &nearY, &nearZ);
+		gluUnProject(winX, winY, 1.0, modelview, projection, viewport, &farX, &farY, &farZ);
+
+		origin = Vec3(nearX, nearY, nearZ);
+		direction = Vec3(farX - nearX, farY - nearY, farZ - nearZ);
+		direction.normalize();
+	}
+
+	// Point de la surface sous la souris : lancer de rayon dans le BVH,
+	// on retombe sur la lecture du depth buffer (screenTo3D) si le rayon ne touche rien
+	Vec3 pickSurface(const Mesh &mesh, int mouseX, int mouseY)
+	{
+		if (spatialIndex != NULL && !spatialIndex->triangles.empty())
+		{
+			Vec3 origin, direction;
+			screenRay(mouseX, mouseY, origin, direction);
+			RayHit hit;
+			if (spatialIndex->pick(mesh, origin, direction, hit))
+				return hit.position;
+		}
+		return screenTo3D(mouseX, mouseY);
+	}
+
 	// Scroll radius modif
 	void updateRadius(float deltaRadius)
 	{